@@ -85,6 +85,16 @@ void free_detection_results(bcnn_output_detection *dets, int num_dets) {
     }
 }
 
+bcnn_output_detection *get_detections(int w_frame, int h_frame, bcnn_net *net,
+                                      int *num_dets) {
+    int nd = 0;
+    bcnn_output_detection *dets =
+        bcnn_yolo_get_detections(net, 0, w_frame, h_frame, net->tensors[0].w,
+                                 net->tensors[0].h, 0.5, 1, &nd);
+    *num_dets = nd;
+    return dets;
+}
+
 bcnn_output_detection *run_inference(int w_frame, int h_frame, bcnn_net *net,
                                      int *num_dets) {
     float nms_tresh = 0.45f;
@@ -98,12 +108,7 @@ bcnn_output_detection *run_inference(int w_frame, int h_frame, bcnn_net *net,
     bh_timer_stop(&t);
     fprintf(stderr, "time= %lf msec\n", bh_timer_get_msec(&t));
     // Get bcnn_output_detection boxes
-    int nd = 0;
-    bcnn_output_detection *dets =
-        bcnn_yolo_get_detections(net, 0, w_frame, h_frame, net->tensors[0].w,
-                                 net->tensors[0].h, 0.5, 1, &nd);
-    *num_dets = nd;
-    return dets;
+    return get_detections(w_frame, h_frame, net, num_dets);
 }
 
 #ifdef USE_OPENCV
@@ -222,15 +227,28 @@ int main(int argc, char **argv) {
         if (!open_video(argv[2], cap)) {
             return -1;
         }
-        cv::Mat frame;
+        cv::Mat frame, next_frame;
         cap >> frame;
+        if (!frame.empty()) {
+            prepare_frame(frame, bcnn_get_input_buffer(net, 0),
+                          net->tensors[0].w, net->tensors[0].h);
+            bcnn_forward_async(net, NULL, NULL);
+        }
         while (!frame.empty()) {
-            cap >> frame;
-            prepare_frame(frame, net->tensors[0].data, net->tensors[0].w,
-                          net->tensors[0].h);
+            // The next frame is decoded and preprocessed while the inference
+            // of the current one runs in the background
+            cap >> next_frame;
+            if (!next_frame.empty()) {
+                prepare_frame(next_frame, bcnn_get_input_buffer(net, 0),
+                              net->tensors[0].w, net->tensors[0].h);
+            }
+            bcnn_wait_forward(net);
             int num_dets = 0;
             bcnn_output_detection *dets =
-                run_inference(frame.cols, frame.rows, net, &num_dets);
+                get_detections(frame.cols, frame.rows, net, &num_dets);
+            if (!next_frame.empty()) {
+                bcnn_forward_async(net, NULL, NULL);
+            }
             display_detections(frame, dets, num_dets, 0.45, 80);
             cv::imshow("yolov3 example", frame);
             free_detection_results(dets, num_dets);
@@ -239,6 +257,7 @@ int main(int argc, char **argv) {
             if (q == 27) {
                 break;
             }
+            cv::swap(frame, next_frame);
         }
 #else
         fprintf(stderr,
@@ -80,6 +80,9 @@ typedef struct bcnn_tensor bcnn_tensor;
 /** Object detection result struct */
 typedef struct bcnn_output_detection bcnn_output_detection;
 
+/** Dynamic batching front-end struct */
+typedef struct bcnn_batcher bcnn_batcher;
+
 /****************************************************************************
  * BCNN types
  ***************************************************************************/
@@ -226,25 +229,73 @@ typedef enum {
 typedef enum bcnn_filler_type {
     BCNN_FILLER_FIXED,  /* Fill with constant value. For internal use only */
     BCNN_FILLER_XAVIER, /* Xavier init */
-    BCNN_FILLER_MSRA    /* MSRA init */
+    BCNN_FILLER_MSRA,   /* MSRA init */
+    BCNN_FILLER_NONE    /* Data left as allocated, i.e. zero. For internal use
+                           only */
 } bcnn_filler_type;
 
+/**
+ * Tensor data layout.
+ */
+typedef enum bcnn_layout {
+    BCNN_LAYOUT_NCHW,  /* Default layout */
+    BCNN_LAYOUT_NC4HW4 /* Channels packed by blocks of 4 (zero-padded), used
+                          between consecutive conv 3x3/s1 in predict mode. For
+                          internal use only */
+} bcnn_layout;
+
+/**
+ * Kind of memory requested from the allocator, see 'bcnn_set_allocator'.
+ */
+typedef enum {
+    BCNN_ALLOC_WEIGHTS,     /* Parameters of the layers (weights, biases, packed
+                               weights...) and optimizer states */
+    BCNN_ALLOC_ACTIVATIONS, /* Data of the intermediate tensors */
+    BCNN_ALLOC_WORKSPACE,   /* Scratch memory of the layers */
+    BCNN_ALLOC_DATA,        /* Input batches: staging buffers of the async
+                               forward and buffers of the data loaders */
+    BCNN_ALLOC_ARENA        /* Single memory chunk holding the parameters and
+                               the activations of a compiled net */
+} bcnn_alloc_tag;
+
+/**
+ * Precision of the weights written in a model file, see
+ * 'bcnn_set_model_precision'.
+ */
+typedef enum {
+    BCNN_PRECISION_F32, /* Single precision (default) */
+    BCNN_PRECISION_F16  /* IEEE half precision, converted back to single
+                           precision at load time */
+} bcnn_precision;
+
 /* Max number of bounding boxes for detection */
 #define BCNN_DETECTION_MAX_BOXES 50
 
 /* Function signature for logging callback */
 typedef void (*bcnn_log_callback)(const char *fmt, ...);
 
+/* Function signature for the completion callback of 'bcnn_forward_async' */
+typedef void (*bcnn_forward_callback)(bcnn_net *net, void *user_data);
+
+/* Function signatures of a custom allocator. 'alloc' returns a block of
+ * 'size' bytes aligned on 'alignment' (a power of 2), or NULL on failure.
+ * 'free' receives the size and tag the block was allocated with. */
+typedef void *(*bcnn_alloc_func)(size_t size, size_t alignment,
+                                 bcnn_alloc_tag tag, void *user_data);
+typedef void (*bcnn_free_func)(void *ptr, size_t size, bcnn_alloc_tag tag,
+                               void *user_data);
+
 /**
  * Tensor structure.
- * Data layout is NCHW.
+ * Data layout is NCHW, except for some intermediate tensors in predict mode.
  */
 struct bcnn_tensor {
-    int n;            /* Batch size */
-    int c;            /* Number of channels = depth */
-    int h;            /* Spatial height */
-    int w;            /* Spatial width */
-    int has_grad;     /* If has gradient data or not */
+    int n;              /* Batch size */
+    int c;              /* Number of channels = depth */
+    int h;              /* Spatial height */
+    int w;              /* Spatial width */
+    int has_grad;       /* If has gradient data or not */
+    bcnn_layout layout; /* Data layout */
     char *name;       /* Tensor name */
     float *data;      /* Pointer to data */
     float *grad_data; /* Pointer to gradient data */
@@ -265,10 +316,83 @@ struct bcnn_output_detection {
     float objectness;
 };
 
+/**
+ * Timings of a request processed by a batcher.
+ */
+typedef struct bcnn_batch_timing {
+    double queue_time;   /* Time in ms between the submission of the request
+                            and the start of its batch */
+    double compute_time; /* Time in ms to fill the batch, run the forward and
+                            copy the outputs */
+    int batch_fill;      /* Number of requests processed in the same batch */
+} bcnn_batch_timing;
+
+/**
+ * Static cost of the forward of a node, or of the whole net, for the current
+ * shapes.
+ */
+typedef struct bcnn_node_cost {
+    uint64_t macs;          /* Number of multiply-accumulates */
+    size_t param_bytes;     /* Bytes of the weights and other parameters */
+    size_t src_bytes;       /* Bytes of activations read */
+    size_t dst_bytes;       /* Bytes of activations written */
+    size_t workspace_bytes; /* Bytes of scratch memory used */
+} bcnn_node_cost;
+
 /****************************************************************************
  * BCNN functions API
  ***************************************************************************/
 
+/**
+ * \brief Sets the allocator used for the large buffers of the library: the
+ * tensors data, the memory arena, the layers workspaces, the staging buffers
+ * of the asynchronous forward and the buffers of the data loaders.
+ *
+ * Each request is tagged with the kind of memory it is for, so that e.g. the
+ * weights can be placed on huge pages or on a given NUMA node, or the memory
+ * use accounted per kind. The small bookkeeping allocations (graph, names...)
+ * are still made with malloc.
+ *
+ * \note The allocator is global to the process. It must be set before the
+ * creation of any net and must not be changed until all the nets are
+ * destroyed, since a block is always given back to the allocator that
+ * provided it. The functions may be called concurrently, e.g. by the threads
+ * that load the weights.
+ *
+ * \param[in]   alloc_func      Allocation function, NULL to restore the
+ *                              default aligned malloc.
+ * \param[in]   free_func       Deallocation function, NULL to restore the
+ *                              default free.
+ * \param[in]   user_data       Pointer passed to both functions.
+ */
+BCNN_API void bcnn_set_allocator(bcnn_alloc_func alloc_func,
+                                 bcnn_free_func free_func, void *user_data);
+
+/**
+ * \brief Backs the buffers of at least 'min_size' bytes with transparent huge
+ * pages.
+ *
+ * Such buffers (typically the memory arena, the large weights and the
+ * workspaces) are allocated 2 MB-aligned with a size rounded up to 2 MB and
+ * advised with MADV_HUGEPAGE, which reduces the TLB misses of the strided
+ * accesses of the gemm. When huge pages are not available (other OS than
+ * Linux, kernel policy set to 'never'...), buffers are silently allocated on
+ * regular pages.
+ *
+ * \note Applies to the buffers allocated after the call, i.e. it should be
+ * called before 'bcnn_compile_net'. Works with any allocator set with
+ * 'bcnn_set_allocator' as long as it honors the requested alignment.
+ *
+ * \param[in]   min_size        Size threshold in bytes, 0 to disable (default).
+ */
+BCNN_API void bcnn_set_huge_pages(size_t min_size);
+
+/**
+ * \brief Returns the number of bytes currently advised to be backed by huge
+ * pages, over all the nets of the process.
+ */
+BCNN_API size_t bcnn_get_huge_page_bytes(void);
+
 /**
  * \brief Creates a net object.
  *
@@ -310,9 +434,22 @@ BCNN_API void bcnn_set_log_context(bcnn_net *net, bcnn_log_callback fct,
  * \brief Sets the number of threads for BCNN to use and optionally sets the CPU
  * affinity per thread.
  *
+ * The threads belong to a persistent pool shared by all the nets of the
+ * process: they are spawned here once and wait for the parallel loops of the
+ * kernels instead of being forked / joined at each loop. The calling thread
+ * takes part in the loops as the thread 0.
+ *
  * \note This function must be called before any function that defines or loads
  * the network architecture.
  *
+ * \warning The pool is not owned by 'net': calling this function joins and
+ * respawns the threads of the whole process, hence it also changes the number
+ * of threads and the CPU affinity used by every other live net, whose loops
+ * run on at most 'num_threads' threads from then on. The loops submitted by
+ * other threads during the respawn run on their calling thread only. The
+ * contexts created by 'bcnn_create_numa_context' have their own pools and are
+ * not affected.
+ *
  * \param[in]   net             Pointer to net instance.
  * \param[in]   num_threads     Number of threads to use. BCNN_USE_OPENMP must
  *                              be defined.
@@ -381,21 +518,68 @@ BCNN_API int bcnn_get_batch_size(bcnn_net *net);
  * \brief Resizes the network according to given input width, height and
  * channels.
  *
+ * The shapes of all the tensors and the size of the workspace are inferred
+ * again from the new input shape. The batch size is kept. On a compiled net,
+ * the memory arena is planned again and only reallocated if it has to grow.
+ *
  * \note This function is valid only when applied to a fully convolutionnal
- * network.
+ * network or when the input of the full-connected layers keeps its size.
+ * The execution contexts created from the net must be freed before,
+ * otherwise BCNN_INVALID_PARAMETER is returned.
  *
  * \param[in]   net                  Pointer to net instance.
  * \param[in]   w                    New input width.
  * \param[in]   h                    New input height.
  * \param[in]   c                    New input number of channels.
- * \param[in]   need_realloc         Set to '1' if a memory allocation is
- * needed, '0' otherwise.
+ * \param[in]   need_realloc         Set to '1' if the buffers may need to
+ * grow, '0' otherwise. Ignored for a net compiled on CPU.
  *
- * \return      Possible error include BCNN_FAILED_ALLOC.
+ * \return      Possible errors include BCNN_INVALID_PARAMETER if the new
+ * shape is not supported by a layer and BCNN_FAILED_ALLOC.
  */
 BCNN_API bcnn_status bcnn_resize_net(bcnn_net *net, int w, int h, int c,
                                      int need_realloc);
 
+/**
+ * \brief Compiles the net ahead of time for another input size and batch
+ * size.
+ *
+ * A plan holds the shapes of the tensors, the size of the workspace and the
+ * memory of the inference data for its input size. All the plans share the
+ * weights of the net. The plan the net was compiled with is always available.
+ * The active plan is left unchanged.
+ *
+ * \note The net must be compiled in predict mode on CPU and have no live
+ * execution context. The plans are freed by 'bcnn_compile_net' and
+ * 'bcnn_resize_net'.
+ *
+ * \param[in]   net                  Pointer to net instance.
+ * \param[in]   w                    Input width.
+ * \param[in]   h                    Input height.
+ * \param[in]   batch_size           Batch size.
+ *
+ * \return      Possible errors include BCNN_INVALID_PARAMETER if the input
+ * size is not supported by a layer and BCNN_FAILED_ALLOC.
+ */
+BCNN_API bcnn_status bcnn_add_plan(bcnn_net *net, int w, int h,
+                                   int batch_size);
+
+/**
+ * \brief Selects the plan used by the next forward passes.
+ *
+ * No shape inference nor memory allocation happens here. The content of the
+ * input tensors is not kept from one plan to another.
+ *
+ * \param[in]   net                  Pointer to net instance.
+ * \param[in]   w                    Input width.
+ * \param[in]   h                    Input height.
+ * \param[in]   batch_size           Batch size.
+ *
+ * \return      BCNN_INVALID_PARAMETER if no plan was added for this input.
+ */
+BCNN_API bcnn_status bcnn_select_plan(bcnn_net *net, int w, int h,
+                                      int batch_size);
+
 /**
  * \brief Finalizes the net configuration.
  *
@@ -404,19 +588,114 @@ BCNN_API bcnn_status bcnn_resize_net(bcnn_net *net, int w, int h, int c,
  * configuration and the model weights) and before effectively
  * starting the model training or inference.
  *
+ * On CPU, all the net buffers (tensors, gradients and layers internal
+ * buffers) are moved into a single memory chunk. In predict mode, standalone
+ * batchnorm and activation layers are fused into the preceding layer when
+ * possible, hence the model weights must be loaded beforehand, and the
+ * intermediate tensors whose lifetimes do not overlap are mapped onto the same
+ * memory: once 'bcnn_forward' returns, only the input tensors, the output
+ * tensors (i.e. the tensors that are not consumed by any other node) and the
+ * tensors requested by 'bcnn_set_outputs' are guaranteed to hold valid data.
+ *
+ * \warning Once layers were fused, 'bcnn_load_weights', 'bcnn_save_weights'
+ * and 'bcnn_save_weights_async' return BCNN_INVALID_PARAMETER: the fused
+ * layers hold folded weights that no longer match the model files. Loading the
+ * weights after compiling a net in predict mode is thus an error whenever a
+ * layer could be fused.
+ *
  * \param[in]   net         Pointer to net instance.
  *
- * \return Possible errors include BCNN_INVALID_PARAMETER and BCNN_FAILED_ALLOC.
+ * \return Possible errors include BCNN_INVALID_PARAMETER, e.g. if execution
+ * contexts created from the net are still alive, and BCNN_FAILED_ALLOC.
  */
 BCNN_API bcnn_status bcnn_compile_net(bcnn_net *net);
 
+/**
+ * \brief Gets the size of the memory chunk holding the net buffers.
+ *
+ * \param[in]   net         Pointer to net instance.
+ *
+ * \return The size in bytes of the memory allocated by 'bcnn_compile_net'.
+ */
+BCNN_API size_t bcnn_get_arena_size(bcnn_net *net);
+
+/**
+ * \brief Creates an execution context that runs the inference of a net without
+ * duplicating its weights.
+ *
+ * The context shares the graph and the weights of 'net', which are only read,
+ * and owns the inputs, activations and scratch memory of one inference. Several
+ * contexts created from the same net can thus run 'bcnn_forward' concurrently,
+ * e.g. one per serving thread. The context is used like any other net
+ * ('bcnn_fill_tensor_with_image', 'bcnn_forward', 'bcnn_get_tensor_by_name'...)
+ * and is destroyed with 'bcnn_end_net'.
+ *
+ * \note The net must have been compiled in predict mode on CPU. The contexts
+ * must be destroyed before the net is compiled again, resized or destroyed:
+ * 'bcnn_compile_net', 'bcnn_resize_net', 'bcnn_add_plan' and
+ * 'bcnn_set_outputs' return BCNN_INVALID_PARAMETER while a context is alive.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[out]  ctx         Pointer to the created context.
+ *
+ * \return Possible errors include BCNN_INVALID_PARAMETER and BCNN_FAILED_ALLOC.
+ */
+BCNN_API bcnn_status bcnn_create_context(bcnn_net *net, bcnn_net **ctx);
+
+/**
+ * \brief Returns the number of NUMA nodes of the host, 1 if the topology is
+ * unknown.
+ */
+BCNN_API int bcnn_get_num_numa_nodes(void);
+
+/**
+ * \brief Creates an execution context bound to a NUMA node.
+ *
+ * Same as 'bcnn_create_context' except that the context holds its own copy of
+ * the weights, and that its weights, activations and scratch memory are placed
+ * on the node 'node'. Its forward runs on a pool of threads that is shared by
+ * the contexts of the node and runs on the CPUs of the node only. The thread
+ * that calls 'bcnn_forward' on the context is moved to the CPUs of the node as
+ * well. Creating one context per node and serving each from its own thread
+ * runs one replica of the net per socket, without cross-node memory traffic.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   node            NUMA node, in [0, 'bcnn_get_num_numa_nodes').
+ * \param[in]   num_threads     Number of threads running the forward, the
+ *                              caller included. Clamped to the number of CPUs
+ *                              of the node and to the number of threads of
+ *                              'net'.
+ * \param[out]  ctx             Pointer to the created context.
+ *
+ * \return Possible errors include BCNN_INVALID_PARAMETER and BCNN_FAILED_ALLOC.
+ */
+BCNN_API bcnn_status bcnn_create_numa_context(bcnn_net *net, int node,
+                                              int num_threads, bcnn_net **ctx);
+
 /**
  * \brief Loads the model weights from disk.
  *
+ * The version of a bcnn model ('.bcnnmodel' extension or any extension other
+ * than '.weights' and '.onnx') is read from its header. A model in format v2
+ * is memory mapped: in predict mode, if the net is not compiled yet, the
+ * weights are used straight from the mapping without being copied.
+ *
+ * For the other formats, the offsets of the weights of every layer are
+ * computed first, then the layers are read and converted (batchnorm folding,
+ * re-ordering for the kernels) concurrently on the threads of the net. A
+ * Darknet or v1 file that ends early only initializes the first layers.
+ *
+ * \note In predict mode, 'bcnn_compile_net' fuses the batchnorm and
+ * activation layers into the preceding layers: the weights must be loaded
+ * before the compilation. Loading them into a net whose layers were fused
+ * returns BCNN_INVALID_PARAMETER instead of loading the unfused weights into
+ * the fused layers.
+ *
  * \param[in]   net           Pointer to net instance.
  * \param[in]   model_path    Path to the model weights to be loaded.
  *
- * \return Possible erros include BCNN_INVALID_MODEL and BCNN_INVALID_PARAMETER.
+ * \return Possible erros include BCNN_INVALID_MODEL and BCNN_INVALID_PARAMETER
+ * (e.g. if layers of the net were fused by its compilation).
  */
 BCNN_API bcnn_status bcnn_load_weights(bcnn_net *net, const char *model_path);
 
@@ -440,13 +719,131 @@ BCNN_API bcnn_status bcnn_load_net(bcnn_net *net, const char *config_path,
 /**
  * \brief Writes the model weights on disk.
  *
+ * If the filename extension is '.bcnnmodel', the model is written in format
+ * v2: a table of the named tensors followed by their weights aligned on 64
+ * bytes.
+ *
+ * \note The weights of a net whose layers were fused by 'bcnn_compile_net'
+ * (predict mode) are folded and can not be saved: save them before the
+ * compilation, or use 'bcnn_save_inference_model'.
+ *
  * \param[in]   net         Pointer to net instance.
  * \param[in]   filename    Path where to save the model weights.
  *
- * \return BCNN_INVALID_PARAMETER if file failed to be open.
+ * \return BCNN_INVALID_PARAMETER if file failed to be open or if layers of the
+ * net were fused.
  */
 BCNN_API bcnn_status bcnn_save_weights(bcnn_net *net, const char *filename);
 
+/**
+ * \brief Writes the model weights on disk in the background, e.g. for the
+ * checkpoints of a training.
+ *
+ * The weights are copied into a snapshot buffer, kept from one call to the
+ * next, then written in format v2 by a worker thread: the caller can update
+ * the weights as soon as the function returns. The file is written under a
+ * temporary name ('<filename>.tmp') and renamed once complete, so that an
+ * interrupted write never leaves a truncated model.
+ *
+ * \note Waits for the previous write first. Its failure, if any, is logged.
+ * Without pthreads, the file is written before the function returns.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[in]   filename    Path where to save the model weights, with the
+ *                          '.bcnnmodel' extension.
+ *
+ * \return BCNN_INVALID_PARAMETER if the filename extension is not
+ * '.bcnnmodel' or if layers of the net were fused by 'bcnn_compile_net',
+ * BCNN_FAILED_ALLOC if the snapshot or the worker thread could
+ * not be created.
+ */
+BCNN_API bcnn_status bcnn_save_weights_async(bcnn_net *net,
+                                             const char *filename);
+
+/**
+ * \brief Waits for the write started by 'bcnn_save_weights_async' to
+ * complete. Does nothing if no write is pending.
+ *
+ * \param[in]   net         Pointer to net instance.
+ *
+ * \return BCNN_INVALID_PARAMETER if the file could not be written.
+ */
+BCNN_API bcnn_status bcnn_wait_save(bcnn_net *net);
+
+/**
+ * \brief Sets the precision of the weights written by 'bcnn_save_weights',
+ * 'bcnn_save_inference_model' and 'bcnn_save_plan'.
+ *
+ * Half precision is only available in format v2 ('.bcnnmodel'): it halves the
+ * size of the model file at the cost of the rounding of the weights. The
+ * tensors holding a value out of the half precision range are still written
+ * in single precision. The weights are converted back to single precision at
+ * load time, hence they are copied instead of being used from the mapping of
+ * the file.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[in]   precision   Precision of the weights, BCNN_PRECISION_F32 by
+ *                          default.
+ *
+ * \return BCNN_INVALID_PARAMETER if the precision is unknown.
+ */
+BCNN_API bcnn_status bcnn_set_model_precision(bcnn_net *net,
+                                              bcnn_precision precision);
+
+/**
+ * \brief Writes the model in format v2 with the weights as used by the
+ * inference kernels of the build: the batchnorm statistics are folded and the
+ * conv weights are stored Winograd transformed or packed for the GEMM, so that
+ * loading the model does not convert anything.
+ *
+ * The net must be in predict mode on CPU, with its weights loaded, and not
+ * compiled yet. The model can only be loaded in predict mode on CPU, before
+ * the compilation of the net. A build targeting another instruction set
+ * re-packs the GEMM weights at load time.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[in]   filename    Path where to save the model.
+ *
+ * \return BCNN_INVALID_PARAMETER if the net is not in the expected state or if
+ * the file failed to be written.
+ */
+BCNN_API bcnn_status bcnn_save_inference_model(bcnn_net *net,
+                                               const char *filename);
+
+/**
+ * \brief Writes a compiled net in one file: its graph after the fusion of the
+ * layers, the input shape, the requested outputs and the weights as used by
+ * the inference kernels of the build (see 'bcnn_save_inference_model').
+ *
+ * The net must be compiled in predict mode on CPU. The file is read back with
+ * 'bcnn_load_plan', no config file is needed.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[in]   filename    Path where to save the compiled net.
+ *
+ * \return BCNN_INVALID_PARAMETER if the net is not compiled in predict mode,
+ * if it holds a layer that can not be written or if the file failed to be
+ * written.
+ */
+BCNN_API bcnn_status bcnn_save_plan(bcnn_net *net, const char *filename);
+
+/**
+ * \brief Loads a net written by 'bcnn_save_plan' and compiles it.
+ *
+ * The file is memory mapped: the graph is rebuilt from it and the weights are
+ * used straight from the mapping, without being converted. Only the memory
+ * plan is computed again.
+ *
+ * \param[in]   net         Pointer to a net instance created in predict mode
+ *                          to which no layer has been added yet. Its number of
+ *                          threads can be set beforehand.
+ * \param[in]   filename    Path to the compiled net.
+ *
+ * \return BCNN_INVALID_PARAMETER if the net is not empty or not in predict
+ * mode, BCNN_INVALID_MODEL if the file is not a valid compiled net.
+ */
+BCNN_API bcnn_status bcnn_load_plan(bcnn_net *net, const char *filename);
+
 /**
  * \brief Setups the dataset loader.
  *
@@ -643,10 +1040,284 @@ BCNN_API bcnn_status bcnn_fill_tensor_with_image(
  * \brief Computes the model prediction on the current batch data and computes
  * the loss if cost layers are defined.
  *
+ * If 'bcnn_forward_async' has been used, waits for the pending forward and
+ * runs on the staged inputs.
+ *
  * \param[in]   net             Pointer to net instance.
  */
 BCNN_API void bcnn_forward(bcnn_net *net);
 
+/**
+ * \brief Restricts the forward to the nodes needed to compute a set of output
+ * tensors.
+ *
+ * The nodes that do not feed, directly or not, one of the requested tensors
+ * are skipped by 'bcnn_forward', e.g. to extract an intermediate embedding or
+ * to run a single detection head. The requested tensors keep their own memory
+ * hence hold valid data once 'bcnn_forward' returns. Without requested
+ * outputs, every node is run except the cost layers in predict mode, which
+ * 'bcnn_predict_on_batch' still runs to return the loss.
+ *
+ * \note The nodes are skipped in predict and validation modes only. The
+ * execution contexts use the outputs of the net at the time they are created.
+ * On a compiled net, the memory of the inference data is planned again, hence
+ * the contexts created from the net must be freed before, otherwise
+ * BCNN_INVALID_PARAMETER is returned.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   num_outputs     Number of output tensors. Set to 0 to run the
+ *                              whole net again.
+ * \param[in]   names           Array of 'num_outputs' tensor names.
+ *
+ * \return Possible errors include BCNN_INVALID_PARAMETER if a name is invalid
+ * and BCNN_FAILED_ALLOC.
+ */
+BCNN_API bcnn_status bcnn_set_outputs(bcnn_net *net, int num_outputs,
+                                      const char **names);
+
+/**
+ * \brief Computes the forward of the nodes whose index is between 'first' and
+ * 'last' included.
+ *
+ * Allows to run a net in several steps, e.g. the backbone and then the heads.
+ * The nodes skipped because of 'bcnn_set_outputs' are not run.
+ *
+ * \note The nodes indexes are those of the compiled net, which may differ from
+ * the model configuration as layers may be fused at compile time. See
+ * 'bcnn_get_num_nodes' and 'bcnn_get_node_index_by_output_name'. In predict
+ * mode, the tensors produced before 'first' and read by the range are only
+ * guaranteed to be valid if they are inputs of the net or requested outputs.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   first           Index of the first node to run.
+ * \param[in]   last            Index of the last node to run.
+ *
+ * \return BCNN_INVALID_PARAMETER if the range is invalid.
+ */
+BCNN_API bcnn_status bcnn_forward_range(bcnn_net *net, int first, int last);
+
+/**
+ * \brief Starts the model prediction on the current inputs in the background
+ * and returns immediately.
+ *
+ * The forward runs on a worker thread owned by the net. The input tensors are
+ * double-buffered: once this function returns, the inputs of the next forward
+ * can be written with 'bcnn_fill_tensor_with_image' or into the buffer given
+ * by 'bcnn_get_input_buffer' while the current forward runs. The next call
+ * waits for the current forward to complete before swapping the buffers.
+ *
+ * The outputs can be read from the completion callback, which runs on the
+ * worker thread, or from the caller thread once 'bcnn_wait_forward' returns or
+ * 'bcnn_poll_forward' returns 1. They are overwritten by the next forward.
+ *
+ * \note Only available in predict mode. On GPU or without pthreads, the
+ * forward runs synchronously. The callback must not submit another forward.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   callback        Function called once the forward is completed.
+ *                              Can be NULL.
+ * \param[in]   user_data       Pointer passed to the callback.
+ *
+ * \return Possible errors include BCNN_INVALID_PARAMETER and BCNN_FAILED_ALLOC.
+ */
+BCNN_API bcnn_status bcnn_forward_async(bcnn_net *net,
+                                        bcnn_forward_callback callback,
+                                        void *user_data);
+
+/**
+ * \brief Waits for the forward started by 'bcnn_forward_async' to complete,
+ * completion callback included.
+ *
+ * \param[in]   net             Pointer to net instance.
+ */
+BCNN_API void bcnn_wait_forward(bcnn_net *net);
+
+/**
+ * \brief Checks whether the forward started by 'bcnn_forward_async' is
+ * completed, without blocking.
+ *
+ * \param[in]   net             Pointer to net instance.
+ *
+ * \return 1 if no forward is pending, 0 otherwise.
+ */
+BCNN_API int bcnn_poll_forward(bcnn_net *net);
+
+/**
+ * \brief Gets the buffer receiving the data of an input tensor for the next
+ * forward.
+ *
+ * This is the tensor data itself until 'bcnn_forward_async' is used, then the
+ * staging buffer of the tensor.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   tensor_index    Index of the input tensor.
+ *
+ * \return Pointer to the buffer holding the whole batch of the tensor.
+ */
+BCNN_API float *bcnn_get_input_buffer(bcnn_net *net, int tensor_index);
+
+/**
+ * \brief Enables or disables the profiling of the forward.
+ *
+ * While enabled, the wall time of every node is recorded at each forward
+ * ('bcnn_forward', 'bcnn_forward_range', 'bcnn_forward_async'...), each
+ * forward being one run. The records are aggregated over all the runs since
+ * profiling was enabled or last reset. Disabling the profiling frees the
+ * records; when disabled, the forward has no profiling overhead.
+ *
+ * \note On GPU, the recorded times are those of the kernels launches. The
+ * records are dropped if the net is compiled again.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   enable          1 to enable the profiling, 0 to disable it.
+ *
+ * \return Possible errors include BCNN_FAILED_ALLOC.
+ */
+BCNN_API bcnn_status bcnn_set_profiling(bcnn_net *net, int enable);
+
+/**
+ * \brief Enables or disables the recording of hardware performance counters
+ * (cycles, instructions, last level cache misses and branch misses) for each
+ * node. Linux only.
+ *
+ * The counters are read through perf_event_open for every thread of the
+ * process, user space only, and are written along with the timings by
+ * 'bcnn_write_profiling_trace' and 'bcnn_write_profiling_summary'. While they
+ * are enabled, the nodes of the concurrency lanes are run one after another so
+ * that the counts can be attributed to a single node.
+ *
+ * \note The counters that the machine does not expose are skipped with a
+ * warning.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   enable          1 to enable the counters, 0 to disable them.
+ *
+ * \return BCNN_INVALID_PARAMETER if profiling is not enabled.
+ * BCNN_INTERNAL_ERROR if no counter is available (e.g. on other platforms, in
+ * virtual machines without a PMU, or if perf_event_paranoid forbids it), in
+ * which case only the timings are recorded.
+ */
+BCNN_API bcnn_status bcnn_set_profiling_counters(bcnn_net *net, int enable);
+
+/**
+ * \brief Discards the runs recorded so far by the profiler, e.g. to exclude
+ * warm-up runs.
+ *
+ * \param[in]   net             Pointer to net instance.
+ */
+BCNN_API void bcnn_reset_profiling(bcnn_net *net);
+
+/**
+ * \brief Writes the recorded runs in the Chrome trace event format.
+ *
+ * The file can be opened with chrome://tracing or Perfetto. Each node is drawn
+ * on the thread of its concurrency lane with its layer type, kernel and
+ * shapes.
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   filename        Path to the output JSON file.
+ *
+ * \return BCNN_INVALID_PARAMETER if profiling is not enabled or the file can
+ * not be written.
+ */
+BCNN_API bcnn_status bcnn_write_profiling_trace(bcnn_net *net,
+                                                const char *filename);
+
+/**
+ * \brief Writes the timings of the forward and of each node aggregated over
+ * the recorded runs (total, mean, min, max and share of the forward time) as
+ * JSON. The mean of the hardware counters per node is included if they have
+ * been recorded (see 'bcnn_set_profiling_counters').
+ *
+ * \param[in]   net             Pointer to net instance.
+ * \param[in]   filename        Path to the output JSON file.
+ *
+ * \return BCNN_INVALID_PARAMETER if profiling is not enabled or the file can
+ * not be written.
+ */
+BCNN_API bcnn_status bcnn_write_profiling_summary(bcnn_net *net,
+                                                  const char *filename);
+
+/**
+ * \brief Creates a dynamic batching front-end for the inference of a net.
+ *
+ * The batcher gathers the images submitted one by one through
+ * 'bcnn_batcher_submit' and runs them together in a single forward, which is
+ * much more efficient than running them one at a time. A batch is run as soon
+ * as 'batch_size' requests are pending or when the oldest pending request has
+ * waited for 'max_wait_us' microseconds, whichever comes first.
+ *
+ * The batcher runs the forward on its own thread: 'net' (which can also be an
+ * execution context created with 'bcnn_create_context') must not be used by
+ * the caller until the batcher is destroyed with 'bcnn_end_batcher'. The
+ * images are written into the first input tensor of the net with
+ * 'bcnn_fill_tensor_with_image' and the given preprocessing parameters.
+ *
+ * \note Requires pthreads: on other platforms, BCNN_INVALID_PARAMETER is
+ * returned.
+ *
+ * \param[in]   net             Pointer to net instance, compiled in predict
+ *                              mode.
+ * \param[in]   output_name     Name of the tensor returned for each request.
+ *                              It must be an output of the net: a tensor
+ *                              requested by 'bcnn_set_outputs' or, if none
+ *                              was requested, a tensor read by no other layer.
+ * \param[in]   max_wait_us     Max time in microseconds a request can wait for
+ *                              its batch to be filled.
+ * \param[in]   norm_coeff      See 'bcnn_fill_tensor_with_image'.
+ * \param[in]   swap_to_bgr     See 'bcnn_fill_tensor_with_image'.
+ * \param[in]   mean_r          See 'bcnn_fill_tensor_with_image'.
+ * \param[in]   mean_g          See 'bcnn_fill_tensor_with_image'.
+ * \param[in]   mean_b          See 'bcnn_fill_tensor_with_image'.
+ * \param[out]  batcher         Pointer to the created batcher.
+ *
+ * \return Possible errors include BCNN_INVALID_PARAMETER and BCNN_FAILED_ALLOC.
+ */
+BCNN_API bcnn_status bcnn_create_batcher(bcnn_net *net, const char *output_name,
+                                         int max_wait_us, float norm_coeff,
+                                         int swap_to_bgr, float mean_r,
+                                         float mean_g, float mean_b,
+                                         bcnn_batcher **batcher);
+
+/**
+ * \brief Destroys a batcher. The pending requests are processed first.
+ *
+ * \param[in]   batcher         Pointer to batcher instance.
+ */
+BCNN_API void bcnn_end_batcher(bcnn_batcher **batcher);
+
+/**
+ * \brief Submits an image to a batcher and waits for its prediction.
+ *
+ * This function is thread-safe and is meant to be called concurrently by the
+ * threads serving the requests.
+ *
+ * \param[in]   batcher         Pointer to batcher instance.
+ * \param[in]   src             Pointer to input image pixels data.
+ * \param[in]   w               Image width.
+ * \param[in]   h               Image height.
+ * \param[in]   c               Number of channels of input image.
+ * \param[out]  out             Output values of the request. Must hold
+ *                              'bcnn_batcher_get_output_size' floats.
+ * \param[out]  timing          Queue / compute timings of the request. Can be
+ *                              NULL.
+ *
+ * \return Possible errors include BCNN_INVALID_PARAMETER.
+ */
+BCNN_API bcnn_status bcnn_batcher_submit(bcnn_batcher *batcher,
+                                         const uint8_t *src, int w, int h,
+                                         int c, float *out,
+                                         bcnn_batch_timing *timing);
+
+/**
+ * \brief Gets the number of output values of one request.
+ *
+ * \param[in]   batcher         Pointer to batcher instance.
+ *
+ * \return Size of the output tensor slice of one request.
+ */
+BCNN_API int bcnn_batcher_get_output_size(bcnn_batcher *batcher);
+
 /**
  * \brief Back-propagates the gradients of the loss w.r.t. the model weights.
  *
@@ -688,6 +1359,12 @@ BCNN_API float bcnn_train_on_batch(bcnn_net *net);
  * This functions performs the following:
  * - Load the next data batch (and performs data augmentation if required)
  * - Compute the forward pass given the loaded data batch
+ * - Return the loss according to the error metric
+ *
+ * \note In predict mode, the cost layers skipped by 'bcnn_forward' are run
+ * here, the loader providing the labels. If outputs were requested with
+ * 'bcnn_set_outputs', the loss is only computed if a cost layer output is
+ * among them.
  *
  * \param[in]   net            Pointer to net instance.
  * \param[out]  out            Pointer to output tensor hold in the net
@@ -761,6 +1438,67 @@ BCNN_API bcnn_tensor *bcnn_get_tensor_by_index(bcnn_net *net, int index);
  */
 BCNN_API bcnn_tensor *bcnn_get_tensor_by_name(bcnn_net *net, const char *name);
 
+/**
+ * \brief Returns the number of nodes of the net.
+ *
+ * \param[in]   net         Pointer to net instance.
+ *
+ * \return The number of nodes, after the fusions done by 'bcnn_compile_net'.
+ */
+BCNN_API int bcnn_get_num_nodes(bcnn_net *net);
+
+/**
+ * \brief Gets the index of the node that computes a tensor, given the tensor
+ * name.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[in]   name        Tensor name.
+ *
+ * \return Index of the last node writing the tensor. Returns -1 if the name is
+ * invalid or if the tensor is not computed by any node.
+ */
+BCNN_API int bcnn_get_node_index_by_output_name(bcnn_net *net,
+                                                const char *name);
+
+/**
+ * \brief Computes the static cost of the forward of a node: number of
+ * multiply-accumulates, bytes of parameters, bytes of activations read and
+ * written and bytes of scratch memory.
+ *
+ * The convolutions, dense layers, batchnorms, average poolings and eltwise
+ * layers count one MAC per multiply-add. The other layers only move or compare
+ * data and count 0 MAC.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[in]   index       Node index.
+ * \param[out]  cost        Cost of the node.
+ *
+ * \return BCNN_INVALID_PARAMETER if the index is invalid.
+ */
+BCNN_API bcnn_status bcnn_get_node_cost(bcnn_net *net, int index,
+                                        bcnn_node_cost *cost);
+
+/**
+ * \brief Computes the sum of the costs of all the nodes of the net.
+ *
+ * \param[in]   net         Pointer to net instance.
+ * \param[out]  cost        Cost of the whole net.
+ */
+BCNN_API void bcnn_get_net_cost(bcnn_net *net, bcnn_node_cost *cost);
+
+/**
+ * \brief Logs the cost of every node and of the whole net, with the
+ * arithmetic intensity of each node, i.e. the number of floating point
+ * operations per byte of parameters and activations.
+ *
+ * A low arithmetic intensity denotes a bandwidth-bound layer, a high one a
+ * compute-bound layer. The costs are also written in the profiling summary
+ * (see 'bcnn_write_profiling_summary') along with the achieved GFLOP/s.
+ *
+ * \param[in]   net         Pointer to net instance.
+ */
+BCNN_API void bcnn_log_cost_report(bcnn_net *net);
+
 /****************************************************************************
  * BCNN layers API
  ***************************************************************************/
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "bcnn_allocator.h"
+
+#include <stdio.h>
+#include <string.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <bh/bh_macros.h>
+#include <bh/bh_mem.h>
+
+#include "bcnn_numa.h"
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+#define BCNN_HAS_HUGE_PAGES
+#endif
+
+/* Size of a transparent huge page on x86-64 and arm64 */
+#define BCNN_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+/* Size of a regular page */
+#define BCNN_PAGE_SIZE 4096
+
+#if defined(_MSC_VER)
+#define BCNN_THREAD_LOCAL __declspec(thread)
+#else
+#define BCNN_THREAD_LOCAL __thread
+#endif
+
+/* Stored right before each block: the allocator is given back the size and
+ * tag of the block when it is released */
+typedef struct {
+    size_t size;   /* Size requested from the allocator */
+    size_t offset; /* Offset of the block from the start of the allocation */
+    bcnn_alloc_tag tag;
+    int huge; /* Block was advised to be backed by huge pages */
+} bcnn_alloc_header;
+
+static void *bcnn_default_alloc(size_t size, size_t alignment,
+                                bcnn_alloc_tag tag, void *user_data) {
+    return bh_align_malloc(size, alignment);
+}
+
+static void bcnn_default_free(void *ptr, size_t size, bcnn_alloc_tag tag,
+                              void *user_data) {
+    bh_align_free(ptr);
+}
+
+static bcnn_alloc_func bcnn_alloc_fn = bcnn_default_alloc;
+static bcnn_free_func bcnn_free_fn = bcnn_default_free;
+static void *bcnn_alloc_user_data = NULL;
+/* Blocks of at least that size are put on huge pages, 0 to disable */
+static size_t bcnn_huge_page_threshold = 0;
+#ifdef BCNN_HAS_HUGE_PAGES
+static size_t bcnn_huge_page_bytes = 0;
+#endif
+/* NUMA node of the blocks allocated by the thread, -1 for first-touch */
+static BCNN_THREAD_LOCAL int bcnn_alloc_node = -1;
+
+void bcnn_set_allocator(bcnn_alloc_func alloc_func, bcnn_free_func free_func,
+                        void *user_data) {
+    bcnn_alloc_fn = alloc_func ? alloc_func : bcnn_default_alloc;
+    bcnn_free_fn = free_func ? free_func : bcnn_default_free;
+    bcnn_alloc_user_data = user_data;
+}
+
+#ifdef BCNN_HAS_HUGE_PAGES
+/* Returns 1 if the kernel can back the memory with transparent huge pages
+ * i.e. the policy is either 'always' or 'madvise' */
+static int bcnn_huge_pages_supported(void) {
+    static int supported = -1;
+    if (supported < 0) {
+        char buf[128] = {0};
+        FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+        supported = 0;
+        if (f != NULL) {
+            if (fgets(buf, sizeof(buf), f) != NULL) {
+                supported = (strstr(buf, "[never]") == NULL);
+            }
+            fclose(f);
+        }
+    }
+    return supported;
+}
+#endif
+
+void bcnn_set_huge_pages(size_t min_size) {
+#ifdef BCNN_HAS_HUGE_PAGES
+    bcnn_huge_page_threshold = bcnn_huge_pages_supported() ? min_size : 0;
+#endif
+}
+
+size_t bcnn_get_huge_page_bytes(void) {
+#ifdef BCNN_HAS_HUGE_PAGES
+    return __atomic_load_n(&bcnn_huge_page_bytes, __ATOMIC_RELAXED);
+#else
+    return 0;
+#endif
+}
+
+int bcnn_set_alloc_numa_node(int node) {
+    int prev = bcnn_alloc_node;
+    bcnn_alloc_node = node;
+    return prev;
+}
+
+void *bcnn_align_malloc(size_t size, size_t align, bcnn_alloc_tag tag) {
+    align = bh_max(align, sizeof(size_t));
+    // The header takes a whole alignment unit so that the block stays aligned
+    size_t offset = bh_round_up(sizeof(bcnn_alloc_header), align);
+    size_t alloc_size = size + offset;
+    char *p = NULL;
+    int huge = (bcnn_huge_page_threshold > 0 &&
+                size >= bcnn_huge_page_threshold);
+    // Blocks placed on a NUMA node span whole pages
+    int bind = (bcnn_alloc_node >= 0 && size >= BCNN_PAGE_SIZE);
+    if (huge) {
+        // Whole huge pages so that no small page is left at either end
+        alloc_size = bh_round_up(size + offset, BCNN_HUGE_PAGE_SIZE);
+        p = (char *)bcnn_alloc_fn(alloc_size, BCNN_HUGE_PAGE_SIZE, tag,
+                                  bcnn_alloc_user_data);
+    }
+    if (p == NULL) {
+        // Regular block, also the fallback when the huge one failed
+        huge = 0;
+        alloc_size = size + offset;
+        if (bind) {
+            alloc_size = bh_round_up(alloc_size, BCNN_PAGE_SIZE);
+        }
+        p = (char *)bcnn_alloc_fn(alloc_size,
+                                  bind ? bh_max(align, BCNN_PAGE_SIZE) : align,
+                                  tag, bcnn_alloc_user_data);
+    }
+    if (p == NULL) {
+        return NULL;
+    }
+    if (bind) {
+        // Before the pages are touched so that they are faulted on the node.
+        // Blocks stay on the first-touch policy if the binding fails.
+        bcnn_numa_bind_memory(p, alloc_size, bcnn_alloc_node);
+    }
+#ifdef BCNN_HAS_HUGE_PAGES
+    if (huge) {
+        // The block stays on regular pages if the advice is refused
+        huge = (madvise(p, alloc_size, MADV_HUGEPAGE) == 0);
+        if (huge) {
+            __atomic_add_fetch(&bcnn_huge_page_bytes, alloc_size,
+                               __ATOMIC_RELAXED);
+        }
+    }
+#endif
+    bcnn_alloc_header *header = (bcnn_alloc_header *)(p + offset) - 1;
+    header->size = alloc_size;
+    header->offset = offset;
+    header->tag = tag;
+    header->huge = huge;
+    return p + offset;
+}
+
+void *bcnn_align_calloc(size_t size, size_t align, bcnn_alloc_tag tag) {
+    void *p = bcnn_align_malloc(size, align, tag);
+    if (p != NULL) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void bcnn_align_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    bcnn_alloc_header *header = (bcnn_alloc_header *)ptr - 1;
+#ifdef BCNN_HAS_HUGE_PAGES
+    if (header->huge) {
+        __atomic_sub_fetch(&bcnn_huge_page_bytes, header->size,
+                           __ATOMIC_RELAXED);
+    }
+#endif
+    bcnn_free_fn((char *)ptr - header->offset, header->size, header->tag,
+                 bcnn_alloc_user_data);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef BCNN_ALLOCATOR_H
+#define BCNN_ALLOCATOR_H
+
+#include <stddef.h>
+
+#include <bcnn/bcnn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Aligned allocations routed through the allocator set by
+ * 'bcnn_set_allocator'. A block allocated with these functions must be
+ * released with 'bcnn_align_free'.
+ */
+
+void *bcnn_align_malloc(size_t size, size_t align, bcnn_alloc_tag tag);
+
+/* Same as 'bcnn_align_malloc' with the memory set to zero */
+void *bcnn_align_calloc(size_t size, size_t align, bcnn_alloc_tag tag);
+
+void bcnn_align_free(void *ptr);
+
+/* Places the blocks of at least a page allocated afterwards by the calling
+ * thread on the NUMA node 'node', -1 to restore the default first-touch
+ * placement. Returns the previous node. */
+int bcnn_set_alloc_numa_node(int node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BCNN_ALLOCATOR_H
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "bcnn_async.h"
+
+#ifdef BCNN_USE_PTHREADS
+#include <pthread.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include <bh/bh_macros.h>
+#include <bh/bh_mem.h>
+
+#include "bcnn_allocator.h"
+#include "bcnn_net.h"
+#include "bcnn_tensor.h"
+#include "bcnn_utils.h"
+
+#ifdef BCNN_USE_PTHREADS
+
+struct bcnn_async {
+    float **staging; /* Buffer receiving the next inputs of each input tensor */
+    float **buffers; /* Buffers allocated for the double-buffering */
+    int pending;     /* Set while a forward is submitted or running */
+    int stop;
+    bcnn_forward_callback callback;
+    void *user_data;
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void *bcnn_async_worker(void *arg) {
+    bcnn_net *net = (bcnn_net *)arg;
+    bcnn_async *async = net->async;
+    pthread_mutex_lock(&async->mutex);
+    for (;;) {
+        while (!async->pending && !async->stop) {
+            pthread_cond_wait(&async->cond, &async->mutex);
+        }
+        if (!async->pending) {
+            break;
+        }
+        pthread_mutex_unlock(&async->mutex);
+        bcnn_net_forward(net);
+        // The callback runs before the forward is flagged as completed so that
+        // 'bcnn_wait_forward' also waits for it
+        if (async->callback) {
+            async->callback(net, async->user_data);
+        }
+        pthread_mutex_lock(&async->mutex);
+        async->pending = 0;
+        pthread_cond_broadcast(&async->cond);
+    }
+    pthread_mutex_unlock(&async->mutex);
+    return NULL;
+}
+
+static void bcnn_async_free(bcnn_async *async, int num_inputs) {
+    if (async->buffers) {
+        for (int i = 0; i < num_inputs; ++i) {
+            bcnn_align_free(async->buffers[i]);
+        }
+    }
+    bh_free(async->buffers);
+    bh_free(async->staging);
+    bh_free(async);
+}
+
+static bcnn_status bcnn_async_create(bcnn_net *net) {
+    bcnn_async *async = (bcnn_async *)calloc(1, sizeof(bcnn_async));
+    BCNN_CHECK_AND_LOG(net->log_ctx, async, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    async->staging = (float **)calloc(net->num_inputs, sizeof(float *));
+    async->buffers = (float **)calloc(net->num_inputs, sizeof(float *));
+    if (async->staging == NULL || async->buffers == NULL) {
+        bcnn_async_free(async, net->num_inputs);
+        BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                   "Internal allocation error\n");
+    }
+    for (int i = 0; i < net->num_inputs; ++i) {
+        bcnn_tensor *t = &net->tensors[net->inputs[i]];
+        async->buffers[i] = (float *)bcnn_align_calloc(
+            bcnn_tensor_size(t) * sizeof(float), align_offset_,
+            BCNN_ALLOC_DATA);
+        if (async->buffers[i] == NULL) {
+            bcnn_async_free(async, net->num_inputs);
+            BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+        }
+        async->staging[i] = async->buffers[i];
+    }
+    pthread_mutex_init(&async->mutex, NULL);
+    pthread_cond_init(&async->cond, NULL);
+    net->async = async;
+    if (pthread_create(&async->worker, NULL, bcnn_async_worker, net) != 0) {
+        pthread_cond_destroy(&async->cond);
+        pthread_mutex_destroy(&async->mutex);
+        bcnn_async_free(async, net->num_inputs);
+        net->async = NULL;
+        BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                   "Could not create the asynchronous forward thread\n");
+    }
+    return BCNN_SUCCESS;
+}
+
+void bcnn_async_commit_inputs(bcnn_net *net) {
+    bcnn_async *async = net->async;
+    bcnn_wait_forward(net);
+    for (int i = 0; i < net->num_inputs; ++i) {
+        bcnn_tensor *t = &net->tensors[net->inputs[i]];
+        float *data = t->data;
+        t->data = async->staging[i];
+        async->staging[i] = data;
+    }
+}
+
+void bcnn_async_destroy(bcnn_net *net) {
+    bcnn_async *async = net->async;
+    if (async == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&async->mutex);
+    async->stop = 1;
+    pthread_cond_broadcast(&async->cond);
+    pthread_mutex_unlock(&async->mutex);
+    pthread_join(async->worker, NULL);
+    pthread_cond_destroy(&async->cond);
+    pthread_mutex_destroy(&async->mutex);
+    // The input tensors may point to a staging buffer: the current inputs are
+    // copied back to the tensor own buffer
+    for (int i = 0; i < net->num_inputs; ++i) {
+        bcnn_tensor *t = &net->tensors[net->inputs[i]];
+        if (t->data == async->buffers[i]) {
+            memcpy(async->staging[i], t->data,
+                   bcnn_tensor_size(t) * sizeof(float));
+            t->data = async->staging[i];
+        }
+    }
+    bcnn_async_free(async, net->num_inputs);
+    net->async = NULL;
+}
+
+void bcnn_wait_forward(bcnn_net *net) {
+    bcnn_async *async = net->async;
+    if (async == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&async->mutex);
+    while (async->pending) {
+        pthread_cond_wait(&async->cond, &async->mutex);
+    }
+    pthread_mutex_unlock(&async->mutex);
+}
+
+int bcnn_poll_forward(bcnn_net *net) {
+    bcnn_async *async = net->async;
+    if (async == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&async->mutex);
+    int done = !async->pending;
+    pthread_mutex_unlock(&async->mutex);
+    return done;
+}
+
+float *bcnn_get_input_buffer(bcnn_net *net, int tensor_index) {
+    if (net->async != NULL) {
+        for (int i = 0; i < net->num_inputs; ++i) {
+            if (net->inputs[i] == tensor_index) {
+                return net->async->staging[i];
+            }
+        }
+    }
+    return net->tensors[tensor_index].data;
+}
+
+#else
+
+/* Without pthreads, the forward runs synchronously in 'bcnn_forward_async'
+ * and the asynchronous state is never created */
+void bcnn_async_commit_inputs(bcnn_net *net) {}
+
+void bcnn_async_destroy(bcnn_net *net) {}
+
+void bcnn_wait_forward(bcnn_net *net) {}
+
+int bcnn_poll_forward(bcnn_net *net) { return 1; }
+
+float *bcnn_get_input_buffer(bcnn_net *net, int tensor_index) {
+    return net->tensors[tensor_index].data;
+}
+
+#endif  // BCNN_USE_PTHREADS
+
+bcnn_status bcnn_forward_async(bcnn_net *net, bcnn_forward_callback callback,
+                               void *user_data) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->mode == BCNN_MODE_PREDICT,
+                       BCNN_INVALID_PARAMETER,
+                       "Asynchronous forward requires the predict mode\n");
+#if defined(BCNN_USE_CUDA) || !defined(BCNN_USE_PTHREADS)
+#ifdef BCNN_USE_CUDA
+    // The inputs are uploaded to the device when filled: the forward runs
+    // synchronously
+    for (int i = 0; i < net->num_inputs; ++i) {
+        bcnn_tensor *t = &net->tensors[net->inputs[i]];
+        bcnn_cuda_memcpy_host2dev(t->data_gpu, t->data, bcnn_tensor_size(t));
+    }
+#endif
+    bcnn_net_forward(net);
+    if (callback) {
+        callback(net, user_data);
+    }
+#else
+    if (net->async == NULL) {
+        // The inputs of the first forward have been written directly into the
+        // input tensors
+        BCNN_CHECK_STATUS(bcnn_async_create(net));
+    } else {
+        bcnn_async_commit_inputs(net);
+    }
+    bcnn_async *async = net->async;
+    pthread_mutex_lock(&async->mutex);
+    async->callback = callback;
+    async->user_data = user_data;
+    async->pending = 1;
+    pthread_cond_broadcast(&async->cond);
+    pthread_mutex_unlock(&async->mutex);
+#endif
+    return BCNN_SUCCESS;
+}
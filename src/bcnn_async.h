@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef BCNN_ASYNC_H
+#define BCNN_ASYNC_H
+
+#include <bcnn/bcnn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Asynchronous forward. The input tensors are double-buffered: the caller
+ * writes the inputs of the next forward into a staging buffer while the
+ * current forward runs on a worker thread, and the buffers are swapped when
+ * the next forward is submitted.
+ */
+
+/* Waits for the pending asynchronous forward to complete, then moves the
+ * staged inputs into the input tensors */
+void bcnn_async_commit_inputs(bcnn_net *net);
+
+/* Waits for the pending asynchronous forward, joins the worker thread and
+ * gives the input tensors their own buffers back. The inputs staged since the
+ * last forward are discarded. */
+void bcnn_async_destroy(bcnn_net *net);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BCNN_ASYNC_H
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#ifdef BCNN_USE_PTHREADS
+#include <pthread.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <bh/bh_macros.h>
+
+#include "bcnn_net.h"
+#include "bcnn_tensor.h"
+#include "bcnn_utils.h"
+
+#ifdef BCNN_USE_PTHREADS
+
+/* Clock of the deadlines given to pthread_cond_timedwait: the condition
+ * variables of macOS can not wait on the monotonic clock */
+#ifdef __APPLE__
+#define BCNN_BATCHER_CLOCK CLOCK_REALTIME
+#else
+#define BCNN_BATCHER_CLOCK CLOCK_MONOTONIC
+#endif
+
+/**
+ * Request submitted to a batcher. It lives on the stack of the submitting
+ * thread until its batch has been processed.
+ */
+typedef struct bcnn_batch_request {
+    const uint8_t *src;
+    int w;
+    int h;
+    int c;
+    float *out;
+    int done;           /* Set once 'out' and 'status' are filled */
+    bcnn_status status; /* Status of the filling of the input tensor */
+    int64_t submit_time;
+    int64_t start_time;
+    int64_t end_time;
+    int batch_fill;
+    struct bcnn_batch_request *next;
+} bcnn_batch_request;
+
+struct bcnn_batcher {
+    bcnn_net *net;
+    int input_id;  /* Index of the tensor filled with the images */
+    int output_id; /* Index of the tensor sliced into the requests outputs */
+    int64_t max_wait; /* Max waiting time of a request in microseconds */
+    float norm_coeff;
+    int swap_to_bgr;
+    float mean_r;
+    float mean_g;
+    float mean_b;
+    int stop;
+    int num_pending;          /* Number of requests in the queue */
+    bcnn_batch_request *head; /* Oldest pending request */
+    bcnn_batch_request *tail; /* Newest pending request */
+    bcnn_batch_request **batch; /* Requests of the batch being processed */
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t pending_cond; /* Signaled when a request is queued */
+    pthread_cond_t done_cond;    /* Signaled when a batch is processed */
+};
+
+/* Time of 'BCNN_BATCHER_CLOCK' in microseconds */
+static int64_t bcnn_batcher_now(void) {
+    struct timespec ts;
+    clock_gettime(BCNN_BATCHER_CLOCK, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bcnn_batcher_run_batch(bcnn_batcher *batcher, int num_requests) {
+    bcnn_net *net = batcher->net;
+    bcnn_tensor *dst = &net->tensors[batcher->output_id];
+    int64_t start_time = bcnn_batcher_now();
+    int num_filled = 0;
+    for (int i = 0; i < num_requests; ++i) {
+        bcnn_batch_request *req = batcher->batch[i];
+        req->status = bcnn_fill_tensor_with_image(
+            net, req->src, req->w, req->h, req->c, batcher->norm_coeff,
+            batcher->swap_to_bgr, batcher->mean_r, batcher->mean_g,
+            batcher->mean_b, batcher->input_id, i);
+        num_filled += (req->status == BCNN_SUCCESS);
+    }
+    // The slots left empty hold the inputs of a previous batch and their
+    // outputs are discarded
+    if (num_filled > 0) {
+        bcnn_forward(net);
+#ifdef BCNN_USE_CUDA
+        bcnn_cuda_memcpy_dev2host(dst->data_gpu, dst->data,
+                                  bcnn_tensor_size(dst));
+#endif
+    }
+    int sz = bcnn_tensor_size3d(dst);
+    for (int i = 0; i < num_requests; ++i) {
+        bcnn_batch_request *req = batcher->batch[i];
+        if (req->status == BCNN_SUCCESS) {
+            memcpy(req->out, dst->data + i * sz, sz * sizeof(float));
+        }
+    }
+    int64_t end_time = bcnn_batcher_now();
+    for (int i = 0; i < num_requests; ++i) {
+        batcher->batch[i]->start_time = start_time;
+        batcher->batch[i]->end_time = end_time;
+        batcher->batch[i]->batch_fill = num_requests;
+    }
+}
+
+static void *bcnn_batcher_worker(void *arg) {
+    bcnn_batcher *batcher = (bcnn_batcher *)arg;
+    int batch_size = batcher->net->batch_size;
+    pthread_mutex_lock(&batcher->mutex);
+    for (;;) {
+        while (batcher->num_pending == 0 && !batcher->stop) {
+            pthread_cond_wait(&batcher->pending_cond, &batcher->mutex);
+        }
+        if (batcher->num_pending == 0) {
+            break;
+        }
+        // Waits for the batch to be full or for the deadline of the oldest
+        // request, unless the batcher is being destroyed
+        int64_t deadline = batcher->head->submit_time + batcher->max_wait;
+        struct timespec ts;
+        ts.tv_sec = (time_t)(deadline / 1000000);
+        ts.tv_nsec = (long)(deadline % 1000000) * 1000;
+        while (batcher->num_pending < batch_size && !batcher->stop) {
+            if (pthread_cond_timedwait(&batcher->pending_cond, &batcher->mutex,
+                                       &ts) == ETIMEDOUT) {
+                break;
+            }
+        }
+        int num_requests = bh_min(batcher->num_pending, batch_size);
+        for (int i = 0; i < num_requests; ++i) {
+            batcher->batch[i] = batcher->head;
+            batcher->head = batcher->head->next;
+        }
+        if (batcher->head == NULL) {
+            batcher->tail = NULL;
+        }
+        batcher->num_pending -= num_requests;
+        pthread_mutex_unlock(&batcher->mutex);
+
+        bcnn_batcher_run_batch(batcher, num_requests);
+
+        pthread_mutex_lock(&batcher->mutex);
+        for (int i = 0; i < num_requests; ++i) {
+            batcher->batch[i]->done = 1;
+        }
+        pthread_cond_broadcast(&batcher->done_cond);
+    }
+    pthread_mutex_unlock(&batcher->mutex);
+    return NULL;
+}
+
+bcnn_status bcnn_create_batcher(bcnn_net *net, const char *output_name,
+                                int max_wait_us, float norm_coeff,
+                                int swap_to_bgr, float mean_r, float mean_g,
+                                float mean_b, bcnn_batcher **batcher) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->mode == BCNN_MODE_PREDICT,
+                       BCNN_INVALID_PARAMETER,
+                       "A batcher requires a net in predict mode\n");
+    BCNN_CHECK_AND_LOG(net->log_ctx, max_wait_us >= 0, BCNN_INVALID_PARAMETER,
+                       "Invalid batcher max waiting time %d\n", max_wait_us);
+    int output_id = bcnn_get_tensor_index_by_name(net, output_name);
+    BCNN_CHECK_AND_LOG(net->log_ctx, output_id >= 0, BCNN_INVALID_PARAMETER,
+                       "Batcher: invalid output tensor name %s\n",
+                       output_name);
+    // The intermediate tensors may be skipped, packed or overwritten by the
+    // forward
+    BCNN_CHECK_AND_LOG(net->log_ctx, bcnn_net_holds_output(net, output_id),
+                       BCNN_INVALID_PARAMETER,
+                       "Batcher: %s is not an output of the net, request it "
+                       "with bcnn_set_outputs first\n",
+                       output_name);
+    bcnn_batcher *p_batcher = (bcnn_batcher *)calloc(1, sizeof(bcnn_batcher));
+    BCNN_CHECK_AND_LOG(net->log_ctx, p_batcher, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    p_batcher->batch = (bcnn_batch_request **)calloc(
+        net->batch_size, sizeof(bcnn_batch_request *));
+    if (p_batcher->batch == NULL) {
+        bh_free(p_batcher);
+        BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                   "Internal allocation error\n");
+    }
+    p_batcher->net = net;
+    p_batcher->input_id = net->inputs[0];
+    p_batcher->output_id = output_id;
+    p_batcher->max_wait = max_wait_us;
+    p_batcher->norm_coeff = norm_coeff;
+    p_batcher->swap_to_bgr = swap_to_bgr;
+    p_batcher->mean_r = mean_r;
+    p_batcher->mean_g = mean_g;
+    p_batcher->mean_b = mean_b;
+    // The deadlines are computed with 'BCNN_BATCHER_CLOCK'
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef __APPLE__
+    pthread_condattr_setclock(&attr, BCNN_BATCHER_CLOCK);
+#endif
+    pthread_mutex_init(&p_batcher->mutex, NULL);
+    pthread_cond_init(&p_batcher->pending_cond, &attr);
+    pthread_cond_init(&p_batcher->done_cond, NULL);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&p_batcher->worker, NULL, bcnn_batcher_worker,
+                       p_batcher) != 0) {
+        pthread_cond_destroy(&p_batcher->done_cond);
+        pthread_cond_destroy(&p_batcher->pending_cond);
+        pthread_mutex_destroy(&p_batcher->mutex);
+        bh_free(p_batcher->batch);
+        bh_free(p_batcher);
+        BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                   "Could not create the batcher thread\n");
+    }
+    *batcher = p_batcher;
+    return BCNN_SUCCESS;
+}
+
+void bcnn_end_batcher(bcnn_batcher **batcher) {
+    bcnn_batcher *p_batcher = *batcher;
+    pthread_mutex_lock(&p_batcher->mutex);
+    p_batcher->stop = 1;
+    pthread_cond_signal(&p_batcher->pending_cond);
+    pthread_mutex_unlock(&p_batcher->mutex);
+    pthread_join(p_batcher->worker, NULL);
+    pthread_cond_destroy(&p_batcher->done_cond);
+    pthread_cond_destroy(&p_batcher->pending_cond);
+    pthread_mutex_destroy(&p_batcher->mutex);
+    bh_free(p_batcher->batch);
+    bh_free(*batcher);
+}
+
+bcnn_status bcnn_batcher_submit(bcnn_batcher *batcher, const uint8_t *src,
+                                int w, int h, int c, float *out,
+                                bcnn_batch_timing *timing) {
+    bcnn_batch_request req = {0};
+    req.src = src;
+    req.w = w;
+    req.h = h;
+    req.c = c;
+    req.out = out;
+    pthread_mutex_lock(&batcher->mutex);
+    req.submit_time = bcnn_batcher_now();
+    if (batcher->tail != NULL) {
+        batcher->tail->next = &req;
+    } else {
+        batcher->head = &req;
+    }
+    batcher->tail = &req;
+    batcher->num_pending++;
+    pthread_cond_signal(&batcher->pending_cond);
+    while (!req.done) {
+        pthread_cond_wait(&batcher->done_cond, &batcher->mutex);
+    }
+    pthread_mutex_unlock(&batcher->mutex);
+    if (timing != NULL) {
+        timing->queue_time = (double)(req.start_time - req.submit_time) / 1000;
+        timing->compute_time = (double)(req.end_time - req.start_time) / 1000;
+        timing->batch_fill = req.batch_fill;
+    }
+    return req.status;
+}
+
+int bcnn_batcher_get_output_size(bcnn_batcher *batcher) {
+    return bcnn_tensor_size3d(&batcher->net->tensors[batcher->output_id]);
+}
+
+#else
+
+bcnn_status bcnn_create_batcher(bcnn_net *net, const char *output_name,
+                                int max_wait_us, float norm_coeff,
+                                int swap_to_bgr, float mean_r, float mean_g,
+                                float mean_b, bcnn_batcher **batcher) {
+    BCNN_ERROR(net->log_ctx, BCNN_INVALID_PARAMETER,
+               "Batcher: not supported without pthreads\n");
+}
+
+void bcnn_end_batcher(bcnn_batcher **batcher) {}
+
+bcnn_status bcnn_batcher_submit(bcnn_batcher *batcher, const uint8_t *src,
+                                int w, int h, int c, float *out,
+                                bcnn_batch_timing *timing) {
+    return BCNN_INVALID_PARAMETER;
+}
+
+int bcnn_batcher_get_output_size(bcnn_batcher *batcher) { return 0; }
+
+#endif  // BCNN_USE_PTHREADS
@@ -55,7 +55,7 @@ bcnn_status bcnn_fill_tensor_with_image(bcnn_net *net, const uint8_t *src,
         "tensor has size (w=%d h=%d c=%d)",
         net->tensors[tensor_index].w, net->tensors[tensor_index].h,
         net->tensors[tensor_index].c);
-    float *data = net->tensors[tensor_index].data +
+    float *data = bcnn_get_input_buffer(net, tensor_index) +
                   batch_index * bcnn_tensor_size3d(&net->tensors[tensor_index]);
     bcnn_convert_img_to_float(src, w, h, c, norm_coeff, swap_to_bgr, mean_r,
                               mean_g, mean_b, data);
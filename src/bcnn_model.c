@@ -0,0 +1,1292 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bcnn_model.h"
+
+#include <math.h>
+#ifdef BCNN_USE_PTHREADS
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BCNN_HAS_MMAP
+#endif
+
+#include <bh/bh_macros.h>
+#include <bh/bh_mem.h>
+#include <bh/bh_timer.h>
+
+#include "bcnn_activation_layer.h"
+#include "bcnn_allocator.h"
+#include "bcnn_conv_layer.h"
+#include "bcnn_cost_layer.h"
+#include "bcnn_deconv_layer.h"
+#include "bcnn_depthwise_conv_layer.h"
+#include "bcnn_dropout_layer.h"
+#include "bcnn_eltwise_layer.h"
+#include "bcnn_fc_layer.h"
+#include "bcnn_lrn_layer.h"
+#include "bcnn_mat.h"
+#include "bcnn_maxpool_layer.h"
+#include "bcnn_net.h"
+#include "bcnn_tensor.h"
+#include "bcnn_upsample_layer.h"
+#include "bcnn_utils.h"
+#include "bcnn_yolo.h"
+
+/* Max number of src of a node of a compiled net */
+#define BCNN_MODEL_MAX_SRC 32
+
+/* Payload written in the model file */
+typedef struct bcnn_model_item {
+    const char *name;
+    const float *data;
+    bcnn_model_entry entry;
+} bcnn_model_item;
+
+/* Instruction set the GEMM panels of the build are laid out for */
+static uint32_t bcnn_model_host_isa(void) {
+#ifdef BCNN_USE_NEON
+    return BCNN_MODEL_ISA_NEON;
+#else
+    return BCNN_MODEL_ISA_GENERIC;
+#endif
+}
+
+/* Size in number of floats of the weights of a conv 3x3/s1 in NC4HW4 */
+static size_t bcnn_model_conv3x3_size(bcnn_net *net, bcnn_node *node) {
+    return (size_t)bh_div_up(net->tensors[node->src[0]].c, 4) *
+           bh_div_up(net->tensors[node->dst[0]].c, 4) * CONV3x3_WEIGHT_BLOCK;
+}
+
+/* Max magnitude of a float that does not round to infinity in half
+ * precision */
+#define BCNN_MODEL_F16_MAX 65519.996f
+
+/* Returns the element type of a payload written with 'flags': half precision
+ * if requested and if the values fit in its range */
+static uint32_t bcnn_model_item_dtype(uint32_t flags, const float *data,
+                                      size_t count) {
+    if (!(flags & BCNN_MODEL_FLAG_F16)) {
+        return BCNN_MODEL_DTYPE_F32;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        // Also catches NaN
+        if (!(fabsf(data[i]) <= BCNN_MODEL_F16_MAX)) {
+            return BCNN_MODEL_DTYPE_F32;
+        }
+    }
+    return BCNN_MODEL_DTYPE_F16;
+}
+
+static void bcnn_model_add_item(bcnn_model_item *items, int *num_items,
+                                uint32_t flags, const char *name,
+                                const float *data, int n, int c, int h, int w,
+                                uint32_t layout, uint32_t isa) {
+    if (items != NULL) {
+        bcnn_model_item *item = &items[*num_items];
+        size_t count = (size_t)n * c * h * w;
+        memset(item, 0, sizeof(*item));
+        item->name = name;
+        item->data = data;
+        item->entry.dtype = bcnn_model_item_dtype(flags, data, count);
+        item->entry.size =
+            count * (item->entry.dtype == BCNN_MODEL_DTYPE_F16
+                         ? sizeof(uint16_t)
+                         : sizeof(float));
+        item->entry.n = n;
+        item->entry.c = c;
+        item->entry.h = h;
+        item->entry.w = w;
+        item->entry.layout = layout;
+        item->entry.isa = isa;
+    }
+    (*num_items)++;
+}
+
+/* Returns 1 if the tensor 't_id' is read by a node of the net */
+static int bcnn_model_is_read(bcnn_net *net, int t_id) {
+    for (int i = 0; i < net->num_nodes; ++i) {
+        for (int j = 0; j < net->nodes[i].num_src; ++j) {
+            if (net->nodes[i].src[j] == t_id) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Lists the payloads of the file: the parameter tensors and, for a model
+ * prepared for inference, the conv weights re-ordered for their kernel. The
+ * parameters of the nodes removed by the fusion are not part of a compiled
+ * net. Returns the number of payloads, 'items' can be NULL to count them. */
+static int bcnn_model_list_items(bcnn_net *net, uint32_t flags,
+                                 bcnn_model_item *items) {
+    int num_items = 0;
+    int prepared = (flags & BCNN_MODEL_FLAG_PREPARED);
+    for (int i = 0; i < net->num_tensors; ++i) {
+        bcnn_tensor *t = &net->tensors[i];
+        if (!bcnn_net_is_data_tensor(net, i) && t->data != NULL &&
+            bcnn_tensor_size(t) > 0 &&
+            (!(flags & BCNN_MODEL_FLAG_GRAPH) || bcnn_model_is_read(net, i))) {
+            bcnn_model_add_item(items, &num_items, flags, t->name, t->data,
+                                t->n, t->c, t->h, t->w,
+                                BCNN_MODEL_LAYOUT_PLAIN, BCNN_MODEL_ISA_ANY);
+        }
+    }
+    for (int i = 0; i < net->num_nodes && prepared; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        if (node->type != BCNN_LAYER_CONV2D) {
+            continue;
+        }
+        bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+        const char *name = net->tensors[node->src[1]].name;
+        if (param->weights_workspace != NULL) {
+            bcnn_model_add_item(items, &num_items, flags, name,
+                                param->weights_workspace, 1, 1, 1,
+                                (int)bcnn_model_conv3x3_size(net, node),
+                                BCNN_MODEL_LAYOUT_CONV3X3, BCNN_MODEL_ISA_ANY);
+        }
+        if (param->packed_weights != NULL) {
+            bcnn_model_add_item(
+                items, &num_items, flags, name, param->packed_weights, 1, 1, 1,
+                (int)bcnn_conv_layer_packed_weights_size(net, node),
+                BCNN_MODEL_LAYOUT_GEMM, bcnn_model_host_isa());
+        }
+    }
+    return num_items;
+}
+
+static uint64_t bcnn_model_align(uint64_t offset) {
+    return (offset + BCNN_MODEL_ALIGN - 1) & ~(uint64_t)(BCNN_MODEL_ALIGN - 1);
+}
+
+static int bcnn_model_pad(FILE *fp, uint64_t offset) {
+    static const char zeros[BCNN_MODEL_ALIGN] = {0};
+    long pos = ftell(fp);
+    if (pos < 0 || (uint64_t)pos > offset) {
+        return -1;
+    }
+    size_t n = (size_t)(offset - (uint64_t)pos);
+    return (fwrite(zeros, 1, n, fp) == n) ? 0 : -1;
+}
+
+/* Names and arrays referenced by the graph */
+typedef struct bcnn_model_values {
+    char *data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} bcnn_model_values;
+
+/* Appends 'size' bytes to the values and returns their offset */
+static uint32_t bcnn_model_put_values(bcnn_model_values *v, const void *data,
+                                      size_t size) {
+    size_t offset = v->size;
+    size_t new_size = bh_round_up(offset + size, 4);
+    if (new_size > v->capacity) {
+        size_t capacity = bh_max(bh_max(2 * v->capacity, new_size), 256);
+        char *p = (char *)realloc(v->data, capacity);
+        if (p == NULL) {
+            v->failed = 1;
+            return 0;
+        }
+        v->data = p;
+        v->capacity = capacity;
+    }
+    memcpy(v->data + offset, data, size);
+    memset(v->data + offset + size, 0, new_size - offset - size);
+    v->size = new_size;
+    return (uint32_t)offset;
+}
+
+static uint32_t bcnn_model_put_name(bcnn_model_values *v, const char *name) {
+    return bcnn_model_put_values(v, name, strlen(name) + 1);
+}
+
+/* Fills the description of a node with the arguments of the
+ * 'bcnn_add_*_layer' function that rebuilds it */
+static bcnn_status bcnn_model_describe_node(bcnn_net *net, bcnn_node *node,
+                                            bcnn_model_values *v,
+                                            bcnn_model_node *desc) {
+    memset(desc, 0, sizeof(*desc));
+    desc->type = node->type;
+    desc->num_src = 1;
+    switch (node->type) {
+        case BCNN_LAYER_CONV2D: {
+            bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+            desc->iargs[0] = param->num;
+            desc->iargs[1] = param->size;
+            desc->iargs[2] = param->stride;
+            desc->iargs[3] = param->pad;
+            desc->iargs[4] = param->num_groups;
+            desc->iargs[5] = param->batch_norm;
+            desc->iargs[6] = param->activation;
+            break;
+        }
+        case BCNN_LAYER_TRANSPOSE_CONV2D: {
+            bcnn_deconv_param *param = (bcnn_deconv_param *)node->param;
+            desc->iargs[0] = param->num;
+            desc->iargs[1] = param->size;
+            desc->iargs[2] = param->stride;
+            desc->iargs[3] = param->pad;
+            desc->iargs[4] = param->activation;
+            break;
+        }
+        case BCNN_LAYER_DEPTHWISE_CONV2D: {
+            bcnn_depthwise_conv_param *param =
+                (bcnn_depthwise_conv_param *)node->param;
+            desc->iargs[0] = param->size;
+            desc->iargs[1] = param->stride;
+            desc->iargs[2] = param->pad;
+            desc->iargs[3] = param->activation;
+            break;
+        }
+        case BCNN_LAYER_ACTIVATION:
+            desc->iargs[0] =
+                ((bcnn_activation_param *)node->param)->activation;
+            break;
+        case BCNN_LAYER_FULL_CONNECTED:
+            desc->iargs[0] = net->tensors[node->dst[0]].c;
+            desc->iargs[1] = ((bcnn_fullc_param *)node->param)->activation;
+            break;
+        case BCNN_LAYER_MAXPOOL: {
+            bcnn_maxpool_param *param = (bcnn_maxpool_param *)node->param;
+            desc->iargs[0] = param->size;
+            desc->iargs[1] = param->stride;
+            desc->iargs[2] = param->padding;
+            break;
+        }
+        case BCNN_LAYER_AVGPOOL:
+        case BCNN_LAYER_SOFTMAX:
+        case BCNN_LAYER_BATCHNORM:
+            break;
+        case BCNN_LAYER_DROPOUT:
+            desc->fargs[0] = ((bcnn_dropout_param *)node->param)->dropout_rate;
+            break;
+        case BCNN_LAYER_LRN: {
+            bcnn_lrn_param *param = (bcnn_lrn_param *)node->param;
+            desc->iargs[0] = param->local_size;
+            desc->fargs[0] = param->alpha;
+            desc->fargs[1] = param->beta;
+            desc->fargs[2] = param->k;
+            break;
+        }
+        case BCNN_LAYER_CONCAT:
+            desc->num_src = node->num_src;
+            break;
+        case BCNN_LAYER_ELTWISE:
+            desc->num_src = 2;
+            desc->iargs[0] = ((bcnn_eltwise_param *)node->param)->activation;
+            break;
+        case BCNN_LAYER_UPSAMPLE:
+            desc->iargs[0] = ((bcnn_upsample_param *)node->param)->size;
+            break;
+        case BCNN_LAYER_YOLOV3: {
+            bcnn_yolo_param *param = (bcnn_yolo_param *)node->param;
+            desc->iargs[0] = param->num;
+            desc->iargs[1] = param->classes;
+            desc->iargs[2] = param->coords;
+            desc->iargs[3] = param->total;
+            // The anchors directly follow the mask
+            desc->extra = bcnn_model_put_values(v, param->mask,
+                                                param->num * sizeof(int));
+            bcnn_model_put_values(v, param->biases.data,
+                                  param->total * 2 * sizeof(float));
+            break;
+        }
+        case BCNN_LAYER_COST: {
+            bcnn_cost_param *param = (bcnn_cost_param *)node->param;
+            desc->iargs[0] = param->loss_metric;
+            desc->iargs[1] = param->loss;
+            desc->fargs[0] = param->scale;
+            break;
+        }
+        default:
+            BCNN_ERROR(net->log_ctx, BCNN_INVALID_PARAMETER,
+                       "%s layers can not be written in a compiled net\n",
+                       bcnn_net_node_type2str(node->type));
+    }
+    uint32_t src[BCNN_MODEL_MAX_SRC];
+    BCNN_CHECK_AND_LOG(net->log_ctx, desc->num_src <= BCNN_MODEL_MAX_SRC,
+                       BCNN_INVALID_PARAMETER,
+                       "Too many inputs for a node of a compiled net: %u\n",
+                       desc->num_src);
+    for (uint32_t i = 0; i < desc->num_src; ++i) {
+        src[i] = bcnn_model_put_name(v, net->tensors[node->src[i]].name);
+    }
+    desc->src = bcnn_model_put_values(v, src, desc->num_src * sizeof(uint32_t));
+    desc->dst = bcnn_model_put_name(v, net->tensors[node->dst[0]].name);
+    return BCNN_SUCCESS;
+}
+
+/* Serializes the graph of the net in a buffer laid out as in the file */
+static bcnn_status bcnn_model_build_graph(bcnn_net *net, char **graph,
+                                          size_t *graph_size) {
+    bcnn_model_values v = {0};
+    bcnn_model_graph g = {0};
+    g.w = net->tensors[0].w;
+    g.h = net->tensors[0].h;
+    g.c = net->tensors[0].c;
+    g.batch_size = net->tensors[0].n;
+    g.num_inputs = net->num_inputs - 1;
+    g.num_nodes = net->num_nodes;
+    g.num_outputs = net->num_outputs;
+    size_t tables_size = sizeof(g) + g.num_inputs * sizeof(bcnn_model_input) +
+                         g.num_nodes * sizeof(bcnn_model_node) +
+                         g.num_outputs * sizeof(uint32_t);
+    char *buf = (char *)calloc(1, tables_size);
+    BCNN_CHECK_AND_LOG(net->log_ctx, buf, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    bcnn_model_input *inputs = (bcnn_model_input *)(buf + sizeof(g));
+    bcnn_model_node *nodes = (bcnn_model_node *)(inputs + g.num_inputs);
+    uint32_t *outputs = (uint32_t *)(nodes + g.num_nodes);
+    for (uint32_t i = 0; i < g.num_inputs; ++i) {
+        bcnn_tensor *t = &net->tensors[net->inputs[i + 1]];
+        inputs[i].w = t->w;
+        inputs[i].h = t->h;
+        inputs[i].c = t->c;
+        inputs[i].name = bcnn_model_put_name(&v, t->name);
+    }
+    bcnn_status ret = BCNN_SUCCESS;
+    for (uint32_t i = 0; i < g.num_nodes && ret == BCNN_SUCCESS; ++i) {
+        ret = bcnn_model_describe_node(net, &net->nodes[i], &v, &nodes[i]);
+    }
+    for (uint32_t i = 0; i < g.num_outputs; ++i) {
+        outputs[i] =
+            bcnn_model_put_name(&v, net->tensors[net->outputs[i]].name);
+    }
+    g.values_size = (uint32_t)v.size;
+    memcpy(buf, &g, sizeof(g));
+    char *p = NULL;
+    if (ret == BCNN_SUCCESS && !v.failed) {
+        p = (char *)realloc(buf, tables_size + v.size);
+    }
+    if (p == NULL) {
+        bh_free(buf);
+        bh_free(v.data);
+        if (ret != BCNN_SUCCESS) {
+            return ret;
+        }
+        BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                   "Internal allocation error\n");
+    }
+    memcpy(p + tables_size, v.data, v.size);
+    bh_free(v.data);
+    *graph = p;
+    *graph_size = tables_size + v.size;
+    return BCNN_SUCCESS;
+}
+
+/* Writes a payload, converted to half precision by chunks if needed */
+static int bcnn_model_write_payload(FILE *fp, const bcnn_model_item *item) {
+    if (item->entry.dtype == BCNN_MODEL_DTYPE_F32) {
+        return (fwrite(item->data, 1, item->entry.size, fp) !=
+                item->entry.size);
+    }
+    uint16_t buf[4096];
+    size_t count = item->entry.size / sizeof(uint16_t);
+    for (size_t i = 0; i < count; i += 4096) {
+        size_t n = bh_min(count - i, 4096);
+        bcnn_f32_to_f16(n, item->data + i, buf);
+        if (fwrite(buf, sizeof(uint16_t), n, fp) != n) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int bcnn_model_write(FILE *fp, const bcnn_model_header *header,
+                            const bcnn_model_item *items, int num_items,
+                            const char *graph, size_t graph_size) {
+    int err = (fwrite(header, sizeof(*header), 1, fp) != 1);
+    for (int i = 0; i < num_items && !err; ++i) {
+        err |= (fwrite(&items[i].entry, sizeof(bcnn_model_entry), 1, fp) != 1);
+    }
+    for (int i = 0; i < num_items && !err; ++i) {
+        size_t len = strlen(items[i].name) + 1;
+        err |= (fwrite(items[i].name, 1, len, fp) != len);
+    }
+    for (int i = 0; i < num_items && !err; ++i) {
+        err |= bcnn_model_pad(fp, items[i].entry.offset);
+        err |= bcnn_model_write_payload(fp, &items[i]);
+    }
+    if (graph != NULL && !err) {
+        err |= bcnn_model_pad(fp, header->graph_offset);
+        err |= (fwrite(graph, 1, graph_size, fp) != graph_size);
+    }
+    err |= bcnn_model_pad(fp, header->file_size);
+    return err;
+}
+
+/* Model file ready to be written: the payloads point to the weights */
+typedef struct bcnn_model_file {
+    bcnn_model_header header;
+    bcnn_model_item *items;
+    int num_items;
+    char *graph;
+    size_t graph_size;
+} bcnn_model_file;
+
+static void bcnn_model_free_file(bcnn_model_file *file) {
+    bh_free(file->items);
+    bh_free(file->graph);
+    file->num_items = 0;
+    file->graph_size = 0;
+}
+
+/* Lists the payloads written with 'flags' and computes the layout of the
+ * file */
+static bcnn_status bcnn_model_prepare_file(bcnn_net *net, uint32_t flags,
+                                           bcnn_model_file *file) {
+    if (flags & BCNN_MODEL_FLAG_GRAPH) {
+        BCNN_CHECK_AND_LOG(net->log_ctx,
+                           net->mode == BCNN_MODE_PREDICT &&
+                               net->arena != NULL && net->parent == NULL,
+                           BCNN_INVALID_PARAMETER,
+                           "A compiled net is written from a net compiled in "
+                           "predict mode\n");
+    } else if (flags & BCNN_MODEL_FLAG_PREPARED) {
+        BCNN_CHECK_AND_LOG(net->log_ctx,
+                           net->mode == BCNN_MODE_PREDICT &&
+                               net->arena == NULL && net->parent == NULL,
+                           BCNN_INVALID_PARAMETER,
+                           "A model prepared for inference is written from a "
+                           "net in predict mode, before its compilation\n");
+    }
+#ifdef BCNN_USE_CUDA
+    if (flags & BCNN_MODEL_FLAG_PREPARED) {
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_PARAMETER,
+                   "Models prepared for inference are not supported on "
+                   "GPU\n");
+    }
+#endif
+    memset(file, 0, sizeof(*file));
+    if (flags & BCNN_MODEL_FLAG_GRAPH) {
+        BCNN_CHECK_STATUS(
+            bcnn_model_build_graph(net, &file->graph, &file->graph_size));
+    }
+#ifdef BCNN_USE_CUDA
+    // The weights are brought back from the device before the payloads are
+    // listed: the dtype of each payload is chosen from its host values
+    for (int i = 0; i < net->num_tensors; ++i) {
+        bcnn_tensor *t = &net->tensors[i];
+        if (!bcnn_net_is_data_tensor(net, i) && t->data != NULL &&
+            t->data_gpu != NULL && bcnn_tensor_size(t) > 0) {
+            bcnn_cuda_memcpy_dev2host(t->data_gpu, t->data,
+                                      bcnn_tensor_size(t));
+        }
+    }
+#endif
+    int num_items = bcnn_model_list_items(net, flags, NULL);
+    bcnn_model_item *items = NULL;
+    if (num_items > 0) {
+        items = (bcnn_model_item *)calloc(num_items, sizeof(bcnn_model_item));
+        if (items == NULL) {
+            bcnn_model_free_file(file);
+            BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+        }
+        bcnn_model_list_items(net, flags, items);
+    }
+    file->items = items;
+    file->num_items = num_items;
+    // Layout of the file
+    bcnn_model_header *header = &file->header;
+    memcpy(header->magic, BCNN_MODEL_MAGIC, 4);
+    header->major = BCNN_VERSION_MAJOR;
+    header->minor = BCNN_VERSION_MINOR;
+    header->patch = BCNN_VERSION_PATCH;
+    header->num_tensors = num_items;
+    header->flags = flags;
+    header->table_offset = sizeof(bcnn_model_header);
+    header->strings_offset =
+        header->table_offset + num_items * sizeof(bcnn_model_entry);
+    uint64_t offset = header->strings_offset;
+    for (int i = 0; i < num_items; ++i) {
+        items[i].entry.name = (uint32_t)(offset - header->strings_offset);
+        offset += strlen(items[i].name) + 1;
+    }
+    header->data_offset = bcnn_model_align(offset);
+    offset = header->data_offset;
+    for (int i = 0; i < num_items; ++i) {
+        items[i].entry.offset = offset;
+        offset = bcnn_model_align(offset + items[i].entry.size);
+    }
+    if (file->graph != NULL) {
+        header->graph_offset = offset;
+        offset = bcnn_model_align(offset + file->graph_size);
+    }
+    header->file_size = offset;
+    return BCNN_SUCCESS;
+}
+
+/* Writes the file to 'tmp_filename', then renames it to 'filename'. The file
+ * is never truncated in place: it may be the one mapped by the net being
+ * saved. Returns 0 on success */
+static int bcnn_model_write_file(const bcnn_model_file *file,
+                                 const char *filename,
+                                 const char *tmp_filename) {
+    FILE *fp = fopen(tmp_filename, "wb");
+    if (fp == NULL) {
+        return -1;
+    }
+    int err = bcnn_model_write(fp, &file->header, file->items,
+                               file->num_items, file->graph, file->graph_size);
+    err |= (fclose(fp) != 0);
+    // The rename is atomic: the file is either complete or absent
+    if (!err) {
+#ifdef _WIN32
+        // rename does not replace an existing file on Windows
+        remove(filename);
+#endif
+        err = (rename(tmp_filename, filename) != 0);
+    }
+    if (err) {
+        remove(tmp_filename);
+    }
+    return err;
+}
+
+bcnn_status bcnn_model_save(bcnn_net *net, const char *filename,
+                            uint32_t flags) {
+    size_t len = strlen(filename) + 5;
+    char *tmp_filename = (char *)calloc(len, 1);
+    BCNN_CHECK_AND_LOG(net->log_ctx, tmp_filename, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    snprintf(tmp_filename, len, "%s.tmp", filename);
+    bcnn_model_file file;
+    bcnn_status ret = bcnn_model_prepare_file(net, flags, &file);
+    if (ret != BCNN_SUCCESS) {
+        bh_free(tmp_filename);
+        return ret;
+    }
+    int err = bcnn_model_write_file(&file, filename, tmp_filename);
+    bcnn_model_free_file(&file);
+    bh_free(tmp_filename);
+    BCNN_CHECK_AND_LOG(net->log_ctx, !err, BCNN_INVALID_PARAMETER,
+                       "Could not write model file %s\n", filename);
+    return BCNN_SUCCESS;
+}
+
+/* Checkpoint written in the background. The payloads point to a snapshot of
+ * the weights, kept allocated from one checkpoint to the next. */
+struct bcnn_model_writer {
+    bcnn_model_file file;
+    char *filename;
+    char *tmp_filename; /* The file is written there, then renamed */
+    char *staging;      /* Snapshot of the names and the payloads */
+    size_t staging_size;
+    int pending; /* Set while the writer thread runs */
+    int err;
+    double write_ms;
+#ifdef BCNN_USE_PTHREADS
+    pthread_t thread;
+#endif
+};
+
+static void *bcnn_model_writer_run(void *arg) {
+    bcnn_model_writer *w = (bcnn_model_writer *)arg;
+    bh_timer t = {0};
+    bh_timer_start(&t);
+    w->err = bcnn_model_write_file(&w->file, w->filename, w->tmp_filename);
+    bh_timer_stop(&t);
+    w->write_ms = bh_timer_get_msec(&t);
+    return NULL;
+}
+
+bcnn_status bcnn_model_wait_save(bcnn_net *net) {
+    bcnn_model_writer *w = net->writer;
+    if (w == NULL || !w->pending) {
+        return BCNN_SUCCESS;
+    }
+#ifdef BCNN_USE_PTHREADS
+    pthread_join(w->thread, NULL);
+#endif
+    w->pending = 0;
+    bcnn_model_free_file(&w->file);
+    bcnn_status ret = BCNN_SUCCESS;
+    if (w->err) {
+        bcnn_log(net->log_ctx, BCNN_LOG_ERROR,
+                 "Could not write model file %s\n", w->filename);
+        ret = BCNN_INVALID_PARAMETER;
+    } else {
+        BCNN_INFO(net->log_ctx, "Model %s written in %.2f ms\n", w->filename,
+                  w->write_ms);
+    }
+    bh_free(w->filename);
+    bh_free(w->tmp_filename);
+    return ret;
+}
+
+/* Copies the names and the payloads of the file into the staging buffer of
+ * the writer and points the items to the copy */
+static bcnn_status bcnn_model_snapshot(bcnn_net *net, bcnn_model_writer *w) {
+    bcnn_model_file *file = &w->file;
+    size_t size = 0;
+    for (int i = 0; i < file->num_items; ++i) {
+        bcnn_model_entry *e = &file->items[i].entry;
+        size += bcnn_model_align(strlen(file->items[i].name) + 1);
+        size += bcnn_model_align((size_t)e->n * e->c * e->h * e->w *
+                                 sizeof(float));
+    }
+    if (size > w->staging_size) {
+        bcnn_align_free(w->staging);
+        w->staging_size = 0;
+        w->staging = (char *)bcnn_align_malloc(size, BCNN_MODEL_ALIGN,
+                                               BCNN_ALLOC_WEIGHTS);
+        BCNN_CHECK_AND_LOG(net->log_ctx, w->staging, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+        w->staging_size = size;
+    }
+    char *p = w->staging;
+    for (int i = 0; i < file->num_items; ++i) {
+        bcnn_model_item *item = &file->items[i];
+        size_t len = strlen(item->name) + 1;
+        memcpy(p, item->name, len);
+        item->name = p;
+        p += bcnn_model_align(len);
+        size_t sz = (size_t)item->entry.n * item->entry.c * item->entry.h *
+                    item->entry.w * sizeof(float);
+        memcpy(p, item->data, sz);
+        item->data = (const float *)p;
+        p += bcnn_model_align(sz);
+    }
+    return BCNN_SUCCESS;
+}
+
+bcnn_status bcnn_model_save_async(bcnn_net *net, const char *filename,
+                                  uint32_t flags) {
+    // The failure of the previous checkpoint is logged, it does not prevent
+    // the next one
+    bcnn_model_wait_save(net);
+    if (net->writer == NULL) {
+        net->writer =
+            (bcnn_model_writer *)calloc(1, sizeof(bcnn_model_writer));
+        BCNN_CHECK_AND_LOG(net->log_ctx, net->writer, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+    }
+    bcnn_model_writer *w = net->writer;
+    BCNN_CHECK_STATUS(bcnn_model_prepare_file(net, flags, &w->file));
+    size_t len = strlen(filename) + 5;
+    w->filename = (char *)calloc(len, 1);
+    w->tmp_filename = (char *)calloc(len, 1);
+    bcnn_status ret = BCNN_FAILED_ALLOC;
+    if (w->filename != NULL && w->tmp_filename != NULL) {
+        snprintf(w->filename, len, "%s", filename);
+        snprintf(w->tmp_filename, len, "%s.tmp", filename);
+        ret = bcnn_model_snapshot(net, w);
+    }
+    if (ret == BCNN_SUCCESS) {
+#ifdef BCNN_USE_PTHREADS
+        w->pending =
+            (pthread_create(&w->thread, NULL, bcnn_model_writer_run, w) == 0);
+        ret = w->pending ? BCNN_SUCCESS : BCNN_FAILED_ALLOC;
+#else
+        // Without pthreads, the checkpoint is written before returning
+        bcnn_model_writer_run(w);
+        w->pending = 1;
+        return bcnn_model_wait_save(net);
+#endif
+    }
+    if (ret != BCNN_SUCCESS) {
+        bcnn_model_free_file(&w->file);
+        bh_free(w->filename);
+        bh_free(w->tmp_filename);
+        BCNN_ERROR(net->log_ctx, ret,
+                   "Could not start the writing of model file %s\n",
+                   filename);
+    }
+    return BCNN_SUCCESS;
+}
+
+void bcnn_model_destroy_writer(bcnn_net *net) {
+    if (net->writer == NULL) {
+        return;
+    }
+    bcnn_model_wait_save(net);
+    bcnn_align_free(net->writer->staging);
+    bh_free(net->writer);
+}
+
+/* Maps the whole file in memory. The pages are private: writing to them, e.g.
+ * when folding the batchnorm, does not change the file. Without mmap, the
+ * file is read into an aligned buffer instead. */
+static bcnn_status bcnn_model_map(bcnn_net *net, const char *filename,
+                                  void **data, size_t *size, int *mapped) {
+#ifdef BCNN_HAS_MMAP
+    int fd = open(filename, O_RDONLY);
+    BCNN_CHECK_AND_LOG(net->log_ctx, fd >= 0, BCNN_INVALID_PARAMETER,
+                       "Can not open file %s\n", filename);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(bcnn_model_header)) {
+        close(fd);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                   "Invalid format for model file %s\n", filename);
+    }
+    *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fd, 0);
+    close(fd);
+    BCNN_CHECK_AND_LOG(net->log_ctx, *data != MAP_FAILED, BCNN_FAILED_ALLOC,
+                       "Could not map model file %s\n", filename);
+    *size = (size_t)st.st_size;
+    *mapped = 1;
+#else
+    FILE *fp = fopen(filename, "rb");
+    BCNN_CHECK_AND_LOG(net->log_ctx, fp, BCNN_INVALID_PARAMETER,
+                       "Can not open file %s\n", filename);
+    long sz = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        sz = ftell(fp);
+    }
+    if (sz < (long)sizeof(bcnn_model_header) || fseek(fp, 0, SEEK_SET)) {
+        fclose(fp);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                   "Invalid format for model file %s\n", filename);
+    }
+    *data = bcnn_align_malloc((size_t)sz, BCNN_MODEL_ALIGN, BCNN_ALLOC_WEIGHTS);
+    if (*data == NULL || fread(*data, 1, sz, fp) != (size_t)sz) {
+        fclose(fp);
+        bcnn_align_free(*data);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                   "Could not read model file %s\n", filename);
+    }
+    fclose(fp);
+    *size = (size_t)sz;
+    *mapped = 0;
+#endif
+    return BCNN_SUCCESS;
+}
+
+static void bcnn_model_unmap(void *data, size_t size, int mapped) {
+#ifdef BCNN_HAS_MMAP
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+#endif
+    bcnn_align_free(data);
+}
+
+static const bcnn_model_entry *bcnn_model_find_entry(
+    const bcnn_model_header *header, const char *name, uint32_t layout,
+    uint32_t isa) {
+    const char *base = (const char *)header;
+    const bcnn_model_entry *entries =
+        (const bcnn_model_entry *)(base + header->table_offset);
+    const char *names = base + header->strings_offset;
+    size_t names_size = header->data_offset - header->strings_offset;
+    for (uint32_t i = 0; i < header->num_tensors; ++i) {
+        if (entries[i].layout == layout && entries[i].isa == isa &&
+            entries[i].name < names_size &&
+            strncmp(names + entries[i].name, name,
+                    names_size - entries[i].name) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Checks that the sections of the file lie within the file */
+static int bcnn_model_is_valid(const bcnn_model_header *header, size_t size) {
+    if (memcmp(header->magic, BCNN_MODEL_MAGIC, 4) != 0 ||
+        header->file_size > size ||
+        header->table_offset < sizeof(bcnn_model_header) ||
+        header->strings_offset < header->table_offset ||
+        (header->strings_offset - header->table_offset) /
+                sizeof(bcnn_model_entry) <
+            header->num_tensors ||
+        header->data_offset < header->strings_offset ||
+        header->data_offset > header->file_size) {
+        return 0;
+    }
+    if ((header->flags & BCNN_MODEL_FLAG_GRAPH) &&
+        (header->graph_offset < header->data_offset ||
+         header->graph_offset % BCNN_MODEL_ALIGN != 0 ||
+         header->graph_offset + sizeof(bcnn_model_graph) >
+             header->file_size)) {
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct bcnn_model_loader {
+    const bcnn_model_header *header; /* Start of the file */
+    int zero_copy;
+    int num_mapped;
+    size_t mapped_size;
+    int num_converted; /* Number of half precision payloads */
+    int num_packed;
+} bcnn_model_loader;
+
+/* Points '*dst' into the model file if the loader is zero copy, copies the
+ * payload into '*dst' otherwise ('*dst' is allocated if NULL). A half
+ * precision payload is always converted into '*dst'. */
+static bcnn_status bcnn_model_load_payload(bcnn_net *net,
+                                           bcnn_model_loader *loader,
+                                           const bcnn_model_entry *e,
+                                           const char *name, size_t size,
+                                           float **dst) {
+    const bcnn_model_header *header = loader->header;
+    int is_f16 = (e->dtype == BCNN_MODEL_DTYPE_F16);
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       e->dtype == BCNN_MODEL_DTYPE_F32 || is_f16,
+                       BCNN_INVALID_MODEL,
+                       "Unknown element type %u of tensor %s\n", e->dtype,
+                       name);
+    size_t expected = is_f16 ? size / 2 : size;
+    BCNN_CHECK_AND_LOG(
+        net->log_ctx, e->size == expected, BCNN_INVALID_MODEL,
+        "Inconsistent size of tensor %s: expected %lu but found %lu\n", name,
+        (unsigned long)expected, (unsigned long)e->size);
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       e->offset >= header->data_offset &&
+                           e->offset % BCNN_MODEL_ALIGN == 0 &&
+                           e->offset + e->size <= header->file_size,
+                       BCNN_INVALID_MODEL, "Invalid offset of tensor %s\n",
+                       name);
+    const char *src = (const char *)header + e->offset;
+    if (loader->zero_copy && !is_f16) {
+        bcnn_align_free(*dst);
+        *dst = (float *)src;
+        loader->num_mapped++;
+        loader->mapped_size += size;
+        return BCNN_SUCCESS;
+    }
+    if (*dst == NULL) {
+        *dst = (float *)bcnn_align_malloc(size, align_offset_,
+                                          BCNN_ALLOC_WEIGHTS);
+        BCNN_CHECK_AND_LOG(net->log_ctx, *dst, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+    }
+    if (is_f16) {
+        bcnn_f16_to_f32(size / sizeof(float), (const uint16_t *)src, *dst);
+        loader->num_converted++;
+    } else {
+        memcpy(*dst, src, size);
+    }
+    return BCNN_SUCCESS;
+}
+
+static bcnn_status bcnn_model_load_tensors(bcnn_net *net,
+                                           bcnn_model_loader *loader) {
+    for (int i = 0; i < net->num_tensors; ++i) {
+        bcnn_tensor *t = &net->tensors[i];
+        if (bcnn_net_is_data_tensor(net, i) || t->data == NULL ||
+            bcnn_tensor_size(t) == 0) {
+            continue;
+        }
+        const bcnn_model_entry *e =
+            bcnn_model_find_entry(loader->header, t->name,
+                                  BCNN_MODEL_LAYOUT_PLAIN, BCNN_MODEL_ISA_ANY);
+        BCNN_CHECK_AND_LOG(net->log_ctx, e, BCNN_INVALID_MODEL,
+                           "Tensor %s not found in model file\n", t->name);
+        BCNN_CHECK_AND_LOG(
+            net->log_ctx,
+            e->n == t->n && e->c == t->c && e->h == t->h && e->w == t->w,
+            BCNN_INVALID_MODEL,
+            "Inconsistent shape of tensor %s: expected %d %d %d %d but "
+            "found %d %d %d %d\n",
+            t->name, t->n, t->c, t->h, t->w, e->n, e->c, e->h, e->w);
+        BCNN_CHECK_STATUS(bcnn_model_load_payload(
+            net, loader, e, t->name, bcnn_tensor_size(t) * sizeof(float),
+            &t->data));
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Loads the weights of a conv layer re-ordered for its kernel if the file
+ * holds them for the kernel and instruction set of the build. Sets 'packed'
+ * if so. */
+static bcnn_status bcnn_model_load_packed(bcnn_net *net,
+                                          bcnn_model_loader *loader,
+                                          bcnn_node *node, int *packed) {
+    *packed = 0;
+    if (node->type != BCNN_LAYER_CONV2D) {
+        return BCNN_SUCCESS;
+    }
+    bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+    const char *name = net->tensors[node->src[1]].name;
+    const bcnn_model_entry *e = NULL;
+    if (param->weights_workspace != NULL) {
+        e = bcnn_model_find_entry(loader->header, name,
+                                  BCNN_MODEL_LAYOUT_CONV3X3,
+                                  BCNN_MODEL_ISA_ANY);
+        if (e != NULL) {
+            BCNN_CHECK_STATUS(bcnn_model_load_payload(
+                net, loader, e, name,
+                bcnn_model_conv3x3_size(net, node) * sizeof(float),
+                &param->weights_workspace));
+        }
+    } else if (bcnn_conv_layer_packed_weights_size(net, node) > 0) {
+        e = bcnn_model_find_entry(loader->header, name,
+                                  BCNN_MODEL_LAYOUT_GEMM,
+                                  bcnn_model_host_isa());
+        if (e != NULL) {
+            BCNN_CHECK_STATUS(bcnn_model_load_payload(
+                net, loader, e, name,
+                bcnn_conv_layer_packed_weights_size(net, node) * sizeof(float),
+                &param->packed_weights));
+        }
+    }
+    *packed = (e != NULL);
+    loader->num_packed += *packed;
+    return BCNN_SUCCESS;
+}
+
+static bcnn_status bcnn_model_load_weights(bcnn_net *net,
+                                           bcnn_model_loader *loader) {
+    int prepared = (loader->header->flags & BCNN_MODEL_FLAG_PREPARED);
+    BCNN_CHECK_STATUS(bcnn_model_load_tensors(net, loader));
+    for (int i = 0; i < net->num_nodes; ++i) {
+        int packed = 0;
+        if (prepared) {
+            BCNN_CHECK_STATUS(
+                bcnn_model_load_packed(net, loader, &net->nodes[i], &packed));
+        }
+        BCNN_CHECK_STATUS(
+            bcnn_net_prepare_weights(net, &net->nodes[i], prepared, packed));
+    }
+    return BCNN_SUCCESS;
+}
+
+bcnn_status bcnn_model_load(bcnn_net *net, const char *filename) {
+    void *data = NULL;
+    size_t size = 0;
+    int mapped = 0;
+    BCNN_CHECK_STATUS(bcnn_model_map(net, filename, &data, &size, &mapped));
+    bcnn_model_loader loader = {0};
+    loader.header = (const bcnn_model_header *)data;
+    if (!bcnn_model_is_valid(loader.header, size)) {
+        bcnn_model_unmap(data, size, mapped);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                   "Invalid format for model file %s\n", filename);
+    }
+    BCNN_INFO(net->log_ctx, "BCNN version %d.%d.%d used for model %s\n",
+              loader.header->major, loader.header->minor,
+              loader.header->patch, filename);
+    // The batchnorm of a prepared model is already folded for inference
+    int prepared = (loader.header->flags & BCNN_MODEL_FLAG_PREPARED);
+    int is_cpu_predict = (net->mode == BCNN_MODE_PREDICT);
+#ifdef BCNN_USE_CUDA
+    is_cpu_predict = 0;
+#endif
+    if (prepared && !is_cpu_predict) {
+        bcnn_model_unmap(data, size, mapped);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                   "Model %s is prepared for inference: it can only be "
+                   "loaded in predict mode on CPU\n",
+                   filename);
+    }
+    // The weights of a prepared model are re-ordered for the kernels chosen
+    // at compile time: the net must not be compiled yet
+    if (prepared && net->arena != NULL) {
+        bcnn_model_unmap(data, size, mapped);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_PARAMETER,
+                   "Model %s is prepared for inference: it must be loaded "
+                   "before bcnn_compile_net\n",
+                   filename);
+    }
+    // The weights of a compiled net only match its fused graph
+    if (loader.header->flags & BCNN_MODEL_FLAG_GRAPH) {
+        bcnn_model_unmap(data, size, mapped);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                   "Model %s holds a compiled net: it is loaded with "
+                   "bcnn_load_plan\n",
+                   filename);
+    }
+    // Once compiled, the weights live in the arena and are copied there. The
+    // weights of a model loaded previously are overwritten in place as well.
+    loader.zero_copy = (is_cpu_predict && net->arena == NULL &&
+                        net->parent == NULL && net->model_data == NULL);
+    if (loader.zero_copy) {
+        // The net owns the mapping from now on, even if the loading fails
+        net->model_data = data;
+        net->model_size = size;
+        net->model_mapped = mapped;
+    }
+    bcnn_status ret = bcnn_model_load_weights(net, &loader);
+    if (!loader.zero_copy) {
+        bcnn_model_unmap(data, size, mapped);
+    } else if (ret == BCNN_SUCCESS && loader.num_mapped == 0) {
+        // All the payloads were converted, the mapping is not used anymore
+        bcnn_model_release(net);
+    }
+    if (ret != BCNN_SUCCESS) {
+        return ret;
+    }
+    BCNN_INFO(net->log_ctx,
+              "Model %s loaded succesfully: %d tensors mapped (%.2f MB), %d "
+              "converted from half precision, %d layers with pre-packed "
+              "weights\n",
+              filename, loader.num_mapped, loader.mapped_size / 1048576.0f,
+              loader.num_converted, loader.num_packed);
+    return BCNN_SUCCESS;
+}
+
+/* Returns the null terminated string at 'offset' in the values or NULL */
+static const char *bcnn_model_get_name(const char *values, uint32_t size,
+                                       uint32_t offset) {
+    if (offset >= size ||
+        memchr(values + offset, '\0', size - offset) == NULL) {
+        return NULL;
+    }
+    return values + offset;
+}
+
+/* Returns the array of 'count' 4 bytes elements at 'offset' in the values or
+ * NULL */
+static const void *bcnn_model_get_array(const char *values, uint32_t size,
+                                        uint32_t offset, uint64_t count) {
+    if (offset % 4 != 0 || offset + count * 4 > size) {
+        return NULL;
+    }
+    return values + offset;
+}
+
+/* Adds a node to the net from its description */
+static bcnn_status bcnn_model_add_node(bcnn_net *net,
+                                       const bcnn_model_node *desc,
+                                       const char *values, uint32_t size) {
+    const uint32_t *src_names = (const uint32_t *)bcnn_model_get_array(
+        values, size, desc->src, desc->num_src);
+    const char *dst = bcnn_model_get_name(values, size, desc->dst);
+    char *src[BCNN_MODEL_MAX_SRC] = {NULL};
+    int is_valid = (desc->num_src > 0 && desc->num_src <= BCNN_MODEL_MAX_SRC &&
+                    src_names != NULL && dst != NULL);
+    for (uint32_t i = 0; i < desc->num_src && is_valid; ++i) {
+        src[i] = (char *)bcnn_model_get_name(values, size, src_names[i]);
+        is_valid &= (src[i] != NULL);
+    }
+    BCNN_CHECK_AND_LOG(net->log_ctx, is_valid, BCNN_INVALID_MODEL,
+                       "Invalid node %d in the graph\n", net->num_nodes);
+    // The weights are overwritten by the model: their random init is skipped
+    const int32_t *a = desc->iargs;
+    const float *f = desc->fargs;
+    switch (desc->type) {
+        case BCNN_LAYER_CONV2D:
+            return bcnn_add_convolutional_layer(
+                net, a[0], a[1], a[2], a[3], a[4], a[5], BCNN_FILLER_NONE,
+                (bcnn_activation)a[6], 0, src[0], dst);
+        case BCNN_LAYER_TRANSPOSE_CONV2D:
+            return bcnn_add_deconvolutional_layer(
+                net, a[0], a[1], a[2], a[3], BCNN_FILLER_NONE,
+                (bcnn_activation)a[4], src[0], dst);
+        case BCNN_LAYER_DEPTHWISE_CONV2D:
+            return bcnn_add_depthwise_conv_layer(
+                net, a[0], a[1], a[2], 0, BCNN_FILLER_NONE,
+                (bcnn_activation)a[3], src[0], dst);
+        case BCNN_LAYER_ACTIVATION:
+            return bcnn_add_activation_layer(net, (bcnn_activation)a[0],
+                                             src[0]);
+        case BCNN_LAYER_FULL_CONNECTED:
+            return bcnn_add_fullc_layer(net, a[0], BCNN_FILLER_NONE,
+                                        (bcnn_activation)a[1], 0, src[0],
+                                        dst);
+        case BCNN_LAYER_MAXPOOL:
+            return bcnn_add_maxpool_layer(net, a[0], a[1], (bcnn_padding)a[2],
+                                          src[0], dst);
+        case BCNN_LAYER_AVGPOOL:
+            return bcnn_add_avgpool_layer(net, src[0], dst);
+        case BCNN_LAYER_SOFTMAX:
+            return bcnn_add_softmax_layer(net, src[0], dst);
+        case BCNN_LAYER_DROPOUT:
+            return bcnn_add_dropout_layer(net, f[0], src[0]);
+        case BCNN_LAYER_BATCHNORM:
+            return bcnn_add_batchnorm_layer(net, src[0], dst);
+        case BCNN_LAYER_LRN:
+            return bcnn_add_lrn_layer(net, a[0], f[0], f[1], f[2], src[0],
+                                      dst);
+        case BCNN_LAYER_CONCAT:
+            return bcnn_add_concat_layer(net, desc->num_src, src, dst);
+        case BCNN_LAYER_ELTWISE:
+            BCNN_CHECK_AND_LOG(net->log_ctx, desc->num_src == 2,
+                               BCNN_INVALID_MODEL,
+                               "Invalid node %d in the graph\n",
+                               net->num_nodes);
+            return bcnn_add_eltwise_layer(net, (bcnn_activation)a[0], src[0],
+                                          src[1], dst);
+        case BCNN_LAYER_UPSAMPLE:
+            return bcnn_add_upsample_layer(net, a[0], src[0], dst);
+        case BCNN_LAYER_YOLOV3: {
+            const int *mask = (const int *)bcnn_model_get_array(
+                values, size, desc->extra,
+                (uint64_t)(uint32_t)a[0] + 2 * (uint64_t)(uint32_t)a[3]);
+            BCNN_CHECK_AND_LOG(net->log_ctx, mask, BCNN_INVALID_MODEL,
+                               "Invalid node %d in the graph\n",
+                               net->num_nodes);
+            return bcnn_add_yolo_layer(net, a[0], a[1], a[2], a[3],
+                                       (int *)mask, (float *)(mask + a[0]),
+                                       src[0], dst);
+        }
+        case BCNN_LAYER_COST:
+            return bcnn_add_cost_layer(net, (bcnn_loss)a[1],
+                                       (bcnn_loss_metric)a[0], f[0], src[0],
+                                       "label", dst);
+        default:
+            BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                       "Invalid node %d in the graph: unknown type %u\n",
+                       net->num_nodes, desc->type);
+    }
+}
+
+/* Rebuilds the inputs, the nodes and the outputs of the net */
+static bcnn_status bcnn_model_add_graph(bcnn_net *net,
+                                        const bcnn_model_header *header) {
+    const char *base = (const char *)header + header->graph_offset;
+    bcnn_model_graph g;
+    memcpy(&g, base, sizeof(g));
+    uint64_t tables_size = sizeof(g) +
+                           (uint64_t)g.num_inputs * sizeof(bcnn_model_input) +
+                           (uint64_t)g.num_nodes * sizeof(bcnn_model_node) +
+                           (uint64_t)g.num_outputs * sizeof(uint32_t);
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       tables_size + g.values_size <=
+                           header->file_size - header->graph_offset,
+                       BCNN_INVALID_MODEL, "Invalid size of the graph\n");
+    const bcnn_model_input *inputs =
+        (const bcnn_model_input *)(base + sizeof(g));
+    const bcnn_model_node *nodes =
+        (const bcnn_model_node *)(inputs + g.num_inputs);
+    const uint32_t *outputs = (const uint32_t *)(nodes + g.num_nodes);
+    const char *values = base + tables_size;
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       g.w > 0 && g.h > 0 && g.c > 0 && g.batch_size > 0,
+                       BCNN_INVALID_MODEL,
+                       "Invalid input shape %dx%dx%d batch size %d\n", g.w,
+                       g.h, g.c, g.batch_size);
+    bcnn_set_input_shape(net, g.w, g.h, g.c, g.batch_size);
+    for (uint32_t i = 0; i < g.num_inputs; ++i) {
+        const char *name =
+            bcnn_model_get_name(values, g.values_size, inputs[i].name);
+        BCNN_CHECK_AND_LOG(net->log_ctx, name, BCNN_INVALID_MODEL,
+                           "Invalid input %u in the graph\n", i + 1);
+        BCNN_CHECK_STATUS(
+            bcnn_add_input(net, inputs[i].w, inputs[i].h, inputs[i].c, name));
+    }
+    for (uint32_t i = 0; i < g.num_nodes; ++i) {
+        bcnn_status ret =
+            bcnn_model_add_node(net, &nodes[i], values, g.values_size);
+        if (ret != BCNN_SUCCESS) {
+            return ret;
+        }
+    }
+    if (g.num_outputs == 0) {
+        return BCNN_SUCCESS;
+    }
+    const char **names = (const char **)calloc(g.num_outputs, sizeof(char *));
+    BCNN_CHECK_AND_LOG(net->log_ctx, names, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    int is_valid = 1;
+    for (uint32_t i = 0; i < g.num_outputs && is_valid; ++i) {
+        names[i] = bcnn_model_get_name(values, g.values_size, outputs[i]);
+        is_valid &= (names[i] != NULL);
+    }
+    bcnn_status ret = BCNN_INVALID_MODEL;
+    if (is_valid) {
+        ret = bcnn_set_outputs(net, (int)g.num_outputs, names);
+    }
+    bh_free(names);
+    return ret;
+}
+
+bcnn_status bcnn_model_load_graph(bcnn_net *net, const char *filename) {
+    int is_cpu_predict = (net->mode == BCNN_MODE_PREDICT);
+#ifdef BCNN_USE_CUDA
+    is_cpu_predict = 0;
+#endif
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       is_cpu_predict && net->num_nodes == 0 &&
+                           net->parent == NULL && net->model_data == NULL,
+                       BCNN_INVALID_PARAMETER,
+                       "A compiled net is loaded into an empty net in predict "
+                       "mode on CPU\n");
+    void *data = NULL;
+    size_t size = 0;
+    int mapped = 0;
+    BCNN_CHECK_STATUS(bcnn_model_map(net, filename, &data, &size, &mapped));
+    bcnn_model_loader loader = {0};
+    loader.header = (const bcnn_model_header *)data;
+    if (!bcnn_model_is_valid(loader.header, size) ||
+        !(loader.header->flags & BCNN_MODEL_FLAG_GRAPH)) {
+        bcnn_model_unmap(data, size, mapped);
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_MODEL,
+                   "Invalid format for compiled net %s\n", filename);
+    }
+    BCNN_INFO(net->log_ctx, "BCNN version %d.%d.%d used for model %s\n",
+              loader.header->major, loader.header->minor,
+              loader.header->patch, filename);
+    // The net owns the mapping from now on, even if the loading fails
+    net->model_data = data;
+    net->model_size = size;
+    net->model_mapped = mapped;
+    loader.zero_copy = 1;
+    BCNN_CHECK_STATUS(bcnn_model_add_graph(net, loader.header));
+    BCNN_CHECK_STATUS(bcnn_model_load_weights(net, &loader));
+    BCNN_INFO(net->log_ctx,
+              "Compiled net %s loaded succesfully: %d nodes, %d tensors "
+              "mapped (%.2f MB), %d converted from half precision, %d layers "
+              "with pre-packed weights\n",
+              filename, net->num_nodes, loader.num_mapped,
+              loader.mapped_size / 1048576.0f, loader.num_converted,
+              loader.num_packed);
+    return BCNN_SUCCESS;
+}
+
+int bcnn_model_owns_buffer(bcnn_net *net, const void *buf) {
+    const char *data = (const char *)net->model_data;
+    return (data != NULL && (const char *)buf >= data &&
+            (const char *)buf < data + net->model_size);
+}
+
+void bcnn_model_release(bcnn_net *net) {
+    if (net->model_data == NULL) {
+        return;
+    }
+    for (int i = 0; i < net->num_tensors; ++i) {
+        if (bcnn_model_owns_buffer(net, net->tensors[i].data)) {
+            net->tensors[i].data = NULL;
+        }
+    }
+    for (int i = 0; i < net->num_nodes; ++i) {
+        if (net->nodes[i].type != BCNN_LAYER_CONV2D) {
+            continue;
+        }
+        bcnn_conv_param *param = (bcnn_conv_param *)net->nodes[i].param;
+        if (bcnn_model_owns_buffer(net, param->weights_workspace)) {
+            param->weights_workspace = NULL;
+        }
+        if (bcnn_model_owns_buffer(net, param->packed_weights)) {
+            param->packed_weights = NULL;
+        }
+    }
+    bcnn_model_unmap(net->model_data, net->model_size, net->model_mapped);
+    net->model_data = NULL;
+    net->model_size = 0;
+    net->model_mapped = 0;
+}
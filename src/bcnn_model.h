@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BCNN_MODEL_H
+#define BCNN_MODEL_H
+
+#include <stdint.h>
+
+#include <bcnn/bcnn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Model file format v2, written for the '.bcnnmodel' extension. All the
+ * fields are little endian:
+ * - a 64 bytes header,
+ * - the table of the payloads, a tensor may have several payloads in
+ *   different layouts,
+ * - the names of the tensors, null terminated,
+ * - the payloads of the tensors, each one aligned on 64 bytes,
+ * - for a compiled net, the description of its graph, aligned on 64 bytes.
+ * The file is memory mapped at load time so that the weights can be used
+ * straight from the page cache.
+ */
+
+#define BCNN_MODEL_MAGIC "\x42\x43\x4E\x32"
+
+/* Alignment of the payloads in the file */
+#define BCNN_MODEL_ALIGN 64
+
+/* Element type of a payload */
+typedef enum {
+    BCNN_MODEL_DTYPE_F32 = 0,
+    BCNN_MODEL_DTYPE_F16 = 1 /* IEEE half precision */
+} bcnn_model_dtype;
+
+/* Order of the elements of a payload */
+typedef enum {
+    BCNN_MODEL_LAYOUT_PLAIN = 0,   /* Tensor as held by the net */
+    BCNN_MODEL_LAYOUT_CONV3X3 = 1, /* Winograd transformed weights of a conv
+                                      3x3/s1 in NC4HW4 blocks */
+    BCNN_MODEL_LAYOUT_GEMM = 2     /* Conv weights packed in GEMM panels */
+} bcnn_model_layout;
+
+/* Instruction set a payload is laid out for */
+typedef enum {
+    BCNN_MODEL_ISA_ANY = 0,     /* Layout does not depend on the build */
+    BCNN_MODEL_ISA_GENERIC = 1, /* Generic / AVX kernels: 8x8 GEMM micro
+                                   kernel */
+    BCNN_MODEL_ISA_NEON = 2     /* 32 bits Neon kernels: 4x4 GEMM micro
+                                   kernel */
+} bcnn_model_isa;
+
+/* The weights are stored as used for inference: the batchnorm statistics are
+ * folded into the scales and biases and the conv weights are also stored
+ * re-ordered for their kernel */
+#define BCNN_MODEL_FLAG_PREPARED 1
+/* The file holds a compiled net: the graph after the fusion of the layers and
+ * its prepared weights. The graph is rebuilt from the file, no config is
+ * needed. */
+#define BCNN_MODEL_FLAG_GRAPH 2
+/* The payloads are written in half precision, except the ones holding values
+ * out of its range */
+#define BCNN_MODEL_FLAG_F16 4
+
+typedef struct bcnn_model_header {
+    char magic[4];
+    uint32_t major; /* Version of the library that wrote the file */
+    uint32_t minor;
+    uint32_t patch;
+    uint32_t num_tensors;
+    uint32_t flags; /* BCNN_MODEL_FLAG_* */
+    uint64_t table_offset;   /* Offset of the tensor table */
+    uint64_t strings_offset; /* Offset of the tensor names */
+    uint64_t data_offset;    /* Offset of the first payload */
+    uint64_t file_size;
+    uint64_t graph_offset; /* Offset of the graph, 0 if none */
+} bcnn_model_header;
+
+typedef struct bcnn_model_entry {
+    uint64_t offset; /* Offset of the payload from the start of the file */
+    uint64_t size;   /* Size of the payload in bytes */
+    int32_t n;
+    int32_t c;
+    int32_t h;
+    int32_t w;
+    uint32_t dtype;  /* One of bcnn_model_dtype */
+    uint32_t name;   /* Offset of the name in the names section */
+    uint32_t layout; /* One of bcnn_model_layout */
+    uint32_t isa;    /* One of bcnn_model_isa */
+} bcnn_model_entry;
+
+/* Graph of a compiled net. It is followed by:
+ * - the table of the additional inputs,
+ * - the table of the nodes, in execution order,
+ * - the offsets of the names of the outputs requested by 'bcnn_set_outputs',
+ * - the values: names and arrays referenced by the tables, each one aligned
+ *   on 4 bytes. */
+typedef struct bcnn_model_graph {
+    int32_t w; /* Shape of the input of the net */
+    int32_t h;
+    int32_t c;
+    int32_t batch_size;
+    uint32_t num_inputs; /* Number of inputs added by 'bcnn_add_input' */
+    uint32_t num_nodes;
+    uint32_t num_outputs;
+    uint32_t values_size; /* Size in bytes of the values */
+} bcnn_model_graph;
+
+typedef struct bcnn_model_input {
+    int32_t w;
+    int32_t h;
+    int32_t c;
+    uint32_t name; /* Offset of the name in the values */
+} bcnn_model_input;
+
+/* Node of the graph, replayed with the 'bcnn_add_*_layer' function of its
+ * type. The meaning of the arguments depends on the type. */
+typedef struct bcnn_model_node {
+    uint32_t type;    /* One of bcnn_layer_type */
+    uint32_t num_src; /* Number of src read from other nodes or inputs */
+    uint32_t src;     /* Offset in the values of the offsets of the src names */
+    uint32_t dst;     /* Offset of the dst name in the values */
+    uint32_t extra;   /* Offset in the values of the yolo mask and anchors */
+    int32_t iargs[7];
+    float fargs[4];
+} bcnn_model_node;
+
+/* Writes the parameters of the net in format v2. 'flags' is a combination of
+ * BCNN_MODEL_FLAG_*: with BCNN_MODEL_FLAG_PREPARED, the weights are written
+ * as used by the inference kernels of the build; with BCNN_MODEL_FLAG_GRAPH,
+ * the compiled net is written as well; with BCNN_MODEL_FLAG_F16, the weights
+ * are written in half precision. */
+bcnn_status bcnn_model_save(bcnn_net *net, const char *filename,
+                            uint32_t flags);
+
+/* Snapshots the parameters of the net and writes them in format v2 on a
+ * background thread, to a temporary file renamed to 'filename' once complete.
+ * Waits for the previous checkpoint first. */
+bcnn_status bcnn_model_save_async(bcnn_net *net, const char *filename,
+                                  uint32_t flags);
+
+/* Waits for the checkpoint being written, returns BCNN_INVALID_PARAMETER if
+ * it could not be written */
+bcnn_status bcnn_model_wait_save(bcnn_net *net);
+
+/* Waits for the checkpoint being written and frees the snapshot */
+void bcnn_model_destroy_writer(bcnn_net *net);
+
+/* Loads the parameters of the net from a file in format v2. In predict mode,
+ * if the net is not compiled yet, the parameter tensors and the re-ordered
+ * conv weights point into the mapping of the file instead of getting a copy
+ * of the weights. The half precision payloads are always converted into the
+ * buffers of the net. */
+bcnn_status bcnn_model_load(bcnn_net *net, const char *filename);
+
+/* Rebuilds the graph of a net from a file written with BCNN_MODEL_FLAG_GRAPH
+ * and loads its weights. The net must be empty and in predict mode. */
+bcnn_status bcnn_model_load_graph(bcnn_net *net, const char *filename);
+
+/* Returns 1 if the buffer lies in the model file mapped by the net */
+int bcnn_model_owns_buffer(bcnn_net *net, const void *buf);
+
+/* Unmaps the model file. The data of the tensors pointing into the mapping is
+ * reset to NULL. */
+void bcnn_model_release(bcnn_net *net);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BCNN_MODEL_H
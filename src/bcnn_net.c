@@ -21,8 +21,6 @@
  */
 
 #include <math.h>
-#include <sys/syscall.h>
-#include <unistd.h>
 
 /* include bh helpers */
 #include <bh/bh_ini.h>
@@ -34,6 +32,8 @@
 #include <bip/bip.h>
 
 #include "bcnn_activation_layer.h"
+#include "bcnn_allocator.h"
+#include "bcnn_async.h"
 #include "bcnn_avgpool_layer.h"
 #include "bcnn_batchnorm_layer.h"
 #include "bcnn_concat_layer.h"
@@ -48,9 +48,13 @@
 #include "bcnn_lrn_layer.h"
 #include "bcnn_mat.h"
 #include "bcnn_maxpool_layer.h"
+#include "bcnn_model.h"
 #include "bcnn_net.h"
+#include "bcnn_numa.h"
+#include "bcnn_profiler.h"
 #include "bcnn_softmax_layer.h"
 #include "bcnn_tensor.h"
+#include "bcnn_thread_pool.h"
 #include "bcnn_upsample_layer.h"
 #include "bcnn_utils.h"
 #include "bcnn_yolo.h"
@@ -58,6 +62,12 @@
 // PROFILE
 #include <bh/bh_timer.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <unistd.h>
+#define BCNN_HAS_PREAD
+#endif
+
 bcnn_status bcnn_init_net(bcnn_net **net, bcnn_mode mode) {
     bcnn_net *p_net = (bcnn_net *)calloc(1, sizeof(bcnn_net));
     if (p_net == NULL) {
@@ -83,6 +93,8 @@ bcnn_status bcnn_init_net(bcnn_net **net, bcnn_mode mode) {
     // Allocate input index array
     p_net->num_inputs = 1;
     p_net->inputs = (int *)calloc(1, sizeof(int));  // 1st input index is 0
+    p_net->num_lanes = 1;
+    p_net->numa_node = -1;
 
 #ifdef BCNN_USE_CUDA
     BCNN_CHECK_STATUS(bcnn_net_create_cuda_context(p_net));
@@ -95,6 +107,7 @@ bcnn_status bcnn_init_net(bcnn_net **net, bcnn_mode mode) {
 #ifdef BCNN_USE_OPENMP
     p_net->num_threads = bcnn_omp_get_num_threads();
 #endif
+    BCNN_CHECK_STATUS(bcnn_thread_pool_acquire(p_net->num_threads));
     *net = p_net;
     return BCNN_SUCCESS;
 }
@@ -112,17 +125,47 @@ static inline void bcnn_free_node(bcnn_node *node) {
     bh_free(node->param);
 }
 
-static void bcnn_free_workload(bcnn_net *net) {
+static bcnn_status bcnn_net_release_arena(bcnn_net *net, int restore);
+static bcnn_status bcnn_net_resize_arena(bcnn_net *net);
+static bcnn_status bcnn_net_collect_mem_blocks(bcnn_net *net);
+static bcnn_status bcnn_net_grow_buffers(bcnn_net *net, bcnn_mem_block *blocks,
+                                         int num_blocks);
+static void bcnn_net_share_workspace(bcnn_net *net);
+static void bcnn_free_context(bcnn_net *ctx);
+static void bcnn_context_release_pool(bcnn_net *ctx);
+static void bcnn_net_free_plans(bcnn_net *net);
+
+static bcnn_status bcnn_free_workload(bcnn_net *net) {
+    // Buffers are given back their own memory as they may still be needed
+    // after a new compilation
+    bcnn_status ret = bcnn_net_release_arena(net, 1);
     bcnn_tensor_free(&net->tensors[0]);
 #ifdef BCNN_USE_CUDA
     bcnn_cuda_context *cuda_ctx = (bcnn_cuda_context *)net->cuda_ctx;
     bcnn_cuda_free(cuda_ctx->workspace_gpu);
 #endif
+    return ret;
 }
 
 static void bcnn_free_net(bcnn_net *net) {
+    bcnn_async_destroy(net);
+    bcnn_model_destroy_writer(net);
+    bcnn_profiler_destroy(net);
+    bcnn_net_free_plans(net);
+    if (net->parent != NULL) {
+        bcnn_free_context(net);
+        bcnn_context_release_pool(net);
+        return;
+    }
+    // Release arena without copying back the buffers content
+    bcnn_net_release_arena(net, 0);
     // Free workload
     bcnn_free_workload(net);
+    bcnn_align_free(net->workspace);
+    bh_free(net->schedule);
+    bh_free(net->level_offsets);
+    // The buffers mapped onto the model file are not owned
+    bcnn_model_release(net);
     // Destroy nodes
     for (int i = 0; i < net->num_nodes; ++i) {
         if (net->nodes[i].release_param) {
@@ -141,14 +184,16 @@ static void bcnn_free_net(bcnn_net *net) {
     bh_free(net->learner);
     // Free input indexes array
     bh_free(net->inputs);
+    bh_free(net->outputs);
 #ifdef BCNN_USE_CUDA
     // Free cuda context
     bh_free(net->cuda_ctx);
 #endif
 #ifndef BCNN_USE_BLAS
     // Free gemm context
-    bh_align_free(net->gemm_ctx);
+    bcnn_align_free(net->gemm_ctx);
 #endif
+    bcnn_thread_pool_release();
 }
 
 void bcnn_end_net(bcnn_net **net) {
@@ -163,7 +208,11 @@ void bcnn_set_log_context(bcnn_net *net, bcnn_log_callback fct,
 }
 
 bcnn_status bcnn_net_create_gemm_context(bcnn_net *net) {
-    net->gemm_ctx = bh_align_calloc(sizeof(bcnn_gemm_context), 32);
+    // One context per concurrency lane
+    bcnn_align_free(net->gemm_ctx);
+    net->gemm_ctx = bcnn_align_calloc(
+        bh_max(net->num_lanes, 1) * sizeof(bcnn_gemm_context), 32,
+        BCNN_ALLOC_WORKSPACE);
     if (net->gemm_ctx) {
         return BCNN_SUCCESS;
     } else {
@@ -171,6 +220,14 @@ bcnn_status bcnn_net_create_gemm_context(bcnn_net *net) {
     }
 }
 
+void *bcnn_net_get_gemm_context(bcnn_net *net, bcnn_node *node) {
+#ifndef BCNN_USE_BLAS
+    return (bcnn_gemm_context *)net->gemm_ctx + node->lane;
+#else
+    return NULL;
+#endif
+}
+
 #ifdef BCNN_USE_CUDA
 bcnn_status bcnn_net_create_cuda_context(bcnn_net *net) {
     net->cuda_ctx = calloc(1, sizeof(bcnn_cuda_context));
@@ -182,53 +239,15 @@ bcnn_status bcnn_net_create_cuda_context(bcnn_net *net) {
 }
 #endif
 
-static int bcnn_set_thread_cpu_affinity(const int *cpu_ids, int num_cpus) {
-#define CPU_SETSIZE 1024
-#define __NCPUBITS (8 * sizeof(unsigned long))
-    typedef struct {
-        unsigned long __bits[CPU_SETSIZE / __NCPUBITS];
-    } cpu_set_t;
-
-#define CPU_SET(cpu, cpusetp) \
-    ((cpusetp)->__bits[(cpu) / __NCPUBITS] |= (1UL << ((cpu) % __NCPUBITS)))
-
-    //#define CPU_ZERO(cpusetp) memset((cpusetp), 0, sizeof(cpu_set_t))
-
-#ifdef __GLIBC__
-    pid_t pid = syscall(SYS_gettid);
-#else
-    pid_t pid = gettid();
-#endif
-    cpu_set_t mask;
-    memset(&mask, 0, sizeof(cpu_set_t));
-    for (int i = 0; i < num_cpus; i++) {
-        CPU_SET(cpu_ids[i], &mask);
-    }
-    int syscallret = syscall(__NR_sched_setaffinity, pid, sizeof(mask), &mask);
-    if (syscallret) {
-        return -1;
-    }
-    return 0;
-}
-
 bcnn_status bcnn_set_num_threads(bcnn_net *net, int num_threads,
                                  const int *cpu_ids) {
     net->num_threads = 1;
-    int ret = 0;
 #ifdef BCNN_USE_OPENMP
     net->num_threads = bh_clamp(num_threads, 1, omp_get_max_threads());
-    omp_set_num_threads(net->num_threads);
-    if (cpu_ids) {
-#pragma omp parallel for num_threads(net->num_threads)
-        for (int i = 0; i < net->num_threads; ++i) {
-            ret += bcnn_set_thread_cpu_affinity(cpu_ids, net->num_threads);
-        }
-    }
 #endif
-    if (ret != 0) {
-        return BCNN_INVALID_PARAMETER;
-    }
-    return BCNN_SUCCESS;
+    // The workers are respawned once here rather than forked for each loop.
+    // The pool is process-wide: the other nets share the new workers
+    return bcnn_thread_pool_set_num_threads(net->num_threads, cpu_ids);
 }
 
 int bcnn_get_num_threads(bcnn_net *net) { return net->num_threads; }
@@ -286,76 +305,1682 @@ void bcnn_set_input_shape(bcnn_net *net, int input_width, int input_height,
 
 bcnn_status bcnn_resize_net(bcnn_net *net, int w, int h, int c,
                             int need_realloc) {
-    bcnn_set_input_shape(net, w, h, c, 1);
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->parent == NULL,
+                       BCNN_INVALID_PARAMETER,
+                       "An execution context can not be resized\n");
+    int num_contexts = bcnn_atomic_load(&net->num_contexts);
+    BCNN_CHECK_AND_LOG(net->log_ctx, num_contexts == 0, BCNN_INVALID_PARAMETER,
+                       "Can not resize the net: %d execution contexts still "
+                       "share its buffers\n",
+                       num_contexts);
+    bcnn_async_destroy(net);
+    bcnn_net_free_plans(net);
+    // Sizes of the buffers before the resize
+    bcnn_mem_block *blocks = NULL;
+    int num_blocks = 0;
+    if (net->arena == NULL && need_realloc) {
+        BCNN_CHECK_STATUS(bcnn_net_collect_mem_blocks(net));
+        blocks = net->mem_blocks;
+        num_blocks = net->num_mem_blocks;
+        net->mem_blocks = NULL;
+        net->num_mem_blocks = 0;
+    }
+    bcnn_set_input_shape(net, w, h, c, net->batch_size);
+    net->workspace_size = 0;
+    bcnn_status ret = BCNN_SUCCESS;
+    for (int i = 0; i < net->num_nodes && ret == BCNN_SUCCESS; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        if (node->infer_shape != NULL) {
+            ret = node->infer_shape(net, node);
+        }
+    }
+    if (ret == BCNN_SUCCESS) {
+        if (net->arena != NULL) {
+            ret = bcnn_net_resize_arena(net);
+        } else if (need_realloc) {
+            ret = bcnn_net_grow_buffers(net, blocks, num_blocks);
+        }
+    }
+    bh_free(blocks);
+    bcnn_net_share_workspace(net);
+    return ret;
+}
+
+/* Re-orders the weights of a conv layer for the kernel it runs: layout NC4HW4
+ * for conv 3x3/s1, GEMM panels otherwise. If 'packed' is set, the weights were
+ * loaded already re-ordered and only the per-channel parameters are copied. */
+static bcnn_status bcnn_net_pack_conv_weights(bcnn_net *net, bcnn_node *node,
+                                              int packed) {
+    bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+    if (!packed) {
+        BCNN_CHECK_STATUS(bcnn_conv_layer_pack_weights(net, node));
+    }
+    if (param->weights_workspace == NULL) {
+        return BCNN_SUCCESS;
+    }
+    bcnn_tensor *w = &net->tensors[node->src[1]];
+    bcnn_tensor *b = &net->tensors[node->src[2]];
+    if (!packed) {
+        bcnn_conv3x3_convert_weights(w->data, param->weights_workspace,
+                                     net->tensors[node->src[0]].c,
+                                     net->tensors[node->dst[0]].c);
+    }
+    memcpy(param->biases_workspace, b->data,
+           bcnn_tensor_size(b) * sizeof(float));
+    if (param->batch_norm == 1) {
+        bcnn_tensor *s = &net->tensors[node->src[5]];
+        memcpy(param->scales_workspace, s->data,
+               bcnn_tensor_size(s) * sizeof(float));
+    }
+    if (param->activation == BCNN_ACT_PRELU) {
+        int tid = 3 + 3 * (param->batch_norm);
+        bcnn_tensor *slopes = &net->tensors[node->src[tid]];
+        memcpy(param->slopes_workspace, slopes->data,
+               bcnn_tensor_size(slopes) * sizeof(float));
+    }
+    return BCNN_SUCCESS;
+}
+
+const char *bcnn_net_node_type2str(bcnn_layer_type type) {
+    switch (type) {
+        case BCNN_LAYER_CONV2D:
+            return "Conv2d";
+        case BCNN_LAYER_TRANSPOSE_CONV2D:
+            return "Deconv2d";
+        case BCNN_LAYER_DEPTHWISE_CONV2D:
+            return "Depthwise-conv2d";
+        case BCNN_LAYER_ACTIVATION:
+            return "Activation";
+        case BCNN_LAYER_FULL_CONNECTED:
+            return "Dense";
+        case BCNN_LAYER_MAXPOOL:
+            return "Maxpool";
+        case BCNN_LAYER_AVGPOOL:
+            return "Avgpool";
+        case BCNN_LAYER_SOFTMAX:
+            return "Softmax";
+        case BCNN_LAYER_DROPOUT:
+            return "Dropout";
+        case BCNN_LAYER_BATCHNORM:
+            return "Batchnorm";
+        case BCNN_LAYER_LRN:
+            return "LRN";
+        case BCNN_LAYER_CONCAT:
+            return "Concat";
+        case BCNN_LAYER_ELTWISE:
+            return "Eltwise";
+        case BCNN_LAYER_UPSAMPLE:
+            return "Upsample";
+        case BCNN_LAYER_YOLOV3:
+            return "Yolo";
+        case BCNN_LAYER_RESHAPE:
+            return "Reshape";
+        case BCNN_LAYER_COST:
+            return "Cost";
+        default:
+            return "Unknown";
+    }
+}
+
+/* Returns the number of nodes in [begin, end) that read the tensor 't_id',
+ * the node 'except' being ignored */
+static int bcnn_net_count_readers(bcnn_net *net, int t_id, int begin, int end,
+                                  int except) {
+    int n = 0;
+    for (int i = begin; i < end; ++i) {
+        if (i == except) {
+            continue;
+        }
+        for (int j = 0; j < net->nodes[i].num_src; ++j) {
+            if (net->nodes[i].src[j] == t_id) {
+                n++;
+                break;
+            }
+        }
+    }
+    return n;
+}
+
+/* Returns the index of the last node before 'end' that writes the tensor
+ * 't_id' or -1 if none */
+static int bcnn_net_find_producer(bcnn_net *net, int t_id, int end) {
+    for (int i = end - 1; i >= 0; --i) {
+        for (int j = 0; j < net->nodes[i].num_dst; ++j) {
+            if (net->nodes[i].dst[j] == t_id) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Returns 1 if the tensor 't_id' has been requested by 'bcnn_set_outputs' */
+static int bcnn_net_is_output(bcnn_net *net, int t_id) {
+    for (int i = 0; i < net->num_outputs; ++i) {
+        if (net->outputs[i] == t_id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int bcnn_net_holds_output(bcnn_net *net, int t_id) {
+    if (net->num_outputs > 0) {
+        return bcnn_net_is_output(net, t_id);
+    }
     for (int i = 0; i < net->num_nodes; ++i) {
-        if (net->nodes[i].type == BCNN_LAYER_CONV2D) {
-            bcnn_conv_param *param = (bcnn_conv_param *)(net->nodes[i].param);
-            bcnn_tensor_set_shape(&net->tensors[net->nodes[i].dst[0]],
-                                  net->tensors[net->nodes[i].src[0]].n,
-                                  param->num,
-                                  (net->tensors[net->nodes[i].src[0]].h +
-                                   2 * param->pad - param->size) /
-                                          param->stride +
-                                      1,
-                                  (net->tensors[net->nodes[i].src[0]].w +
-                                   2 * param->pad - param->size) /
-                                          param->stride +
-                                      1,
-                                  1);
-            if (need_realloc) {
-                BCNN_CHECK_STATUS(bcnn_tensor_allocate(
-                    &net->tensors[net->nodes[i].dst[0]], net->mode));
+        bcnn_node *node = &net->nodes[i];
+        for (int j = 0; j < node->num_dst; ++j) {
+            if (node->dst[j] == t_id && node->type == BCNN_LAYER_COST &&
+                net->mode == BCNN_MODE_PREDICT) {
+                return 0;
+            }
+        }
+        for (int j = 0; j < node->num_src; ++j) {
+            int inplace = 0;
+            for (int k = 0; k < node->num_dst; ++k) {
+                inplace |= (node->dst[k] == node->src[j]);
+            }
+            // A tensor read by another node may share its memory
+            if (node->src[j] == t_id && !inplace) {
+                return 0;
             }
-        } else if (net->nodes[i].type == BCNN_LAYER_MAXPOOL) {
-            bcnn_maxpool_param *param =
-                (bcnn_maxpool_param *)(net->nodes[i].param);
-            bcnn_tensor_set_shape(
-                &net->tensors[net->nodes[i].dst[0]],
-                net->tensors[net->nodes[i].src[0]].n,
-                net->tensors[net->nodes[i].src[0]].c,
-                (net->tensors[net->nodes[i].src[0]].h - 1) / param->stride + 1,
-                (net->tensors[net->nodes[i].src[0]].w - 1) / param->stride + 1,
-                1);
-            if (need_realloc) {
-                BCNN_CHECK_STATUS(bcnn_tensor_allocate(
-                    &net->tensors[net->nodes[i].dst[0]], net->mode));
+        }
+    }
+    return 1;
+}
+
+/* Returns a pointer to the activation field of a node that applies its own
+ * activation or NULL */
+static bcnn_activation *bcnn_net_node_activation(bcnn_node *node) {
+    switch (node->type) {
+        case BCNN_LAYER_CONV2D:
+            return &((bcnn_conv_param *)node->param)->activation;
+        case BCNN_LAYER_TRANSPOSE_CONV2D:
+            return &((bcnn_deconv_param *)node->param)->activation;
+        case BCNN_LAYER_DEPTHWISE_CONV2D:
+            return &((bcnn_depthwise_conv_param *)node->param)->activation;
+        case BCNN_LAYER_FULL_CONNECTED:
+            return &((bcnn_fullc_param *)node->param)->activation;
+        case BCNN_LAYER_ELTWISE:
+            return &((bcnn_eltwise_param *)node->param)->activation;
+        default:
+            return NULL;
+    }
+}
+
+static void bcnn_net_remove_node(bcnn_net *net, int index) {
+    if (net->nodes[index].release_param) {
+        net->nodes[index].release_param(&net->nodes[index]);
+    }
+    bcnn_free_node(&net->nodes[index]);
+    memmove(&net->nodes[index], &net->nodes[index + 1],
+            (net->num_nodes - index - 1) * sizeof(bcnn_node));
+    net->num_nodes--;
+}
+
+/* Folds the scales and biases of a standalone batchnorm (mean and variance
+ * are already merged into them in predict mode) into the producer of its
+ * input: dst = scales * (W * src + b) + biases */
+static void bcnn_net_fold_batchnorm(bcnn_net *net, bcnn_node *producer,
+                                    bcnn_node *bn) {
+    float *bn_scales = net->tensors[bn->src[3]].data;
+    float *bn_biases = net->tensors[bn->src[4]].data;
+    bcnn_tensor *weights = &net->tensors[producer->src[1]];
+    float *w = weights->data;
+    float *b = net->tensors[producer->src[2]].data;
+    int num = net->tensors[producer->dst[0]].c;
+    int wsz = bcnn_tensor_size(weights);
+    if (producer->type == BCNN_LAYER_CONV2D &&
+        ((bcnn_conv_param *)producer->param)->batch_norm) {
+        // Only the embedded batchnorm scales need to be updated
+        w = net->tensors[producer->src[5]].data;
+        wsz = num;
+    }
+    for (int i = 0; i < num; ++i) {
+        b[i] = b[i] * bn_scales[i] + bn_biases[i];
+    }
+    if (producer->type == BCNN_LAYER_TRANSPOSE_CONV2D) {
+        // Weights layout: src_c x num x size x size
+        bcnn_deconv_param *param = (bcnn_deconv_param *)producer->param;
+        int k2 = param->size * param->size;
+        for (int i = 0; i < wsz; ++i) {
+            w[i] *= bn_scales[(i / k2) % num];
+        }
+    } else {
+        // Weights layout: num x ...
+        for (int i = 0; i < wsz; ++i) {
+            w[i] *= bn_scales[i / (wsz / num)];
+        }
+    }
+}
+
+/* Rewrites the graph for inference:
+ * - Standalone batchnorm layers are folded into the preceding convolution /
+ *   deconvolution / depthwise convolution.
+ * - Activation layers are absorbed by the preceding layer if it can apply
+ *   the activation itself.
+ * The producer must be the only reader of the tensor being fused and that
+ * tensor must not be a requested output.
+ * PReLU activations are kept as they are since they require extra weights. */
+static void bcnn_net_fuse_nodes(bcnn_net *net) {
+    int num_fused = 0;
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        int t_id = node->src[0];
+        if (node->type != BCNN_LAYER_BATCHNORM &&
+            node->type != BCNN_LAYER_ACTIVATION) {
+            continue;
+        }
+        int p = bcnn_net_find_producer(net, t_id, i);
+        if (p < 0 || net->nodes[p].num_dst != 1) {
+            continue;
+        }
+        bcnn_node *producer = &net->nodes[p];
+        bcnn_activation *producer_act = bcnn_net_node_activation(producer);
+        if (producer_act == NULL || *producer_act != BCNN_ACT_NONE) {
+            continue;
+        }
+        if (node->type == BCNN_LAYER_BATCHNORM) {
+            if ((producer->type != BCNN_LAYER_CONV2D &&
+                 producer->type != BCNN_LAYER_TRANSPOSE_CONV2D &&
+                 producer->type != BCNN_LAYER_DEPTHWISE_CONV2D) ||
+                bcnn_net_count_readers(net, t_id, 0, net->num_nodes, i) > 0 ||
+                bcnn_net_is_output(net, t_id)) {
+                continue;
             }
+            bcnn_net_fold_batchnorm(net, producer, node);
+            // The producer now writes directly into the batchnorm output
+            bcnn_tensor_free(&net->tensors[t_id]);
+            producer->dst[0] = node->dst[0];
+            BCNN_INFO(net->log_ctx, "Fusion: Batchnorm %s folded into %s %s\n",
+                      net->tensors[node->dst[0]].name,
+                      bcnn_net_node_type2str(producer->type),
+                      net->tensors[producer->src[0]].name);
         } else {
-            bcnn_tensor_set_shape(&net->tensors[net->nodes[i].dst[0]],
-                                  net->tensors[net->nodes[i].src[0]].n,
-                                  net->tensors[net->nodes[i].src[0]].c,
-                                  net->tensors[net->nodes[i].src[0]].h,
-                                  net->tensors[net->nodes[i].src[0]].w, 1);
-            if (need_realloc) {
-                BCNN_CHECK_STATUS(bcnn_tensor_allocate(
-                    &net->tensors[net->nodes[i].dst[0]], net->mode));
+            bcnn_activation_param *param =
+                (bcnn_activation_param *)node->param;
+            if (param->activation == BCNN_ACT_PRELU ||
+                bcnn_net_count_readers(net, t_id, p + 1, i, -1) > 0) {
+                continue;
             }
+            *producer_act = param->activation;
+            BCNN_INFO(net->log_ctx, "Fusion: %s %s absorbed by %s %s\n",
+                      bcnn_act2str(param->activation), net->tensors[t_id].name,
+                      bcnn_net_node_type2str(producer->type),
+                      net->tensors[producer->src[0]].name);
+        }
+        if (producer->type == BCNN_LAYER_CONV2D) {
+            bcnn_conv_param *conv_param = (bcnn_conv_param *)producer->param;
+            bcnn_conv_layer_set_post_func(conv_param);
+            // Without packed weights, the GEMM packs them on the fly
+            bcnn_net_pack_conv_weights(net, producer, 0);
+        }
+        bcnn_net_remove_node(net, i);
+        --i;
+        num_fused++;
+    }
+    net->num_fused += num_fused;
+    if (num_fused > 0) {
+        BCNN_INFO(net->log_ctx, "Fusion: %d nodes fused, %d nodes left\n",
+                  num_fused, net->num_nodes);
+    }
+}
+
+/* Size in number of floats of the workspace of one concurrency lane */
+static size_t bcnn_net_workspace_lane_size(bcnn_net *net) {
+    return bh_round_up(net->workspace_size, 16);
+}
+
+static void bcnn_net_free_schedule(bcnn_net *net) {
+    bh_free(net->schedule);
+    bh_free(net->level_offsets);
+    net->num_levels = 0;
+    net->num_lanes = 1;
+    for (int i = 0; i < net->num_nodes; ++i) {
+        net->nodes[i].lane = 0;
+    }
+}
+
+/* Groups the nodes by levels of the dependency graph built from the nodes
+ * src / dst: a node depends on the last writer of each tensor it reads or
+ * writes and on the readers of each tensor it overwrites. The nodes of a same
+ * level do not depend on each other and are dispatched on up to 'num_lanes'
+ * threads. */
+static bcnn_status bcnn_net_build_schedule(bcnn_net *net) {
+    bcnn_net_free_schedule(net);
+    int *node_level = (int *)calloc(net->num_nodes, sizeof(int));
+    int *write_level = (int *)calloc(net->num_tensors, sizeof(int));
+    int *read_level = (int *)calloc(net->num_tensors, sizeof(int));
+    net->schedule = (int *)calloc(net->num_nodes, sizeof(int));
+    net->level_offsets = (int *)calloc(net->num_nodes + 1, sizeof(int));
+    if (!node_level || !write_level || !read_level || !net->schedule ||
+        !net->level_offsets) {
+        bh_free(node_level);
+        bh_free(write_level);
+        bh_free(read_level);
+        bcnn_net_free_schedule(net);
+        return BCNN_FAILED_ALLOC;
+    }
+    for (int i = 0; i < net->num_tensors; ++i) {
+        write_level[i] = -1;
+        read_level[i] = -1;
+    }
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        int level = 0;
+        for (int j = 0; j < node->num_src; ++j) {
+            level = bh_max(level, write_level[node->src[j]] + 1);
+        }
+        for (int j = 0; j < node->num_dst; ++j) {
+            level = bh_max(level, write_level[node->dst[j]] + 1);
+            level = bh_max(level, read_level[node->dst[j]] + 1);
+        }
+        for (int j = 0; j < node->num_src; ++j) {
+            read_level[node->src[j]] = bh_max(read_level[node->src[j]], level);
+        }
+        for (int j = 0; j < node->num_dst; ++j) {
+            write_level[node->dst[j]] = level;
+        }
+        node_level[i] = level;
+        net->num_levels = bh_max(net->num_levels, level + 1);
+    }
+    // Counting sort of the nodes by level, original order is kept inside a
+    // level
+    for (int i = 0; i < net->num_nodes; ++i) {
+        net->level_offsets[node_level[i] + 1]++;
+    }
+    for (int l = 0; l < net->num_levels; ++l) {
+        int width = net->level_offsets[l + 1];
+        net->level_offsets[l + 1] += net->level_offsets[l];
+        net->num_lanes = bh_max(net->num_lanes, width);
+    }
+    net->num_lanes = bh_min(net->num_lanes, net->num_threads);
+    for (int l = 0, k = 0; l < net->num_levels; ++l) {
+        for (int i = 0; i < net->num_nodes; ++i) {
+            if (node_level[i] == l) {
+                net->nodes[i].lane =
+                    (k - net->level_offsets[l]) % net->num_lanes;
+                net->schedule[k++] = i;
+            }
+        }
+    }
+    BCNN_INFO(net->log_ctx,
+              "Scheduler: %d nodes in %d levels, up to %d nodes run "
+              "concurrently\n",
+              net->num_nodes, net->num_levels, net->num_lanes);
+    bh_free(node_level);
+    bh_free(write_level);
+    bh_free(read_level);
+    return BCNN_SUCCESS;
+}
+
+/* Keeps in NC4HW4 layout the tensors exchanged between conv 3x3/s1 layers
+ * so that they are not unpacked and packed back in-between. The tensor must
+ * be written by a single conv 3x3/s1, only read by conv 3x3/s1 layers and not
+ * be a requested output. Once the net is compiled, the buffers are carved out
+ * of the arena: only the layout is updated and the caller plans the arena
+ * again. */
+static bcnn_status bcnn_net_propagate_layout(bcnn_net *net) {
+    int num_packed = 0;
+    for (int i = 0; i < net->num_tensors; ++i) {
+        bcnn_tensor *t = &net->tensors[i];
+        bcnn_layout layout = BCNN_LAYOUT_NCHW;
+        int num_producers = 0, num_readers = 0, is_packable = 1;
+        for (int j = 0; j < net->num_nodes && is_packable; ++j) {
+            bcnn_node *node = &net->nodes[j];
+            int is_conv3x3 =
+                (node->type == BCNN_LAYER_CONV2D &&
+                 ((bcnn_conv_param *)node->param)->weights_workspace != NULL);
+            for (int k = 0; k < node->num_src; ++k) {
+                if (node->src[k] == i) {
+                    is_packable &= (is_conv3x3 && k == 0);
+                    num_readers++;
+                }
+            }
+            for (int k = 0; k < node->num_dst; ++k) {
+                if (node->dst[k] == i) {
+                    is_packable &= is_conv3x3;
+                    num_producers++;
+                }
+            }
+        }
+        for (int j = 0; j < net->num_inputs; ++j) {
+            is_packable &= (net->inputs[j] != i);
+        }
+        // The requested outputs are read by the caller in NCHW
+        is_packable &= !bcnn_net_is_output(net, i);
+        if (is_packable && num_producers == 1 && num_readers > 0) {
+            layout = BCNN_LAYOUT_NC4HW4;
+            num_packed++;
+        }
+        if (t->layout != layout) {
+            t->layout = layout;
+            if (net->arena == NULL) {
+                BCNN_CHECK_STATUS(bcnn_tensor_allocate(t, net->mode));
+            }
+        }
+    }
+    if (num_packed > 0) {
+        BCNN_INFO(net->log_ctx, "Layout: %d tensors kept in NC4HW4\n",
+                  num_packed);
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Alignment of the buffers carved out of the arena */
+#define BCNN_ARENA_ALIGN 64
+
+/* Returns 1 if the buffer is not owned by the net: it belongs to the net the
+ * execution context 'net' was created from, to the context replica of its
+ * weights or to a mapped model file */
+static int bcnn_net_is_shared_buffer(bcnn_net *net, const void *buf) {
+    const char *arena = (const char *)(net->parent ? net->parent->arena : NULL);
+    const char *replica = (const char *)net->replica;
+    return ((arena != NULL && (const char *)buf >= arena &&
+             (const char *)buf < arena + net->parent->arena_size) ||
+            (replica != NULL && (const char *)buf >= replica &&
+             (const char *)buf < replica + net->replica_size) ||
+            bcnn_model_owns_buffer(net, buf) ||
+            (net->parent != NULL && bcnn_model_owns_buffer(net->parent, buf)));
+}
+
+/* Returns the address of the pointer to the memory block buffer */
+static void **bcnn_mem_block_slot(bcnn_net *net, bcnn_mem_block *block) {
+    if (block->tensor_id >= 0) {
+        bcnn_tensor *t = &net->tensors[block->tensor_id];
+        return block->is_grad ? (void **)&t->grad_data : (void **)&t->data;
+    }
+    return block->slot;
+}
+
+/* Kind of memory of a buffer that is not carved out of the arena */
+static bcnn_alloc_tag bcnn_mem_block_tag(const bcnn_mem_block *block) {
+    return block->dynamic ? BCNN_ALLOC_ACTIVATIONS : BCNN_ALLOC_WEIGHTS;
+}
+
+static bcnn_status bcnn_net_add_mem_block(bcnn_net *net, int tensor_id,
+                                          int is_grad, int dynamic,
+                                          void **slot, size_t size) {
+    bcnn_mem_block block = {0};
+    block.tensor_id = tensor_id;
+    block.is_grad = is_grad;
+    block.dynamic = dynamic;
+    block.slot = slot;
+    block.size = size;
+    void *buf = *bcnn_mem_block_slot(net, &block);
+    if (buf == NULL || size == 0 || bcnn_net_is_shared_buffer(net, buf)) {
+        return BCNN_SUCCESS;
+    }
+    bcnn_mem_block *p_blocks = (bcnn_mem_block *)realloc(
+        net->mem_blocks, (net->num_mem_blocks + 1) * sizeof(bcnn_mem_block));
+    BCNN_CHECK_AND_LOG(net->log_ctx, (p_blocks != NULL), BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    net->mem_blocks = p_blocks;
+    net->mem_blocks[net->num_mem_blocks++] = block;
+    return BCNN_SUCCESS;
+}
+
+static bcnn_status bcnn_net_add_param_tensor_mem_blocks(bcnn_net *net,
+                                                        bcnn_tensor *t) {
+    size_t sz = bcnn_tensor_size(t) * sizeof(float);
+    BCNN_CHECK_STATUS(
+        bcnn_net_add_mem_block(net, -1, 0, 0, (void **)&t->data, sz));
+    BCNN_CHECK_STATUS(
+        bcnn_net_add_mem_block(net, -1, 0, 0, (void **)&t->grad_data, sz));
+    return BCNN_SUCCESS;
+}
+
+/* Lists every buffer of the net: the tensors data and gradients and the
+ * layers internal buffers. Sizes must match the ones used at allocation.
+ * The order of the list only depends on the graph. */
+static bcnn_status bcnn_net_collect_mem_blocks(bcnn_net *net) {
+    for (int i = 0; i < net->num_tensors; ++i) {
+        size_t sz = bcnn_tensor_buffer_size(&net->tensors[i]) * sizeof(float);
+        int dynamic = bcnn_net_is_data_tensor(net, i);
+        BCNN_CHECK_STATUS(
+            bcnn_net_add_mem_block(net, i, 0, dynamic, NULL, sz));
+        BCNN_CHECK_STATUS(
+            bcnn_net_add_mem_block(net, i, 1, dynamic, NULL, sz));
+    }
+#ifndef BCNN_USE_BLAS
+    BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+        net, -1, 0, 0, &net->gemm_ctx,
+        bh_max(net->num_lanes, 1) * sizeof(bcnn_gemm_context)));
+#endif
+    BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+        net, -1, 0, 1, (void **)&net->workspace,
+        bcnn_net_workspace_lane_size(net) * bh_max(net->num_lanes, 1) *
+            sizeof(float)));
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        bcnn_tensor *src = &net->tensors[node->src[0]];
+        bcnn_tensor *dst = &net->tensors[node->dst[0]];
+        size_t src_sz = bcnn_tensor_size(src) * sizeof(float);
+        size_t dst_sz = bcnn_tensor_size(dst) * sizeof(float);
+        size_t w_sz = 0;
+        if (node->num_src > 1) {
+            w_sz = bcnn_tensor_size(&net->tensors[node->src[1]]) *
+                   sizeof(float);
+        }
+        if (node->type == BCNN_LAYER_CONV2D) {
+            bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+            size_t c4_sz = bh_round_up(dst->c, 4) * sizeof(float);
+            int src_c_div4 = bh_div_up(src->c, 4);
+            int dst_c_div4 = bh_div_up(dst->c, 4);
+            BCNN_CHECK_STATUS(
+                bcnn_net_add_param_tensor_mem_blocks(net, &param->saved_mean));
+            BCNN_CHECK_STATUS(bcnn_net_add_param_tensor_mem_blocks(
+                net, &param->saved_variance));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->x_norm, dst_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->workspace, dst_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->weights_workspace,
+                src_c_div4 * dst_c_div4 * 256 * sizeof(float)));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->packed_weights,
+                bcnn_conv_layer_packed_weights_size(net, node) *
+                    sizeof(float)));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->biases_workspace, c4_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->scales_workspace, c4_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->slopes_workspace, c4_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_m, w_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_v, w_sz));
+        } else if (node->type == BCNN_LAYER_TRANSPOSE_CONV2D) {
+            bcnn_deconv_param *param = (bcnn_deconv_param *)node->param;
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_m, w_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_v, w_sz));
+        } else if (node->type == BCNN_LAYER_DEPTHWISE_CONV2D) {
+            bcnn_depthwise_conv_param *param =
+                (bcnn_depthwise_conv_param *)node->param;
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_m, w_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_v, w_sz));
+        } else if (node->type == BCNN_LAYER_FULL_CONNECTED) {
+            bcnn_fullc_param *param = (bcnn_fullc_param *)node->param;
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_m, w_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 0, (void **)&param->adam_v, w_sz));
+        } else if (node->type == BCNN_LAYER_BATCHNORM) {
+            bcnn_batchnorm_param *param = (bcnn_batchnorm_param *)node->param;
+            BCNN_CHECK_STATUS(
+                bcnn_net_add_param_tensor_mem_blocks(net, &param->saved_mean));
+            BCNN_CHECK_STATUS(bcnn_net_add_param_tensor_mem_blocks(
+                net, &param->saved_variance));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->x_norm, dst_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->workspace, dst_sz));
+        } else if (node->type == BCNN_LAYER_MAXPOOL) {
+            bcnn_maxpool_param *param = (bcnn_maxpool_param *)node->param;
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->indexes,
+                bcnn_tensor_size(dst) * sizeof(int)));
+        } else if (node->type == BCNN_LAYER_DROPOUT) {
+            bcnn_dropout_param *param = (bcnn_dropout_param *)node->param;
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->rand, src_sz));
+        } else if (node->type == BCNN_LAYER_LRN) {
+            bcnn_lrn_param *param = (bcnn_lrn_param *)node->param;
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->tmp_sum, src_sz));
+            BCNN_CHECK_STATUS(bcnn_net_add_mem_block(
+                net, -1, 0, 1, (void **)&param->tmp_squared, src_sz));
+        }
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Shared blocks first, then by decreasing size */
+static int bcnn_mem_block_cmp_size(const void *a, const void *b) {
+    const bcnn_mem_block *ba = (const bcnn_mem_block *)a;
+    const bcnn_mem_block *bb = (const bcnn_mem_block *)b;
+    if (ba->shared != bb->shared) {
+        return bb->shared - ba->shared;
+    }
+    if (ba->size != bb->size) {
+        return (ba->size < bb->size) ? 1 : -1;
+    }
+    return ba->first - bb->first;
+}
+
+static int bcnn_mem_block_cmp_offset(const void *a, const void *b) {
+    const bcnn_mem_block *ba = *(const bcnn_mem_block **)a;
+    const bcnn_mem_block *bb = *(const bcnn_mem_block **)b;
+    if (ba->offset == bb->offset) {
+        return 0;
+    }
+    return (ba->offset < bb->offset) ? -1 : 1;
+}
+
+/* Static memory planning for inference: the intermediate tensors whose
+ * lifetimes do not overlap share the same memory.
+ * Network inputs, graph outputs (i.e. tensors that are never read by another
+ * node), outputs requested by 'bcnn_set_outputs' and parameters keep their own
+ * memory.
+ * The shared tensors are placed at the beginning of the arena, the size of
+ * that region is returned in 'shared_size'. */
+static bcnn_status bcnn_net_plan_memory(bcnn_net *net, size_t *shared_size) {
+    int *first = (int *)calloc(net->num_tensors, sizeof(int));
+    int *last = (int *)calloc(net->num_tensors, sizeof(int));
+    int *consumed = (int *)calloc(net->num_tensors, sizeof(int));
+    bcnn_mem_block **live = (bcnn_mem_block **)calloc(
+        net->num_mem_blocks + 1, sizeof(bcnn_mem_block *));
+    if (!first || !last || !consumed || !live) {
+        bh_free(first);
+        bh_free(last);
+        bh_free(consumed);
+        bh_free(live);
+        return BCNN_FAILED_ALLOC;
+    }
+    for (int i = 0; i < net->num_tensors; ++i) {
+        first[i] = -1;
+    }
+    // Liveness analysis, in execution order. The nodes of a same level of the
+    // schedule may run concurrently hence they share the same time step
+    for (int k = 0, level = 0; k < net->num_nodes; ++k) {
+        int step = k;
+        bcnn_node *node = &net->nodes[k];
+        if (net->num_levels > 0) {
+            while (k >= net->level_offsets[level + 1]) {
+                ++level;
+            }
+            step = level;
+            node = &net->nodes[net->schedule[k]];
+        }
+        for (int j = 0; j < node->num_dst; ++j) {
+            if (first[node->dst[j]] < 0) {
+                first[node->dst[j]] = step;
+            }
+            last[node->dst[j]] = step;
+        }
+        for (int j = 0; j < node->num_src; ++j) {
+            int inplace = 0;
+            for (int q = 0; q < node->num_dst; ++q) {
+                inplace |= (node->dst[q] == node->src[j]);
+            }
+            last[node->src[j]] = step;
+            if (!inplace) {
+                consumed[node->src[j]] = 1;
+            }
+        }
+    }
+    for (int i = 0; i < net->num_inputs; ++i) {
+        first[net->inputs[i]] = -1;
+    }
+    int num_shared = 0;
+    size_t naive_size = 0;
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        if (b->tensor_id < 0 || b->is_grad || first[b->tensor_id] < 0 ||
+            !consumed[b->tensor_id] ||
+            bcnn_net_is_output(net, b->tensor_id)) {
+            continue;
+        }
+        b->shared = 1;
+        b->first = first[b->tensor_id];
+        b->last = last[b->tensor_id];
+        naive_size += bh_round_up(b->size, BCNN_ARENA_ALIGN);
+        num_shared++;
+    }
+    // Greedy placement, largest tensors first: each tensor takes the lowest
+    // offset that does not collide with an already placed tensor alive at the
+    // same time
+    qsort(net->mem_blocks, net->num_mem_blocks, sizeof(bcnn_mem_block),
+          bcnn_mem_block_cmp_size);
+    *shared_size = 0;
+    for (int i = 0; i < num_shared; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        size_t size = bh_round_up(b->size, BCNN_ARENA_ALIGN);
+        int num_live = 0;
+        for (int j = 0; j < i; ++j) {
+            if (net->mem_blocks[j].first <= b->last &&
+                b->first <= net->mem_blocks[j].last) {
+                live[num_live++] = &net->mem_blocks[j];
+            }
+        }
+        qsort(live, num_live, sizeof(bcnn_mem_block *),
+              bcnn_mem_block_cmp_offset);
+        size_t offset = 0;
+        for (int j = 0; j < num_live; ++j) {
+            if (live[j]->offset >= offset + size) {
+                break;
+            }
+            offset = bh_max(offset, live[j]->offset +
+                                        bh_round_up(live[j]->size,
+                                                    BCNN_ARENA_ALIGN));
+        }
+        b->offset = offset;
+        *shared_size = bh_max(*shared_size, offset + size);
+    }
+    BCNN_INFO(net->log_ctx,
+              "Memory planner: %d intermediate tensors use %.2f MB (%.2f MB "
+              "without reuse)\n",
+              num_shared, *shared_size / 1048576.0f, naive_size / 1048576.0f);
+    bh_free(first);
+    bh_free(last);
+    bh_free(consumed);
+    bh_free(live);
+    return BCNN_SUCCESS;
+}
+
+/* Computes the offset of every buffer of the net in the arena. The static
+ * buffers (parameters, packed weights...) come first and their offsets do not
+ * depend on the input shape, followed by the buffers of the inference data.
+ * The size of the static region is returned in 'static_size'. */
+static bcnn_status bcnn_net_layout_arena(bcnn_net *net, size_t *static_size,
+                                         size_t *arena_size) {
+    bcnn_status ret = bcnn_net_collect_mem_blocks(net);
+    *static_size = 0;
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        if (!b->dynamic) {
+            b->offset = *static_size;
+            *static_size += bh_round_up(b->size, BCNN_ARENA_ALIGN);
+        }
+    }
+    size_t shared_size = 0;
+    if (ret == BCNN_SUCCESS && net->mode == BCNN_MODE_PREDICT) {
+        ret = bcnn_net_plan_memory(net, &shared_size);
+    }
+    if (ret != BCNN_SUCCESS) {
+        bh_free(net->mem_blocks);
+        net->num_mem_blocks = 0;
+        return ret;
+    }
+    *arena_size = *static_size + shared_size;
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        if (b->shared) {
+            b->offset += *static_size;
+        } else if (b->dynamic) {
+            b->offset = *arena_size;
+            *arena_size += bh_round_up(b->size, BCNN_ARENA_ALIGN);
+        }
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Sizes every buffer of the net up front and moves them into one single
+ * memory chunk owned by the net */
+static bcnn_status bcnn_net_build_arena(bcnn_net *net) {
+    size_t static_size = 0, arena_size = 0;
+    BCNN_CHECK_STATUS(bcnn_net_layout_arena(net, &static_size, &arena_size));
+    if (arena_size > 0) {
+        net->arena = bcnn_align_calloc(arena_size, BCNN_ARENA_ALIGN,
+                                       BCNN_ALLOC_ARENA);
+    }
+    if (net->arena == NULL) {
+        // Buffers keep their own memory
+        bh_free(net->mem_blocks);
+        net->num_mem_blocks = 0;
+        return (arena_size > 0) ? BCNN_FAILED_ALLOC : BCNN_SUCCESS;
+    }
+    net->arena_size = arena_size;
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        void **slot = bcnn_mem_block_slot(net, b);
+        void *p = (char *)net->arena + b->offset;
+        // The inference data is overwritten by the next forward
+        if (!b->dynamic) {
+            memcpy(p, *slot, b->size);
+        }
+        bcnn_align_free(*slot);
+        *slot = p;
+    }
+    BCNN_INFO(net->log_ctx, "Memory arena: %.2f MB for %d buffers\n",
+              net->arena_size / 1048576.0f, net->num_mem_blocks);
+    if (bcnn_get_huge_page_bytes() > 0) {
+        BCNN_INFO(net->log_ctx, "Huge pages: %.2f MB\n",
+                  bcnn_get_huge_page_bytes() / 1048576.0f);
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Plans the arena again after a change of the input shape. The static region
+ * is left untouched and the arena is only reallocated if it has to grow. */
+static bcnn_status bcnn_net_resize_arena(bcnn_net *net) {
+    bh_free(net->mem_blocks);
+    net->num_mem_blocks = 0;
+    size_t static_size = 0, arena_size = 0;
+    BCNN_CHECK_STATUS(bcnn_net_layout_arena(net, &static_size, &arena_size));
+    if (arena_size > net->arena_size) {
+        void *arena = bcnn_align_calloc(arena_size, BCNN_ARENA_ALIGN,
+                                        BCNN_ALLOC_ARENA);
+        BCNN_CHECK_AND_LOG(net->log_ctx, arena, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+        memcpy(arena, net->arena, static_size);
+        bcnn_align_free(net->arena);
+        net->arena = arena;
+        net->arena_size = arena_size;
+        BCNN_INFO(net->log_ctx, "Memory arena: grown to %.2f MB\n",
+                  net->arena_size / 1048576.0f);
+    } else {
+        memset((char *)net->arena + static_size, 0, arena_size - static_size);
+    }
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        *bcnn_mem_block_slot(net, b) = (char *)net->arena + b->offset;
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Gives a larger memory to the buffers, not held by an arena, that outgrew
+ * their size listed in 'blocks' */
+static bcnn_status bcnn_net_grow_buffers(bcnn_net *net, bcnn_mem_block *blocks,
+                                         int num_blocks) {
+    BCNN_CHECK_STATUS(bcnn_net_collect_mem_blocks(net));
+    bcnn_status ret = BCNN_SUCCESS;
+    for (int i = 0; i < net->num_mem_blocks && ret == BCNN_SUCCESS; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        void **slot = bcnn_mem_block_slot(net, b);
+        size_t size = 0;
+        for (int j = 0; j < num_blocks; ++j) {
+            if (bcnn_mem_block_slot(net, &blocks[j]) == slot) {
+                size = blocks[j].size;
+                break;
+            }
+        }
+        if (b->size <= size) {
+            continue;
+        }
+        if (b->tensor_id >= 0) {
+            // Data and gradient are allocated together
+            if (!b->is_grad) {
+                ret = bcnn_tensor_allocate(&net->tensors[b->tensor_id],
+                                           net->mode);
+            }
+        } else {
+            bcnn_align_free(*slot);
+            *slot = bcnn_align_calloc(b->size, align_offset_,
+                                      bcnn_mem_block_tag(b));
+            if (*slot == NULL) {
+                ret = BCNN_FAILED_ALLOC;
+            }
+        }
+    }
+    bh_free(net->mem_blocks);
+    net->num_mem_blocks = 0;
+    return ret;
+}
+
+/* Releases the arena. If 'restore' is set, each buffer is given back its own
+ * memory with the same content. */
+static bcnn_status bcnn_net_release_arena(bcnn_net *net, int restore) {
+    if (net->arena == NULL) {
+        return BCNN_SUCCESS;
+    }
+    bcnn_status ret = BCNN_SUCCESS;
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        void **slot = bcnn_mem_block_slot(net, b);
+        *slot = NULL;
+        if (restore) {
+            *slot = bcnn_align_calloc(b->size, align_offset_,
+                                      bcnn_mem_block_tag(b));
+            if (*slot == NULL) {
+                ret = BCNN_FAILED_ALLOC;
+            } else if (!b->shared) {
+                memcpy(*slot, (char *)net->arena + b->offset, b->size);
+            }
+        }
+    }
+    bcnn_align_free(net->arena);
+    net->arena = NULL;
+    net->arena_size = 0;
+    bh_free(net->mem_blocks);
+    net->num_mem_blocks = 0;
+    return ret;
+}
+
+size_t bcnn_get_arena_size(bcnn_net *net) { return net->arena_size; }
+
+/* Points the layers scratch buffers to the net workspace. Layers are run one
+ * after another so that they can all borrow the same memory. */
+static void bcnn_net_share_workspace(bcnn_net *net) {
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        // Nodes running concurrently use a different part of the workspace
+        float *workspace = NULL;
+        if (net->workspace != NULL) {
+            workspace =
+                net->workspace + node->lane * bcnn_net_workspace_lane_size(net);
+        }
+        if (node->type == BCNN_LAYER_CONV2D) {
+            bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+            param->conv_workspace = workspace;
+            if (param->weights_workspace != NULL && net->workspace != NULL) {
+                // conv 3x3/s1: kernel workspace, then src and dst in nc4hw4
+                bcnn_tensor *src = &net->tensors[node->src[0]];
+                size_t src_sz =
+                    src->w * src->h * bh_round_up(src->c, 4) * src->n;
+                param->src_workspace =
+                    param->conv_workspace +
+                    bh_round_up(param->workspace_size, 16);
+                param->dst_workspace =
+                    param->src_workspace + bh_round_up(src_sz, 16);
+            }
+        } else if (node->type == BCNN_LAYER_TRANSPOSE_CONV2D) {
+            bcnn_deconv_param *param = (bcnn_deconv_param *)node->param;
+            param->conv_workspace = workspace;
+        }
+    }
+}
+
+static void bcnn_plan_free(bcnn_plan *plan) {
+    if (plan->own_memory) {
+        bcnn_align_free(plan->memory);
+    }
+    bh_free(plan->shapes);
+    bh_free(plan->params);
+    bh_free(plan->mem_blocks);
+}
+
+/* Saves the current shapes of the tensors and parameters of the nodes */
+static bcnn_status bcnn_plan_save_state(bcnn_net *net, bcnn_plan *plan) {
+    size_t params_size = 0;
+    for (int i = 0; i < net->num_nodes; ++i) {
+        params_size += net->nodes[i].param_size;
+    }
+    plan->shapes = (int *)calloc(4 * net->num_tensors, sizeof(int));
+    plan->params = (char *)calloc(bh_max(params_size, 1), 1);
+    BCNN_CHECK_AND_LOG(net->log_ctx, plan->shapes && plan->params,
+                       BCNN_FAILED_ALLOC, "Internal allocation error\n");
+    plan->w = net->tensors[0].w;
+    plan->h = net->tensors[0].h;
+    plan->batch_size = net->batch_size;
+    plan->workspace_size = net->workspace_size;
+    for (int i = 0; i < net->num_tensors; ++i) {
+        bcnn_tensor *t = &net->tensors[i];
+        plan->shapes[4 * i] = t->n;
+        plan->shapes[4 * i + 1] = t->c;
+        plan->shapes[4 * i + 2] = t->h;
+        plan->shapes[4 * i + 3] = t->w;
+    }
+    char *p = plan->params;
+    for (int i = 0; i < net->num_nodes; ++i) {
+        if (net->nodes[i].param != NULL) {
+            memcpy(p, net->nodes[i].param, net->nodes[i].param_size);
+        }
+        p += net->nodes[i].param_size;
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Makes a plan the active one: nothing is allocated nor inferred here, the
+ * shapes, parameters and buffers pointers saved in the plan are restored */
+static void bcnn_net_bind_plan(bcnn_net *net, int index) {
+    bcnn_plan *plan = &net->plans[index];
+    for (int i = 0; i < net->num_tensors; ++i) {
+        bcnn_tensor *t = &net->tensors[i];
+        bcnn_tensor_set_shape(t, plan->shapes[4 * i], plan->shapes[4 * i + 1],
+                              plan->shapes[4 * i + 2], plan->shapes[4 * i + 3],
+                              t->has_grad);
+    }
+    char *p = plan->params;
+    for (int i = 0; i < net->num_nodes; ++i) {
+        if (net->nodes[i].param != NULL) {
+            memcpy(net->nodes[i].param, p, net->nodes[i].param_size);
+        }
+        p += net->nodes[i].param_size;
+    }
+    net->batch_size = plan->batch_size;
+    net->workspace_size = plan->workspace_size;
+    // The static buffers may have moved with the arena since the parameters
+    // were saved
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        if (!b->dynamic) {
+            *bcnn_mem_block_slot(net, b) = (char *)net->arena + b->offset;
+        }
+    }
+    for (int i = 0; i < plan->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &plan->mem_blocks[i];
+        *bcnn_mem_block_slot(net, b) = (char *)plan->memory + b->offset;
+    }
+    bcnn_net_share_workspace(net);
+    net->plan = index;
+}
+
+/* Frees the plans, the net is left with the plan it was compiled with */
+static void bcnn_net_free_plans(bcnn_net *net) {
+    if (net->num_plans == 0) {
+        return;
+    }
+    if (net->plan != 0) {
+        bcnn_net_bind_plan(net, 0);
+    }
+    for (int i = 0; i < net->num_plans; ++i) {
+        bcnn_plan_free(&net->plans[i]);
+    }
+    bh_free(net->plans);
+    net->num_plans = 0;
+    net->plan = 0;
+}
+
+static int bcnn_net_find_plan(bcnn_net *net, int w, int h, int batch_size) {
+    for (int i = 0; i < net->num_plans; ++i) {
+        if (net->plans[i].w == w && net->plans[i].h == h &&
+            net->plans[i].batch_size == batch_size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bcnn_status bcnn_net_append_plan(bcnn_net *net, bcnn_plan *plan) {
+    bcnn_plan *p_plans = (bcnn_plan *)realloc(
+        net->plans, (net->num_plans + 1) * sizeof(bcnn_plan));
+    BCNN_CHECK_AND_LOG(net->log_ctx, (p_plans != NULL), BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    net->plans = p_plans;
+    net->plans[net->num_plans++] = *plan;
+    return BCNN_SUCCESS;
+}
+
+/* Keeps the memory blocks of the inference data out of 'blocks' */
+static bcnn_status bcnn_plan_set_mem_blocks(bcnn_net *net, bcnn_plan *plan,
+                                            bcnn_mem_block *blocks,
+                                            int num_blocks, size_t offset) {
+    plan->mem_blocks =
+        (bcnn_mem_block *)calloc(bh_max(num_blocks, 1), sizeof(bcnn_mem_block));
+    BCNN_CHECK_AND_LOG(net->log_ctx, plan->mem_blocks, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    for (int i = 0; i < num_blocks; ++i) {
+        if (blocks[i].dynamic) {
+            plan->mem_blocks[plan->num_mem_blocks] = blocks[i];
+            plan->mem_blocks[plan->num_mem_blocks].offset -= offset;
+            plan->num_mem_blocks++;
+        }
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Plans the memory of the inference data for the current shapes. The
+ * buffers get a memory of their own, the arena of the net is left as is. */
+static bcnn_status bcnn_net_layout_plan(bcnn_net *net, bcnn_plan *plan) {
+    bcnn_mem_block *mem_blocks = net->mem_blocks;
+    int num_mem_blocks = net->num_mem_blocks;
+    net->mem_blocks = NULL;
+    net->num_mem_blocks = 0;
+    size_t static_size = 0, arena_size = 0;
+    bcnn_status ret = bcnn_net_layout_arena(net, &static_size, &arena_size);
+    if (ret == BCNN_SUCCESS) {
+        ret = bcnn_plan_set_mem_blocks(net, plan, net->mem_blocks,
+                                       net->num_mem_blocks, static_size);
+    }
+    if (ret == BCNN_SUCCESS && arena_size > static_size) {
+        plan->memory =
+            bcnn_align_calloc(arena_size - static_size, BCNN_ARENA_ALIGN,
+                              BCNN_ALLOC_ACTIVATIONS);
+        plan->own_memory = 1;
+        if (plan->memory == NULL) {
+            ret = BCNN_FAILED_ALLOC;
+        }
+    }
+    bh_free(net->mem_blocks);
+    net->mem_blocks = mem_blocks;
+    net->num_mem_blocks = num_mem_blocks;
+    return ret;
+}
+
+bcnn_status bcnn_add_plan(bcnn_net *net, int w, int h, int batch_size) {
+    BCNN_CHECK_AND_LOG(
+        net->log_ctx,
+        net->parent == NULL && net->mode == BCNN_MODE_PREDICT && net->arena,
+        BCNN_INVALID_PARAMETER,
+        "Plans require a net compiled in predict mode\n");
+    int num_contexts = bcnn_atomic_load(&net->num_contexts);
+    BCNN_CHECK_AND_LOG(net->log_ctx, num_contexts == 0, BCNN_INVALID_PARAMETER,
+                       "Can not add a plan to the net: %d execution contexts "
+                       "still share its buffers\n",
+                       num_contexts);
+    BCNN_CHECK_AND_LOG(net->log_ctx, w > 0 && h > 0 && batch_size > 0,
+                       BCNN_INVALID_PARAMETER,
+                       "Invalid plan input %dx%d batch size %d\n", w, h,
+                       batch_size);
+    if (bcnn_net_find_plan(net, w, h, batch_size) >= 0) {
+        return BCNN_SUCCESS;
+    }
+    if (net->num_plans == 0) {
+        // The plan the net was compiled with lives in the arena
+        bcnn_plan plan = {0};
+        plan.memory = net->arena;
+        bcnn_status ret = bcnn_plan_save_state(net, &plan);
+        if (ret == BCNN_SUCCESS) {
+            ret = bcnn_plan_set_mem_blocks(net, &plan, net->mem_blocks,
+                                           net->num_mem_blocks, 0);
+        }
+        if (ret == BCNN_SUCCESS) {
+            ret = bcnn_net_append_plan(net, &plan);
+        }
+        if (ret != BCNN_SUCCESS) {
+            bcnn_plan_free(&plan);
+            return ret;
+        }
+        if (bcnn_net_find_plan(net, w, h, batch_size) >= 0) {
+            return BCNN_SUCCESS;
+        }
+    }
+    bcnn_async_destroy(net);
+    // Shapes are inferred for the new input, then the active plan is restored
+    bcnn_set_input_shape(net, w, h, net->tensors[0].c, batch_size);
+    net->workspace_size = 0;
+    bcnn_status ret = BCNN_SUCCESS;
+    for (int i = 0; i < net->num_nodes && ret == BCNN_SUCCESS; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        if (node->infer_shape != NULL) {
+            ret = node->infer_shape(net, node);
+        }
+    }
+    bcnn_plan plan = {0};
+    if (ret == BCNN_SUCCESS) {
+        ret = bcnn_net_layout_plan(net, &plan);
+    }
+    if (ret == BCNN_SUCCESS) {
+        ret = bcnn_plan_save_state(net, &plan);
+    }
+    if (ret == BCNN_SUCCESS) {
+        ret = bcnn_net_append_plan(net, &plan);
+    }
+    if (ret != BCNN_SUCCESS) {
+        bcnn_plan_free(&plan);
+    }
+    bcnn_net_bind_plan(net, net->plan);
+    if (ret == BCNN_SUCCESS) {
+        BCNN_INFO(net->log_ctx, "Plan %d: input %dx%d batch size %d\n",
+                  net->num_plans - 1, w, h, batch_size);
+    }
+    return ret;
+}
+
+bcnn_status bcnn_select_plan(bcnn_net *net, int w, int h, int batch_size) {
+    int index = bcnn_net_find_plan(net, w, h, batch_size);
+    if (index < 0 && net->num_plans == 0 && net->tensors[0].w == w &&
+        net->tensors[0].h == h && net->batch_size == batch_size) {
+        return BCNN_SUCCESS;
+    }
+    BCNN_CHECK_AND_LOG(net->log_ctx, index >= 0, BCNN_INVALID_PARAMETER,
+                       "No plan for input %dx%d batch size %d\n", w, h,
+                       batch_size);
+    if (index != net->plan) {
+        // The staging buffers are sized for the inputs of the active plan
+        bcnn_async_destroy(net);
+        bcnn_net_bind_plan(net, index);
+    }
+    return BCNN_SUCCESS;
+}
+
+/* Flags the nodes that do not feed any requested output. The nodes are
+ * walked backward from the outputs, in reverse topological order. */
+static bcnn_status bcnn_net_mark_skipped_nodes(bcnn_net *net) {
+    for (int i = 0; i < net->num_nodes; ++i) {
+        net->nodes[i].skip = 0;
+    }
+    if (net->num_outputs == 0) {
+        return BCNN_SUCCESS;
+    }
+    char *needed = (char *)calloc(net->num_tensors, 1);
+    BCNN_CHECK_AND_LOG(net->log_ctx, needed, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    for (int i = 0; i < net->num_outputs; ++i) {
+        needed[net->outputs[i]] = 1;
+    }
+    int num_skipped = 0;
+    for (int i = net->num_nodes - 1; i >= 0; --i) {
+        bcnn_node *node = &net->nodes[i];
+        node->skip = 1;
+        for (int j = 0; j < node->num_dst; ++j) {
+            if (needed[node->dst[j]]) {
+                node->skip = 0;
+            }
+        }
+        if (node->skip) {
+            num_skipped++;
+            continue;
+        }
+        for (int j = 0; j < node->num_src; ++j) {
+            needed[node->src[j]] = 1;
+        }
+    }
+    BCNN_INFO(net->log_ctx, "Outputs: %d nodes out of %d are skipped\n",
+              num_skipped, net->num_nodes);
+    bh_free(needed);
+    return BCNN_SUCCESS;
+}
+
+/* Plans the memory of the inference data again for every plan of the net,
+ * the shapes being unchanged */
+static bcnn_status bcnn_net_replan_memory(bcnn_net *net) {
+    if (net->num_plans == 0) {
+        bcnn_status ret = bcnn_net_resize_arena(net);
+        bcnn_net_share_workspace(net);
+        return ret;
+    }
+    int active = net->plan;
+    bcnn_status ret = BCNN_SUCCESS;
+    for (int i = 0; i < net->num_plans && ret == BCNN_SUCCESS; ++i) {
+        bcnn_plan *plan = &net->plans[i];
+        bcnn_net_bind_plan(net, i);
+        bh_free(plan->mem_blocks);
+        plan->num_mem_blocks = 0;
+        if (plan->own_memory) {
+            bcnn_align_free(plan->memory);
+            plan->memory = NULL;
+            plan->own_memory = 0;
+            ret = bcnn_net_layout_plan(net, plan);
+        } else {
+            ret = bcnn_net_resize_arena(net);
+            plan->memory = net->arena;
+            if (ret == BCNN_SUCCESS) {
+                ret = bcnn_plan_set_mem_blocks(net, plan, net->mem_blocks,
+                                               net->num_mem_blocks, 0);
+            }
+        }
+    }
+    if (ret != BCNN_SUCCESS) {
+        bcnn_net_free_plans(net);
+        return ret;
+    }
+    bcnn_net_bind_plan(net, active);
+    return BCNN_SUCCESS;
+}
+
+bcnn_status bcnn_set_outputs(bcnn_net *net, int num_outputs,
+                             const char **names) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->parent == NULL,
+                       BCNN_INVALID_PARAMETER,
+                       "The outputs of an execution context are those of its "
+                       "net\n");
+    int num_contexts = bcnn_atomic_load(&net->num_contexts);
+    BCNN_CHECK_AND_LOG(net->log_ctx, num_contexts == 0, BCNN_INVALID_PARAMETER,
+                       "Can not change the outputs of the net: %d execution "
+                       "contexts still share its buffers\n",
+                       num_contexts);
+    int *outputs = NULL;
+    if (num_outputs > 0) {
+        outputs = (int *)calloc(num_outputs, sizeof(int));
+        BCNN_CHECK_AND_LOG(net->log_ctx, outputs, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+    }
+    for (int i = 0; i < num_outputs; ++i) {
+        outputs[i] = bcnn_get_tensor_index_by_name(net, names[i]);
+        if (outputs[i] < 0) {
+            bh_free(outputs);
+            BCNN_ERROR(net->log_ctx, BCNN_INVALID_PARAMETER,
+                       "Invalid output tensor name %s\n", names[i]);
+        }
+    }
+    bcnn_async_destroy(net);
+    bh_free(net->outputs);
+    net->outputs = outputs;
+    net->num_outputs = bh_max(num_outputs, 0);
+    BCNN_CHECK_STATUS(bcnn_net_mark_skipped_nodes(net));
+    // The requested outputs must be in NCHW and must not be overwritten by the
+    // following nodes
+    if (net->arena != NULL && net->mode == BCNN_MODE_PREDICT) {
+        BCNN_CHECK_STATUS(bcnn_net_propagate_layout(net));
+        BCNN_CHECK_STATUS(bcnn_net_replan_memory(net));
+    }
+    return BCNN_SUCCESS;
+}
+
+static bcnn_status bcnn_init_workload(bcnn_net *net) {
+    // Allocate tensor for input node
+    BCNN_CHECK_STATUS(bcnn_tensor_allocate(&net->tensors[0], net->mode));
+#ifndef BCNN_USE_CUDA
+    bcnn_net_free_schedule(net);
+    if (net->mode == BCNN_MODE_PREDICT) {
+        bcnn_net_fuse_nodes(net);
+        BCNN_CHECK_STATUS(bcnn_net_mark_skipped_nodes(net));
+        BCNN_CHECK_STATUS(bcnn_net_propagate_layout(net));
+        BCNN_CHECK_STATUS(bcnn_net_build_schedule(net));
+    }
+#ifndef BCNN_USE_BLAS
+    BCNN_CHECK_STATUS(bcnn_net_create_gemm_context(net));
+#endif
+    // Allocate the scratch memory shared by the layers
+    size_t workspace_size =
+        bcnn_net_workspace_lane_size(net) * net->num_lanes;
+    bcnn_align_free(net->workspace);
+    net->workspace = (float *)bcnn_align_calloc(
+        workspace_size * sizeof(float), align_offset_, BCNN_ALLOC_WORKSPACE);
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->workspace || workspace_size == 0,
+                       BCNN_FAILED_ALLOC, "Internal allocation error\n");
+    BCNN_CHECK_STATUS(bcnn_net_build_arena(net));
+    bcnn_net_share_workspace(net);
+#endif
+#ifdef BCNN_USE_CUDA
+    bcnn_cuda_context *cuda_ctx = (bcnn_cuda_context *)net->cuda_ctx;
+    cuda_ctx->workspace_gpu = bcnn_cuda_malloc_f32(cuda_ctx->workspace_size);
+    for (int i = 0; i < net->num_nodes; ++i) {
+        if (net->nodes[i].type == BCNN_LAYER_CONV2D) {
+            bcnn_conv_param *param = (bcnn_conv_param *)(net->nodes[i].param);
+            param->conv_workspace_gpu = cuda_ctx->workspace_gpu;
+        }
+    }
+#endif
+
+    return BCNN_SUCCESS;
+}
+
+int bcnn_get_batch_size(bcnn_net *net) { return net->batch_size; }
+
+bcnn_status bcnn_compile_net(bcnn_net *net) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->parent == NULL,
+                       BCNN_INVALID_PARAMETER,
+                       "An execution context can not be compiled\n");
+    int num_contexts = bcnn_atomic_load(&net->num_contexts);
+    BCNN_CHECK_AND_LOG(net->log_ctx, num_contexts == 0, BCNN_INVALID_PARAMETER,
+                       "Can not compile the net: %d execution contexts still "
+                       "share its buffers\n",
+                       num_contexts);
+    bcnn_async_destroy(net);
+    bcnn_net_free_plans(net);
+    BCNN_CHECK_STATUS(bcnn_free_workload(net));
+    return bcnn_init_workload(net);
+}
+
+/* Tensors holding the data of one inference: inputs, label and nodes outputs.
+ * Every other tensor is a parameter of the net. */
+int bcnn_net_is_data_tensor(bcnn_net *net, int t_id) {
+    if (t_id == 1) {  // label
+        return 1;
+    }
+    for (int i = 0; i < net->num_inputs; ++i) {
+        if (net->inputs[i] == t_id) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < net->num_nodes; ++i) {
+        for (int j = 0; j < net->nodes[i].num_dst; ++j) {
+            if (net->nodes[i].dst[j] == t_id) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Gives the context its own copy of the layers buffers written during the
+ * forward pass */
+static bcnn_status bcnn_context_alloc_node_buffers(bcnn_net *ctx,
+                                                   bcnn_node *node) {
+    bcnn_tensor *dst = &ctx->parent->tensors[node->dst[0]];
+    size_t src_sz = bcnn_tensor_size(&ctx->parent->tensors[node->src[0]]);
+    if (node->type == BCNN_LAYER_MAXPOOL) {
+        bcnn_maxpool_param *param = (bcnn_maxpool_param *)node->param;
+        param->indexes = (int *)bcnn_align_calloc(
+            bcnn_tensor_size(dst) * sizeof(int), align_offset_,
+            BCNN_ALLOC_ACTIVATIONS);
+        BCNN_CHECK_AND_LOG(ctx->log_ctx, param->indexes, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+    } else if (node->type == BCNN_LAYER_LRN) {
+        bcnn_lrn_param *param = (bcnn_lrn_param *)node->param;
+        param->tmp_squared = NULL;
+        param->tmp_sum =
+            (float *)bcnn_align_calloc(src_sz * sizeof(float), align_offset_,
+                                       BCNN_ALLOC_WORKSPACE);
+        BCNN_CHECK_AND_LOG(ctx->log_ctx, param->tmp_sum, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+        param->tmp_squared =
+            (float *)bcnn_align_calloc(src_sz * sizeof(float), align_offset_,
+                                       BCNN_ALLOC_WORKSPACE);
+        BCNN_CHECK_AND_LOG(ctx->log_ctx, param->tmp_squared,
+                           BCNN_FAILED_ALLOC, "Internal allocation error\n");
+    }
+    return BCNN_SUCCESS;
+}
+
+static void bcnn_context_free_node_buffers(bcnn_net *ctx, bcnn_node *node) {
+    if (node->param == NULL) {
+        return;
+    }
+    if (node->type == BCNN_LAYER_MAXPOOL) {
+        bcnn_maxpool_param *param = (bcnn_maxpool_param *)node->param;
+        bcnn_align_free(param->indexes);
+    } else if (node->type == BCNN_LAYER_LRN) {
+        bcnn_lrn_param *param = (bcnn_lrn_param *)node->param;
+        bcnn_align_free(param->tmp_sum);
+        bcnn_align_free(param->tmp_squared);
+    }
+}
+
+static bcnn_status bcnn_context_init(bcnn_net *ctx) {
+    bcnn_net *net = ctx->parent;
+    ctx->tensors = (bcnn_tensor *)calloc(net->num_tensors, sizeof(bcnn_tensor));
+    ctx->nodes = (bcnn_node *)calloc(net->num_nodes, sizeof(bcnn_node));
+    BCNN_CHECK_AND_LOG(ctx->log_ctx, ctx->tensors && ctx->nodes,
+                       BCNN_FAILED_ALLOC, "Internal allocation error\n");
+    // Graph: nodes are copied with their own param, the src / dst arrays and
+    // the schedule are shared
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_node *node = &ctx->nodes[i];
+        *node = net->nodes[i];
+        node->param = NULL;
+        if (net->nodes[i].param != NULL) {
+            node->param = malloc(node->param_size);
+            BCNN_CHECK_AND_LOG(ctx->log_ctx, node->param, BCNN_FAILED_ALLOC,
+                               "Internal allocation error\n");
+            memcpy(node->param, net->nodes[i].param, node->param_size);
+        }
+        ctx->num_nodes++;
+        BCNN_CHECK_STATUS(bcnn_context_alloc_node_buffers(ctx, node));
+    }
+    // Tensors: the parameters point to the net weights, the inference data
+    // get their own buffers
+    for (int i = 0; i < net->num_tensors; ++i) {
+        bcnn_tensor *t = &ctx->tensors[i];
+        *t = net->tensors[i];
+        if (bcnn_net_is_data_tensor(net, i)) {
+            t->data = NULL;
+            t->grad_data = NULL;
+            if (net->tensors[i].data != NULL) {
+                BCNN_CHECK_STATUS(bcnn_tensor_allocate(t, ctx->mode));
+            }
+        }
+        ctx->num_tensors++;
+    }
+    // The requested outputs keep their own memory in the context as well
+    if (net->num_outputs > 0) {
+        ctx->outputs = (int *)calloc(net->num_outputs, sizeof(int));
+        BCNN_CHECK_AND_LOG(ctx->log_ctx, ctx->outputs, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+        memcpy(ctx->outputs, net->outputs, net->num_outputs * sizeof(int));
+        ctx->num_outputs = net->num_outputs;
+    }
+#ifndef BCNN_USE_BLAS
+    BCNN_CHECK_STATUS(bcnn_net_create_gemm_context(ctx));
+#endif
+    size_t workspace_size =
+        bcnn_net_workspace_lane_size(ctx) * ctx->num_lanes;
+    ctx->workspace = (float *)bcnn_align_calloc(
+        workspace_size * sizeof(float), align_offset_, BCNN_ALLOC_WORKSPACE);
+    BCNN_CHECK_AND_LOG(ctx->log_ctx, ctx->workspace || workspace_size == 0,
+                       BCNN_FAILED_ALLOC, "Internal allocation error\n");
+    BCNN_CHECK_STATUS(bcnn_net_build_arena(ctx));
+    bcnn_net_share_workspace(ctx);
+    return BCNN_SUCCESS;
+}
+
+/* Returns the address in the context of the pointer to the buffer of a memory
+ * block of the net, NULL if the pointer does not belong to a tensor or a node
+ * of the context */
+static void **bcnn_context_block_slot(bcnn_net *ctx, bcnn_mem_block *block) {
+    bcnn_net *net = ctx->parent;
+    if (block->tensor_id >= 0) {
+        bcnn_tensor *t = &ctx->tensors[block->tensor_id];
+        return block->is_grad ? (void **)&t->grad_data : (void **)&t->data;
+    }
+    for (int i = 0; i < net->num_nodes; ++i) {
+        char *param = (char *)net->nodes[i].param;
+        char *slot = (char *)block->slot;
+        if (param != NULL && slot >= param &&
+            slot < param + net->nodes[i].param_size) {
+            return (void **)((char *)ctx->nodes[i].param + (slot - param));
+        }
+    }
+    return NULL;
+}
+
+/* Gives the context its own copy of the weights of the net, allocated by the
+ * thread that runs on the NUMA node of the context */
+static bcnn_status bcnn_context_replicate_weights(bcnn_net *ctx) {
+    bcnn_net *net = ctx->parent;
+    // The weights are laid out first in the arena of the net
+    size_t size = 0;
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        if (!b->dynamic) {
+            size = bh_max(size,
+                          b->offset + bh_round_up(b->size, BCNN_ARENA_ALIGN));
+        }
+    }
+    if (size == 0) {
+        return BCNN_SUCCESS;
+    }
+    ctx->replica =
+        bcnn_align_malloc(size, BCNN_ARENA_ALIGN, BCNN_ALLOC_WEIGHTS);
+    BCNN_CHECK_AND_LOG(ctx->log_ctx, ctx->replica, BCNN_FAILED_ALLOC,
+                       "Internal allocation error\n");
+    memcpy(ctx->replica, net->arena, size);
+    ctx->replica_size = size;
+    for (int i = 0; i < net->num_mem_blocks; ++i) {
+        bcnn_mem_block *b = &net->mem_blocks[i];
+        if (b->dynamic) {
+            continue;
+        }
+        void **slot = bcnn_context_block_slot(ctx, b);
+        // Only the pointers still shared with the net are moved
+        if (slot != NULL && *slot == *bcnn_mem_block_slot(net, b)) {
+            *slot = (char *)ctx->replica + b->offset;
+        }
+    }
+    return BCNN_SUCCESS;
+}
+
+static bcnn_status bcnn_net_create_context(bcnn_net *net, int numa_node,
+                                           int num_threads, bcnn_net **ctx) {
+    *ctx = NULL;
+#ifdef BCNN_USE_CUDA
+    BCNN_CHECK_AND_LOG(net->log_ctx, 0, BCNN_INVALID_PARAMETER,
+                       "Execution contexts are not supported on GPU\n");
+#endif
+    BCNN_CHECK_AND_LOG(
+        net->log_ctx,
+        net->parent == NULL && net->mode == BCNN_MODE_PREDICT && net->arena,
+        BCNN_INVALID_PARAMETER,
+        "Execution contexts require a net compiled in predict mode\n");
+    bcnn_net *p_ctx = (bcnn_net *)calloc(1, sizeof(bcnn_net));
+    if (p_ctx == NULL) {
+        return BCNN_FAILED_ALLOC;
+    }
+    p_ctx->parent = net;
+    // Contexts may be created and freed concurrently by the serving threads
+    bcnn_atomic_add(&net->num_contexts, 1);
+    p_ctx->batch_size = net->batch_size;
+    p_ctx->mode = net->mode;
+    p_ctx->log_ctx = net->log_ctx;
+    p_ctx->num_inputs = net->num_inputs;
+    p_ctx->inputs = net->inputs;
+    p_ctx->num_threads = num_threads;
+    p_ctx->workspace_size = net->workspace_size;
+    p_ctx->num_lanes = net->num_lanes;
+    p_ctx->num_levels = net->num_levels;
+    p_ctx->level_offsets = net->level_offsets;
+    p_ctx->schedule = net->schedule;
+    p_ctx->numa_node = numa_node;
+    bcnn_status ret =
+        (numa_node >= 0)
+            ? bcnn_thread_pool_acquire_node(numa_node, p_ctx->num_threads)
+            : bcnn_thread_pool_acquire(p_ctx->num_threads);
+    int acquired = (ret == BCNN_SUCCESS);
+    if (acquired) {
+        // The buffers of a NUMA context are placed on its node
+        int prev_node = bcnn_set_alloc_numa_node(numa_node);
+        ret = bcnn_context_init(p_ctx);
+        if (ret == BCNN_SUCCESS && numa_node >= 0) {
+            ret = bcnn_context_replicate_weights(p_ctx);
+        }
+        bcnn_set_alloc_numa_node(prev_node);
+    }
+    if (ret != BCNN_SUCCESS) {
+        bcnn_free_context(p_ctx);
+        // The reference to the pool is only held if it was acquired
+        if (acquired) {
+            bcnn_context_release_pool(p_ctx);
         }
+        bh_free(p_ctx);
+        return ret;
     }
+    *ctx = p_ctx;
+    return BCNN_SUCCESS;
 }
 
-static bcnn_status bcnn_init_workload(bcnn_net *net) {
-    // Allocate tensor for input node
-    BCNN_CHECK_STATUS(bcnn_tensor_allocate(&net->tensors[0], net->mode));
-#ifdef BCNN_USE_CUDA
-    bcnn_cuda_context *cuda_ctx = (bcnn_cuda_context *)net->cuda_ctx;
-    cuda_ctx->workspace_gpu = bcnn_cuda_malloc_f32(cuda_ctx->workspace_size);
-    for (int i = 0; i < net->num_nodes; ++i) {
-        if (net->nodes[i].type == BCNN_LAYER_CONV2D) {
-            bcnn_conv_param *param = (bcnn_conv_param *)(net->nodes[i].param);
-            param->conv_workspace_gpu = cuda_ctx->workspace_gpu;
-        }
-    }
-#endif
+bcnn_status bcnn_create_context(bcnn_net *net, bcnn_net **ctx) {
+    return bcnn_net_create_context(net, -1, net->num_threads, ctx);
+}
 
+int bcnn_get_num_numa_nodes(void) { return bcnn_numa_num_nodes(); }
+
+bcnn_status bcnn_create_numa_context(bcnn_net *net, int node, int num_threads,
+                                     bcnn_net **ctx) {
+    *ctx = NULL;
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       node >= 0 && node < bcnn_numa_num_nodes(),
+                       BCNN_INVALID_PARAMETER, "Invalid NUMA node %d\n", node);
+    // The workspaces of the layers are sized for the threads of the net
+    int max_threads =
+        bh_min(net->num_threads, bcnn_numa_node_cpus(node, NULL, 0));
+    BCNN_CHECK_STATUS(bcnn_net_create_context(
+        net, node, bh_clamp(num_threads, 1, bh_max(max_threads, 1)), ctx));
+    BCNN_INFO(net->log_ctx,
+              "Context on NUMA node %d: %d threads, %.2f MB of weights\n",
+              node, (*ctx)->num_threads, (*ctx)->replica_size / 1048576.0f);
     return BCNN_SUCCESS;
 }
 
-int bcnn_get_batch_size(bcnn_net *net) { return net->batch_size; }
+static void bcnn_free_context(bcnn_net *ctx) {
+    bcnn_net_release_arena(ctx, 0);
+    // Only the buffers that were not moved into the arena are left here
+    for (int i = 0; i < ctx->num_tensors; ++i) {
+        if (!bcnn_net_is_shared_buffer(ctx, ctx->tensors[i].data)) {
+            bcnn_align_free(ctx->tensors[i].data);
+        }
+    }
+    for (int i = 0; i < ctx->num_nodes; ++i) {
+        bcnn_context_free_node_buffers(ctx, &ctx->nodes[i]);
+        bh_free(ctx->nodes[i].param);
+    }
+    bh_free(ctx->tensors);
+    bh_free(ctx->nodes);
+    bh_free(ctx->outputs);
+    bcnn_align_free(ctx->workspace);
+#ifndef BCNN_USE_BLAS
+    bcnn_align_free(ctx->gemm_ctx);
+#endif
+    bcnn_align_free(ctx->replica);
+    bcnn_atomic_sub(&ctx->parent->num_contexts, 1);
+}
 
-bcnn_status bcnn_compile_net(bcnn_net *net) {
-    bcnn_free_workload(net);
-    return bcnn_init_workload(net);
+/* Drops the reference of the context to its thread pool */
+static void bcnn_context_release_pool(bcnn_net *ctx) {
+    if (ctx->numa_node >= 0) {
+        bcnn_thread_pool_release_node(ctx->numa_node);
+    } else {
+        bcnn_thread_pool_release();
+    }
 }
 
 static void bcnn_reset_gradients(bcnn_net *net, bcnn_node *node) {
@@ -407,20 +2032,127 @@ bcnn_tensor *bcnn_get_tensor_by_name(bcnn_net *net, const char *name) {
     return bcnn_get_tensor_by_index(net, index);
 }
 
-void bcnn_forward(bcnn_net *net) {
-    for (int i = 0; i < net->num_nodes; ++i) {
-        bcnn_node *node = &net->nodes[i];
-        if (net->mode == BCNN_MODE_TRAIN) {
-            bcnn_reset_gradients(net, node);
-        }
-        // bh_timer t = {0};
-        // bh_timer_start(&t);
+/* Nodes that feed none of the requested outputs are not run, neither are the
+ * cost layers in predict mode unless their output is requested */
+static int bcnn_net_skip_node(bcnn_net *net, bcnn_node *node) {
+    if (net->mode == BCNN_MODE_TRAIN) {
+        return 0;
+    }
+    return node->skip ||
+           (node->type == BCNN_LAYER_COST && net->mode == BCNN_MODE_PREDICT &&
+            net->num_outputs == 0 && !net->need_loss);
+}
+
+static inline void bcnn_net_run_node(bcnn_net *net, bcnn_node *node,
+                                     int index) {
+    if (net->profiler != NULL) {
+        bcnn_profiler_run_node(net, node, index);
+    } else {
         node->forward(net, node);
-        // bh_timer_stop(&t);
-        // fprintf(stderr, "node %d %f\n", i, bh_timer_get_msec(&t));
     }
 }
 
+typedef struct {
+    bcnn_net *net;
+    int begin;
+    int end;
+    int first; /* Range of the nodes indexes to run */
+    int last;
+} bcnn_level_job;
+
+static void bcnn_forward_lanes(void *arg, int lane_begin, int lane_end) {
+    bcnn_level_job *job = (bcnn_level_job *)arg;
+    bcnn_net *net = job->net;
+    for (int lane = lane_begin; lane < lane_end; ++lane) {
+        for (int k = job->begin; k < job->end; ++k) {
+            int i = net->schedule[k];
+            bcnn_node *node = &net->nodes[i];
+            if (node->lane == lane && i >= job->first && i <= job->last &&
+                !bcnn_net_skip_node(net, node)) {
+                bcnn_net_run_node(net, node, i);
+            }
+        }
+    }
+}
+
+/* Runs the nodes of a level of the schedule, each lane on its own thread */
+static void bcnn_forward_level(bcnn_net *net, int level, int first,
+                               int last) {
+    bcnn_level_job job = {net, net->level_offsets[level],
+                          net->level_offsets[level + 1], first, last};
+    int num_lanes = bh_min(net->num_lanes, job.end - job.begin);
+    int num_threads = bcnn_profiler_uses_counters(net) ? 1 : num_lanes;
+    bcnn_parallel_for(num_lanes, num_threads, bcnn_forward_lanes, &job);
+}
+
+/* Runs the nodes whose index is in [first, last] in the order the memory of
+ * the net has been planned for */
+static void bcnn_net_forward_range(bcnn_net *net, int first, int last) {
+    int prev_node = -1;
+    if (net->numa_node >= 0) {
+        // Kernels run on the threads of the node of the context
+        prev_node = bcnn_thread_pool_bind_node(net->numa_node);
+    }
+    if (net->profiler != NULL) {
+        bcnn_profiler_begin_run(net);
+    }
+    if (net->num_levels > 0) {
+        for (int l = 0; l < net->num_levels; ++l) {
+            bcnn_forward_level(net, l, first, last);
+        }
+    } else {
+        for (int i = first; i <= last; ++i) {
+            bcnn_node *node = &net->nodes[i];
+            if (bcnn_net_skip_node(net, node)) {
+                continue;
+            }
+            if (net->mode == BCNN_MODE_TRAIN) {
+                bcnn_reset_gradients(net, node);
+            }
+            bcnn_net_run_node(net, node, i);
+        }
+    }
+    if (net->profiler != NULL) {
+        bcnn_profiler_end_run(net);
+    }
+    if (net->numa_node >= 0) {
+        bcnn_thread_pool_bind_node(prev_node);
+    }
+}
+
+void bcnn_net_forward(bcnn_net *net) {
+    bcnn_net_forward_range(net, 0, net->num_nodes - 1);
+}
+
+void bcnn_forward(bcnn_net *net) {
+    if (net->async != NULL) {
+        bcnn_async_commit_inputs(net);
+    }
+    bcnn_net_forward(net);
+}
+
+bcnn_status bcnn_forward_range(bcnn_net *net, int first, int last) {
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       first >= 0 && first <= last && last < net->num_nodes,
+                       BCNN_INVALID_PARAMETER,
+                       "Invalid nodes range [%d, %d]\n", first, last);
+    if (net->async != NULL) {
+        bcnn_async_commit_inputs(net);
+    }
+    bcnn_net_forward_range(net, first, last);
+    return BCNN_SUCCESS;
+}
+
+int bcnn_get_num_nodes(bcnn_net *net) { return net->num_nodes; }
+
+int bcnn_get_node_index_by_output_name(bcnn_net *net, const char *name) {
+    int t_id = bcnn_get_tensor_index_by_name(net, name);
+    if (t_id < 0) {
+        return -1;
+    }
+    return bcnn_net_find_producer(net, t_id, net->num_nodes);
+}
+
 void bcnn_backward(bcnn_net *net) {
     for (int i = net->num_nodes - 1; i >= 0; --i) {
         bcnn_node *node = &net->nodes[i];
@@ -465,8 +2197,11 @@ float bcnn_train_on_batch(bcnn_net *net) {
 float bcnn_predict_on_batch(bcnn_net *net, bcnn_tensor **out) {
     // Get next batch of data
     bcnn_loader_next(net);
-    // Forward
+    // Forward. The loader provides the labels: the cost nodes are run to
+    // return the loss
+    net->need_loss = 1;
     bcnn_forward(net);
+    net->need_loss = 0;
     // Extract output tensor
     int out_id = net->nodes[net->num_nodes - 1].dst[0];
     if (net->nodes[net->num_nodes - 1].type == BCNN_LAYER_COST) {
@@ -592,9 +2327,60 @@ void bcnn_net_set_param(bcnn_net *net, const char *name, const char *val) {
     }
 }
 
+static int bcnn_model_find_format(const char *filename) {
+    int format = 0;  // default is BCNN
+    // Parse filename extension
+    char **toks = NULL;
+    int ntoks = bh_strsplit((char *)filename, '.', &toks);
+    if (strcmp(toks[ntoks - 1], "weights") == 0) {
+        format = 1;  // Darknet
+    } else if (strcmp(toks[ntoks - 1], "onnx") == 0) {
+        format = 2;  // onnx
+    } else if (strcmp(toks[ntoks - 1], "bcnnmodel") == 0) {
+        format = 3;  // bcnn v2
+    }
+    for (int i = 0; i < ntoks; ++i) {
+        bh_free(toks[i]);
+    }
+    bh_free(toks);
+    return format;
+}
+
 #define BCNN_MAGIC "\x42\x43\x4E\x4E"
 
+bcnn_status bcnn_set_model_precision(bcnn_net *net, bcnn_precision precision) {
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       precision == BCNN_PRECISION_F32 ||
+                           precision == BCNN_PRECISION_F16,
+                       BCNN_INVALID_PARAMETER, "Unknown model precision %d\n",
+                       (int)precision);
+    net->model_precision = precision;
+    return BCNN_SUCCESS;
+}
+
+/* Flags of the model files written by the net */
+static uint32_t bcnn_net_model_flags(bcnn_net *net) {
+    return (net->model_precision == BCNN_PRECISION_F16) ? BCNN_MODEL_FLAG_F16
+                                                        : 0;
+}
+
 bcnn_status bcnn_save_weights(bcnn_net *net, const char *filename) {
+    // The fused nodes hold folded weights: a model saved from them would be
+    // folded a second time when compiled after being loaded
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->num_fused == 0,
+                       BCNN_INVALID_PARAMETER,
+                       "Can not save model %s: %d layers were fused by "
+                       "bcnn_compile_net, the weights must be saved before "
+                       "the compilation\n",
+                       filename, net->num_fused);
+    if (bcnn_model_find_format(filename) == 3) {
+        return bcnn_model_save(net, filename, bcnn_net_model_flags(net));
+    }
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       net->model_precision == BCNN_PRECISION_F32,
+                       BCNN_INVALID_PARAMETER,
+                       "Half precision weights are only written in format v2 "
+                       "('.bcnnmodel')\n");
     FILE *fp = fopen(filename, "wb");
     BCNN_CHECK_AND_LOG(net->log_ctx, fp, BCNN_INVALID_PARAMETER,
                        "Could not open model file %s\n", filename);
@@ -680,6 +2466,45 @@ bcnn_status bcnn_save_weights(bcnn_net *net, const char *filename) {
     return BCNN_SUCCESS;
 }
 
+bcnn_status bcnn_save_weights_async(bcnn_net *net, const char *filename) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->num_fused == 0,
+                       BCNN_INVALID_PARAMETER,
+                       "Can not save model %s: %d layers were fused by "
+                       "bcnn_compile_net, the weights must be saved before "
+                       "the compilation\n",
+                       filename, net->num_fused);
+    BCNN_CHECK_AND_LOG(net->log_ctx, bcnn_model_find_format(filename) == 3,
+                       BCNN_INVALID_PARAMETER,
+                       "Model %s: weights are only saved asynchronously in "
+                       "format v2 ('.bcnnmodel')\n",
+                       filename);
+    return bcnn_model_save_async(net, filename, bcnn_net_model_flags(net));
+}
+
+bcnn_status bcnn_wait_save(bcnn_net *net) { return bcnn_model_wait_save(net); }
+
+bcnn_status bcnn_save_inference_model(bcnn_net *net, const char *filename) {
+    return bcnn_model_save(
+        net, filename, BCNN_MODEL_FLAG_PREPARED | bcnn_net_model_flags(net));
+}
+
+bcnn_status bcnn_save_plan(bcnn_net *net, const char *filename) {
+    return bcnn_model_save(net, filename, BCNN_MODEL_FLAG_PREPARED |
+                                              BCNN_MODEL_FLAG_GRAPH |
+                                              bcnn_net_model_flags(net));
+}
+
+bcnn_status bcnn_load_plan(bcnn_net *net, const char *filename) {
+    bh_timer t = {0};
+    bh_timer_start(&t);
+    BCNN_CHECK_STATUS(bcnn_model_load_graph(net, filename));
+    BCNN_CHECK_STATUS(bcnn_compile_net(net));
+    bh_timer_stop(&t);
+    BCNN_INFO(net->log_ctx, "Compiled net %s ready in %.3f ms\n", filename,
+              bh_timer_get_msec(&t));
+    return BCNN_SUCCESS;
+}
+
 typedef struct {
     int stride;
     int pad;
@@ -1217,273 +3042,359 @@ bcnn_status bcnn_load_net(bcnn_net *net, const char *config_path,
     return BCNN_SUCCESS;
 }
 
-static bcnn_status bcnn_load_conv_weights(bcnn_net *net, bcnn_node *node,
-                                          FILE *fp, int format) {
-    bcnn_tensor *w = &net->tensors[node->src[1]];  // weights
-    bcnn_tensor *b = &net->tensors[node->src[2]];  // biases
-    int w_sz = bcnn_tensor_size(w);
-    int b_sz = bcnn_tensor_size(b);
-    int nr = 0;
-    BCNN_CHECK_AND_LOG(
-        net->log_ctx, (nr = fread(b->data, sizeof(float), b_sz, fp)) == b_sz,
-        BCNN_INVALID_MODEL,
-        "Inconsistent biases size %s: expected %d but found %lu\n", b->name,
-        b_sz, (unsigned long)nr);
-    if (format == 0) {
-        BCNN_CHECK_AND_LOG(
-            net->log_ctx,
-            (nr = fread(w->data, sizeof(float), w_sz, fp)) == w_sz,
-            BCNN_INVALID_MODEL,
-            "Inconsistent weights size %s: expected %d but found %lu\n",
-            w->name, w_sz, (unsigned long)nr);
+/* Folds the batchnorm means / variances into the scales and biases */
+static void bcnn_fold_batchnorm_stats(const float *m, const float *v, float *s,
+                                      float *b, int sz) {
+    for (int i = 0; i < sz; ++i) {
+        b[i] = b[i] - (s[i] * m[i]) / (sqrtf(v[i] + 0.000001f));
+        s[i] = s[i] / (sqrtf(v[i] + 0.000001f));
     }
-    if (node->type == BCNN_LAYER_CONV2D) {
+}
+
+static void bcnn_transpose(float *a, int rows, int cols) {
+    float *transpose = (float *)calloc(rows * cols, sizeof(float));
+    int x, y;
+    for (x = 0; x < rows; ++x) {
+        for (y = 0; y < cols; ++y) {
+            transpose[y * rows + x] = a[x * cols + y];
+        }
+    }
+    memcpy(a, transpose, rows * cols * sizeof(float));
+    free(transpose);
+}
+
+/* Region of a model file read into a parameter tensor */
+typedef struct bcnn_weights_chunk {
+    float *data;
+    size_t size; /* Number of floats */
+    int64_t offset;
+} bcnn_weights_chunk;
+
+/* Weights of a node: they are read and converted independently of the other
+ * nodes */
+typedef struct bcnn_weights_job {
+    bcnn_node *node;
+    int first_chunk;
+    int num_chunks;
+    int64_t size; /* Size in bytes of the chunks */
+    bcnn_status status;
+    double read_ms;
+    double convert_ms;
+} bcnn_weights_job;
+
+/* Maximum number of chunks of a node: biases, weights, batchnorm means /
+ * variances / scales and prelu slopes */
+#define BCNN_WEIGHTS_MAX_CHUNKS 6
+
+typedef struct bcnn_weights_loader {
+    bcnn_net *net;
+    FILE *fp;
+    int format;
+    int need_transpose;
+    int64_t offset; /* Offset of the next chunk in the file */
+    bcnn_weights_chunk *chunks;
+    int num_chunks;
+    bcnn_weights_job *jobs;
+    int num_jobs;
+    int next_job;
+} bcnn_weights_loader;
+
+static void bcnn_weights_add_chunk(bcnn_weights_loader *loader, float *data,
+                                   size_t size) {
+    bcnn_weights_chunk *chunk = &loader->chunks[loader->num_chunks++];
+    chunk->data = data;
+    chunk->size = size;
+    chunk->offset = loader->offset;
+    loader->offset += (int64_t)(size * sizeof(float));
+}
+
+static void bcnn_weights_add_tensor(bcnn_weights_loader *loader,
+                                    bcnn_tensor *t) {
+    bcnn_weights_add_chunk(loader, t->data, bcnn_tensor_size(t));
+}
+
+/* Lists the chunks of the weights of a node in the order they are written in
+ * the file. The file offsets of all the nodes are thus known before anything
+ * is read. */
+static void bcnn_weights_add_node(bcnn_weights_loader *loader,
+                                  bcnn_node *node) {
+    bcnn_tensor *t = loader->net->tensors;
+    int format = loader->format;
+    bcnn_weights_job *job = &loader->jobs[loader->num_jobs];
+    memset(job, 0, sizeof(*job));
+    job->node = node;
+    job->first_chunk = loader->num_chunks;
+    int64_t begin = loader->offset;
+    if (node->type == BCNN_LAYER_CONV2D ||
+        node->type == BCNN_LAYER_TRANSPOSE_CONV2D ||
+        node->type == BCNN_LAYER_DEPTHWISE_CONV2D) {
         bcnn_conv_param *param = (bcnn_conv_param *)node->param;
-        if (param->batch_norm == 1) {
-            bcnn_tensor *m = &net->tensors[node->src[3]];  // means
-            bcnn_tensor *v = &net->tensors[node->src[4]];  // variances
-            bcnn_tensor *s = &net->tensors[node->src[5]];  // scales
-            int m_sz = bcnn_tensor_size(m);
-            int v_sz = bcnn_tensor_size(v);
-            int s_sz = bcnn_tensor_size(s);
+        int is_conv = (node->type == BCNN_LAYER_CONV2D);
+        int bn = (is_conv && param->batch_norm == 1);
+        bcnn_weights_add_tensor(loader, &t[node->src[2]]);  // biases
+        if (format == 0) {
+            bcnn_weights_add_tensor(loader, &t[node->src[1]]);  // weights
+        }
+        if (bn) {
             if (format == 1) {
-                BCNN_CHECK_AND_LOG(
-                    net->log_ctx,
-                    (nr = fread(s->data, sizeof(float), s_sz, fp)) == s_sz,
-                    BCNN_INVALID_MODEL,
-                    "Inconsistent batchnorm scales size: "
-                    "expected %d but found %lu\n",
-                    s_sz, (unsigned long)nr);
+                bcnn_weights_add_tensor(loader, &t[node->src[5]]);  // scales
             }
-            BCNN_CHECK_AND_LOG(
-                net->log_ctx,
-                (nr = fread(m->data, sizeof(float), m_sz, fp)) == m_sz,
-                BCNN_INVALID_MODEL,
-                "Inconsistent batchnorm means size: expected %d but found "
-                "%lu\n",
-                m_sz, (unsigned long)nr);
-            BCNN_CHECK_AND_LOG(
-                net->log_ctx,
-                (nr = fread(v->data, sizeof(float), v_sz, fp)) == v_sz,
-                BCNN_INVALID_MODEL,
-                "Inconsistent batchnorm variances size: "
-                "expected %d but found %lu\n",
-                v_sz, (unsigned long)nr);
+            bcnn_weights_add_tensor(loader, &t[node->src[3]]);  // means
+            bcnn_weights_add_tensor(loader, &t[node->src[4]]);  // variances
             if (format == 0) {
-                BCNN_CHECK_AND_LOG(
-                    net->log_ctx,
-                    (nr = fread(s->data, sizeof(float), s_sz, fp)) == s_sz,
-                    BCNN_INVALID_MODEL,
-                    "Inconsistent batchnorm scales size: "
-                    "expected %d but found %lu\n",
-                    s_sz, (unsigned long)nr);
-            }
-#ifndef BCNN_USE_CUDA
-            if (net->mode == BCNN_MODE_PREDICT) {
-                // Fuse mean / variance into scales and biases for optimal
-                // inference speed
-                for (int i = 0; i < s_sz; ++i) {
-                    b->data[i] =
-                        b->data[i] - (s->data[i] * m->data[i]) /
-                                         (sqrtf(v->data[i] + 0.000001f));
-                    s->data[i] = s->data[i] / (sqrtf(v->data[i] + 0.000001f));
-                }
+                bcnn_weights_add_tensor(loader, &t[node->src[5]]);  // scales
             }
-#endif
-#ifdef BCNN_USE_CUDA
-            bcnn_cuda_memcpy_host2dev(m->data_gpu, m->data, m_sz);
-            bcnn_cuda_memcpy_host2dev(v->data_gpu, v->data, v_sz);
-            bcnn_cuda_memcpy_host2dev(s->data_gpu, s->data, s_sz);
-#endif
         }
-    }
-    if (format == 1) {
-        BCNN_CHECK_AND_LOG(
-            net->log_ctx,
-            (nr = fread(w->data, sizeof(float), w_sz, fp)) == w_sz,
-            BCNN_INVALID_MODEL,
-            "Inconsistent weights size %s: expected %d but found %lu\n",
-            w->name, w_sz, (unsigned long)nr);
-    }
-    if (node->type == BCNN_LAYER_CONV2D) {
-        bcnn_conv_param *param = (bcnn_conv_param *)node->param;
-        if (param->activation == BCNN_ACT_PRELU) {
+        if (format == 1) {
+            bcnn_weights_add_tensor(loader, &t[node->src[1]]);  // weights
+        }
+        if (is_conv && param->activation == BCNN_ACT_PRELU) {
             // prelu slopes: 3 if no batchnorm, 6 if batchnorm
-            int tid = 3 + 3 * (param->batch_norm);
-            bcnn_tensor *slopes = &net->tensors[node->src[tid]];
-            int slopes_sz = bcnn_tensor_size(slopes);
-            int nr = 0;
-            BCNN_CHECK_AND_LOG(
-                net->log_ctx,
-                (nr = fread(slopes->data, sizeof(float), slopes_sz, fp)) ==
-                    slopes_sz,
-                BCNN_INVALID_MODEL,
-                "Inconsistent prelu slopes size: expected %d but found %lu\n",
-                slopes_sz, (unsigned long)nr);
+            bcnn_weights_add_tensor(loader, &t[node->src[3 + 3 * bn]]);
+        }
+    } else if (node->type == BCNN_LAYER_ACTIVATION) {
+        bcnn_activation_param *param = (bcnn_activation_param *)node->param;
+        if (param->activation == BCNN_ACT_PRELU && format == 0) {
+            bcnn_weights_add_tensor(loader, &t[node->src[1]]);
         }
+    } else if (node->type == BCNN_LAYER_BATCHNORM) {
+        int sz = t[node->dst[0]].c;
+        if (format == 1) {
+            bcnn_weights_add_chunk(loader, t[node->src[3]].data, sz);
+        }
+        bcnn_weights_add_chunk(loader, t[node->src[1]].data, sz);
+        bcnn_weights_add_chunk(loader, t[node->src[2]].data, sz);
+        if (format == 0) {
+            bcnn_weights_add_chunk(loader, t[node->src[3]].data, sz);
+            bcnn_weights_add_chunk(loader, t[node->src[4]].data, sz);
+        }
+    } else if (node->type == BCNN_LAYER_FULL_CONNECTED) {
+        bcnn_weights_add_tensor(loader, &t[node->src[2]]);  // biases
+        bcnn_weights_add_tensor(loader, &t[node->src[1]]);  // weights
+    }
+    job->num_chunks = loader->num_chunks - job->first_chunk;
+    job->size = loader->offset - begin;
+    if (job->num_chunks > 0) {
+        loader->num_jobs++;
     }
+}
 
-    // Re-ordering weights for layout NC4HW4
-    if (node->type == BCNN_LAYER_CONV2D) {
-        bcnn_conv_param *param = (bcnn_conv_param *)node->param;
-        if (param->size == 3 && param->stride == 1 && param->num_groups == 1 &&
-            net->mode == BCNN_MODE_PREDICT) {
-            bcnn_conv3x3_convert_weights(w->data, param->weights_workspace,
-                                         net->tensors[node->src[0]].c,
-                                         net->tensors[node->dst[0]].c);
-            memcpy(param->biases_workspace, b->data,
-                   bcnn_tensor_size(b) * sizeof(float));
-            if (param->batch_norm == 1) {
-                bcnn_tensor *s = &net->tensors[node->src[5]];
-                memcpy(param->scales_workspace, s->data,
-                       bcnn_tensor_size(s) * sizeof(float));
-            }
-            if (param->activation == BCNN_ACT_PRELU) {
-                int tid = 3 + 3 * (param->batch_norm);
-                bcnn_tensor *slopes = &net->tensors[node->src[tid]];
-                memcpy(param->slopes_workspace, slopes->data,
-                       bcnn_tensor_size(slopes) * sizeof(float));
-            }
+/* Reads a chunk. Positioned reads let the threads share the file. */
+static int bcnn_weights_read(bcnn_weights_loader *loader,
+                             const bcnn_weights_chunk *chunk) {
+    size_t size = chunk->size * sizeof(float);
+#ifdef BCNN_HAS_PREAD
+    char *dst = (char *)chunk->data;
+    off_t offset = (off_t)chunk->offset;
+    int fd = fileno(loader->fp);
+    while (size > 0) {
+        ssize_t n = pread(fd, dst, size, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
         }
+        if (n <= 0) {
+            return -1;
+        }
+        dst += n;
+        size -= (size_t)n;
+        offset += n;
     }
-
-#ifdef BCNN_USE_CUDA
-    bcnn_cuda_memcpy_host2dev(w->data_gpu, w->data, w_sz);
-    bcnn_cuda_memcpy_host2dev(b->data_gpu, b->data, b_sz);
+    return 0;
+#else
+    return (fseek(loader->fp, (long)chunk->offset, SEEK_SET) != 0 ||
+            fread(chunk->data, 1, size, loader->fp) != size)
+               ? -1
+               : 0;
 #endif
-    return BCNN_SUCCESS;
 }
 
-static bcnn_status bcnn_load_batchnorm_weights(bcnn_net *net, bcnn_node *node,
-                                               FILE *fp, int format) {
-    bcnn_tensor *m = &net->tensors[node->src[1]];  // means
-    bcnn_tensor *v = &net->tensors[node->src[2]];  // variances
-    bcnn_tensor *s = &net->tensors[node->src[3]];  // scales
-    bcnn_tensor *b = &net->tensors[node->src[4]];  // biases
-    int sz = net->tensors[node->dst[0]].c;
-    int nr = 0;
-    if (format == 1) {
-        BCNN_CHECK_AND_LOG(
-            net->log_ctx, (nr = fread(s->data, sizeof(float), sz, fp)) == sz,
-            BCNN_INVALID_MODEL,
-            "Inconsistent scales size: expected %d but found %lu\n", sz,
-            (unsigned long)nr);
+/* Reads the weights of a node, then folds the batchnorm statistics and
+ * re-orders the weights for the kernel */
+static void bcnn_weights_run_job(bcnn_weights_loader *loader,
+                                 bcnn_weights_job *job) {
+    bcnn_net *net = loader->net;
+    bcnn_node *node = job->node;
+    bh_timer t = {0};
+    bh_timer_start(&t);
+    for (int i = 0; i < job->num_chunks; ++i) {
+        if (bcnn_weights_read(loader, &loader->chunks[job->first_chunk + i])) {
+            bcnn_log(net->log_ctx, BCNN_LOG_ERROR,
+                     "Could not read the weights of %s layer %s\n",
+                     bcnn_net_node_type2str(node->type),
+                     net->tensors[node->dst[0]].name);
+            job->status = BCNN_INVALID_MODEL;
+            return;
+        }
     }
-    BCNN_CHECK_AND_LOG(net->log_ctx,
-                       (nr = fread(m->data, sizeof(float), sz, fp)) == sz,
-                       BCNN_INVALID_MODEL,
-                       "Inconsistent means size: expected %d but found %lu\n",
-                       sz, (unsigned long)nr);
-    BCNN_CHECK_AND_LOG(
-        net->log_ctx, (nr = fread(v->data, sizeof(float), sz, fp)) == sz,
-        BCNN_INVALID_MODEL,
-        "Inconsistent variances size: expected %d but found %lu\n", sz,
-        (unsigned long)nr);
-    if (format == 0) {
-        BCNN_CHECK_AND_LOG(
-            net->log_ctx, (nr = fread(s->data, sizeof(float), sz, fp)) == sz,
-            BCNN_INVALID_MODEL,
-            "Inconsistent scales size: expected %d but found %lu\n", sz,
-            (unsigned long)nr);
-        BCNN_CHECK_AND_LOG(
-            net->log_ctx, (nr = fread(b->data, sizeof(float), sz, fp)) == sz,
-            BCNN_INVALID_MODEL,
-            "Inconsistent biases size: expected %d but found %lu\n", sz,
-            (unsigned long)nr);
+    bh_timer_stop(&t);
+    job->read_ms = bh_timer_get_msec(&t);
+    bh_timer_start(&t);
+    if (node->type == BCNN_LAYER_FULL_CONNECTED && loader->need_transpose) {
+        bcnn_transpose(net->tensors[node->src[1]].data,
+                       bcnn_tensor_size3d(&net->tensors[node->src[0]]),
+                       bcnn_tensor_size3d(&net->tensors[node->dst[0]]));
     }
-#ifndef BCNN_USE_CUDA
-    if (net->mode == BCNN_MODE_PREDICT) {
-        // Fuse mean / variance into scales and biases for optimal
-        // inference speed
-        for (int i = 0; i < sz; ++i) {
-            b->data[i] = b->data[i] - (s->data[i] * m->data[i]) /
-                                          (sqrtf(v->data[i] + 0.000001f));
-            s->data[i] = s->data[i] / (sqrtf(v->data[i] + 0.000001f));
-        }
+    job->status = bcnn_net_prepare_weights(net, node, 0, 0);
+    bh_timer_stop(&t);
+    job->convert_ms = bh_timer_get_msec(&t);
+}
+
+/* Each thread picks the next pending job until there is none left */
+static void bcnn_weights_task(void *arg, int begin, int end) {
+    bcnn_weights_loader *loader = (bcnn_weights_loader *)arg;
+#ifdef BCNN_HAS_PREAD
+    for (int i = __atomic_fetch_add(&loader->next_job, 1, __ATOMIC_RELAXED);
+         i < loader->num_jobs;
+         i = __atomic_fetch_add(&loader->next_job, 1, __ATOMIC_RELAXED)) {
+        bcnn_weights_run_job(loader, &loader->jobs[i]);
+    }
+#else
+    for (int i = 0; i < loader->num_jobs; ++i) {
+        bcnn_weights_run_job(loader, &loader->jobs[i]);
     }
 #endif
-#ifdef BCNN_USE_CUDA
-    bcnn_cuda_memcpy_host2dev(m->data_gpu, m->data, sz);
-    bcnn_cuda_memcpy_host2dev(v->data_gpu, v->data, sz);
-    bcnn_cuda_memcpy_host2dev(s->data_gpu, s->data, sz);
-    bcnn_cuda_memcpy_host2dev(b->data_gpu, b->data, sz);
-#endif
-    return BCNN_SUCCESS;
 }
 
-static bcnn_status bcnn_load_prelu_weights(bcnn_net *net, bcnn_node *node,
-                                           FILE *fp, int format) {
-    bcnn_tensor *w = &net->tensors[node->src[1]];
-    int w_sz = bcnn_tensor_size(w);
-    int nr = 0;
-    BCNN_CHECK_AND_LOG(
-        net->log_ctx, (nr = fread(w->data, sizeof(float), w_sz, fp)) == w_sz,
-        BCNN_INVALID_MODEL,
-        "Inconsistent prelu weights size: expected %d but found %lu\n", w_sz,
-        (unsigned long)nr);
-    return BCNN_SUCCESS;
+/* Largest jobs first so that the last ones picked are short */
+static int bcnn_weights_job_cmp(const void *a, const void *b) {
+    int64_t sa = ((const bcnn_weights_job *)a)->size;
+    int64_t sb = ((const bcnn_weights_job *)b)->size;
+    return (sa < sb) - (sa > sb);
 }
 
-static void bcnn_transpose(float *a, int rows, int cols) {
-    float *transpose = (float *)calloc(rows * cols, sizeof(float));
-    int x, y;
-    for (x = 0; x < rows; ++x) {
-        for (y = 0; y < cols; ++y) {
-            transpose[y * rows + x] = a[x * cols + y];
+/* Loads the weights of a model in format v1 or Darknet from 'fp', positioned
+ * after the header. The weights of the nodes are read and converted on the
+ * threads of the net. */
+static bcnn_status bcnn_load_weights_parallel(bcnn_net *net, FILE *fp,
+                                              const char *filename, int format,
+                                              int need_transpose) {
+    bh_timer total = {0};
+    bh_timer_start(&total);
+    bcnn_weights_loader loader = {0};
+    loader.net = net;
+    loader.fp = fp;
+    loader.format = format;
+    loader.need_transpose = need_transpose;
+    loader.offset = ftell(fp);
+    int64_t file_size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        file_size = ftell(fp);
+    }
+    BCNN_CHECK_AND_LOG(net->log_ctx, loader.offset >= 0 && file_size >= 0,
+                       BCNN_INVALID_MODEL, "Can not read model file %s\n",
+                       filename);
+    loader.chunks = (bcnn_weights_chunk *)calloc(
+        (size_t)net->num_nodes * BCNN_WEIGHTS_MAX_CHUNKS + 1,
+        sizeof(bcnn_weights_chunk));
+    loader.jobs = (bcnn_weights_job *)calloc((size_t)net->num_nodes + 1,
+                                             sizeof(bcnn_weights_job));
+    if (loader.chunks == NULL || loader.jobs == NULL) {
+        bh_free(loader.chunks);
+        bh_free(loader.jobs);
+        BCNN_ERROR(net->log_ctx, BCNN_FAILED_ALLOC,
+                   "Internal allocation error\n");
+    }
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_weights_add_node(&loader, &net->nodes[i]);
+    }
+    // As with Darknet, a file that ends early only initializes the first
+    // layers, e.g. with the weights of a pre-trained backbone
+    int num_layers = loader.num_jobs;
+    while (loader.num_jobs > 0) {
+        bcnn_weights_job *last = &loader.jobs[loader.num_jobs - 1];
+        if (loader.chunks[last->first_chunk].offset + last->size <=
+            file_size) {
+            break;
         }
+        loader.num_jobs--;
     }
-    memcpy(a, transpose, rows * cols * sizeof(float));
-    free(transpose);
-}
-
-static bcnn_status bcnn_load_fullc_weights(bcnn_net *net, bcnn_node *node,
-                                           FILE *fp, int format,
-                                           int need_transpose) {
-    bcnn_tensor *w = &net->tensors[node->src[1]];  // weights
-    bcnn_tensor *b = &net->tensors[node->src[2]];  // biases
-    int w_sz = bcnn_tensor_size(w);
-    int b_sz = bcnn_tensor_size(b);
-    int nr = 0;
-    BCNN_CHECK_AND_LOG(
-        net->log_ctx, (nr = fread(b->data, sizeof(float), b_sz, fp)) == b_sz,
-        BCNN_INVALID_MODEL,
-        "Inconsistent biases size %s: expected %d but found %lu\n", b->name,
-        b_sz, (unsigned long)nr);
-    BCNN_CHECK_AND_LOG(
-        net->log_ctx, (nr = fread(w->data, sizeof(float), w_sz, fp)) == w_sz,
-        BCNN_INVALID_MODEL,
-        "Inconsistent weights size %s: expected %d but found %lu\n", w->name,
-        w_sz, (unsigned long)nr);
-    if (need_transpose) {
-        bcnn_transpose(w->data, bcnn_tensor_size3d(&net->tensors[node->src[0]]),
-                       bcnn_tensor_size3d(&net->tensors[node->dst[0]]));
+    if (loader.num_jobs < num_layers) {
+        BCNN_WARNING(net->log_ctx,
+                     "Model file %s only holds the weights of the first %d "
+                     "layers out of %d\n",
+                     filename, loader.num_jobs, num_layers);
     }
-#ifdef BCNN_USE_CUDA
-    bcnn_cuda_memcpy_host2dev(w->data_gpu, w->data, w_sz);
-    bcnn_cuda_memcpy_host2dev(b->data_gpu, b->data, b_sz);
+    qsort(loader.jobs, loader.num_jobs, sizeof(bcnn_weights_job),
+          bcnn_weights_job_cmp);
+#ifdef BCNN_HAS_PREAD
+    int num_threads = bh_min(net->num_threads, loader.num_jobs);
+#else
+    int num_threads = 1;
 #endif
-    return BCNN_SUCCESS;
+    bcnn_parallel_for(num_threads, num_threads, bcnn_weights_task, &loader);
+    bcnn_status ret = BCNN_SUCCESS;
+    double read_ms = 0, convert_ms = 0;
+    for (int i = 0; i < loader.num_jobs; ++i) {
+        if (ret == BCNN_SUCCESS) {
+            ret = loader.jobs[i].status;
+        }
+        read_ms += loader.jobs[i].read_ms;
+        convert_ms += loader.jobs[i].convert_ms;
+    }
+    bh_free(loader.chunks);
+    bh_free(loader.jobs);
+    bh_timer_stop(&total);
+    if (ret == BCNN_SUCCESS) {
+        BCNN_INFO(net->log_ctx,
+                  "Model %s loaded succesfully in %.2f ms: %d layers on %d "
+                  "threads, read %.2f ms, conversion %.2f ms (cumulated over "
+                  "the threads)\n",
+                  filename, bh_timer_get_msec(&total), loader.num_jobs,
+                  num_threads, read_ms, convert_ms);
+    }
+    return ret;
 }
 
-static int bcnn_model_find_format(const char *filename) {
-    int format = 0;  // default is BCNN
-    // Parse filename extension
-    char **toks = NULL;
-    int ntoks = bh_strsplit((char *)filename, '.', &toks);
-    if (strcmp(toks[ntoks - 1], "weights") == 0) {
-        format = 1;  // Darknet
-    } else if (strcmp(toks[ntoks - 1], "onnx") == 0) {
-        format = 2;  // onnx
+bcnn_status bcnn_net_prepare_weights(bcnn_net *net, bcnn_node *node,
+                                     int folded, int packed) {
+#ifndef BCNN_USE_CUDA
+    if (net->mode == BCNN_MODE_PREDICT && !folded) {
+        if (node->type == BCNN_LAYER_CONV2D &&
+            ((bcnn_conv_param *)node->param)->batch_norm == 1) {
+            bcnn_tensor *s = &net->tensors[node->src[5]];
+            bcnn_fold_batchnorm_stats(net->tensors[node->src[3]].data,
+                                      net->tensors[node->src[4]].data, s->data,
+                                      net->tensors[node->src[2]].data,
+                                      bcnn_tensor_size(s));
+        } else if (node->type == BCNN_LAYER_BATCHNORM) {
+            bcnn_fold_batchnorm_stats(net->tensors[node->src[1]].data,
+                                      net->tensors[node->src[2]].data,
+                                      net->tensors[node->src[3]].data,
+                                      net->tensors[node->src[4]].data,
+                                      net->tensors[node->dst[0]].c);
+        }
     }
-    for (int i = 0; i < ntoks; ++i) {
-        bh_free(toks[i]);
+#endif
+    if (node->type == BCNN_LAYER_CONV2D) {
+        BCNN_CHECK_STATUS(bcnn_net_pack_conv_weights(net, node, packed));
     }
-    bh_free(toks);
-    return format;
+#ifdef BCNN_USE_CUDA
+    for (int i = 0; i < node->num_src; ++i) {
+        bcnn_tensor *t = &net->tensors[node->src[i]];
+        if (!bcnn_net_is_data_tensor(net, node->src[i]) && t->data_gpu) {
+            bcnn_cuda_memcpy_host2dev(t->data_gpu, t->data,
+                                      bcnn_tensor_size(t));
+        }
+    }
+#endif
+    return BCNN_SUCCESS;
 }
 
 bcnn_status bcnn_load_weights(bcnn_net *net, const char *filename) {
+    // The fused nodes hold the weights of the nodes they absorbed, already
+    // folded, while the model files follow the graph as built
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->num_fused == 0,
+                       BCNN_INVALID_PARAMETER,
+                       "Can not load model %s: %d layers were fused by "
+                       "bcnn_compile_net, the weights must be loaded before "
+                       "the compilation\n",
+                       filename, net->num_fused);
+    // The '.bcnnmodel' extension is shared by the v1 and v2 formats: the
+    // version of a bcnn model is given by its magic
     int format = bcnn_model_find_format(filename);
+    if (format == 3) {
+        format = 0;
+    }
     FILE *fp = fopen(filename, "rb");
     BCNN_CHECK_AND_LOG(net->log_ctx, fp, BCNN_INVALID_PARAMETER,
                        "Can not open file %s\n", filename);
@@ -1492,10 +3403,14 @@ bcnn_status bcnn_load_weights(bcnn_net *net, const char *filename) {
         char magic[4];
         uint32_t major, minor, patch;
         size_t nr = fread(magic, 1, 4, fp);
+        if (nr == 4 && strncmp(magic, BCNN_MODEL_MAGIC, 4) == 0) {
+            fclose(fp);
+            return bcnn_model_load(net, filename);
+        }
         nr = fread(&major, sizeof(uint32_t), 1, fp);
         nr = fread(&minor, sizeof(uint32_t), 1, fp);
         nr = fread(&patch, sizeof(uint32_t), 1, fp);
-        if (strncmp(magic, BCNN_MAGIC, 4) != 0) {
+        if (nr != 1 || strncmp(magic, BCNN_MAGIC, 4) != 0) {
             bcnn_log(net->log_ctx, BCNN_LOG_ERROR,
                      "Invalid format for model file %s\n", filename);
             fclose(fp);
@@ -1531,28 +3446,8 @@ bcnn_status bcnn_load_weights(bcnn_net *net, const char *filename) {
         return BCNN_INVALID_MODEL;
     }
 
-    for (int i = 0; i < net->num_nodes; ++i) {
-        bcnn_node *node = &net->nodes[i];
-        if (node->type == BCNN_LAYER_CONV2D ||
-            node->type == BCNN_LAYER_TRANSPOSE_CONV2D ||
-            node->type == BCNN_LAYER_DEPTHWISE_CONV2D) {
-            bcnn_load_conv_weights(net, node, fp, format);
-        } else if (node->type == BCNN_LAYER_ACTIVATION) {
-            bcnn_activation_param *param = (bcnn_activation_param *)node->param;
-            if (param->activation == BCNN_ACT_PRELU && format == 0) {
-                bcnn_load_prelu_weights(net, node, fp, 0);
-            }
-        } else if (node->type == BCNN_LAYER_BATCHNORM) {
-            bcnn_load_batchnorm_weights(net, node, fp, format);
-        } else if (node->type == BCNN_LAYER_FULL_CONNECTED) {
-            bcnn_load_fullc_weights(net, node, fp, format, need_transpose);
-        }
-    }
-    if (fp != NULL) {
-        fclose(fp);
-    }
-
-    BCNN_INFO(net->log_ctx, "Model %s loaded succesfully\n", filename);
-
-    return BCNN_SUCCESS;
+    bcnn_status ret =
+        bcnn_load_weights_parallel(net, fp, filename, format, need_transpose);
+    fclose(fp);
+    return ret;
 }
\ No newline at end of file
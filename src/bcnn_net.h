@@ -41,6 +41,56 @@ typedef struct bcnn_cuda_context {
 } bcnn_cuda_context;
 #endif
 
+/**
+ * Buffer of the net carved out of the arena at compile time
+ */
+typedef struct bcnn_mem_block {
+    int tensor_id; /* Index of the tensor owning the buffer or -1 for a buffer
+                      referenced by 'slot' */
+    int is_grad;   /* Buffer holds the gradient of the tensor */
+    int shared;    /* Memory is shared with other intermediate tensors */
+    int dynamic;   /* Size depends on the shape of the net input */
+    int first;     /* Index of the node producing the tensor */
+    int last;      /* Index of the last node reading the tensor */
+    void **slot;   /* Address of the pointer to the buffer */
+    size_t size;   /* Size in bytes */
+    size_t offset; /* Offset in the arena in bytes */
+} bcnn_mem_block;
+
+/**
+ * Net compiled for one input size and batch size: shapes of the tensors,
+ * nodes parameters and memory of the inference data. The plans of a net share
+ * the static part of its arena, i.e. the weights.
+ */
+typedef struct bcnn_plan {
+    int w;
+    int h;
+    int batch_size;
+    size_t workspace_size;
+    int *shapes;   /* n, c, h, w of each tensor */
+    char *params;  /* Copy of the param of each node */
+    int num_mem_blocks;
+    bcnn_mem_block *mem_blocks; /* Buffers of the inference data, offsets are
+                                   relative to 'memory' */
+    void *memory;
+    int own_memory; /* 0 if 'memory' is the arena of the net */
+} bcnn_plan;
+
+/**
+ * Worker thread and input staging buffers of the asynchronous forward
+ */
+typedef struct bcnn_async bcnn_async;
+
+/**
+ * Per node timings recorded while profiling is enabled
+ */
+typedef struct bcnn_profiler bcnn_profiler;
+
+/**
+ * Writer thread and weights snapshot of 'bcnn_save_weights_async'
+ */
+typedef struct bcnn_model_writer bcnn_model_writer;
+
 /**
  * Net definition
  */
@@ -51,6 +101,11 @@ struct bcnn_net {
     int num_inputs;  /* Number of input tensors */
     int *inputs;     /* Indexes of the input tensors in the below 'tensors'
                             array */
+    int num_outputs; /* Number of output tensors requested by
+                        'bcnn_set_outputs', 0 if the whole net is run */
+    int *outputs;    /* Indexes of the requested output tensors */
+    int need_loss;   /* Set while the cost nodes run in predict mode without
+                        requested outputs, i.e. for 'bcnn_predict_on_batch' */
     bcnn_mode mode;
     bcnn_log_context log_ctx; /* Logging stuff */
     bcnn_node *nodes;         /* Array of 'num_nodes' nodes */
@@ -64,13 +119,75 @@ struct bcnn_net {
     void *cuda_ctx;
 #endif
     int num_threads; /* Number of threads (CPU only) */
+    float *workspace;      /* Scratch memory borrowed by the layers during
+                              forward / backward (CPU only) */
+    size_t workspace_size; /* Size of 'workspace' in number of floats, for
+                              one concurrency lane */
+    int num_lanes;      /* Max number of nodes running concurrently (predict
+                           mode on CPU) */
+    int num_fused;      /* Number of nodes removed by the fusion at compile
+                           time: the graph no longer matches the model files */
+    int num_levels;     /* Number of levels of the schedule, 0 if the nodes are
+                           run sequentially */
+    int *level_offsets; /* Offset of each level in 'schedule' */
+    int *schedule; /* Nodes indexes sorted by level: the nodes of a same level
+                      do not depend on each other */
+    void *arena;       /* Single memory chunk holding all the net buffers,
+                          built at compile time (CPU only) */
+    size_t arena_size; /* Size of 'arena' in bytes */
+    int num_mem_blocks;
+    bcnn_mem_block *mem_blocks; /* Buffers carved out of 'arena' */
+    bcnn_net *parent; /* Net owning the graph and the weights if the net is an
+                         execution context created by 'bcnn_create_context',
+                         NULL otherwise */
+    int num_contexts; /* Number of live execution contexts created from the
+                         net: they share its graph and its arena */
+    int numa_node;     /* NUMA node of a context created by
+                          'bcnn_create_numa_context', -1 otherwise */
+    void *replica;     /* Copy of the weights of 'parent' local to 'numa_node'
+                          or NULL */
+    size_t replica_size; /* Size of 'replica' in bytes */
+    void *model_data;  /* Model file loaded by 'bcnn_load_weights' in format
+                          v2, the weights may point into it */
+    size_t model_size; /* Size of 'model_data' in bytes */
+    int model_mapped;  /* 1 if 'model_data' is a memory mapping of the file */
+    bcnn_precision model_precision; /* Precision of the weights written in
+                                       model files */
+    bcnn_model_writer *writer; /* Checkpoint written in the background, NULL
+                                  until the first 'bcnn_save_weights_async' */
+    bcnn_async *async; /* State of 'bcnn_forward_async', created by its first
+                          call */
+    bcnn_profiler *profiler; /* Timings of the forward, NULL unless profiling
+                                is enabled */
+    int num_plans;
+    int plan;          /* Index of the active plan */
+    bcnn_plan *plans;  /* Plans added by 'bcnn_add_plan', the first one is the
+                          plan the net was compiled with */
 };
 
 bcnn_status bcnn_net_create_gemm_context(bcnn_net *net);
+/* Returns the gemm context of the concurrency lane the node runs on */
+void *bcnn_net_get_gemm_context(bcnn_net *net, bcnn_node *node);
 #ifdef BCNN_USE_CUDA
 bcnn_status bcnn_net_create_cuda_context(bcnn_net *net);
 #endif
+/* Runs the forward of the nodes on the inputs currently held by the input
+ * tensors */
+void bcnn_net_forward(bcnn_net *net);
 bcnn_status bcnn_net_add_node(bcnn_net *net, bcnn_node node);
+const char *bcnn_net_node_type2str(bcnn_layer_type type);
+/* Returns 1 if the tensor holds inference data, 0 if it is a parameter */
+int bcnn_net_is_data_tensor(bcnn_net *net, int t_id);
+/* Returns 1 if the tensor holds valid data once 'bcnn_forward' returns: a
+ * tensor requested by 'bcnn_set_outputs' or, if none was requested, a graph
+ * output (i.e. read by no other node) written by a node that is run */
+int bcnn_net_holds_output(bcnn_net *net, int t_id);
+/* Prepares the freshly loaded weights of the node for the net mode: folds the
+ * batchnorm statistics in predict mode unless 'folded' is set, re-orders the
+ * conv weights for their kernel unless 'packed' is set and uploads the weights
+ * to the device */
+bcnn_status bcnn_net_prepare_weights(bcnn_net *net, bcnn_node *node,
+                                     int folded, int packed);
 bcnn_status bcnn_net_add_tensor(bcnn_net *net, bcnn_tensor tensor);
 void bcnn_net_set_param(bcnn_net *net, const char *name, const char *val);
 
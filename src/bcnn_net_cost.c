@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <bh/bh_macros.h>
+
+#include "bcnn_conv_layer.h"
+#include "bcnn_deconv_layer.h"
+#include "bcnn_depthwise_conv_layer.h"
+#include "bcnn_net.h"
+#include "bcnn_tensor.h"
+#include "bcnn_utils.h"
+
+/* Number of multiply-accumulates of the forward of a node */
+static uint64_t bcnn_node_macs(bcnn_net *net, bcnn_node *node) {
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    uint64_t src_sz = bcnn_tensor_size(src);
+    uint64_t dst_sz = bcnn_tensor_size(dst);
+    switch (node->type) {
+        case BCNN_LAYER_CONV2D: {
+            bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+            uint64_t macs = dst_sz * param->size * param->size *
+                            (src->c / param->num_groups);
+            // Embedded batchnorm
+            return macs + (param->batch_norm ? dst_sz : 0);
+        }
+        case BCNN_LAYER_TRANSPOSE_CONV2D: {
+            bcnn_deconv_param *param = (bcnn_deconv_param *)node->param;
+            return src_sz * param->num * param->size * param->size;
+        }
+        case BCNN_LAYER_DEPTHWISE_CONV2D: {
+            bcnn_depthwise_conv_param *param =
+                (bcnn_depthwise_conv_param *)node->param;
+            return dst_sz * param->size * param->size;
+        }
+        case BCNN_LAYER_FULL_CONNECTED:
+            return (uint64_t)src->n * bcnn_tensor_size3d(src) *
+                   bcnn_tensor_size3d(dst);
+        case BCNN_LAYER_BATCHNORM:
+        case BCNN_LAYER_ELTWISE:
+            return dst_sz;
+        case BCNN_LAYER_AVGPOOL:
+            return src_sz;
+        default:
+            return 0;
+    }
+}
+
+/* Size in bytes of the scratch memory used by the forward of a node */
+static size_t bcnn_node_workspace_bytes(bcnn_net *net, bcnn_node *node) {
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    switch (node->type) {
+        case BCNN_LAYER_CONV2D:
+            return bcnn_conv_layer_workspace_size(net, node) * sizeof(float);
+        case BCNN_LAYER_TRANSPOSE_CONV2D: {
+            // col2im
+            bcnn_deconv_param *param = (bcnn_deconv_param *)node->param;
+            return (size_t)dst->w * dst->h * src->c * param->size *
+                   param->size * sizeof(float);
+        }
+        default:
+            return 0;
+    }
+}
+
+bcnn_status bcnn_get_node_cost(bcnn_net *net, int index,
+                               bcnn_node_cost *cost) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, index >= 0 && index < net->num_nodes,
+                       BCNN_INVALID_PARAMETER, "Invalid node index %d\n",
+                       index);
+    bcnn_node *node = &net->nodes[index];
+    memset(cost, 0, sizeof(bcnn_node_cost));
+    cost->macs = bcnn_node_macs(net, node);
+    for (int i = 0; i < node->num_src; ++i) {
+        size_t sz = bcnn_tensor_size(&net->tensors[node->src[i]]) *
+                    sizeof(float);
+        if (bcnn_net_is_data_tensor(net, node->src[i])) {
+            cost->src_bytes += sz;
+        } else {
+            cost->param_bytes += sz;
+        }
+    }
+    for (int i = 0; i < node->num_dst; ++i) {
+        cost->dst_bytes +=
+            bcnn_tensor_size(&net->tensors[node->dst[i]]) * sizeof(float);
+    }
+    cost->workspace_bytes = bcnn_node_workspace_bytes(net, node);
+    return BCNN_SUCCESS;
+}
+
+void bcnn_get_net_cost(bcnn_net *net, bcnn_node_cost *cost) {
+    memset(cost, 0, sizeof(bcnn_node_cost));
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_node_cost node_cost;
+        bcnn_get_node_cost(net, i, &node_cost);
+        cost->macs += node_cost.macs;
+        cost->param_bytes += node_cost.param_bytes;
+        cost->src_bytes += node_cost.src_bytes;
+        cost->dst_bytes += node_cost.dst_bytes;
+        // The layers borrow the same workspace one after another
+        cost->workspace_bytes =
+            bh_max(cost->workspace_bytes, node_cost.workspace_bytes);
+    }
+}
+
+/* Floating point operations per byte of parameters and activations */
+static float bcnn_cost_intensity(bcnn_node_cost *cost) {
+    size_t bytes = cost->param_bytes + cost->src_bytes + cost->dst_bytes;
+    return (bytes > 0) ? 2.0f * cost->macs / bytes : 0.0f;
+}
+
+void bcnn_log_cost_report(bcnn_net *net) {
+    BCNN_INFO(net->log_ctx,
+              "[Cost] %-4s %-16s %-12s %10s %10s %10s %10s %10s %8s\n", "#",
+              "type", "dst", "MMACs", "params KB", "read KB", "write KB",
+              "work KB", "flops/B");
+    for (int i = 0; i < net->num_nodes; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        bcnn_node_cost cost;
+        bcnn_get_node_cost(net, i, &cost);
+        BCNN_INFO(net->log_ctx,
+                  "[Cost] %-4d %-16s %-12s %10.2f %10.1f %10.1f %10.1f "
+                  "%10.1f %8.2f\n",
+                  i, bcnn_net_node_type2str(node->type),
+                  net->tensors[node->dst[0]].name, cost.macs / 1e6,
+                  cost.param_bytes / 1024.0, cost.src_bytes / 1024.0,
+                  cost.dst_bytes / 1024.0, cost.workspace_bytes / 1024.0,
+                  bcnn_cost_intensity(&cost));
+    }
+    bcnn_node_cost total;
+    bcnn_get_net_cost(net, &total);
+    BCNN_INFO(net->log_ctx,
+              "[Cost] Total: %.3f GMACs, parameters %.2f MB, activations "
+              "read %.2f MB / written %.2f MB, workspace %.2f MB, %.2f "
+              "flops/B\n",
+              total.macs / 1e9, total.param_bytes / 1048576.0,
+              total.src_bytes / 1048576.0, total.dst_bytes / 1048576.0,
+              total.workspace_bytes / 1048576.0, bcnn_cost_intensity(&total));
+}
@@ -22,6 +22,7 @@
 
 #include "bcnn_node.h"
 #include "bcnn_net.h"
+#include "bcnn_tensor.h"
 #include "bcnn_utils.h"
 
 #include <stdlib.h>
@@ -46,4 +47,10 @@ bcnn_status bcnn_node_add_input(bcnn_net *net, bcnn_node *node, int index) {
     node->src = p_src;
     node->src[node->num_src - 1] = index;
     return BCNN_SUCCESS;
-}
\ No newline at end of file
+}
+bcnn_status bcnn_node_infer_same_shape(bcnn_net *net, bcnn_node *node) {
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    bcnn_tensor_set_shape(dst, src->n, src->c, src->h, src->w, dst->has_grad);
+    return BCNN_SUCCESS;
+}
@@ -36,6 +36,9 @@ extern "C" {
 struct bcnn_node {
     int num_src;
     int num_dst;
+    int lane; /* Concurrency lane the node runs on (predict mode on CPU) */
+    int skip; /* Node feeds none of the outputs requested by
+                 'bcnn_set_outputs' and is not run */
     bcnn_layer_type type;
     size_t param_size;
     int *src; /* Array of input tensors indexes */
@@ -45,11 +48,16 @@ struct bcnn_node {
     void (*backward)(struct bcnn_net *net, struct bcnn_node *node);
     void (*update)(struct bcnn_net *net, struct bcnn_node *node);
     void (*release_param)(struct bcnn_node *node);
+    /* Recomputes the shape of the dst tensors from the shape of the src
+     * tensors and updates the net workspace size accordingly */
+    bcnn_status (*infer_shape)(struct bcnn_net *net, struct bcnn_node *node);
 };
 typedef struct bcnn_node bcnn_node;
 
 bcnn_status bcnn_node_add_input(bcnn_net *net, bcnn_node *node, int index);
 bcnn_status bcnn_node_add_output(bcnn_net *net, bcnn_node *node, int index);
+/* Shape inference of the layers whose output has the shape of their input */
+bcnn_status bcnn_node_infer_same_shape(bcnn_net *net, bcnn_node *node);
 
 #ifdef __cplusplus
 }
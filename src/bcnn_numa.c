@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bcnn_numa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(SYS_mbind)
+#define BCNN_HAS_MBIND
+/* From <numaif.h>, which is not always installed */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+#endif
+
+/* Parses a list such as "0-3,8,10-11" into up to 'max_values' values. Returns
+ * the number of values of the list. */
+static int bcnn_numa_parse_list(const char *list, int *values,
+                                int max_values) {
+    int num_values = 0;
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end = NULL;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long v = first; v <= last; ++v) {
+            if (num_values < max_values) {
+                values[num_values] = (int)v;
+            }
+            num_values++;
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return num_values;
+}
+
+/* Reads the list held by a sysfs file, returns -1 if it cannot be read */
+static int bcnn_numa_read_list(const char *path, int *values, int max_values) {
+    char buf[4096] = {0};
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    int ret = -1;
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+        ret = bcnn_numa_parse_list(buf, values, max_values);
+    }
+    fclose(f);
+    return ret;
+}
+
+int bcnn_numa_num_nodes(void) {
+    int nodes[BCNN_NUMA_MAX_NODES];
+    int num_nodes = bcnn_numa_read_list("/sys/devices/system/node/online",
+                                        nodes, BCNN_NUMA_MAX_NODES);
+    if (num_nodes <= 0) {
+        return 1;
+    }
+    // Nodes are numbered contiguously on the hosts we support
+    return (num_nodes < BCNN_NUMA_MAX_NODES) ? num_nodes : BCNN_NUMA_MAX_NODES;
+}
+
+int bcnn_numa_node_cpus(int node, int *cpu_ids, int max_cpus) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    int num_cpus = bcnn_numa_read_list(path, cpu_ids, max_cpus);
+    if (num_cpus < 0 && node == 0) {
+        // No topology: the single node holds every online CPU
+        num_cpus = bcnn_numa_read_list("/sys/devices/system/cpu/online",
+                                       cpu_ids, max_cpus);
+    }
+    return (num_cpus > 0) ? num_cpus : 0;
+}
+
+int bcnn_numa_bind_memory(void *ptr, size_t size, int node) {
+#ifdef BCNN_HAS_MBIND
+    const int bits = 8 * sizeof(unsigned long);
+    unsigned long mask[BCNN_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    if (node < 0 || node >= BCNN_NUMA_MAX_NODES) {
+        return -1;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] |= 1UL << (node % bits);
+    return (int)syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, mask,
+                        BCNN_NUMA_MAX_NODES + 1, MPOL_MF_MOVE);
+#else
+    return -1;
+#endif
+}
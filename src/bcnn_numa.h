@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BCNN_NUMA_H
+#define BCNN_NUMA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Max number of NUMA nodes handled */
+#define BCNN_NUMA_MAX_NODES 64
+
+/**
+ * NUMA topology of the host read from /sys/devices/system/node (Linux only).
+ * On other hosts, or when the topology is not exposed, the host is seen as a
+ * single node.
+ */
+
+/* Returns the number of NUMA nodes of the host */
+int bcnn_numa_num_nodes(void);
+
+/* Fills 'cpu_ids' with up to 'max_cpus' CPUs of the node and returns the
+ * number of CPUs of the node, 0 if the node does not exist */
+int bcnn_numa_node_cpus(int node, int *cpu_ids, int max_cpus);
+
+/* Sets the node preferred for the pages of [ptr, ptr + size), moving the pages
+ * already touched. 'ptr' must be page aligned. Returns 0 on success. */
+int bcnn_numa_bind_memory(void *ptr, size_t size, int node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BCNN_NUMA_H
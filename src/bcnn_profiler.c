@@ -0,0 +1,606 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bcnn_profiler.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <bh/bh_macros.h>
+
+#include "bcnn_conv_layer.h"
+#include "bcnn_net.h"
+#include "bcnn_tensor.h"
+#include "bcnn_utils.h"
+
+/* Hardware counters that can be recorded for each node */
+#define BCNN_PROFILER_NUM_COUNTERS 4
+
+static const char *bcnn_profiler_counter_names[BCNN_PROFILER_NUM_COUNTERS] = {
+    "cycles", "instructions", "llc_misses", "branch_misses"};
+
+/* Timing of one node during one run */
+typedef struct bcnn_profiler_event {
+    int64_t start;    /* In nanoseconds, relative to the profiler origin */
+    int64_t duration; /* In nanoseconds, -1 if the node was not run */
+    int64_t counters[BCNN_PROFILER_NUM_COUNTERS]; /* -1 if not counted */
+    int lane;
+} bcnn_profiler_event;
+
+struct bcnn_profiler {
+    int num_nodes;
+    int num_runs;
+    int max_runs;
+    int recording;  /* Set while a run is being recorded */
+    int64_t origin; /* Time the profiling was enabled at */
+    int64_t *runs;  /* Start and end time of each run */
+    bcnn_profiler_event *events; /* 'num_nodes' events per run */
+    /* Hardware counters, opened for each thread of the process. The counters
+     * of a thread form a group that is read at once */
+    int num_counters; /* Number of counters per thread, 0 if disabled */
+    int counters[BCNN_PROFILER_NUM_COUNTERS]; /* Counters in read order */
+    int num_threads;
+    int max_threads;
+    int *thread_ids;
+    int *thread_fds; /* BCNN_PROFILER_NUM_COUNTERS per thread, leader first */
+};
+
+/* Monotonic clock in nanoseconds */
+static int64_t bcnn_profiler_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (int64_t)((double)count.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#ifdef __linux__
+static const uint64_t bcnn_profiler_perf_configs[BCNN_PROFILER_NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+static int bcnn_profiler_perf_open(int counter, int tid, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = bcnn_profiler_perf_configs[counter];
+    // User space only, which is allowed by the default perf_event_paranoid
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, tid, -1, group_fd,
+                        PERF_FLAG_FD_CLOEXEC);
+}
+
+static void bcnn_profiler_close_thread(bcnn_profiler *profiler, int t) {
+    int *fds = profiler->thread_fds + t * BCNN_PROFILER_NUM_COUNTERS;
+    for (int k = profiler->num_counters - 1; k >= 0; --k) {
+        close(fds[k]);
+    }
+}
+
+/* Opens the group of counters of a thread */
+static void bcnn_profiler_open_thread(bcnn_profiler *profiler, int tid) {
+    if (profiler->num_threads == profiler->max_threads) {
+        int max_threads = bh_max(2 * profiler->max_threads, 16);
+        int *ids =
+            (int *)realloc(profiler->thread_ids, max_threads * sizeof(int));
+        if (ids == NULL) {
+            return;
+        }
+        profiler->thread_ids = ids;
+        int *fds = (int *)realloc(
+            profiler->thread_fds,
+            max_threads * BCNN_PROFILER_NUM_COUNTERS * sizeof(int));
+        if (fds == NULL) {
+            return;
+        }
+        profiler->thread_fds = fds;
+        profiler->max_threads = max_threads;
+    }
+    int *fds = profiler->thread_fds +
+               profiler->num_threads * BCNN_PROFILER_NUM_COUNTERS;
+    for (int k = 0; k < profiler->num_counters; ++k) {
+        fds[k] = bcnn_profiler_perf_open(profiler->counters[k], tid,
+                                         k == 0 ? -1 : fds[0]);
+        if (fds[k] < 0) {
+            while (--k >= 0) {
+                close(fds[k]);
+            }
+            return;
+        }
+    }
+    profiler->thread_ids[profiler->num_threads++] = tid;
+}
+
+/* Follows the threads of the process: the worker threads may be spawned or
+ * exit between two runs */
+static void bcnn_profiler_track_threads(bcnn_profiler *profiler) {
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == NULL) {
+        return;
+    }
+    int num_tids = 0, max_tids = 0;
+    int *tids = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int tid = atoi(entry->d_name);
+        if (tid <= 0) {
+            continue;
+        }
+        if (num_tids == max_tids) {
+            max_tids = bh_max(2 * max_tids, 16);
+            int *p = (int *)realloc(tids, max_tids * sizeof(int));
+            if (p == NULL) {
+                break;
+            }
+            tids = p;
+        }
+        tids[num_tids++] = tid;
+    }
+    closedir(dir);
+    // Closes the counters of the threads that have exited
+    int num_threads = 0;
+    for (int t = 0; t < profiler->num_threads; ++t) {
+        int alive = 0;
+        for (int i = 0; i < num_tids && !alive; ++i) {
+            alive = (tids[i] == profiler->thread_ids[t]);
+        }
+        if (!alive) {
+            bcnn_profiler_close_thread(profiler, t);
+            continue;
+        }
+        profiler->thread_ids[num_threads] = profiler->thread_ids[t];
+        memmove(profiler->thread_fds + num_threads * BCNN_PROFILER_NUM_COUNTERS,
+                profiler->thread_fds + t * BCNN_PROFILER_NUM_COUNTERS,
+                BCNN_PROFILER_NUM_COUNTERS * sizeof(int));
+        num_threads++;
+    }
+    profiler->num_threads = num_threads;
+    for (int i = 0; i < num_tids; ++i) {
+        int known = 0;
+        for (int t = 0; t < profiler->num_threads && !known; ++t) {
+            known = (profiler->thread_ids[t] == tids[i]);
+        }
+        if (!known) {
+            bcnn_profiler_open_thread(profiler, tids[i]);
+        }
+    }
+    bh_free(tids);
+}
+
+/* Sums the counters over all the threads, scaled by the share of time they
+ * were actually counting when the hardware counters are multiplexed */
+static void bcnn_profiler_read_counters(bcnn_profiler *profiler,
+                                        int64_t *values) {
+    uint64_t buf[3 + BCNN_PROFILER_NUM_COUNTERS];
+    memset(values, 0, BCNN_PROFILER_NUM_COUNTERS * sizeof(int64_t));
+    for (int t = 0; t < profiler->num_threads; ++t) {
+        int fd = profiler->thread_fds[t * BCNN_PROFILER_NUM_COUNTERS];
+        ssize_t sz = (3 + profiler->num_counters) * sizeof(uint64_t);
+        if (read(fd, buf, sz) != sz) {
+            continue;
+        }
+        double scale = (buf[2] > 0 && buf[2] < buf[1])
+                           ? (double)buf[1] / (double)buf[2]
+                           : 1.0;
+        for (int k = 0; k < profiler->num_counters; ++k) {
+            values[k] += (int64_t)(buf[3 + k] * scale);
+        }
+    }
+}
+
+/* Keeps the counters that can be opened on this machine */
+static void bcnn_profiler_open_counters(bcnn_profiler *profiler) {
+    int tid = (int)syscall(SYS_gettid);
+    profiler->num_counters = 0;
+    for (int k = 0; k < BCNN_PROFILER_NUM_COUNTERS; ++k) {
+        int fd = bcnn_profiler_perf_open(k, tid, -1);
+        if (fd >= 0) {
+            close(fd);
+            profiler->counters[profiler->num_counters++] = k;
+        }
+    }
+    if (profiler->num_counters > 0) {
+        bcnn_profiler_track_threads(profiler);
+    }
+}
+
+static void bcnn_profiler_close_counters(bcnn_profiler *profiler) {
+    for (int t = 0; t < profiler->num_threads; ++t) {
+        bcnn_profiler_close_thread(profiler, t);
+    }
+    bh_free(profiler->thread_ids);
+    bh_free(profiler->thread_fds);
+    profiler->num_threads = 0;
+    profiler->max_threads = 0;
+    profiler->num_counters = 0;
+}
+#else
+static void bcnn_profiler_track_threads(bcnn_profiler *profiler) {}
+
+static void bcnn_profiler_read_counters(bcnn_profiler *profiler,
+                                        int64_t *values) {}
+
+static void bcnn_profiler_open_counters(bcnn_profiler *profiler) {
+    profiler->num_counters = 0;
+}
+
+static void bcnn_profiler_close_counters(bcnn_profiler *profiler) {}
+#endif  // __linux__
+
+static void bcnn_profiler_clear(bcnn_profiler *profiler) {
+    bh_free(profiler->runs);
+    bh_free(profiler->events);
+    profiler->num_runs = 0;
+    profiler->max_runs = 0;
+}
+
+/* Drops the records if the graph has changed since they were taken, e.g. by
+ * a compilation */
+static void bcnn_profiler_check_graph(bcnn_net *net) {
+    bcnn_profiler *profiler = net->profiler;
+    if (profiler->num_nodes != net->num_nodes) {
+        bcnn_profiler_clear(profiler);
+        profiler->num_nodes = net->num_nodes;
+    }
+}
+
+void bcnn_profiler_begin_run(bcnn_net *net) {
+    bcnn_profiler *profiler = net->profiler;
+    bcnn_profiler_check_graph(net);
+    profiler->recording = 0;
+    if (profiler->num_runs == profiler->max_runs) {
+        int max_runs = bh_max(2 * profiler->max_runs, 16);
+        int64_t *runs =
+            (int64_t *)realloc(profiler->runs, 2 * max_runs * sizeof(int64_t));
+        if (runs == NULL) {
+            return;
+        }
+        profiler->runs = runs;
+        bcnn_profiler_event *events = (bcnn_profiler_event *)realloc(
+            profiler->events,
+            (size_t)max_runs * net->num_nodes * sizeof(bcnn_profiler_event));
+        if (events == NULL) {
+            return;
+        }
+        profiler->events = events;
+        profiler->max_runs = max_runs;
+    }
+    bcnn_profiler_event *events =
+        profiler->events + (size_t)profiler->num_runs * net->num_nodes;
+    for (int i = 0; i < net->num_nodes; ++i) {
+        events[i].duration = -1;
+    }
+    if (profiler->num_counters > 0) {
+        bcnn_profiler_track_threads(profiler);
+    }
+    profiler->runs[2 * profiler->num_runs] =
+        bcnn_profiler_now() - profiler->origin;
+    profiler->recording = 1;
+}
+
+void bcnn_profiler_run_node(bcnn_net *net, bcnn_node *node, int index) {
+    bcnn_profiler *profiler = net->profiler;
+    if (!profiler->recording) {
+        node->forward(net, node);
+        return;
+    }
+    int64_t before[BCNN_PROFILER_NUM_COUNTERS];
+    int64_t after[BCNN_PROFILER_NUM_COUNTERS];
+    if (profiler->num_counters > 0) {
+        bcnn_profiler_read_counters(profiler, before);
+    }
+    int64_t start = bcnn_profiler_now();
+    node->forward(net, node);
+    int64_t end = bcnn_profiler_now();
+    if (profiler->num_counters > 0) {
+        bcnn_profiler_read_counters(profiler, after);
+    }
+    bcnn_profiler_event *event =
+        &profiler->events[(size_t)profiler->num_runs * net->num_nodes + index];
+    event->start = start - profiler->origin;
+    event->duration = end - start;
+    event->lane = node->lane;
+    for (int k = 0; k < BCNN_PROFILER_NUM_COUNTERS; ++k) {
+        event->counters[k] = -1;
+    }
+    for (int k = 0; k < profiler->num_counters; ++k) {
+        event->counters[profiler->counters[k]] = after[k] - before[k];
+    }
+}
+
+int bcnn_profiler_uses_counters(bcnn_net *net) {
+    return net->profiler != NULL && net->profiler->num_counters > 0;
+}
+
+void bcnn_profiler_end_run(bcnn_net *net) {
+    bcnn_profiler *profiler = net->profiler;
+    if (!profiler->recording) {
+        return;
+    }
+    profiler->runs[2 * profiler->num_runs + 1] =
+        bcnn_profiler_now() - profiler->origin;
+    profiler->num_runs++;
+    profiler->recording = 0;
+}
+
+void bcnn_profiler_destroy(bcnn_net *net) {
+    if (net->profiler == NULL) {
+        return;
+    }
+    bcnn_profiler_close_counters(net->profiler);
+    bcnn_profiler_clear(net->profiler);
+    bh_free(net->profiler);
+}
+
+bcnn_status bcnn_set_profiling(bcnn_net *net, int enable) {
+    bcnn_wait_forward(net);
+    if (!enable) {
+        bcnn_profiler_destroy(net);
+        return BCNN_SUCCESS;
+    }
+    if (net->profiler == NULL) {
+        net->profiler = (bcnn_profiler *)calloc(1, sizeof(bcnn_profiler));
+        BCNN_CHECK_AND_LOG(net->log_ctx, net->profiler, BCNN_FAILED_ALLOC,
+                           "Internal allocation error\n");
+        net->profiler->num_nodes = net->num_nodes;
+        net->profiler->origin = bcnn_profiler_now();
+    }
+    return BCNN_SUCCESS;
+}
+
+bcnn_status bcnn_set_profiling_counters(bcnn_net *net, int enable) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->profiler, BCNN_INVALID_PARAMETER,
+                       "Profiling is not enabled\n");
+    bcnn_wait_forward(net);
+    bcnn_profiler *profiler = net->profiler;
+    bcnn_profiler_close_counters(profiler);
+    if (!enable) {
+        return BCNN_SUCCESS;
+    }
+    bcnn_profiler_open_counters(profiler);
+    if (profiler->num_counters == 0) {
+        BCNN_WARNING(net->log_ctx,
+                     "Hardware performance counters are not available, only "
+                     "the timings are recorded\n");
+        return BCNN_INTERNAL_ERROR;
+    }
+    for (int k = 0, c = 0; k < BCNN_PROFILER_NUM_COUNTERS; ++k) {
+        if (c < profiler->num_counters && profiler->counters[c] == k) {
+            c++;
+        } else {
+            BCNN_WARNING(net->log_ctx,
+                         "Hardware counter %s is not available\n",
+                         bcnn_profiler_counter_names[k]);
+        }
+    }
+    return BCNN_SUCCESS;
+}
+
+void bcnn_reset_profiling(bcnn_net *net) {
+    bcnn_wait_forward(net);
+    if (net->profiler != NULL) {
+        bcnn_profiler_clear(net->profiler);
+    }
+}
+
+/* Name of the kernel run by the node, NULL if the layer has a single code
+ * path */
+static const char *bcnn_profiler_kernel_name(bcnn_net *net, bcnn_node *node) {
+    switch (node->type) {
+        case BCNN_LAYER_CONV2D:
+            return bcnn_conv_layer_kernel_name(net, node);
+        case BCNN_LAYER_TRANSPOSE_CONV2D:
+            return "gemm+col2im";
+        case BCNN_LAYER_FULL_CONNECTED:
+            return "gemm";
+        default:
+            return NULL;
+    }
+}
+
+static void bcnn_profiler_write_shape(FILE *f, bcnn_tensor *t) {
+    fprintf(f, "[%d, %d, %d, %d]", t->n, t->c, t->h, t->w);
+}
+
+/* Writes the counters that have a value (not negative) as JSON members */
+static void bcnn_profiler_write_counters(FILE *f, const double *values) {
+    for (int k = 0; k < BCNN_PROFILER_NUM_COUNTERS; ++k) {
+        if (values[k] >= 0) {
+            fprintf(f, ", \"%s\": %.0f", bcnn_profiler_counter_names[k],
+                    values[k]);
+        }
+    }
+    if (values[0] > 0 && values[1] >= 0) {
+        fprintf(f, ", \"ipc\": %.3f", values[1] / values[0]);
+    }
+}
+
+bcnn_status bcnn_write_profiling_trace(bcnn_net *net, const char *filename) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->profiler, BCNN_INVALID_PARAMETER,
+                       "Profiling is not enabled\n");
+    bcnn_wait_forward(net);
+    bcnn_profiler_check_graph(net);
+    FILE *f = fopen(filename, "wt");
+    BCNN_CHECK_AND_LOG(net->log_ctx, f, BCNN_INVALID_PARAMETER,
+                       "Could not open file %s\n", filename);
+    bcnn_profiler *profiler = net->profiler;
+    // Chrome trace event format: the forward of each run is drawn on thread
+    // 0, the nodes on the thread of their concurrency lane
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    int first = 1;
+    for (int r = 0; r < profiler->num_runs; ++r) {
+        fprintf(f,
+                "%s{\"name\": \"forward\", \"cat\": \"net\", \"ph\": \"X\", "
+                "\"pid\": 0, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, "
+                "\"args\": {\"run\": %d}}",
+                first ? "" : ",\n", profiler->runs[2 * r] / 1000.0,
+                (profiler->runs[2 * r + 1] - profiler->runs[2 * r]) / 1000.0,
+                r);
+        first = 0;
+        bcnn_profiler_event *events =
+            profiler->events + (size_t)r * profiler->num_nodes;
+        for (int i = 0; i < profiler->num_nodes; ++i) {
+            if (events[i].duration < 0) {
+                continue;
+            }
+            bcnn_node *node = &net->nodes[i];
+            const char *kernel = bcnn_profiler_kernel_name(net, node);
+            fprintf(f,
+                    ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+                    "\"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                    "\"args\": {\"run\": %d, \"node\": %d, \"kernel\": "
+                    "\"%s\", \"src\": ",
+                    net->tensors[node->dst[0]].name,
+                    bcnn_net_node_type2str(node->type), events[i].lane + 1,
+                    events[i].start / 1000.0, events[i].duration / 1000.0, r,
+                    i, kernel ? kernel : "");
+            bcnn_profiler_write_shape(f, &net->tensors[node->src[0]]);
+            fprintf(f, ", \"dst\": ");
+            bcnn_profiler_write_shape(f, &net->tensors[node->dst[0]]);
+            double counters[BCNN_PROFILER_NUM_COUNTERS];
+            for (int k = 0; k < BCNN_PROFILER_NUM_COUNTERS; ++k) {
+                counters[k] = (double)events[i].counters[k];
+            }
+            bcnn_profiler_write_counters(f, counters);
+            fprintf(f, "}}");
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return BCNN_SUCCESS;
+}
+
+bcnn_status bcnn_write_profiling_summary(bcnn_net *net, const char *filename) {
+    BCNN_CHECK_AND_LOG(net->log_ctx, net->profiler, BCNN_INVALID_PARAMETER,
+                       "Profiling is not enabled\n");
+    bcnn_wait_forward(net);
+    bcnn_profiler_check_graph(net);
+    FILE *f = fopen(filename, "wt");
+    BCNN_CHECK_AND_LOG(net->log_ctx, f, BCNN_INVALID_PARAMETER,
+                       "Could not open file %s\n", filename);
+    bcnn_profiler *profiler = net->profiler;
+    int64_t total = 0, min = INT64_MAX, max = 0;
+    for (int r = 0; r < profiler->num_runs; ++r) {
+        int64_t t = profiler->runs[2 * r + 1] - profiler->runs[2 * r];
+        total += t;
+        min = bh_min(min, t);
+        max = bh_max(max, t);
+    }
+    int num_runs = profiler->num_runs;
+    double mean = num_runs > 0 ? (double)total / num_runs : 0.0;
+    bcnn_node_cost net_cost;
+    bcnn_get_net_cost(net, &net_cost);
+    fprintf(f, "{\n  \"num_runs\": %d,\n", num_runs);
+    fprintf(f,
+            "  \"forward\": {\"total_ms\": %.4f, \"mean_ms\": %.4f, "
+            "\"min_ms\": %.4f, \"max_ms\": %.4f, \"macs\": %llu, "
+            "\"param_bytes\": %zu, \"workspace_bytes\": %zu, "
+            "\"gflops\": %.3f},\n",
+            total / 1e6, mean / 1e6, num_runs > 0 ? min / 1e6 : 0.0,
+            max / 1e6, (unsigned long long)net_cost.macs,
+            net_cost.param_bytes, net_cost.workspace_bytes,
+            mean > 0 ? 2.0 * net_cost.macs / mean : 0.0);
+    fprintf(f, "  \"nodes\": [\n");
+    for (int i = 0; i < profiler->num_nodes; ++i) {
+        bcnn_node *node = &net->nodes[i];
+        int64_t node_total = 0, node_min = INT64_MAX, node_max = 0;
+        int node_runs = 0;
+        // Mean of each counter over the runs it was recorded in
+        double counters[BCNN_PROFILER_NUM_COUNTERS] = {0};
+        int counted[BCNN_PROFILER_NUM_COUNTERS] = {0};
+        for (int r = 0; r < num_runs; ++r) {
+            bcnn_profiler_event *event =
+                &profiler->events[(size_t)r * profiler->num_nodes + i];
+            int64_t t = event->duration;
+            if (t >= 0) {
+                node_total += t;
+                node_min = bh_min(node_min, t);
+                node_max = bh_max(node_max, t);
+                node_runs++;
+                for (int k = 0; k < BCNN_PROFILER_NUM_COUNTERS; ++k) {
+                    if (event->counters[k] >= 0) {
+                        counters[k] += event->counters[k];
+                        counted[k]++;
+                    }
+                }
+            }
+        }
+        for (int k = 0; k < BCNN_PROFILER_NUM_COUNTERS; ++k) {
+            counters[k] = counted[k] > 0 ? counters[k] / counted[k] : -1.0;
+        }
+        const char *kernel = bcnn_profiler_kernel_name(net, node);
+        fprintf(f,
+                "    {\"index\": %d, \"name\": \"%s\", \"type\": \"%s\", "
+                "\"kernel\": \"%s\", \"lane\": %d, \"src\": ",
+                i, net->tensors[node->dst[0]].name,
+                bcnn_net_node_type2str(node->type), kernel ? kernel : "",
+                node->lane);
+        bcnn_profiler_write_shape(f, &net->tensors[node->src[0]]);
+        fprintf(f, ", \"dst\": ");
+        bcnn_profiler_write_shape(f, &net->tensors[node->dst[0]]);
+        // Static cost of the node and achieved throughput
+        bcnn_node_cost cost;
+        bcnn_get_node_cost(net, i, &cost);
+        double mean_ns = node_runs > 0 ? (double)node_total / node_runs : 0.0;
+        size_t bytes = cost.param_bytes + cost.src_bytes + cost.dst_bytes;
+        fprintf(f,
+                ", \"macs\": %llu, \"param_bytes\": %zu, \"src_bytes\": %zu, "
+                "\"dst_bytes\": %zu, \"workspace_bytes\": %zu",
+                (unsigned long long)cost.macs, cost.param_bytes,
+                cost.src_bytes, cost.dst_bytes, cost.workspace_bytes);
+        fprintf(f,
+                ", \"runs\": %d, \"total_ms\": %.4f, \"mean_ms\": %.4f, "
+                "\"min_ms\": %.4f, \"max_ms\": %.4f, \"percent\": %.2f, "
+                "\"gflops\": %.3f, \"gbytes_per_s\": %.3f",
+                node_runs, node_total / 1e6, mean_ns / 1e6,
+                node_runs > 0 ? node_min / 1e6 : 0.0, node_max / 1e6,
+                total > 0 ? 100.0 * node_total / total : 0.0,
+                mean_ns > 0 ? 2.0 * cost.macs / mean_ns : 0.0,
+                mean_ns > 0 ? bytes / mean_ns : 0.0);
+        bcnn_profiler_write_counters(f, counters);
+        fprintf(f, "}%s\n", (i < profiler->num_nodes - 1) ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return BCNN_SUCCESS;
+}
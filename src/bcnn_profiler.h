@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BCNN_PROFILER_H
+#define BCNN_PROFILER_H
+
+#include <bcnn/bcnn.h>
+
+#include "bcnn_node.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Forward profiler. Each forward is a run and the wall time of every node is
+ * recorded for each run. The profiler only exists while profiling is enabled,
+ * the forward does not pay anything otherwise.
+ */
+
+/* Starts the recording of a forward */
+void bcnn_profiler_begin_run(bcnn_net *net);
+
+/* Runs the forward of the node 'index' and records its wall time. Can be
+ * called concurrently for nodes of a same level of the schedule. */
+void bcnn_profiler_run_node(bcnn_net *net, bcnn_node *node, int index);
+
+/* Returns 1 if hardware counters are recorded. The counters are read for all
+ * the threads of the process, hence the nodes must be run one at a time to be
+ * told apart */
+int bcnn_profiler_uses_counters(bcnn_net *net);
+
+/* Ends the recording of the current forward */
+void bcnn_profiler_end_run(bcnn_net *net);
+
+/* Frees the profiler and its records */
+void bcnn_profiler_destroy(bcnn_net *net);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BCNN_PROFILER_H
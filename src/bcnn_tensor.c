@@ -28,6 +28,7 @@
 #include <bh/bh_mem.h>
 #include <bh/bh_string.h>
 
+#include "bcnn_allocator.h"
 #include "bcnn_utils.h"
 
 #define BCNN_CHECK_ALLOC(p)                  \
@@ -40,7 +41,8 @@
 void bcnn_tensor_create(bcnn_tensor *t, int n, int c, int h, int w,
                         int has_grad, const char *name, int net_state) {
     bcnn_tensor_set_shape(t, n, c, h, w, has_grad);
-    bcnn_tensor_allocate(t, net_state);
+    bcnn_tensor_allocate_buffer(t, net_state, bcnn_tensor_buffer_size(t),
+                                BCNN_ALLOC_WEIGHTS);
     bh_strfill(&t->name, name);
 }
 
@@ -68,6 +70,8 @@ void bcnn_tensor_fill(bcnn_tensor *t, bcnn_tensor_filler filler) {
                 t->data[i] = filler.value;
             }
             break;
+        case BCNN_FILLER_NONE:
+            break;
     }
 #ifdef BCNN_USE_CUDA
     bcnn_cuda_memcpy_f32_noalloc(t->data, t->data_gpu, bcnn_tensor_size(t));
@@ -96,21 +100,30 @@ void bcnn_tensor_set_shape(bcnn_tensor *t, int n, int c, int h, int w,
 
 int bcnn_tensor_size(const bcnn_tensor *t) { return t->w * t->h * t->c * t->n; }
 
+int bcnn_tensor_buffer_size(const bcnn_tensor *t) {
+    if (t->layout == BCNN_LAYOUT_NC4HW4) {
+        return t->w * t->h * bh_round_up(t->c, 4) * t->n;
+    }
+    return bcnn_tensor_size(t);
+}
+
 int bcnn_tensor_size3d(const bcnn_tensor *t) { return t->w * t->h * t->c; }
 
 int bcnn_tensor_size2d(const bcnn_tensor *t) { return t->w * t->h; }
 
 bcnn_status bcnn_tensor_allocate_buffer(bcnn_tensor *t, int net_state,
-                                        size_t size) {
+                                        size_t size, bcnn_alloc_tag tag) {
     bcnn_tensor_free(t);
     if (size <= 0) {
         return BCNN_INVALID_PARAMETER;
     }
-    t->data = (float *)bh_align_calloc(size * sizeof(float), align_offset_);
+    t->data = (float *)bcnn_align_calloc(size * sizeof(float), align_offset_,
+                                         tag);
     BCNN_CHECK_ALLOC(t->data);
     if (t->has_grad && net_state != BCNN_MODE_PREDICT) {
         t->grad_data =
-            (float *)bh_align_calloc(size * sizeof(float), align_offset_);
+            (float *)bcnn_align_calloc(size * sizeof(float), align_offset_,
+                                       tag);
         BCNN_CHECK_ALLOC(t->grad_data);
     }
 #ifdef BCNN_USE_CUDA
@@ -123,15 +136,15 @@ bcnn_status bcnn_tensor_allocate_buffer(bcnn_tensor *t, int net_state,
 }
 
 bcnn_status bcnn_tensor_allocate(bcnn_tensor *t, int net_state) {
-    int size = t->n * t->c * t->h * t->w;
-    return bcnn_tensor_allocate_buffer(t, net_state, size);
+    return bcnn_tensor_allocate_buffer(t, net_state, bcnn_tensor_buffer_size(t),
+                                       BCNN_ALLOC_ACTIVATIONS);
 }
 
 void bcnn_tensor_free(bcnn_tensor *t) {
-    bh_align_free(t->data);
+    bcnn_align_free(t->data);
     t->data = NULL;
     if (t->has_grad) {
-        bh_align_free(t->grad_data);
+        bcnn_align_free(t->grad_data);
         t->grad_data = NULL;
     }
 #ifdef BCNN_USE_CUDA
@@ -38,6 +38,7 @@ typedef struct tensor_filler {
 // Alignment for align_malloc
 static const size_t align_offset_ = 32;
 
+/* Creates a tensor of parameters */
 void bcnn_tensor_create(bcnn_tensor *t, int n, int c, int h, int w,
                         int has_grad, const char *name, int net_state);
 
@@ -49,7 +50,8 @@ void bcnn_tensor_set_shape(bcnn_tensor *t, int n, int c, int h, int w,
                            int has_grad);
 
 bcnn_status bcnn_tensor_allocate_buffer(bcnn_tensor *t, int net_state,
-                                        size_t size);
+                                        size_t size, bcnn_alloc_tag tag);
+/* Allocates the buffer of a tensor of activations */
 bcnn_status bcnn_tensor_allocate(bcnn_tensor *t, int net_state);
 
 void bcnn_tensor_free(bcnn_tensor *t);
@@ -58,6 +60,8 @@ void bcnn_tensor_free(bcnn_tensor *t);
  * Tensor manipulation helpers
  */
 int bcnn_tensor_size(const bcnn_tensor *t);
+/* Number of elements of the data buffer, according to the tensor layout */
+int bcnn_tensor_buffer_size(const bcnn_tensor *t);
 int bcnn_tensor_size3d(const bcnn_tensor *t);
 int bcnn_tensor_size2d(const bcnn_tensor *t);
 
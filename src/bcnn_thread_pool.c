@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bcnn_thread_pool.h"
+
+#include <stdint.h>
+
+#include <bh/bh_macros.h>
+
+#include "bcnn_utils.h"
+
+#if defined(BCNN_USE_OPENMP) && defined(BCNN_USE_PTHREADS)
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "bcnn_numa.h"
+
+/* Number of polling iterations before a waiting thread gives up its CPU */
+#define BCNN_THREAD_POOL_SPIN_COUNT 20000
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+#endif
+#ifndef __NCPUBITS
+#define __NCPUBITS (8 * sizeof(unsigned long))
+#endif
+typedef struct {
+    unsigned long __bits[CPU_SETSIZE / __NCPUBITS];
+} bcnn_cpu_mask;
+
+#ifndef CPU_SET
+#define CPU_SET(cpu, cpusetp) \
+    ((cpusetp)->__bits[(cpu) / __NCPUBITS] |= (1UL << ((cpu) % __NCPUBITS)))
+#endif
+
+#ifdef __linux__
+static pid_t bcnn_get_thread_id(void) {
+#ifdef __GLIBC__
+    return syscall(SYS_gettid);
+#else
+    return gettid();
+#endif
+}
+
+/* Gets the CPU affinity of the calling thread. Returns 0 on success */
+static int bcnn_get_thread_cpu_mask(bcnn_cpu_mask *mask) {
+    memset(mask, 0, sizeof(bcnn_cpu_mask));
+    // The raw syscall returns the size of the mask copied
+    if (syscall(__NR_sched_getaffinity, bcnn_get_thread_id(),
+                sizeof(bcnn_cpu_mask), mask) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Sets the CPU affinity of the calling thread. Returns 0 on success */
+static int bcnn_set_thread_cpu_mask(const bcnn_cpu_mask *mask) {
+    if (syscall(__NR_sched_setaffinity, bcnn_get_thread_id(),
+                sizeof(bcnn_cpu_mask), mask) != 0) {
+        return -1;
+    }
+    return 0;
+}
+#else
+/* The affinity of a thread is left to the system */
+static int bcnn_get_thread_cpu_mask(bcnn_cpu_mask *mask) { return -1; }
+
+static int bcnn_set_thread_cpu_mask(const bcnn_cpu_mask *mask) { return -1; }
+#endif  // __linux__
+
+static int bcnn_set_thread_cpu_affinity(const int *cpu_ids, int num_cpus) {
+    bcnn_cpu_mask mask;
+    memset(&mask, 0, sizeof(bcnn_cpu_mask));
+    for (int i = 0; i < num_cpus; i++) {
+        CPU_SET(cpu_ids[i], &mask);
+    }
+    return bcnn_set_thread_cpu_mask(&mask);
+}
+
+typedef struct {
+    int job;             /* Last job submitted to the worker */
+    pthread_cond_t wake; /* Signaled under the 'lock' of the pool */
+} bcnn_thread_pool_slot;
+
+typedef struct bcnn_thread_pool {
+    int num_threads; /* Number of threads running the loops, caller included */
+    int num_refs;    /* Number of nets using the pool */
+    int *cpu_ids;    /* CPU of each thread or NULL */
+    int num_node_cpus;
+    int *node_cpus; /* CPUs of the NUMA node the threads of a node pool are
+                       free to run on */
+    pthread_t *workers; /* Array of 'num_threads - 1' worker threads */
+    bcnn_thread_pool_slot *slots; /* Wake-up slot of each worker */
+    pthread_mutex_t dispatch; /* Held while running a loop or respawning */
+    pthread_mutex_t lock;     /* Protects the sleep of the workers */
+    int generation; /* Incremented for each job submitted to the workers */
+    int stop;       /* Set to ask the workers to exit */
+    int pending;    /* Number of workers that have not completed the job */
+    int next_id; /* Id given to the next worker that starts */
+    int num_started;
+    int affinity_err;
+    /* Current job */
+    bcnn_parallel_func func;
+    void *arg;
+    int n;
+    int num_tasks;
+} bcnn_thread_pool;
+
+static bcnn_thread_pool bcnn_pool = {
+    .dispatch = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Pools running on a single NUMA node, created on demand */
+static bcnn_thread_pool *bcnn_node_pools[BCNN_NUMA_MAX_NODES];
+static pthread_mutex_t bcnn_node_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Pool running the parallel loops of the thread, NULL for 'bcnn_pool' */
+static BCNN_THREAD_LOCAL bcnn_thread_pool *bcnn_current_pool = NULL;
+/* Node the thread was moved to by 'bcnn_thread_pool_bind_node', -1 if none */
+static BCNN_THREAD_LOCAL int bcnn_current_node = -1;
+/* CPU affinity of the thread before it was moved to a node */
+static BCNN_THREAD_LOCAL bcnn_cpu_mask bcnn_caller_mask;
+static BCNN_THREAD_LOCAL int bcnn_caller_mask_saved = 0;
+
+static inline void bcnn_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void bcnn_thread_pool_run_task(bcnn_thread_pool *pool,
+                                             int task) {
+    int begin = (int)((int64_t)pool->n * task / pool->num_tasks);
+    int end = (int)((int64_t)pool->n * (task + 1) / pool->num_tasks);
+    if (begin < end) {
+        pool->func(pool->arg, begin, end);
+    }
+}
+
+/* Spins on the job of the worker for a while, then sleeps until a new job
+ * comes */
+static int bcnn_thread_pool_wait_job(bcnn_thread_pool *pool,
+                                     bcnn_thread_pool_slot *slot, int seen) {
+    for (int i = 0; i < BCNN_THREAD_POOL_SPIN_COUNT; ++i) {
+        int job = bcnn_atomic_load(&slot->job);
+        if (job != seen) {
+            return job;
+        }
+        bcnn_cpu_relax();
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (slot->job == seen) {
+        pthread_cond_wait(&slot->wake, &pool->lock);
+    }
+    int job = slot->job;
+    pthread_mutex_unlock(&pool->lock);
+    return job;
+}
+
+static void *bcnn_thread_pool_worker(void *param) {
+    bcnn_thread_pool *pool = (bcnn_thread_pool *)param;
+    int id = bcnn_atomic_add(&pool->next_id, 1);
+    int err = 0;
+    if (pool->num_node_cpus > 0) {
+        err = bcnn_set_thread_cpu_affinity(pool->node_cpus,
+                                           pool->num_node_cpus);
+    } else if (pool->cpu_ids) {
+        err = bcnn_set_thread_cpu_affinity(&pool->cpu_ids[id], 1);
+    }
+    if (err != 0) {
+        bcnn_atomic_add(&pool->affinity_err, 1);
+    }
+    // Nested loops stay on the pool of the worker
+    bcnn_current_pool = pool;
+    // The worker 'id' runs the task 'id', the caller runs the task 0
+    bcnn_thread_pool_slot *slot = &pool->slots[id - 1];
+    int seen = bcnn_atomic_load(&slot->job);
+    bcnn_atomic_add(&pool->num_started, 1);
+    for (;;) {
+        seen = bcnn_thread_pool_wait_job(pool, slot, seen);
+        if (pool->stop) {
+            break;
+        }
+        bcnn_thread_pool_run_task(pool, id);
+        bcnn_atomic_sub(&pool->pending, 1);
+    }
+    return NULL;
+}
+
+/* Wakes up the first 'num_workers' workers on the current job, the others
+ * keep sleeping. Must be called with 'dispatch' held. */
+static void bcnn_thread_pool_notify(bcnn_thread_pool *pool, int num_workers) {
+    bcnn_atomic_store(&pool->pending, num_workers);
+    pthread_mutex_lock(&pool->lock);
+    int job = ++pool->generation;
+    for (int i = 0; i < num_workers; ++i) {
+        bcnn_atomic_store(&pool->slots[i].job, job);
+        pthread_cond_signal(&pool->slots[i].wake);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void bcnn_thread_pool_join(bcnn_thread_pool *pool) {
+    if (pool->num_threads > 1) {
+        pool->stop = 1;
+        bcnn_thread_pool_notify(pool, pool->num_threads - 1);
+        for (int i = 0; i < pool->num_threads - 1; ++i) {
+            pthread_join(pool->workers[i], NULL);
+            pthread_cond_destroy(&pool->slots[i].wake);
+        }
+        pool->stop = 0;
+    }
+    bh_free(pool->workers);
+    bh_free(pool->slots);
+    bh_free(pool->cpu_ids);
+    pool->num_threads = 0;
+}
+
+static bcnn_status bcnn_thread_pool_spawn(bcnn_thread_pool *pool,
+                                          int num_threads,
+                                          const int *cpu_ids) {
+    bcnn_status ret = BCNN_SUCCESS;
+    num_threads = bh_max(num_threads, 1);
+    if (cpu_ids) {
+        pool->cpu_ids = (int *)calloc(num_threads, sizeof(int));
+        if (pool->cpu_ids == NULL) {
+            return BCNN_FAILED_ALLOC;
+        }
+        memcpy(pool->cpu_ids, cpu_ids, num_threads * sizeof(int));
+        // The caller is the thread 0 of the loops
+        if (bcnn_set_thread_cpu_affinity(&pool->cpu_ids[0], 1) != 0) {
+            ret = BCNN_INVALID_PARAMETER;
+        }
+    }
+    pool->num_threads = 1;
+    if (num_threads > 1) {
+        pool->workers = (pthread_t *)calloc(num_threads - 1, sizeof(pthread_t));
+        pool->slots = (bcnn_thread_pool_slot *)calloc(
+            num_threads - 1, sizeof(bcnn_thread_pool_slot));
+        if (pool->workers == NULL || pool->slots == NULL) {
+            bh_free(pool->workers);
+            bh_free(pool->slots);
+            return BCNN_FAILED_ALLOC;
+        }
+    }
+    pool->next_id = 0;
+    pool->num_started = 0;
+    pool->affinity_err = 0;
+    // The workers pick their slot in the order they start
+    for (int i = 0; i < num_threads - 1; ++i) {
+        pthread_cond_init(&pool->slots[i].wake, NULL);
+    }
+    for (int i = 0; i < num_threads - 1; ++i) {
+        if (pthread_create(&pool->workers[i], NULL, bcnn_thread_pool_worker,
+                           pool) != 0) {
+            ret = BCNN_FAILED_ALLOC;
+            break;
+        }
+        pool->num_threads++;
+    }
+    for (int i = pool->num_threads - 1; i < num_threads - 1; ++i) {
+        pthread_cond_destroy(&pool->slots[i].wake);
+    }
+    while (bcnn_atomic_load(&pool->num_started) <
+           pool->num_threads - 1) {
+        sched_yield();
+    }
+    if (pool->affinity_err > 0 && ret == BCNN_SUCCESS) {
+        ret = BCNN_INVALID_PARAMETER;
+    }
+    return ret;
+}
+
+bcnn_status bcnn_thread_pool_acquire(int num_threads) {
+    bcnn_thread_pool *pool = &bcnn_pool;
+    bcnn_status ret = BCNN_SUCCESS;
+    pthread_mutex_lock(&pool->dispatch);
+    if (pool->num_refs == 0) {
+        ret = bcnn_thread_pool_spawn(pool, num_threads, NULL);
+    }
+    // No reference is held on failure: the caller does not release the pool
+    if (ret == BCNN_SUCCESS) {
+        pool->num_refs++;
+    } else {
+        bcnn_thread_pool_join(pool);
+    }
+    pthread_mutex_unlock(&pool->dispatch);
+    return ret;
+}
+
+void bcnn_thread_pool_release(void) {
+    bcnn_thread_pool *pool = &bcnn_pool;
+    pthread_mutex_lock(&pool->dispatch);
+    if (pool->num_refs > 0 && --pool->num_refs == 0) {
+        bcnn_thread_pool_join(pool);
+    }
+    pthread_mutex_unlock(&pool->dispatch);
+}
+
+bcnn_status bcnn_thread_pool_set_num_threads(int num_threads,
+                                             const int *cpu_ids) {
+    bcnn_thread_pool *pool = &bcnn_pool;
+    pthread_mutex_lock(&pool->dispatch);
+    bcnn_thread_pool_join(pool);
+    bcnn_status ret = bcnn_thread_pool_spawn(pool, num_threads, cpu_ids);
+    pthread_mutex_unlock(&pool->dispatch);
+    return ret;
+}
+
+static void bcnn_thread_pool_destroy_node(int node) {
+    bcnn_thread_pool *pool = bcnn_node_pools[node];
+    bcnn_thread_pool_join(pool);
+    bh_free(pool->node_cpus);
+    pthread_mutex_destroy(&pool->dispatch);
+    pthread_mutex_destroy(&pool->lock);
+    bh_free(bcnn_node_pools[node]);
+}
+
+static bcnn_status bcnn_thread_pool_create_node(int node, int num_threads) {
+    bcnn_thread_pool *pool =
+        (bcnn_thread_pool *)calloc(1, sizeof(bcnn_thread_pool));
+    if (pool == NULL) {
+        return BCNN_FAILED_ALLOC;
+    }
+    pthread_mutex_init(&pool->dispatch, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    bcnn_node_pools[node] = pool;
+    int num_cpus = bcnn_numa_node_cpus(node, NULL, 0);
+    if (num_cpus <= 0) {
+        bcnn_thread_pool_destroy_node(node);
+        return BCNN_INVALID_PARAMETER;
+    }
+    pool->node_cpus = (int *)calloc(num_cpus, sizeof(int));
+    if (pool->node_cpus == NULL) {
+        bcnn_thread_pool_destroy_node(node);
+        return BCNN_FAILED_ALLOC;
+    }
+    pool->num_node_cpus = bcnn_numa_node_cpus(node, pool->node_cpus, num_cpus);
+    // One thread per CPU at most, the caller included
+    bcnn_status ret = bcnn_thread_pool_spawn(
+        pool, bh_clamp(num_threads, 1, pool->num_node_cpus), NULL);
+    if (ret != BCNN_SUCCESS) {
+        bcnn_thread_pool_destroy_node(node);
+    }
+    return ret;
+}
+
+bcnn_status bcnn_thread_pool_acquire_node(int node, int num_threads) {
+    if (node < 0 || node >= BCNN_NUMA_MAX_NODES) {
+        return BCNN_INVALID_PARAMETER;
+    }
+    bcnn_status ret = BCNN_SUCCESS;
+    pthread_mutex_lock(&bcnn_node_pools_lock);
+    if (bcnn_node_pools[node] == NULL) {
+        ret = bcnn_thread_pool_create_node(node, num_threads);
+    }
+    if (ret == BCNN_SUCCESS) {
+        bcnn_node_pools[node]->num_refs++;
+    }
+    pthread_mutex_unlock(&bcnn_node_pools_lock);
+    return ret;
+}
+
+void bcnn_thread_pool_release_node(int node) {
+    if (node < 0 || node >= BCNN_NUMA_MAX_NODES) {
+        return;
+    }
+    pthread_mutex_lock(&bcnn_node_pools_lock);
+    bcnn_thread_pool *pool = bcnn_node_pools[node];
+    if (pool != NULL && --pool->num_refs == 0) {
+        bcnn_thread_pool_destroy_node(node);
+    }
+    pthread_mutex_unlock(&bcnn_node_pools_lock);
+}
+
+int bcnn_thread_pool_bind_node(int node) {
+    int prev = bcnn_current_pool ? bcnn_current_node : -1;
+    if (node < 0 || node >= BCNN_NUMA_MAX_NODES ||
+        bcnn_node_pools[node] == NULL) {
+        bcnn_current_pool = NULL;
+        if (bcnn_current_node >= 0) {
+            // The thread belongs to the application: it gets its own CPUs back
+            if (bcnn_caller_mask_saved) {
+                bcnn_set_thread_cpu_mask(&bcnn_caller_mask);
+            }
+            bcnn_caller_mask_saved = 0;
+            bcnn_current_node = -1;
+        }
+        return prev;
+    }
+    bcnn_thread_pool *pool = bcnn_node_pools[node];
+    if (bcnn_current_node != node) {
+        if (bcnn_current_node < 0) {
+            bcnn_caller_mask_saved =
+                (bcnn_get_thread_cpu_mask(&bcnn_caller_mask) == 0);
+        }
+        // The caller is the thread 0 of the loops of the pool
+        bcnn_set_thread_cpu_affinity(pool->node_cpus, pool->num_node_cpus);
+        bcnn_current_node = node;
+    }
+    bcnn_current_pool = pool;
+    return prev;
+}
+
+void bcnn_parallel_for(int n, int num_threads, bcnn_parallel_func func,
+                       void *arg) {
+    bcnn_thread_pool *pool =
+        bcnn_current_pool ? bcnn_current_pool : &bcnn_pool;
+    if (n <= 0) {
+        return;
+    }
+    if (bh_min(num_threads, n) > 1 &&
+        pthread_mutex_trylock(&pool->dispatch) == 0) {
+        int num_tasks = bh_min(bh_min(num_threads, n), pool->num_threads);
+        if (num_tasks > 1) {
+            pool->func = func;
+            pool->arg = arg;
+            pool->n = n;
+            pool->num_tasks = num_tasks;
+            bcnn_thread_pool_notify(pool, num_tasks - 1);
+            bcnn_thread_pool_run_task(pool, 0);
+            for (int i = 0;
+                 bcnn_atomic_load(&pool->pending) > 0; ++i) {
+                if (i < BCNN_THREAD_POOL_SPIN_COUNT) {
+                    bcnn_cpu_relax();
+                } else {
+                    sched_yield();
+                }
+            }
+            pthread_mutex_unlock(&pool->dispatch);
+            return;
+        }
+        pthread_mutex_unlock(&pool->dispatch);
+    }
+    func(arg, 0, n);
+}
+
+#else
+
+bcnn_status bcnn_thread_pool_acquire(int num_threads) { return BCNN_SUCCESS; }
+
+void bcnn_thread_pool_release(void) {}
+
+bcnn_status bcnn_thread_pool_set_num_threads(int num_threads,
+                                             const int *cpu_ids) {
+    return BCNN_SUCCESS;
+}
+
+bcnn_status bcnn_thread_pool_acquire_node(int node, int num_threads) {
+    return BCNN_SUCCESS;
+}
+
+void bcnn_thread_pool_release_node(int node) {}
+
+int bcnn_thread_pool_bind_node(int node) { return -1; }
+
+void bcnn_parallel_for(int n, int num_threads, bcnn_parallel_func func,
+                       void *arg) {
+    if (n <= 0) {
+        return;
+    }
+#ifdef BCNN_USE_OPENMP
+    // No pthreads: the loop is shared by the threads of the OpenMP runtime
+    int num_tasks = bh_min(num_threads, n);
+    if (num_tasks > 1) {
+#pragma omp parallel for num_threads(num_tasks)
+        for (int task = 0; task < num_tasks; ++task) {
+            int begin = (int)((int64_t)n * task / num_tasks);
+            int end = (int)((int64_t)n * (task + 1) / num_tasks);
+            if (begin < end) {
+                func(arg, begin, end);
+            }
+        }
+        return;
+    }
+#endif
+    func(arg, 0, n);
+}
+
+#endif  // BCNN_USE_OPENMP && BCNN_USE_PTHREADS
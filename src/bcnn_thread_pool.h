@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2016-present Jean-Noel Braun.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BCNN_THREAD_POOL_H
+#define BCNN_THREAD_POOL_H
+
+#include <bcnn/bcnn.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Persistent pool of worker threads shared by all the nets of the process.
+ * The workers are spawned once and spin for a while before going to sleep
+ * when no job is submitted, which avoids the cost of a fork / join for each
+ * parallel loop of the kernels.
+ * Where pthreads are not available (e.g. MSVC), there is no pool: the loops
+ * are shared by the OpenMP threads and the node functions do nothing.
+ */
+
+/* Body of a parallel loop, runs the iterations in [begin, end) */
+typedef void (*bcnn_parallel_func)(void *arg, int begin, int end);
+
+/* Adds a reference to the pool, spawning 'num_threads' threads (the caller
+ * included) if it does not exist yet. No reference is added on failure */
+bcnn_status bcnn_thread_pool_acquire(int num_threads);
+
+/* Removes a reference to the pool, the workers are joined with the last one */
+void bcnn_thread_pool_release(void);
+
+/* Respawns the workers so that 'num_threads' threads, the caller included,
+ * share the parallel loops. If 'cpu_ids' is not NULL, the i-th thread is
+ * pinned to the CPU 'cpu_ids[i]', the caller being the thread 0. */
+bcnn_status bcnn_thread_pool_set_num_threads(int num_threads,
+                                             const int *cpu_ids);
+
+/* Adds a reference to the pool of the NUMA node 'node', spawning up to
+ * 'num_threads' threads (the caller included) that run on the CPUs of the node
+ * if it does not exist yet */
+bcnn_status bcnn_thread_pool_acquire_node(int node, int num_threads);
+
+/* Removes a reference to the pool of the NUMA node 'node' */
+void bcnn_thread_pool_release_node(int node);
+
+/* Runs the parallel loops of the calling thread on the pool of the NUMA node
+ * 'node', or on the default pool if 'node' is -1. The calling thread is moved
+ * to the CPUs of the node until it is bound to -1 again, which restores the
+ * CPU affinity it had before its first bind. Returns the previous node. */
+int bcnn_thread_pool_bind_node(int node);
+
+/* Splits the iterations [0, n) into at most 'num_threads' contiguous chunks
+ * run concurrently by the pool. The loop runs on the caller thread only when
+ * the pool is already busy, e.g. for nested loops. */
+void bcnn_parallel_for(int n, int num_threads, bcnn_parallel_func func,
+                       void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BCNN_THREAD_POOL_H
@@ -44,6 +44,9 @@
 #include <stdio.h>
 #include <stdlib.h>  // RAND_MAX
 #include <time.h>
+#ifdef _MSC_VER
+#include <intrin.h>  // _Interlocked*
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -108,6 +111,24 @@ typedef struct {
         bh_free(l);                     \
     } while (0)
 
+/* Thread-local storage and atomic operations on an int shared by threads.
+ * Loads have acquire semantics, stores release semantics and the additions,
+ * which return the new value, are full barriers. */
+#if defined(_MSC_VER)
+#define BCNN_THREAD_LOCAL __declspec(thread)
+#define bcnn_atomic_load(p) _InterlockedOr((volatile long *)(p), 0)
+#define bcnn_atomic_store(p, v) \
+    ((void)_InterlockedExchange((volatile long *)(p), (long)(v)))
+#define bcnn_atomic_add(p, v) \
+    (_InterlockedExchangeAdd((volatile long *)(p), (long)(v)) + (v))
+#else
+#define BCNN_THREAD_LOCAL __thread
+#define bcnn_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define bcnn_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define bcnn_atomic_add(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL)
+#endif
+#define bcnn_atomic_sub(p, v) bcnn_atomic_add((p), -(v))
+
 float bcnn_rng_gaussian(bcnn_gauss_gen *g);
 
 void bcnn_log(bcnn_log_context ctx, bcnn_log_level level, const char *fmt, ...);
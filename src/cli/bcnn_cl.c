@@ -81,6 +81,8 @@ bcnn_status bcnn_cl_load_param(const char *config_path, bcnn_cl_param *param) {
             param->eval_period = atoi(val);
         } else if (strcmp(name, "save_model") == 0) {
             param->save_model = atoi(val);
+        } else if (strcmp(name, "async_checkpoint") == 0) {
+            param->async_checkpoint = atoi(val);
         } else if (strcmp(name, "num_pred") == 0) {
             param->num_pred = atoi(val);
         } else if (strcmp(name, "source_train") == 0) {
@@ -105,7 +107,7 @@ bcnn_status bcnn_cl_train(bcnn_net *net, bcnn_cl_param *param, float *error) {
     float sum_error = 0.0f, error_valid = 0.0f;
     int nb_iter = net->learner->max_batches;
     int batch_size = net->batch_size;
-    bh_timer t = {0};
+    bh_timer t = {0}, t_save = {0};
     char chk_pt_path[1024];
 
     bh_timer_start(&t);
@@ -136,9 +138,21 @@ bcnn_status bcnn_cl_train(bcnn_net *net, bcnn_cl_param *param, float *error) {
         }
         if (i % param->save_model == 0 && i > 0) {
             sprintf(chk_pt_path, "%s_iter%d.bcnnmodel", param->output_model, i);
-            bcnn_save_weights(net, chk_pt_path);
+            // Time during which the training is blocked by the checkpoint
+            bh_timer_start(&t_save);
+            if (param->async_checkpoint) {
+                bcnn_save_weights_async(net, chk_pt_path);
+            } else {
+                bcnn_save_weights(net, chk_pt_path);
+            }
+            bh_timer_stop(&t_save);
+            BCNN_INFO(net->log_ctx, "checkpoint %s: training-stall= %lf ms\n",
+                      chk_pt_path, bh_timer_get_msec(&t_save));
         }
     }
+    if (param->async_checkpoint) {
+        bcnn_wait_save(net);
+    }
 
     *error = (float)sum_error / (param->eval_period * batch_size);
 
@@ -305,6 +319,13 @@ int main(int argc, char **argv) {
     BCNN_CHECK_STATUS(bcnn_set_data_loader(
         net, param.data_format, param.train_input, param.path_train_label,
         param.test_input, param.path_test_label));
+    // The input model is loaded by 'bcnn_load_net', before the compilation
+    // fuses the layers
+    if (net->mode != BCNN_MODE_TRAIN && param.input_model == NULL) {
+        BCNN_ERROR(net->log_ctx, BCNN_INVALID_PARAMETER,
+                   "No model in input. Precise which model to use in config "
+                   "file with field 'input_model'\n");
+    }
     BCNN_CHECK_STATUS(bcnn_compile_net(net));
     if (net->mode == BCNN_MODE_TRAIN) {
         /*if (param.input_model != NULL) {
@@ -325,14 +346,6 @@ int main(int argc, char **argv) {
         }
         BCNN_INFO(net->log_ctx, "Training ended successfully\n");
     } else if (net->mode == BCNN_MODE_VALID || net->mode == BCNN_MODE_PREDICT) {
-        if (param.input_model != NULL) {
-            BCNN_CHECK_STATUS(bcnn_load_weights(net, param.input_model));
-        } else {
-            BCNN_ERROR(net->log_ctx, BCNN_INVALID_PARAMETER,
-                       "No model in input. Precise which model to use in "
-                       "config file "
-                       "with field 'input_model'\n");
-        }
         BCNN_INFO(net->log_ctx, "Start prediction...\n");
         float error_test = 0.0f;
         BCNN_CHECK_STATUS(bcnn_cl_predict(net, &param, &error_test));
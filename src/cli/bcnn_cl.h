@@ -15,6 +15,8 @@ extern "C" {
  */
 typedef struct {
     int save_model;  /* Periodicity of model saving. */
+    int async_checkpoint; /* Set to 1 to write the checkpoints on a background
+                             thread. */
     int num_pred;    /* Number of samples to be predicted in test file. */
     int eval_period; /* Periodicity of evaluating the train/test error. */
     int eval_test;   /* Set to 1 if evaluation of test database is asked. */
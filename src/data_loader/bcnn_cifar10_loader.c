@@ -26,6 +26,7 @@
 #include <bh/bh_string.h>
 /* include bip image processing lib */
 #include <bip/bip.h>
+#include "bcnn_allocator.h"
 #include "bcnn_tensor.h"
 #include "bcnn_utils.h"
 
@@ -40,17 +41,17 @@ bcnn_status bcnn_loader_cifar10_init(bcnn_loader *iter, bcnn_net *net,
     iter->input_width = 32;
     iter->input_height = 32;
     iter->input_depth = 3;
-    iter->input_uchar = (unsigned char *)calloc(
+    iter->input_uchar = (unsigned char *)bcnn_align_calloc(
         iter->input_width * iter->input_height * iter->input_depth,
-        sizeof(unsigned char));
+        align_offset_, BCNN_ALLOC_DATA);
     BCNN_CHECK_AND_LOG(
         net->log_ctx,
         net->tensors[0].w > 0 && net->tensors[0].h > 0 && net->tensors[0].c > 0,
         BCNN_INVALID_PARAMETER,
         "Input's width, height and channels must be > 0\n");
-    iter->input_net = (uint8_t *)calloc(
+    iter->input_net = (uint8_t *)bcnn_align_calloc(
         net->tensors[0].w * net->tensors[0].h * net->tensors[0].c,
-        sizeof(uint8_t));
+        align_offset_, BCNN_ALLOC_DATA);
 
     return BCNN_SUCCESS;
 }
@@ -62,8 +63,8 @@ void bcnn_loader_cifar10_terminate(bcnn_loader *iter) {
     if (iter->f_test != NULL) {
         fclose(iter->f_test);
     }
-    bh_free(iter->input_uchar);
-    bh_free(iter->input_net);
+    bcnn_align_free(iter->input_uchar);
+    bcnn_align_free(iter->input_net);
 }
 
 bcnn_status bcnn_loader_cifar10_next(bcnn_loader *iter, bcnn_net *net,
@@ -24,6 +24,7 @@
 
 #include <bh/bh_macros.h>
 #include <bh/bh_string.h>
+#include "bcnn_allocator.h"
 #include "bcnn_tensor.h"
 #include "bcnn_utils.h"
 
@@ -43,9 +44,9 @@ bcnn_status bcnn_loader_list_classif_init(bcnn_loader *iter, bcnn_net *net,
         net->tensors[0].w > 0 && net->tensors[0].h > 0 && net->tensors[0].c > 0,
         BCNN_INVALID_PARAMETER,
         "Input's width, height and channels must be > 0\n");
-    iter->input_uchar = (unsigned char *)calloc(
+    iter->input_uchar = (unsigned char *)bcnn_align_calloc(
         net->tensors[0].w * net->tensors[0].h * net->tensors[0].c,
-        sizeof(unsigned char));
+        align_offset_, BCNN_ALLOC_DATA);
 
     return BCNN_SUCCESS;
 }
@@ -57,7 +58,7 @@ void bcnn_loader_list_classif_terminate(bcnn_loader *iter) {
     if (iter->f_test != NULL) {
         fclose(iter->f_test);
     }
-    bh_free(iter->input_uchar);
+    bcnn_align_free(iter->input_uchar);
 }
 
 bcnn_status bcnn_loader_list_classif_next(bcnn_loader *iter, bcnn_net *net,
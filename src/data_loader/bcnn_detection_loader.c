@@ -26,6 +26,7 @@
 #include <bh/bh_string.h>
 /* include bip image processing lib */
 #include <bip/bip.h>
+#include "bcnn_allocator.h"
 #include "bcnn_tensor.h"
 #include "bcnn_utils.h"
 
@@ -38,17 +39,17 @@ bcnn_status bcnn_loader_list_detection_init(bcnn_loader *iter, bcnn_net *net,
     BCNN_CHECK_STATUS(bcnn_open_dataset(iter, net, train_path, train_path_extra,
                                         test_path, test_path_extra, false));
     // Allocate img buffer
-    iter->input_uchar = (unsigned char *)calloc(
+    iter->input_uchar = (unsigned char *)bcnn_align_calloc(
         net->tensors[0].w * net->tensors[0].h * net->tensors[0].c,
-        sizeof(unsigned char));
+        align_offset_, BCNN_ALLOC_DATA);
     BCNN_CHECK_AND_LOG(
         net->log_ctx,
         net->tensors[0].w > 0 && net->tensors[0].h > 0 && net->tensors[0].c > 0,
         BCNN_INVALID_PARAMETER,
         "Input's width, height and channels must be > 0");
-    iter->input_net = (uint8_t *)calloc(
+    iter->input_net = (uint8_t *)bcnn_align_calloc(
         net->tensors[0].w * net->tensors[0].h * net->tensors[0].c,
-        sizeof(uint8_t));
+        align_offset_, BCNN_ALLOC_DATA);
 
     return BCNN_SUCCESS;
 }
@@ -60,8 +61,8 @@ void bcnn_loader_list_detection_terminate(bcnn_loader *iter) {
     if (iter->f_test != NULL) {
         fclose(iter->f_test);
     }
-    bh_free(iter->input_uchar);
-    bh_free(iter->input_net);
+    bcnn_align_free(iter->input_uchar);
+    bcnn_align_free(iter->input_net);
 }
 
 bcnn_status bcnn_loader_list_detection_next(bcnn_loader *iter, bcnn_net *net,
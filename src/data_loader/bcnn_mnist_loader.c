@@ -26,6 +26,7 @@
 #include <bh/bh_string.h>
 /* include bip image processing lib */
 #include <bip/bip.h>
+#include "bcnn_allocator.h"
 #include "bcnn_tensor.h"
 #include "bcnn_utils.h"
 
@@ -73,11 +74,12 @@ bcnn_status bcnn_loader_mnist_init(bcnn_loader *iter, bcnn_net *net,
     // Read header
     BCNN_CHECK_STATUS(read_mnist_header(net, iter));
     iter->input_depth = 1;
-    iter->input_uchar = (uint8_t *)calloc(
-        iter->input_width * iter->input_height, sizeof(uint8_t));
-    iter->input_net = (uint8_t *)calloc(
+    iter->input_uchar = (uint8_t *)bcnn_align_calloc(
+        iter->input_width * iter->input_height, align_offset_,
+        BCNN_ALLOC_DATA);
+    iter->input_net = (uint8_t *)bcnn_align_calloc(
         net->tensors[0].w * net->tensors[0].h * net->tensors[0].c,
-        sizeof(uint8_t));
+        align_offset_, BCNN_ALLOC_DATA);
     rewind(iter->f_current);
     rewind(iter->f_current_extra);
 
@@ -97,8 +99,8 @@ void bcnn_loader_mnist_terminate(bcnn_loader *iter) {
     if (iter->f_test_extra != NULL) {
         fclose(iter->f_test_extra);
     }
-    bh_free(iter->input_uchar);
-    bh_free(iter->input_net);
+    bcnn_align_free(iter->input_uchar);
+    bcnn_align_free(iter->input_net);
 }
 
 bcnn_status bcnn_loader_mnist_next(bcnn_loader *iter, bcnn_net *net, int idx) {
@@ -29,6 +29,7 @@
 #include <bh/bh_mem.h>
 
 #include "bcnn/bcnn.h"
+#include "bcnn_thread_pool.h"
 
 #include <bh/bh_timer.h>
 
@@ -49,6 +50,85 @@ int bcnn_copy_f32(int n, float *x, float *y) {
     return 0;
 }
 
+static uint16_t bcnn_f32_to_f16_scalar(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+    uint32_t abs = x & 0x7fffffff;
+    if (abs > 0x7f800000) {  // NaN, kept quiet
+        return sign | 0x7e00 | (uint16_t)((abs >> 13) & 0x3ff);
+    }
+    if (abs >= 0x477ff000) {  // Rounds above 65504
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {  // Half precision subnormal
+        uint32_t exp = abs >> 23;
+        if (exp < 102) {
+            return sign;
+        }
+        uint32_t mant = (abs & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - exp;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        uint32_t m = mant >> shift;
+        if (rem > half || (rem == half && (m & 1))) {
+            ++m;
+        }
+        return sign | (uint16_t)m;
+    }
+    abs += 0xfff + ((abs >> 13) & 1);
+    return sign | (uint16_t)((abs - 0x38000000) >> 13);
+}
+
+static float bcnn_f16_to_f32_scalar(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {  // Zero or subnormal: mant * 2^-24
+        float f = (float)mant * 5.9604644775390625e-8f;
+        memcpy(&x, &f, sizeof(x));
+        x |= sign;
+    } else if (exp == 31) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+void bcnn_f32_to_f16(size_t n, const float *x, uint16_t *y) {
+    size_t i = 0;
+#if defined(BCNN_USE_AVX) && defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(x + i),
+                                    _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(y + i), h);
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] = bcnn_f32_to_f16_scalar(x[i]);
+    }
+}
+
+void bcnn_f16_to_f32(size_t n, const uint16_t *x, float *y) {
+    size_t i = 0;
+#if defined(BCNN_USE_AVX) && defined(__F16C__)
+    for (; i + 16 <= n; i += 16) {
+        __m256 f0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i)));
+        __m256 f1 =
+            _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i + 8)));
+        _mm256_storeu_ps(y + i, f0);
+        _mm256_storeu_ps(y + i + 8, f1);
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] = bcnn_f16_to_f32_scalar(x[i]);
+    }
+}
+
 int bcnn_axpy(int n, float a, float *x, float *y) {
 #ifndef BCNN_USE_AVX
     int i;
@@ -758,26 +838,42 @@ int bcnn_varmean(int n, float *m, float a, float *var) {
     return 0;
 }
 
+typedef struct {
+    float *output;
+    float *values;
+    int num_channels;
+    int spatial_size;
+} bcnn_channel_args;
+
+static void bcnn_add_bias_task(void *arg, int begin, int end) {
+    bcnn_channel_args *a = (bcnn_channel_args *)arg;
+    for (int i = begin; i < end; ++i) {
+        bcnn_add_scalar(a->spatial_size, a->values[i % a->num_channels],
+                        a->output + i * a->spatial_size);
+    }
+}
+
+static void bcnn_scales_task(void *arg, int begin, int end) {
+    bcnn_channel_args *a = (bcnn_channel_args *)arg;
+    for (int i = begin; i < end; ++i) {
+        bcnn_scal(a->spatial_size, a->values[i % a->num_channels],
+                  a->output + i * a->spatial_size);
+    }
+}
+
+// The whole batch is split over the threads in a single parallel loop
 void bcnn_add_bias(float *output, float *bias, int batch_size, int num_channels,
                    int spatial_size, int num_threads) {
-    for (int b = 0; b < batch_size; ++b) {
-#pragma omp parallel for num_threads(num_threads)
-        for (int i = 0; i < num_channels; ++i) {
-            bcnn_add_scalar(spatial_size, bias[i], output + i * spatial_size);
-        }
-        output += num_channels * spatial_size;
-    }
+    bcnn_channel_args args = {output, bias, num_channels, spatial_size};
+    bcnn_parallel_for(batch_size * num_channels, num_threads,
+                      bcnn_add_bias_task, &args);
 }
 
 void bcnn_scales(float *output, float *scales, int batch_size, int num_channels,
                  int spatial_size, int num_threads) {
-    for (int b = 0; b < batch_size; ++b) {
-#pragma omp parallel for num_threads(num_threads)
-        for (int i = 0; i < num_channels; ++i) {
-            bcnn_scal(spatial_size, scales[i], output + i * spatial_size);
-        }
-        output += num_channels * spatial_size;
-    }
+    bcnn_channel_args args = {output, scales, num_channels, spatial_size};
+    bcnn_parallel_for(batch_size * num_channels, num_threads, bcnn_scales_task,
+                      &args);
 }
 
 void bcnn_grad_scales(float *x_norm, float *delta, int batch, int n, int size,
@@ -853,16 +949,28 @@ void bcnn_im2col(const float *data_im, const int channels, const int height,
     }
 }
 
-static void bcnn_im2col_mt_st1(const float *data_im, const int channels,
-                               const int height, const int width,
-                               const int kernel_size, const int pad,
-                               float *data_col, int num_threads) {
+typedef struct {
+    const float *data_im;
+    int height;
+    int width;
+    int kernel_size;
+    int pad;
+    int stride;
+    float *data_col;
+} bcnn_im2col_args;
+
+static void bcnn_im2col_st1_task(void *arg, int begin, int end) {
+    bcnn_im2col_args *a = (bcnn_im2col_args *)arg;
+    const float *data_im = a->data_im;
+    const int height = a->height;
+    const int width = a->width;
+    const int kernel_size = a->kernel_size;
+    const int pad = a->pad;
+    float *data_col = a->data_col;
     int height_col = (height + 2 * pad - kernel_size) + 1;
     int width_col = (width + 2 * pad - kernel_size) + 1;
-    int channels_col = channels * kernel_size * kernel_size;
 
-#pragma omp parallel for num_threads(num_threads)
-    for (int c = 0; c < channels_col; ++c) {
+    for (int c = begin; c < end; ++c) {
         int w_offset = c % kernel_size;
         int h_offset = (c / kernel_size) % kernel_size;
         int c_im = c / kernel_size / kernel_size;
@@ -894,44 +1002,54 @@ static void bcnn_im2col_mt_st1(const float *data_im, const int channels,
     }
 }
 
-void bcnn_im2col_mt(const float *data_im, const int channels, const int height,
-                    const int width, const int kernel_size, const int pad,
-                    const int stride, float *data_col, int num_threads) {
+static void bcnn_im2col_task(void *arg, int begin, int end) {
+    bcnn_im2col_args *a = (bcnn_im2col_args *)arg;
+    const float *data_im = a->data_im;
+    const int height = a->height;
+    const int width = a->width;
+    const int kernel_size = a->kernel_size;
+    const int pad = a->pad;
+    const int stride = a->stride;
+    float *data_col = a->data_col;
     int height_col = (height + 2 * pad - kernel_size) / stride + 1;
     int width_col = (width + 2 * pad - kernel_size) / stride + 1;
-    int channels_col = channels * kernel_size * kernel_size;
 
-    if (stride == 1) {
-        bcnn_im2col_mt_st1(data_im, channels, height, width, kernel_size, pad,
-                           data_col, num_threads);
-    } else {
-#pragma omp parallel for num_threads(num_threads)
-        for (int c = 0; c < channels_col; ++c) {
-            int w_offset = c % kernel_size;
-            int h_offset = (c / kernel_size) % kernel_size;
-            int c_im = c / kernel_size / kernel_size;
-
-            const int hc0 = h_offset - pad;
-            const int wc0 = w_offset - pad;
-            for (int h = 0; h < height_col; ++h) {
-                int h_pad = h * stride + hc0;
-
-                const int row_offset = (c * height_col + h) * width_col;
-                const int srow_offset = (c_im * height + h_pad) * width;
-                for (int w = 0; w < width_col; ++w) {
-                    int w_pad = w * stride + wc0;
-                    if ((((unsigned)h_pad) < ((unsigned)height)) &&
-                        (((unsigned)w_pad) < ((unsigned)width)))
-                        data_col[row_offset + w] = data_im[srow_offset + w_pad];
-                    else {
-                        data_col[row_offset + w] = 0.;
-                    }
+    for (int c = begin; c < end; ++c) {
+        int w_offset = c % kernel_size;
+        int h_offset = (c / kernel_size) % kernel_size;
+        int c_im = c / kernel_size / kernel_size;
+
+        const int hc0 = h_offset - pad;
+        const int wc0 = w_offset - pad;
+        for (int h = 0; h < height_col; ++h) {
+            int h_pad = h * stride + hc0;
+
+            const int row_offset = (c * height_col + h) * width_col;
+            const int srow_offset = (c_im * height + h_pad) * width;
+            for (int w = 0; w < width_col; ++w) {
+                int w_pad = w * stride + wc0;
+                if ((((unsigned)h_pad) < ((unsigned)height)) &&
+                    (((unsigned)w_pad) < ((unsigned)width)))
+                    data_col[row_offset + w] = data_im[srow_offset + w_pad];
+                else {
+                    data_col[row_offset + w] = 0.;
                 }
             }
         }
     }
 }
 
+void bcnn_im2col_mt(const float *data_im, const int channels, const int height,
+                    const int width, const int kernel_size, const int pad,
+                    const int stride, float *data_col, int num_threads) {
+    int channels_col = channels * kernel_size * kernel_size;
+    bcnn_im2col_args args = {data_im, height, width, kernel_size,
+                             pad,     stride, data_col};
+    bcnn_parallel_for(channels_col, num_threads,
+                      stride == 1 ? bcnn_im2col_st1_task : bcnn_im2col_task,
+                      &args);
+}
+
 void bcnn_col2im(const float *data_col, const int channels, const int height,
                  const int width, const int kernel, const int pad,
                  const int stride, float *data_im) {
@@ -1990,6 +2108,160 @@ static void bcnn_gemm_kernel4x4_tiled(float *dst_batch, const float *src,
 }
 //#endif
 
+typedef struct {
+    float *src_batch;
+    int src_w;
+    int src_h;
+    int src_c4;
+    float *dst_batch;
+    int dst_w;
+    int dst_h;
+    int dst_c4;
+    int dst_w2;
+    int dst_area4;
+    int num_tiles;
+    int num_threads;
+    int pad;
+    float *weights;
+    float *scales;
+    float *biases;
+    float *slopes;
+    float *workspace;
+    int workspace_stride;
+    bcnn_post_conv_nc4hw4_func post_function;
+} bcnn_conv3x3s1_args;
+
+static void bcnn_conv3x3s1_task(void *arg, int thread_begin, int thread_end) {
+    bcnn_conv3x3s1_args *a = (bcnn_conv3x3s1_args *)arg;
+    float *src_batch = a->src_batch;
+    float *dst_batch = a->dst_batch;
+    int src_w = a->src_w, src_h = a->src_h, src_c4 = a->src_c4;
+    int dst_w = a->dst_w, dst_h = a->dst_h, dst_c4 = a->dst_c4;
+    int dst_w2 = a->dst_w2;
+    int dst_area4 = a->dst_area4;
+    int num_tiles = a->num_tiles;
+    int num_threads = a->num_threads;
+    int pad = a->pad;
+    float *weight = a->weights;
+    float *bias = a->biases;
+    float *scales = a->scales;
+    float *slopes = a->slopes;
+    bcnn_post_conv_nc4hw4_func post_function = a->post_function;
+
+    for (int thread_id = thread_begin; thread_id < thread_end; ++thread_id) {
+        float *src_thread = a->workspace + thread_id * a->workspace_stride;
+        for (int tid = thread_id; tid < num_tiles; tid += num_threads) {
+            int x_tile = (int)tid * CONV_TILED;
+            int xr = dst_area4 - x_tile;
+            int xc = xr > CONV_TILED ? CONV_TILED : xr;
+            float *dst_block =
+                src_thread + xc * CONV3x3_SRC_BLOCK * (src_c4 + dst_c4);
+            float *dst_thread = src_thread + xc * CONV3x3_SRC_BLOCK * src_c4;
+
+            // bh_timer t = {0};
+            // bh_timer_start(&t);
+            for (int xi = 0; xi < xc; ++xi) {
+                int index = x_tile + xi;
+                float *dst_xi = src_thread + 4 * xi;
+
+                int w_idx = index % dst_w2;
+                int h_idx = index / dst_w2;
+
+                int src_x = w_idx * 2 - pad;
+                int src_y = h_idx * 2 - pad;
+                int sy = bh_max(0, src_y) - src_y;
+                int ey = bh_min(src_y + 4, src_h) - src_y;
+                int sx = bh_max(0, src_x) - src_x;
+                int ex = bh_min(src_x + 4, src_w) - src_x;
+
+                float *src_start = src_batch + (src_x + src_y * src_w) * 4;
+
+                for (int z = 0; z < src_c4; ++z) {
+                    memset(dst_block, 0, CONV3x3_SRC_BLOCK * sizeof(float));
+
+                    float *dst_start = dst_xi + z * 4 * xc;
+
+                    float *src_z = src_start + z * 4 * src_w * src_h;
+                    if (ex > sx) {
+                        // Extract One Block
+                        for (int yy = sy; yy < ey; ++yy) {
+                            float *dst_yy = dst_block + yy * 16;
+                            float *src_yy = src_z + 4 * src_w * yy;
+                            memcpy(dst_yy + 4 * sx, src_yy + sx * 4,
+                                   4 * (ex - sx) * sizeof(float));
+                        }
+                    }
+                    // Transform
+                    bcnn_conv3x3_convert_src(dst_block, dst_start,
+                                             4 * xc * src_c4);
+                }
+            }
+            // bh_timer_stop(&t);
+            // fprintf(stderr, "conv3x3 src %f\n", bh_timer_get_msec(&t));
+            // bh_timer_start(&t);
+            if (xc == CONV_TILED) {
+                for (int i = 0; i < CONV3x3_BLOCK_UNIT * CONV3x3_BLOCK_UNIT;
+                     ++i) {
+                    bcnn_gemm_kernel4x4_tiled(
+                        dst_thread + i * dst_c4 * 4 * xc,
+                        src_thread + i * src_c4 * 4 * xc,
+                        weight + i * 16 * src_c4 * dst_c4, src_c4, xc * 4,
+                        dst_c4, 0);
+                }
+            } else {
+                for (int i = 0; i < CONV3x3_BLOCK_UNIT * CONV3x3_BLOCK_UNIT;
+                     ++i) {
+                    bcnn_gemm_kernel4x4(dst_thread + (i * dst_c4) * xc * 4,
+                                        src_thread + i * src_c4 * 4 * xc,
+                                        weight + (i * dst_c4) * src_c4 * 16,
+                                        src_c4, xc * 4, dst_c4, xc, 0);
+                }
+            }
+            // bh_timer_stop(&t);
+            // fprintf(stderr, "conv3x3 gemm %f\n", bh_timer_get_msec(&t));
+            // dst
+            for (int xi = 0; xi < xc; ++xi) {
+                int index = x_tile + xi;
+                float *src_xi = dst_thread + 4 * xi;
+                int w_idx = index % dst_w2;
+                int h_idx = index / dst_w2;
+                int dst_x = w_idx * 2;
+                int dst_y = h_idx * 2;
+                float *dst_batch_xi =
+                    dst_batch + 4 * (dst_x + dst_y * dst_w);
+
+                for (int z = 0; z < dst_c4; ++z) {
+                    float *src_z = src_xi + z * xc * 4;
+                    float *dst_z = dst_batch_xi + z * dst_w * dst_h * 4;
+                    bcnn_conv3x3_convert_dst(src_z, dst_block,
+                                             dst_c4 * 4 * xc);
+                    // bias addition and relu
+                    float *bias_z = bias + 4 * z;
+                    float *scales_z = scales + 4 * z;
+                    float *slopes_z = slopes + 4 * z;
+                    post_function(dst_block, dst_block, bias_z, scales_z,
+                                  slopes_z, 4, 1);
+                    bv_float4_store(bv_float4_load(dst_block), dst_z);
+                    if (w_idx * 2 + 1 < dst_w) {
+                        bv_float4_store(bv_float4_load(dst_block + 4),
+                                        dst_z + 4);
+                    }
+                    if (h_idx * 2 + 1 < dst_h) {
+                        bv_float4_store(bv_float4_load(dst_block + 8),
+                                        dst_z + dst_w * 4);
+                        if (w_idx * 2 + 1 < dst_w) {
+                            bv_float4_store(bv_float4_load(dst_block + 12),
+                                            dst_z + dst_w * 4 + 4);
+                        }
+                    }
+                }
+            }
+            // bh_timer_stop(&t);
+            // fprintf(stderr, "conv3x3 dst %f\n", bh_timer_get_msec(&t));
+        }
+    }
+}
+
 void bcnn_conv3x3s1_kernel(float *src, int src_w, int src_h, int src_c,
                            float *dst, int dst_w, int dst_h, int dst_c,
                            int batch_size, int pad, float *weights,
@@ -2012,126 +2284,28 @@ void bcnn_conv3x3s1_kernel(float *src, int src_w, int src_h, int src_c,
         int num_tiles = bh_div_up(dst_area4, CONV_TILED);
         num_threads = bh_min(num_threads, num_tiles);
 
-        float *weight = weights;
-        float *bias = biases;
-
-#pragma omp parallel for num_threads(num_threads)
-        for (int thread_id = 0; thread_id < num_threads; thread_id++) {
-            float *src_thread = workspace + thread_id * workspace_thread_stride;
-            /*fprintf(stderr, "num_threads %d stride %d\n", num_threads,
-                    workspace_thread_stride);*/
-            for (int tid = (int)thread_id; tid < num_tiles;
-                 tid += num_threads) {
-                int x_tile = (int)tid * CONV_TILED;
-                int xr = dst_area4 - x_tile;
-                int xc = xr > CONV_TILED ? CONV_TILED : xr;
-                float *dst_block =
-                    src_thread + xc * CONV3x3_SRC_BLOCK * (src_c4 + dst_c4);
-                float *dst_thread =
-                    src_thread + xc * CONV3x3_SRC_BLOCK * src_c4;
-
-                // bh_timer t = {0};
-                // bh_timer_start(&t);
-                for (int xi = 0; xi < xc; ++xi) {
-                    int index = x_tile + xi;
-                    float *dst_xi = src_thread + 4 * xi;
-
-                    int w_idx = index % dst_w2;
-                    int h_idx = index / dst_w2;
-
-                    int src_x = w_idx * 2 - pad;
-                    int src_y = h_idx * 2 - pad;
-                    int sy = bh_max(0, src_y) - src_y;
-                    int ey = bh_min(src_y + 4, src_h) - src_y;
-                    int sx = bh_max(0, src_x) - src_x;
-                    int ex = bh_min(src_x + 4, src_w) - src_x;
-
-                    float *src_start = src_batch + (src_x + src_y * src_w) * 4;
-
-                    for (int z = 0; z < src_c4; ++z) {
-                        memset(dst_block, 0, CONV3x3_SRC_BLOCK * sizeof(float));
-
-                        float *dst_start = dst_xi + z * 4 * xc;
-
-                        float *src_z = src_start + z * 4 * src_w * src_h;
-                        if (ex > sx) {
-                            // Extract One Block
-                            for (int yy = sy; yy < ey; ++yy) {
-                                float *dst_yy = dst_block + yy * 16;
-                                float *src_yy = src_z + 4 * src_w * yy;
-                                memcpy(dst_yy + 4 * sx, src_yy + sx * 4,
-                                       4 * (ex - sx) * sizeof(float));
-                            }
-                        }
-                        // Transform
-                        bcnn_conv3x3_convert_src(dst_block, dst_start,
-                                                 4 * xc * src_c4);
-                    }
-                }
-                // bh_timer_stop(&t);
-                // fprintf(stderr, "conv3x3 src %f\n", bh_timer_get_msec(&t));
-                // bh_timer_start(&t);
-                if (xc == CONV_TILED) {
-                    for (int i = 0; i < CONV3x3_BLOCK_UNIT * CONV3x3_BLOCK_UNIT;
-                         ++i) {
-                        bcnn_gemm_kernel4x4_tiled(
-                            dst_thread + i * dst_c4 * 4 * xc,
-                            src_thread + i * src_c4 * 4 * xc,
-                            weight + i * 16 * src_c4 * dst_c4, src_c4, xc * 4,
-                            dst_c4, 0);
-                    }
-                } else {
-                    for (int i = 0; i < CONV3x3_BLOCK_UNIT * CONV3x3_BLOCK_UNIT;
-                         ++i) {
-                        bcnn_gemm_kernel4x4(dst_thread + (i * dst_c4) * xc * 4,
-                                            src_thread + i * src_c4 * 4 * xc,
-                                            weight + (i * dst_c4) * src_c4 * 16,
-                                            src_c4, xc * 4, dst_c4, xc, 0);
-                    }
-                }
-                // bh_timer_stop(&t);
-                // fprintf(stderr, "conv3x3 gemm %f\n", bh_timer_get_msec(&t));
-                // dst
-                for (int xi = 0; xi < xc; ++xi) {
-                    int index = x_tile + xi;
-                    float *src_xi = dst_thread + 4 * xi;
-                    int w_idx = index % dst_w2;
-                    int h_idx = index / dst_w2;
-                    int dst_x = w_idx * 2;
-                    int dst_y = h_idx * 2;
-                    float *dst_batch_xi =
-                        dst_batch + 4 * (dst_x + dst_y * dst_w);
-
-                    for (int z = 0; z < dst_c4; ++z) {
-                        float *src_z = src_xi + z * xc * 4;
-                        float *dst_z = dst_batch_xi + z * dst_w * dst_h * 4;
-                        bcnn_conv3x3_convert_dst(src_z, dst_block,
-                                                 dst_c4 * 4 * xc);
-                        // bias addition and relu
-                        float *bias_z = bias + 4 * z;
-                        float *scales_z = scales + 4 * z;
-                        float *slopes_z = slopes + 4 * z;
-                        post_function(dst_block, dst_block, bias_z, scales_z,
-                                      slopes_z, 4, 1);
-                        bv_float4_store(bv_float4_load(dst_block), dst_z);
-                        if (w_idx * 2 + 1 < dst_w) {
-                            bv_float4_store(bv_float4_load(dst_block + 4),
-                                            dst_z + 4);
-                        }
-                        if (h_idx * 2 + 1 < dst_h) {
-                            bv_float4_store(bv_float4_load(dst_block + 8),
-                                            dst_z + dst_w * 4);
-                            if (w_idx * 2 + 1 < dst_w) {
-                                bv_float4_store(bv_float4_load(dst_block + 12),
-                                                dst_z + dst_w * 4 + 4);
-                            }
-                        }
-                    }
-                }
-                // bh_timer_stop(&t);
-                // fprintf(stderr, "conv3x3 dst %f\n", bh_timer_get_msec(&t));
-            }
-        }
+        bcnn_conv3x3s1_args args = {src_batch,
+                                    src_w,
+                                    src_h,
+                                    src_c4,
+                                    dst_batch,
+                                    dst_w,
+                                    dst_h,
+                                    dst_c4,
+                                    dst_w2,
+                                    dst_area4,
+                                    num_tiles,
+                                    num_threads,
+                                    pad,
+                                    weights,
+                                    scales,
+                                    biases,
+                                    slopes,
+                                    workspace,
+                                    workspace_thread_stride,
+                                    post_function};
+        bcnn_parallel_for(num_threads, num_threads, bcnn_conv3x3s1_task,
+                          &args);
     }
 
     return;
@@ -2195,28 +2369,44 @@ static void sgemm_nn_pack_MRxk4(int k, const float *A, int inc_row_A,
     }
 }
 
-static void sgemm_nn_pack_A(int mc, int kc, const float *A, int inc_row_A,
-                            int inc_col_A, float *buffer, int mr,
-                            int num_threads) {
-    int mp = mc / mr;
-    int _mr = mc % mr;
-    int tmp1 = kc * mr;
-    int tmp2 = mr * inc_row_A;
-#pragma omp parallel for num_threads(num_threads)
-    for (int i = 0; i < mp; ++i) {
+typedef struct {
+    int kc;
+    const float *M;
+    int inc_row;
+    int inc_col;
+    float *buffer;
+    int r;
+} sgemm_pack_args;
+
+static void sgemm_nn_pack_A_task(void *arg, int begin, int end) {
+    sgemm_pack_args *a = (sgemm_pack_args *)arg;
+    int tmp1 = a->kc * a->r;
+    int tmp2 = a->r * a->inc_row;
+    for (int i = begin; i < end; ++i) {
 #ifdef BCNN_USE_NEON
 #if (defined(__aarch64__))
-        sgemm_nn_pack_MRxk8(kc, A + tmp2 * i, inc_row_A, inc_col_A,
-                            buffer + tmp1 * i, mr);
+        sgemm_nn_pack_MRxk8(a->kc, a->M + tmp2 * i, a->inc_row, a->inc_col,
+                            a->buffer + tmp1 * i, a->r);
 #else
-        sgemm_nn_pack_MRxk4(kc, A + tmp2 * i, inc_row_A, inc_col_A,
-                            buffer + tmp1 * i, mr);
+        sgemm_nn_pack_MRxk4(a->kc, a->M + tmp2 * i, a->inc_row, a->inc_col,
+                            a->buffer + tmp1 * i, a->r);
 #endif  // __aarch64__
 #else
-        sgemm_nn_pack_MRxk8(kc, A + tmp2 * i, inc_row_A, inc_col_A,
-                            buffer + tmp1 * i, mr);
+        sgemm_nn_pack_MRxk8(a->kc, a->M + tmp2 * i, a->inc_row, a->inc_col,
+                            a->buffer + tmp1 * i, a->r);
 #endif
     }
+}
+
+static void sgemm_nn_pack_A(int mc, int kc, const float *A, int inc_row_A,
+                            int inc_col_A, float *buffer, int mr,
+                            int num_threads) {
+    int mp = mc / mr;
+    int _mr = mc % mr;
+    int tmp1 = kc * mr;
+    int tmp2 = mr * inc_row_A;
+    sgemm_pack_args args = {kc, A, inc_row_A, inc_col_A, buffer, mr};
+    bcnn_parallel_for(mp, num_threads, sgemm_nn_pack_A_task, &args);
     A += (tmp2 * mp);
     buffer += (tmp1 * mp);
     if (_mr > 0) {
@@ -2277,17 +2467,23 @@ static void sgemm_nn_pack_kxNR(int k, const float *B, int inc_row_B,
     }
 }
 
+static void sgemm_nn_pack_B_task(void *arg, int begin, int end) {
+    sgemm_pack_args *a = (sgemm_pack_args *)arg;
+    int tmp1 = a->kc * a->r;
+    for (int j = begin; j < end; ++j) {
+        sgemm_nn_pack_kxNR(a->kc, a->M + a->r * j, a->inc_row, a->inc_col,
+                           a->buffer + tmp1 * j, a->r);
+    }
+}
+
 static void sgemm_nn_pack_B(int kc, int nc, const float *B, int inc_row_B,
                             int inc_col_B, float *buffer, int nr,
                             int num_threads) {
     int np = nc / nr;
     int _nr = nc % nr;
     int tmp1 = kc * nr;
-#pragma omp parallel for num_threads(num_threads)
-    for (int j = 0; j < np; ++j) {
-        sgemm_nn_pack_kxNR(kc, B + nr * j, inc_row_B, inc_col_B,
-                           buffer + tmp1 * j, nr);
-    }
+    sgemm_pack_args args = {kc, B, inc_row_B, inc_col_B, buffer, nr};
+    bcnn_parallel_for(np, num_threads, sgemm_nn_pack_B_task, &args);
     B += (nr * np);
     buffer += (tmp1 * np);
     if (_nr > 0) {
@@ -2515,45 +2711,72 @@ static void sgemm_scal(int m, int n, float alpha, float *X, int incRowX,
     }
 }
 
+typedef struct {
+    int mc;
+    int nc;
+    int kc;
+    float alpha;
+    float beta;
+    float *C;
+    int inc_row_C;
+    int inc_col_C;
+    float *buffer_A;
+    float *buffer_B;
+    float *buffer_AB;
+    int mr;
+    int nr;
+} sgemm_mkernel_args;
+
+static void sgemm_mkernel_task(void *arg, int begin, int end) {
+    sgemm_mkernel_args *a = (sgemm_mkernel_args *)arg;
+    int kc = a->kc, mr = a->mr, nr = a->nr;
+    int inc_row_C = a->inc_row_C, inc_col_C = a->inc_col_C;
+    int mp = (a->mc + mr - 1) / mr;
+    int np = (a->nc + nr - 1) / nr;
+    int _mr = a->mc % mr;
+    int _nr = a->nc % nr;
+    // Blocks are ordered by columns panel first to reuse the packed B panel
+    for (int b = begin; b < end; ++b) {
+        int j = b / mp;
+        int i = b % mp;
+        int nrj = (j != np - 1 || _nr == 0) ? nr : _nr;
+        int mri = (i != mp - 1 || _mr == 0) ? mr : _mr;
+        float *C = &a->C[i * mr * inc_row_C + j * nr];
+        if (mri == mr && nrj == nr) {
+            sgemm_ukernel(kc, a->alpha, &a->buffer_A[i * kc * mr],
+                          &a->buffer_B[j * kc * nr], a->beta, C, inc_row_C,
+                          inc_col_C, mr, nr, a->buffer_AB);
+        } else {
+            float buf_c[MR * NR];
+            sgemm_ukernel(kc, a->alpha, &a->buffer_A[i * kc * mr],
+                          &a->buffer_B[j * kc * nr], 0.0, buf_c, 1, mr, mr, nr,
+                          a->buffer_AB);
+            sgemm_scal(mri, nrj, a->beta, C, inc_row_C, inc_col_C);
+            sgemm_axpy(mri, nrj, 1.0, buf_c, 1, mr, C, inc_row_C, inc_col_C);
+        }
+    }
+}
+
 static void sgemm_mkernel(int mc, int nc, int kc, float alpha, float beta,
                           float *C, int inc_row_C, int inc_col_C,
                           float *buffer_A, float *buffer_B, float *buffer_AB,
                           float *buffer_C, int mr, int nr, int num_threads) {
     int mp = (mc + mr - 1) / mr;
     int np = (nc + nr - 1) / nr;
-
-    int _mr = mc % mr;
-    int _nr = nc % nr;
-#pragma omp parallel for num_threads(num_threads)
-    for (int j = 0; j < np; ++j) {
-        int nrj = (j != np - 1 || _nr == 0) ? nr : _nr;
-#pragma omp parallel for num_threads(num_threads)
-        for (int i = 0; i < mp; ++i) {
-            int mri = (i != mp - 1 || _mr == 0) ? mr : _mr;
-            if (mri == mr && nrj == nr) {
-                sgemm_ukernel(kc, alpha, &buffer_A[i * kc * mr],
-                              &buffer_B[j * kc * nr], beta,
-                              &C[i * mr * inc_row_C + j * nr], inc_row_C,
-                              inc_col_C, mr, nr, buffer_AB);
-            } else {
-                float buf_c[MR * NR];
-                sgemm_ukernel(kc, alpha, &buffer_A[i * kc * mr],
-                              &buffer_B[j * kc * nr], 0.0, buf_c, 1, mr, mr, nr,
-                              buffer_AB);
-                sgemm_scal(mri, nrj, beta, &C[i * mr * inc_row_C + j * nr],
-                           inc_row_C, inc_col_C);
-                sgemm_axpy(mri, nrj, 1.0, buf_c, 1, mr,
-                           &C[i * mr * inc_row_C + j * nr], inc_row_C,
-                           inc_col_C);
-            }
-        }
-    }
+    sgemm_mkernel_args args = {mc, nc, kc, alpha, beta, C, inc_row_C,
+                               inc_col_C, buffer_A, buffer_B, buffer_AB, mr,
+                               nr};
+    // One parallel loop over all the mr x nr blocks of C
+    bcnn_parallel_for(mp * np, num_threads, sgemm_mkernel_task, &args);
 }
 
+/* If 'packed_A' is not NULL, A is read from the panels laid out by
+ * 'bcnn_gemm_pack_a' instead of being packed on the fly */
 static void sgemm_nn(bcnn_gemm_context *ctx, int m, int n, int k, float alpha,
                      const float *A, int inc_row_A, int inc_col_A,
-                     const float *B, int inc_row_B, int inc_col_B, float beta,
-                     float *C, int inc_row_C, int inc_col_C, int num_threads) {
+                     const float *packed_A, const float *B, int inc_row_B,
+                     int inc_col_B, float beta, float *C, int inc_row_C,
+                     int inc_col_C, int num_threads) {
     int mb = (m + MC - 1) / MC;
     int nb = (n + NC - 1) / NC;
     int kb = (k + KC - 1) / KC;
@@ -2575,12 +2798,19 @@ static void sgemm_nn(bcnn_gemm_context *ctx, int m, int n, int k, float alpha,
                             inc_col_B, ctx->buffer_b, NR, num_threads);
             for (int i = 0; i < mb; ++i) {
                 int mc = (i != mb - 1 || _mc == 0) ? MC : _mc;
-                sgemm_nn_pack_A(mc, kc, &A[i * MC * inc_row_A + l * KC],
-                                inc_row_A, inc_col_A, ctx->buffer_a, MR,
-                                num_threads);
+                float *buffer_a = ctx->buffer_a;
+                if (packed_A != NULL) {
+                    buffer_a = (float *)packed_A +
+                               (size_t)l * KC * bh_round_up(m, MR) +
+                               (size_t)i * MC * kc;
+                } else {
+                    sgemm_nn_pack_A(mc, kc, &A[i * MC * inc_row_A + l * KC],
+                                    inc_row_A, inc_col_A, buffer_a, MR,
+                                    num_threads);
+                }
                 sgemm_mkernel(
                     mc, nc, kc, alpha, _beta, &C[i * MC * inc_row_C + j * NC],
-                    inc_row_C, inc_col_C, ctx->buffer_a, ctx->buffer_b,
+                    inc_row_C, inc_col_C, buffer_a, ctx->buffer_b,
                     ctx->buffer_ab, ctx->buffer_c, MR, NR, num_threads);
             }
         }
@@ -2639,8 +2869,8 @@ int bcnn_gemm(bcnn_gemm_context *ctx, int trans_a, int trans_b, int m, int n,
     int inc_col_B = (!trans_b) ? 1 : ldb;
 
     if (!trans_a && !trans_b) {
-        sgemm_nn(ctx, m, n, k, alpha, A, inc_row_A, inc_col_A, B, inc_row_B,
-                 inc_col_B, beta, C, ldc, 1, num_threads);
+        sgemm_nn(ctx, m, n, k, alpha, A, inc_row_A, inc_col_A, NULL, B,
+                 inc_row_B, inc_col_B, beta, C, ldc, 1, num_threads);
     } else {
         sgemm(ctx, m, n, k, alpha, A, inc_row_A, inc_col_A, B, inc_row_B,
               inc_col_B, beta, C, ldc, 1, num_threads);
@@ -2648,3 +2878,35 @@ int bcnn_gemm(bcnn_gemm_context *ctx, int trans_a, int trans_b, int m, int n,
 #endif
     return 0;
 }
+
+#ifdef BCNN_GEMM_PACKED_A
+size_t bcnn_gemm_packed_a_size(int m, int k) {
+    return (size_t)bh_round_up(m, MR) * k;
+}
+
+void bcnn_gemm_pack_a(int m, int k, const float *A, int lda, float *packed_A) {
+    int mb = (m + MC - 1) / MC;
+    int kb = (k + KC - 1) / KC;
+    int _mc = m % MC;
+    int _kc = k % KC;
+    // Same order as the blocks are consumed by sgemm_nn
+    for (int l = 0; l < kb; ++l) {
+        int kc = (l != kb - 1 || _kc == 0) ? KC : _kc;
+        for (int i = 0; i < mb; ++i) {
+            int mc = (i != mb - 1 || _mc == 0) ? MC : _mc;
+            sgemm_nn_pack_A(mc, kc, &A[i * MC * lda + l * KC], lda, 1,
+                            packed_A + (size_t)l * KC * bh_round_up(m, MR) +
+                                (size_t)i * MC * kc,
+                            MR, 1);
+        }
+    }
+}
+
+int bcnn_gemm_packed_a(bcnn_gemm_context *ctx, int m, int n, int k,
+                       float alpha, const float *packed_A, float *B, int ldb,
+                       float beta, float *C, int ldc, int num_threads) {
+    sgemm_nn(ctx, m, n, k, alpha, NULL, 0, 0, packed_A, B, ldb, 1, beta, C,
+             ldc, 1, num_threads);
+    return 0;
+}
+#endif
@@ -23,6 +23,7 @@
 #ifndef BCNN_MAT_H
 #define BCNN_MAT_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 /* OpenMP */
@@ -95,6 +96,12 @@ extern "C" {
 #define CONV_TILED 8
 #endif  // __aarch64__
 
+/* The GEMM can run on weights packed ahead of time (not with the OpenBLAS
+ * kernel of aarch64) */
+#if !defined(__aarch64__)
+#define BCNN_GEMM_PACKED_A
+#endif
+
 #define CONV3x3_SRC_BLOCK 64
 #define CONV3x3_WEIGHT_BLOCK 256
 #define CONV3x3_SRC_BLOCK_VEC 16
@@ -136,6 +143,10 @@ typedef struct bv_float4_t {
 /* Matrix computation routines */
 int bcnn_fill_f32(int n, float a, float *x);
 int bcnn_copy_f32(int n, float *x, float *y);
+/* Conversions between fp32 and IEEE half precision, rounded to nearest even.
+ * The values out of the half precision range become infinite. */
+void bcnn_f32_to_f16(size_t n, const float *x, uint16_t *y);
+void bcnn_f16_to_f32(size_t n, const uint16_t *x, float *y);
 int bcnn_axpy(int n, float a, float *x, float *y);
 void bcnn_axpy_strided(int num_batches, float a, float *x, float *y,
                        int stride[2], int x_dim[3], int y_dim[3],
@@ -155,6 +166,19 @@ int bcnn_gemv(int trans_a, int m, int n, float alpha, float *a, float *x,
 int bcnn_gemm(bcnn_gemm_context *ctx, int trans_a, int trans_b, int M, int N,
               int K, float ALPHA, float *A, int lda, float *B, int ldb,
               float BETA, float *C, int ldc, int num_threads);
+#ifdef BCNN_GEMM_PACKED_A
+/* Size in number of floats of a M x K matrix A packed in panels of the GEMM
+ * kernel */
+size_t bcnn_gemm_packed_a_size(int m, int k);
+/* Packs the row major matrix A (not transposed) in panels of the GEMM
+ * kernel */
+void bcnn_gemm_pack_a(int m, int k, const float *A, int lda, float *packed_A);
+/* Same as 'bcnn_gemm' without transposition, A being packed by
+ * 'bcnn_gemm_pack_a' */
+int bcnn_gemm_packed_a(bcnn_gemm_context *ctx, int m, int n, int k,
+                       float alpha, const float *packed_A, float *B, int ldb,
+                       float beta, float *C, int ldc, int num_threads);
+#endif
 float bcnn_l2_distance(float *x, float *y, int n);
 float bcnn_sqrdiff_vs(float *x, float a, int n);
 float bcnn_shiftdot(int n, float *x, float a, float *y, float b);
@@ -60,6 +60,7 @@ bcnn_status bcnn_add_activation_layer(bcnn_net *net, bcnn_activation type,
     param->activation = type;
     node.forward = bcnn_forward_activation_layer;
     node.backward = bcnn_backward_activation_layer;
+    node.infer_shape = bcnn_node_infer_same_shape;
     node.update = bcnn_update_activation_layer;
     if (type == BCNN_ACT_PRELU) {
         char weights_name[256];
@@ -149,13 +150,13 @@ void bcnn_forward_activation_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
     bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
     bcnn_activation_param *param = (bcnn_activation_param *)node->param;
-    bcnn_tensor *weights = NULL;
+    float *slopes = NULL;
     if (param->activation == BCNN_ACT_PRELU) {
-        weights = &net->tensors[node->src[1]];
+        slopes = net->tensors[node->src[1]].data;
     }
     int sz = bcnn_tensor_size(dst_tensor);
     dst_tensor->data = src_tensor->data;
-    bcnn_forward_activation_cpu(dst_tensor->data, sz, weights->data,
+    bcnn_forward_activation_cpu(dst_tensor->data, sz, slopes,
                                 dst_tensor->w * dst_tensor->h, dst_tensor->c,
                                 param->activation);
 
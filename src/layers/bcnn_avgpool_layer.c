@@ -25,6 +25,7 @@
 #include <bh/bh_string.h>
 #include "bcnn_net.h"
 #include "bcnn_tensor.h"
+#include "bcnn_thread_pool.h"
 #include "bcnn_utils.h"
 
 bcnn_status bcnn_add_avgpool_layer(bcnn_net *net, const char *src_id,
@@ -63,6 +64,7 @@ bcnn_status bcnn_add_avgpool_layer(bcnn_net *net, const char *src_id,
     node.type = BCNN_LAYER_AVGPOOL;
     node.forward = bcnn_forward_avgpool_layer;
     node.backward = bcnn_backward_avgpool_layer;
+    node.infer_shape = bcnn_infer_shape_avgpool_layer;
 
     bcnn_net_add_node(net, node);
 
@@ -79,22 +81,38 @@ bcnn_status bcnn_add_avgpool_layer(bcnn_net *net, const char *src_id,
     return 0;
 }
 
-void bcnn_forward_avgpool_layer_cpu(bcnn_net *net, bcnn_node *node) {
-    bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
-    bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
-    for (int b = 0; b < src_tensor->n; ++b) {
-#pragma omp parallel for num_threads(net->num_threads)
-        for (int k = 0; k < src_tensor->c; ++k) {
-            int idx = k + b * src_tensor->c;
-            dst_tensor->data[idx] = 0;
-            for (int i = 0; i < src_tensor->h * src_tensor->w; ++i) {
-                int offset =
-                    src_tensor->h * src_tensor->w * (k + b * src_tensor->c) + i;
-                dst_tensor->data[idx] += src_tensor->data[offset];
-            }
-            dst_tensor->data[idx] /= src_tensor->h * src_tensor->w;
+typedef struct {
+    bcnn_tensor *src_tensor;
+    bcnn_tensor *dst_tensor;
+} bcnn_avgpool_args;
+
+static void bcnn_avgpool_task(void *arg, int begin, int end) {
+    bcnn_avgpool_args *a = (bcnn_avgpool_args *)arg;
+    bcnn_tensor *src_tensor = a->src_tensor;
+    bcnn_tensor *dst_tensor = a->dst_tensor;
+    // idx = k + b * c
+    for (int idx = begin; idx < end; ++idx) {
+        dst_tensor->data[idx] = 0;
+        for (int i = 0; i < src_tensor->h * src_tensor->w; ++i) {
+            int offset = src_tensor->h * src_tensor->w * idx + i;
+            dst_tensor->data[idx] += src_tensor->data[offset];
         }
+        dst_tensor->data[idx] /= src_tensor->h * src_tensor->w;
     }
+}
+
+bcnn_status bcnn_infer_shape_avgpool_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    bcnn_tensor_set_shape(dst, src->n, src->c, 1, 1, dst->has_grad);
+    return BCNN_SUCCESS;
+}
+
+void bcnn_forward_avgpool_layer_cpu(bcnn_net *net, bcnn_node *node) {
+    bcnn_avgpool_args args = {&net->tensors[node->src[0]],
+                              &net->tensors[node->dst[0]]};
+    bcnn_parallel_for(args.src_tensor->n * args.src_tensor->c,
+                      net->num_threads, bcnn_avgpool_task, &args);
     return;
 }
 
@@ -32,6 +32,7 @@ extern "C" {
 
 void bcnn_forward_avgpool_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_avgpool_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_avgpool_layer(bcnn_net *net, bcnn_node *node);
 #ifdef BCNN_USE_CUDA
 void bcnn_forward_avgpool_layer_gpu(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_avgpool_layer_gpu(bcnn_net *net, bcnn_node *node);
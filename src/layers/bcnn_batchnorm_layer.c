@@ -24,6 +24,7 @@
 
 #include <math.h>
 
+#include "bcnn_allocator.h"
 #include "bcnn_mat.h"
 #include "bcnn_net.h"
 #include "bcnn_tensor.h"
@@ -71,6 +72,7 @@ bcnn_status bcnn_add_batchnorm_layer(bcnn_net *net, const char *src_id,
     bcnn_batchnorm_param *param = (bcnn_batchnorm_param *)node.param;
     node.forward = bcnn_forward_batchnorm_layer;
     node.backward = bcnn_backward_batchnorm_layer;
+    node.infer_shape = bcnn_node_infer_same_shape;
     node.release_param = bcnn_release_param_batchnorm_layer;
 
     channels = net->tensors[node.dst[0]].c;
@@ -107,9 +109,12 @@ bcnn_status bcnn_add_batchnorm_layer(bcnn_net *net, const char *src_id,
     bcnn_net_add_tensor(net, biases);
     bcnn_node_add_input(net, &node, net->num_tensors - 1);
     // Internal data
-    param->x_norm = (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+    param->x_norm = (float *)bcnn_align_calloc(sz * sizeof(float),
+                                               align_offset_,
+                                               BCNN_ALLOC_ACTIVATIONS);
     param->workspace =
-        (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+        (float *)bcnn_align_calloc(sz * sizeof(float), align_offset_,
+                                   BCNN_ALLOC_WORKSPACE);
 #ifdef BCNN_USE_CUDA
     param->x_norm_gpu =
         bcnn_cuda_memcpy_f32(net->tensors[node.dst[0]].data, sz);
@@ -365,8 +370,8 @@ void bcnn_backward_batchnorm_layer(bcnn_net *net, bcnn_node *node) {
 
 void bcnn_release_param_batchnorm_layer(bcnn_node *node) {
     bcnn_batchnorm_param *param = (bcnn_batchnorm_param *)node->param;
-    bh_align_free(param->workspace);
-    bh_align_free(param->x_norm);
+    bcnn_align_free(param->workspace);
+    bcnn_align_free(param->x_norm);
     bcnn_tensor_destroy(&param->saved_mean);
     bcnn_tensor_destroy(&param->saved_variance);
 #ifdef BCNN_USE_CUDA
@@ -45,6 +45,7 @@ bcnn_status bcnn_add_concat_layer(bcnn_net *net, int num_src,
     node.type = BCNN_LAYER_CONCAT;
     node.forward = bcnn_forward_concat_layer;
     node.backward = bcnn_backward_concat_layer;
+    node.infer_shape = bcnn_infer_shape_concat_layer;
     for (int i = 0; i < num_src; ++i) {
         int tid = -1;
         BCNN_CHECK_AND_LOG(
@@ -88,7 +89,7 @@ bcnn_status bcnn_add_concat_layer(bcnn_net *net, int num_src,
     snprintf(node_opname, 256, BH_LOG_BOLDBLUE "[Concat]" BH_LOG_RESET);
     int src_names_length = 0;
     for (int i = 0; i < num_src; ++i) {
-        src_names_length += strlen(net->tensors[node.src[i]].name);
+        src_names_length += strlen(net->tensors[node.src[i]].name) + 1;
     }
     char *src_names = (char *)calloc(src_names_length + 1, sizeof(char));
     for (int i = 0; i < num_src; ++i) {
@@ -104,6 +105,25 @@ bcnn_status bcnn_add_concat_layer(bcnn_net *net, int num_src,
     return BCNN_SUCCESS;
 }
 
+bcnn_status bcnn_infer_shape_concat_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_tensor *src0 = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    int out_c = src0->c;
+    for (int i = 1; i < node->num_src; ++i) {
+        bcnn_tensor *src = &net->tensors[node->src[i]];
+        BCNN_CHECK_AND_LOG(
+            net->log_ctx, src0->w == src->w && src0->h == src->h,
+            BCNN_INVALID_PARAMETER,
+            "Concat layer: inconsistent spatial sizes between node %s (%dx%d) "
+            "and node %s (%dx%d)\n",
+            src0->name, src0->w, src0->h, src->name, src->w, src->h);
+        out_c += src->c;
+    }
+    bcnn_tensor_set_shape(dst, src0->n, out_c, src0->h, src0->w,
+                          dst->has_grad);
+    return BCNN_SUCCESS;
+}
+
 void bcnn_forward_concat_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
     int dst_sz = bcnn_tensor_size3d(dst_tensor);
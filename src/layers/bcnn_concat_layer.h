@@ -32,6 +32,7 @@ extern "C" {
 
 void bcnn_forward_concat_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_concat_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_concat_layer(bcnn_net *net, bcnn_node *node);
 
 #ifdef __cplusplus
 }
@@ -32,6 +32,7 @@
 #endif
 
 #include "bcnn_activation_layer.h"
+#include "bcnn_allocator.h"
 #include "bcnn_batchnorm_layer.h"
 #include "bcnn_conv_layer.h"
 #include "bcnn_learner.h"
@@ -42,6 +43,24 @@
 
 #include <bh/bh_timer.h>
 
+/* Size in number of floats of the net workspace needed by the layer: the
+ * im2col buffer or, for conv 3x3/s1, the kernel workspace followed by the src
+ * and dst tensors in nc4hw4 */
+size_t bcnn_conv_layer_workspace_size(bcnn_net *net, bcnn_node *node) {
+    bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    size_t sz = (size_t)dst->w * dst->h * (src->c / param->num_groups) *
+                param->size * param->size;
+    if (param->weights_workspace != NULL) {
+        size_t src_sz = src->w * src->h * bh_round_up(src->c, 4) * src->n;
+        size_t dst_sz = dst->w * dst->h * bh_round_up(dst->c, 4) * dst->n;
+        sz = bh_max(sz, bh_round_up(param->workspace_size, 16) +
+                            bh_round_up(src_sz, 16) + dst_sz);
+    }
+    return sz;
+}
+
 bcnn_status bcnn_add_convolutional_layer(bcnn_net *net, int n, int size,
                                          int stride, int pad, int num_groups,
                                          int batch_norm, bcnn_filler_type init,
@@ -112,15 +131,18 @@ bcnn_status bcnn_add_convolutional_layer(bcnn_net *net, int n, int size,
     param->num_groups = num_groups;
     node.forward = bcnn_forward_conv_layer;
     node.backward = bcnn_backward_conv_layer;
+    node.infer_shape = bcnn_infer_shape_conv_layer;
     node.update = bcnn_update_conv_layer;
     node.release_param = bcnn_release_param_conv_layer;
     if (net->learner != NULL) {
         if (net->learner->optimizer == BCNN_OPTIM_ADAM) {
             int weights_size = bcnn_tensor_size(&weights);
-            param->adam_m = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
-            param->adam_v = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
+            param->adam_m = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
+            param->adam_v = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
         }
     }
     bcnn_tensor_set_shape(
@@ -138,10 +160,6 @@ bcnn_status bcnn_add_convolutional_layer(bcnn_net *net, int n, int size,
     BCNN_CHECK_STATUS(bcnn_net_add_tensor(net, dst_tensor));
     // Add tensor output index to node
     BCNN_CHECK_STATUS(bcnn_node_add_output(net, &node, net->num_tensors - 1));
-    int sz_wk = net->tensors[node.dst[0]].w * net->tensors[node.dst[0]].h *
-                num_channels_per_group * size * size;
-    param->conv_workspace =
-        (float *)bh_align_calloc(sz_wk * sizeof(float), align_offset_);
     if (batch_norm) {
         param->batch_norm = 1;
         int sz = bcnn_tensor_size(&net->tensors[node.dst[0]]);
@@ -181,9 +199,11 @@ bcnn_status bcnn_add_convolutional_layer(bcnn_net *net, int n, int size,
             bcnn_node_add_input(net, &node, net->num_tensors - 1));
         // Internal workspace for batch norm
         param->x_norm =
-            (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+            (float *)bcnn_align_calloc(sz * sizeof(float), align_offset_,
+                                       BCNN_ALLOC_ACTIVATIONS);
         param->workspace =
-            (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+            (float *)bcnn_align_calloc(sz * sizeof(float), align_offset_,
+                                       BCNN_ALLOC_WORKSPACE);
     }
     if (param->activation == BCNN_ACT_PRELU) {
         char prelu_slopes_name[256];
@@ -199,54 +219,34 @@ bcnn_status bcnn_add_convolutional_layer(bcnn_net *net, int n, int size,
     // Special case for conv 3x3/s1
     if (param->size == 3 && param->stride == 1 && param->num_groups == 1 &&
         net->mode == BCNN_MODE_PREDICT) {
-        bh_align_free(param->conv_workspace);
         int src_c_div4 = bh_div_up(net->tensors[node.src[0]].c, 4);
         int dst_c_div4 = bh_div_up(n, 4);
         param->workspace_size = net->num_threads * CONV_TILED *
                                 (src_c_div4 + bh_div_up(n, 4) + 1) *
                                 CONV3x3_SRC_BLOCK;
-        param->conv_workspace = (float *)bh_align_calloc(
-            param->workspace_size * sizeof(float), align_offset_);
-        param->weights_workspace = (float *)bh_align_calloc(
-            src_c_div4 * dst_c_div4 * 256 * sizeof(float), align_offset_);
-        param->biases_workspace = (float *)bh_align_calloc(
+        param->weights_workspace = (float *)bcnn_align_calloc(
+            src_c_div4 * dst_c_div4 * 256 * sizeof(float), align_offset_,
+            BCNN_ALLOC_WEIGHTS);
+        param->biases_workspace = (float *)bcnn_align_calloc(
             bh_round_up(net->tensors[node.dst[0]].c, 4) * sizeof(float),
-            align_offset_);
+            align_offset_, BCNN_ALLOC_WEIGHTS);
         if (param->batch_norm == 1) {
-            param->scales_workspace = (float *)bh_align_calloc(
+            param->scales_workspace = (float *)bcnn_align_calloc(
                 bh_round_up(net->tensors[node.dst[0]].c, 4) * sizeof(float),
-                align_offset_);
+                align_offset_, BCNN_ALLOC_WEIGHTS);
         }
         if (param->activation == BCNN_ACT_PRELU) {
-            param->slopes_workspace = (float *)bh_align_calloc(
+            param->slopes_workspace = (float *)bcnn_align_calloc(
                 bh_round_up(net->tensors[node.dst[0]].c, 4) * sizeof(float),
-                align_offset_);
-        }
-        // Reshape src tensor
-        size_t src_sz = net->tensors[node.src[0]].w *
-                        net->tensors[node.src[0]].h * src_c_div4 * 4 *
-                        net->tensors[node.src[0]].n;
-        param->src_workspace =
-            (float *)bh_align_calloc(src_sz * sizeof(float), align_offset_);
-        size_t dst_sz = net->tensors[node.dst[0]].w *
-                        net->tensors[node.dst[0]].h * dst_c_div4 * 4 *
-                        net->tensors[node.dst[0]].n;
-        param->dst_workspace =
-            (float *)bh_align_calloc(dst_sz * sizeof(float), align_offset_);
-        // Post-function (fused batchnorm and activation)
-        // TODO: hacky, and will break when post-function table is updated
-        param->post_func = 0;
-        if (param->activation == BCNN_ACT_RELU) {
-            param->post_func = 1;
-        } else if (param->activation == BCNN_ACT_LRELU) {
-            param->post_func = 2;
-        } else if (param->activation == BCNN_ACT_PRELU) {
-            param->post_func = 3;
-        }
-        if (param->batch_norm == 1) {
-            param->post_func += 4;
+                align_offset_, BCNN_ALLOC_WEIGHTS);
         }
+        bcnn_conv_layer_set_post_func(param);
     }
+    // The im2col workspace is shared by all the layers and alloc'd at the
+    // struct bcnn_net level. The kernel workspace and the src / dst tensors
+    // reshaped in nc4hw4 of conv 3x3/s1 are carved out of it as well.
+    net->workspace_size = bh_max(net->workspace_size,
+                                 bcnn_conv_layer_workspace_size(net, &node));
 #ifdef BCNN_USE_CUDA
     if (net->learner != NULL) {
         if (net->learner->optimizer == BCNN_OPTIM_ADAM) {
@@ -364,6 +364,111 @@ bcnn_status bcnn_add_convolutional_layer(bcnn_net *net, int n, int size,
     return 0;
 }
 
+void bcnn_conv_layer_set_post_func(bcnn_conv_param *param) {
+    // Post-function (fused batchnorm and activation)
+    // TODO: hacky, and will break when post-function table is updated
+    param->post_func = 0;
+    if (param->activation == BCNN_ACT_RELU) {
+        param->post_func = 1;
+    } else if (param->activation == BCNN_ACT_LRELU) {
+        param->post_func = 2;
+    } else if (param->activation == BCNN_ACT_PRELU) {
+        param->post_func = 3;
+    }
+    if (param->batch_norm == 1) {
+        param->post_func += 4;
+    }
+}
+
+bcnn_status bcnn_infer_shape_conv_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    int num_channels = net->tensors[node->src[1]].c * param->num_groups;
+    BCNN_CHECK_AND_LOG(net->log_ctx, src->c == num_channels,
+                       BCNN_INVALID_PARAMETER,
+                       "Convolution layer: input has %d channels, expected "
+                       "%d\n",
+                       src->c, num_channels);
+    bcnn_tensor_set_shape(
+        dst, src->n, param->num,
+        (src->h + 2 * param->pad - param->size) / param->stride + 1,
+        (src->w + 2 * param->pad - param->size) / param->stride + 1,
+        dst->has_grad);
+    BCNN_CHECK_AND_LOG(net->log_ctx, dst->h > 0 && dst->w > 0,
+                       BCNN_INVALID_PARAMETER,
+                       "Convolution layer: input %dx%d is too small\n",
+                       src->w, src->h);
+    net->workspace_size = bh_max(net->workspace_size,
+                                 bcnn_conv_layer_workspace_size(net, node));
+    return BCNN_SUCCESS;
+}
+
+/* Conv 3x3/s1 layers run a dedicated kernel on data in layout NC4HW4 */
+static int bcnn_conv_layer_is_conv3x3s1(bcnn_net *net, bcnn_conv_param *param) {
+    return (param->size == 3 && param->stride == 1 && param->num_groups == 1 &&
+            net->mode == BCNN_MODE_PREDICT);
+}
+
+size_t bcnn_conv_layer_packed_weights_size(bcnn_net *net, bcnn_node *node) {
+#if defined(BCNN_GEMM_PACKED_A) && !defined(BCNN_USE_BLAS) && \
+    !defined(BCNN_USE_CUDA)
+    bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+    if (net->mode != BCNN_MODE_PREDICT ||
+        bcnn_conv_layer_is_conv3x3s1(net, param)) {
+        return 0;
+    }
+    int m = param->num / param->num_groups;
+    int k = param->size * param->size * net->tensors[node->src[0]].c /
+            param->num_groups;
+    return param->num_groups * bcnn_gemm_packed_a_size(m, k);
+#else
+    return 0;
+#endif
+}
+
+bcnn_status bcnn_conv_layer_pack_weights(bcnn_net *net, bcnn_node *node) {
+#if defined(BCNN_GEMM_PACKED_A) && !defined(BCNN_USE_BLAS) && \
+    !defined(BCNN_USE_CUDA)
+    size_t sz = bcnn_conv_layer_packed_weights_size(net, node);
+    if (sz == 0) {
+        return BCNN_SUCCESS;
+    }
+    bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+    if (param->packed_weights == NULL) {
+        param->packed_weights = (float *)bcnn_align_malloc(
+            sz * sizeof(float), align_offset_, BCNN_ALLOC_WEIGHTS);
+        BCNN_CHECK_AND_LOG(net->log_ctx, param->packed_weights,
+                           BCNN_FAILED_ALLOC, "Internal allocation error\n");
+    }
+    bcnn_tensor *weights = &net->tensors[node->src[1]];
+    int m = param->num / param->num_groups;
+    int k = param->size * param->size * net->tensors[node->src[0]].c /
+            param->num_groups;
+    for (int j = 0; j < param->num_groups; ++j) {
+        bcnn_gemm_pack_a(m, k, weights->data + j * m * k, k,
+                         param->packed_weights + j * (sz / param->num_groups));
+    }
+#endif
+    return BCNN_SUCCESS;
+}
+
+const char *bcnn_conv_layer_kernel_name(bcnn_net *net, bcnn_node *node) {
+#ifdef BCNN_USE_CUDA
+#ifdef BCNN_USE_CUDNN
+    return "cudnn";
+#else
+    return "im2col+gemm (gpu)";
+#endif
+#else
+    bcnn_conv_param *param = (bcnn_conv_param *)node->param;
+    if (bcnn_conv_layer_is_conv3x3s1(net, param)) {
+        return "conv3x3s1 (nc4hw4)";
+    }
+    return (param->size == 1) ? "gemm" : "im2col+gemm";
+#endif
+}
+
 void bcnn_forward_conv_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
     bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
@@ -399,39 +504,39 @@ void bcnn_forward_conv_layer_cpu(bcnn_net *net, bcnn_node *node) {
     int wsz = bcnn_tensor_size(weights);
 
     // Special case for conv 3x3/s1
-    if (param->size == 3 && param->stride == 1 && param->num_groups == 1 &&
-        net->mode == BCNN_MODE_PREDICT) {
-        // bh_timer t = {0};
-        // bh_timer_start(&t);
-        bcnn_nchw_to_nc4hw4(param->src_workspace, src_tensor->data,
-                            src_tensor->h * src_tensor->w, src_tensor->c,
-                            src_tensor->n);
-        // bh_timer_stop(&t);
-        // fprintf(stderr, "pack %f msecs\n", bh_timer_get_msec(&t));
-        // bh_timer_start(&t);
+    if (bcnn_conv_layer_is_conv3x3s1(net, param)) {
+        // Tensors already in nc4hw4 layout are read / written in place
+        float *src_nc4hw4 = src_tensor->data;
+        float *dst_nc4hw4 = dst_tensor->data;
+        if (src_tensor->layout != BCNN_LAYOUT_NC4HW4) {
+            src_nc4hw4 = param->src_workspace;
+            bcnn_nchw_to_nc4hw4(src_nc4hw4, src_tensor->data,
+                                src_tensor->h * src_tensor->w, src_tensor->c,
+                                src_tensor->n);
+        }
+        if (dst_tensor->layout != BCNN_LAYOUT_NC4HW4) {
+            dst_nc4hw4 = param->dst_workspace;
+        }
         bcnn_conv3x3s1_kernel(
-            param->src_workspace, src_tensor->w, src_tensor->h, src_tensor->c,
-            param->dst_workspace, dst_tensor->w, dst_tensor->h, dst_tensor->c,
+            src_nc4hw4, src_tensor->w, src_tensor->h, src_tensor->c,
+            dst_nc4hw4, dst_tensor->w, dst_tensor->h, dst_tensor->c,
             batch_size, param->pad, param->weights_workspace,
             param->scales_workspace, param->biases_workspace,
             param->slopes_workspace, param->conv_workspace,
             param->workspace_size, param->post_func, net->num_threads);
-        // bh_timer_stop(&t);
-        // fprintf(stderr, "conv3x3 %f msecs\n", bh_timer_get_msec(&t));
-        // bh_timer_start(&t);
-        bcnn_nc4hw4_to_nchw(dst_tensor->data, param->dst_workspace,
-                            dst_tensor->w * dst_tensor->h, dst_tensor->c,
-                            dst_tensor->n);
-        // bh_timer_stop(&t);
-        // fprintf(stderr, "%s unpack %f msecs\n", dst_tensor->name,
-        //        bh_timer_get_msec(&t));
+        if (dst_tensor->layout != BCNN_LAYOUT_NC4HW4) {
+            bcnn_nc4hw4_to_nchw(dst_tensor->data, dst_nc4hw4,
+                                dst_tensor->w * dst_tensor->h, dst_tensor->c,
+                                dst_tensor->n);
+        }
         // In case of the activation function is not supported in nc4hw4,
-        // process it here
+        // process it here (element-wise activations only, so that it does not
+        // depend on the layout)
         if ((param->post_func % 4) == 0 &&
             (param->activation != BCNN_ACT_NONE)) {
             bcnn_forward_activation_cpu(
-                dst_tensor->data, bcnn_tensor_size(dst_tensor), slopes_data,
-                dst_tensor->w * dst_tensor->h, dst_tensor->c,
+                dst_tensor->data, bcnn_tensor_buffer_size(dst_tensor),
+                slopes_data, dst_tensor->w * dst_tensor->h, dst_tensor->c,
                 param->activation);
         }
     } else {
@@ -460,8 +565,18 @@ void bcnn_forward_conv_layer_cpu(bcnn_net *net, bcnn_node *node) {
                 cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k,
                             1.0f, a, k, b, n, 1.0f, c, n);
 #else
-                bcnn_gemm(net->gemm_ctx, 0, 0, m, n, k, 1.0f, a, k, b, n, 1.0f,
-                          c, n, net->num_threads);
+#ifdef BCNN_GEMM_PACKED_A
+                if (param->packed_weights != NULL) {
+                    bcnn_gemm_packed_a(
+                        bcnn_net_get_gemm_context(net, node), m, n, k, 1.0f,
+                        param->packed_weights +
+                            j * bcnn_gemm_packed_a_size(m, k),
+                        b, n, 1.0f, c, n, net->num_threads);
+                    continue;
+                }
+#endif
+                bcnn_gemm(bcnn_net_get_gemm_context(net, node), 0, 0, m, n, k,
+                          1.0f, a, k, b, n, 1.0f, c, n, net->num_threads);
 #endif
             }
         }
@@ -858,17 +973,17 @@ void bcnn_release_param_conv_layer(bcnn_node *node) {
     bcnn_conv_param *param = (bcnn_conv_param *)node->param;
     bcnn_tensor_destroy(&param->saved_mean);
     bcnn_tensor_destroy(&param->saved_variance);
-    bh_align_free(param->conv_workspace);
-    bh_align_free(param->x_norm);
-    bh_align_free(param->workspace);
-    bh_align_free(param->adam_m);
-    bh_align_free(param->adam_v);
-    bh_align_free(param->weights_workspace);
-    bh_align_free(param->biases_workspace);
-    bh_align_free(param->scales_workspace);
-    bh_align_free(param->slopes_workspace);
-    bh_align_free(param->src_workspace);
-    bh_align_free(param->dst_workspace);
+    bcnn_align_free(param->x_norm);
+    bcnn_align_free(param->workspace);
+    bcnn_align_free(param->adam_m);
+    bcnn_align_free(param->adam_v);
+    bcnn_align_free(param->weights_workspace);
+    bcnn_align_free(param->packed_weights);
+    bcnn_align_free(param->biases_workspace);
+    bcnn_align_free(param->scales_workspace);
+    bcnn_align_free(param->slopes_workspace);
+// param->conv_workspace, param->src_workspace and param->dst_workspace are
+// alloc'd / free'd at the struct bcnn_net level
 #ifdef BCNN_USE_CUDA
     if (param->x_norm_gpu) {
         bcnn_cuda_free(param->x_norm_gpu);
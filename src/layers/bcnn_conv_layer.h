@@ -46,6 +46,7 @@ typedef struct bcnn_conv_param {
     float *conv_workspace;
     float *workspace;  // embedded batchnorm
     float *weights_workspace;
+    float *packed_weights;  // weights in GEMM panels, one block per group
     float *biases_workspace;
     float *scales_workspace;
     float *slopes_workspace;
@@ -73,8 +74,23 @@ typedef struct bcnn_conv_param {
 #endif
 } bcnn_conv_param;
 
+/* Sets the post-function of the conv 3x3/s1 kernel according to the
+ * activation and batchnorm settings */
+void bcnn_conv_layer_set_post_func(bcnn_conv_param *param);
+/* Returns the size in number of floats of the workspace of the layer */
+size_t bcnn_conv_layer_workspace_size(bcnn_net *net, bcnn_node *node);
+/* Returns the size in number of floats of the weights packed for the GEMM
+ * kernel, 0 if the layer does not run the GEMM on packed weights */
+size_t bcnn_conv_layer_packed_weights_size(bcnn_net *net, bcnn_node *node);
+/* Packs the weights in 'packed_weights' so that the GEMM does not re-pack them
+ * at every forward. Does nothing if the layer does not run the GEMM on packed
+ * weights. */
+bcnn_status bcnn_conv_layer_pack_weights(bcnn_net *net, bcnn_node *node);
+/* Returns the name of the kernel run by the forward of the layer */
+const char *bcnn_conv_layer_kernel_name(bcnn_net *net, bcnn_node *node);
 void bcnn_forward_conv_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_conv_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_conv_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_update_conv_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_release_param_conv_layer(bcnn_node *node);
 
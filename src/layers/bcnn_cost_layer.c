@@ -65,6 +65,7 @@ bcnn_status bcnn_add_cost_layer(bcnn_net *net, bcnn_loss loss,
     param->loss_metric = loss_metric;
     node.forward = bcnn_forward_cost_layer;
     node.backward = bcnn_backward_cost_layer;
+    node.infer_shape = bcnn_infer_shape_cost_layer;
 
     // Setup label node
     bcnn_tensor_set_shape(&net->tensors[1], net->tensors[node.src[0]].n,
@@ -90,6 +91,16 @@ bcnn_status bcnn_add_cost_layer(bcnn_net *net, bcnn_loss loss,
     return 0;
 }
 
+bcnn_status bcnn_infer_shape_cost_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    // The label has the shape of the input
+    bcnn_tensor_set_shape(&net->tensors[node->src[1]], src->n, src->c, src->h,
+                          src->w, 0);
+    bcnn_tensor_set_shape(dst, src->n, src->c, src->h, src->w, dst->has_grad);
+    return BCNN_SUCCESS;
+}
+
 static void bcnn_huber_loss(int n, float *x, float *label, float *error,
                             float *grad_error, float hdelta) {
     int i;
@@ -39,6 +39,7 @@ typedef struct bcnn_cost_param {
 
 void bcnn_forward_cost_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_cost_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_cost_layer(bcnn_net *net, bcnn_node *node);
 
 void bcnn_lifted_struct_loss_backward(bcnn_net *net, bcnn_node *node);
 void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node);
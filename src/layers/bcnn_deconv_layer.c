@@ -26,10 +26,12 @@
 #include "cblas.h"
 #endif
 
+#include <bh/bh_macros.h>
 #include <bh/bh_mem.h>
 #include <bh/bh_string.h>
 
 #include "bcnn_activation_layer.h"
+#include "bcnn_allocator.h"
 #include "bcnn_learner.h"
 #include "bcnn_mat.h"
 #include "bcnn_net.h"
@@ -71,6 +73,7 @@ bcnn_status bcnn_add_deconvolutional_layer(
     param->stride = stride;
     node.forward = bcnn_forward_deconv_layer;
     node.backward = bcnn_backward_deconv_layer;
+    node.infer_shape = bcnn_infer_shape_deconv_layer;
     node.update = bcnn_update_deconv_layer;
     node.release_param = bcnn_release_param_deconv_layer;
 
@@ -106,21 +109,24 @@ bcnn_status bcnn_add_deconvolutional_layer(
     bcnn_net_add_tensor(net, dst_tensor);
     // Add tensor output index to node
     bcnn_node_add_output(net, &node, net->num_tensors - 1);
-    int sz = net->tensors[node.dst[0]].w * net->tensors[node.dst[0]].h *
-             net->tensors[node.src[0]].c * size * size;
-    param->conv_workspace =
-        (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+    // The col2im workspace is shared by all the layers and alloc'd at the
+    // struct bcnn_net level
+    size_t sz = net->tensors[node.dst[0]].w * net->tensors[node.dst[0]].h *
+                net->tensors[node.src[0]].c * size * size;
+    net->workspace_size = bh_max(net->workspace_size, sz);
     if (net->learner != NULL) {
         if (net->learner->optimizer == BCNN_OPTIM_ADAM) {
             int weights_size = bcnn_tensor_size(&weights);
-            param->adam_m = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
-            param->adam_v = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
+            param->adam_m = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
+            param->adam_v = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
         }
     }
 #ifdef BCNN_USE_CUDA
-    param->conv_workspace_gpu = bcnn_cuda_memcpy_f32(param->conv_workspace, sz);
+    param->conv_workspace_gpu = bcnn_cuda_malloc_f32(sz);
     if (net->learner != NULL) {
         if (net->learner->optimizer == BCNN_OPTIM_ADAM) {
             int weights_size = bcnn_tensor_size(&weights);
@@ -146,6 +152,27 @@ bcnn_status bcnn_add_deconvolutional_layer(
     return BCNN_SUCCESS;
 }
 
+bcnn_status bcnn_infer_shape_deconv_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_deconv_param *param = (bcnn_deconv_param *)node->param;
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    BCNN_CHECK_AND_LOG(
+        net->log_ctx,
+        src->c * param->num * param->size * param->size ==
+            bcnn_tensor_size(&net->tensors[node->src[1]]),
+        BCNN_INVALID_PARAMETER,
+        "Deconvolution layer: invalid number of input channels %d\n", src->c);
+    bcnn_tensor_set_shape(
+        dst, src->n, param->num,
+        param->stride * (src->h - 1) + param->size - 2 * param->pad,
+        param->stride * (src->w - 1) + param->size - 2 * param->pad,
+        dst->has_grad);
+    // col2im workspace
+    size_t sz = (size_t)dst->w * dst->h * src->c * param->size * param->size;
+    net->workspace_size = bh_max(net->workspace_size, sz);
+    return BCNN_SUCCESS;
+}
+
 void bcnn_forward_deconv_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
     bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
@@ -169,9 +196,9 @@ void bcnn_forward_deconv_layer_cpu(bcnn_net *net, bcnn_node *node) {
                     weights->data, m, src_tensor->data + i * sz, n, 0.0f,
                     param->conv_workspace, n);
 #else
-        bcnn_gemm(net->gemm_ctx, 1, 0, m, n, k, 1.0f, weights->data, m,
-                  src_tensor->data + i * sz, n, 0.0f, param->conv_workspace, n,
-                  net->num_threads);
+        bcnn_gemm(bcnn_net_get_gemm_context(net, node), 1, 0, m, n, k, 1.0f,
+                  weights->data, m, src_tensor->data + i * sz, n, 0.0f,
+                  param->conv_workspace, n, net->num_threads);
 #endif
         bcnn_col2im(
             param->conv_workspace, param->num, dst_tensor->h, dst_tensor->w,
@@ -395,9 +422,9 @@ void bcnn_update_deconv_layer(bcnn_net *net, bcnn_node *node) {
 
 void bcnn_release_param_deconv_layer(bcnn_node *node) {
     bcnn_deconv_param *param = (bcnn_deconv_param *)node->param;
-    bh_align_free(param->conv_workspace);
-    bh_align_free(param->adam_m);
-    bh_align_free(param->adam_v);
+    // param->conv_workspace is alloc'd / free'd at the struct bcnn_net level
+    bcnn_align_free(param->adam_m);
+    bcnn_align_free(param->adam_v);
 #ifdef BCNN_USE_CUDA
     if (param->adam_m_gpu) {
         bcnn_cuda_free(param->adam_m_gpu);
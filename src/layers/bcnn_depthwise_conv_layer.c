@@ -23,6 +23,7 @@
 #include "bcnn_depthwise_conv_layer.h"
 
 #include "bcnn_activation_layer.h"
+#include "bcnn_allocator.h"
 #include "bcnn_learner.h"
 #include "bcnn_mat.h"
 #include "bcnn_net.h"
@@ -75,6 +76,7 @@ bcnn_status bcnn_add_depthwise_conv_layer(bcnn_net *net, int size, int stride,
     param->stride = stride;
     node.forward = bcnn_forward_depthwise_conv_layer;
     node.backward = bcnn_backward_depthwise_conv_layer;
+    node.infer_shape = bcnn_infer_shape_depthwise_conv_layer;
     node.update = bcnn_update_depthwise_conv_layer;
     node.release_param = bcnn_release_param_depthwise_conv_layer;
 
@@ -101,10 +103,12 @@ bcnn_status bcnn_add_depthwise_conv_layer(bcnn_net *net, int size, int stride,
     if (net->learner != NULL) {
         if (net->learner->optimizer == BCNN_OPTIM_ADAM) {
             int weights_size = bcnn_tensor_size(&weights);
-            param->adam_m = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
-            param->adam_v = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
+            param->adam_m = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
+            param->adam_v = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
         }
     }
 #ifdef BCNN_USE_CUDA
@@ -162,6 +166,32 @@ bcnn_status bcnn_add_depthwise_conv_layer(bcnn_net *net, int size, int stride,
     return 0;
 }
 
+bcnn_status bcnn_infer_shape_depthwise_conv_layer(bcnn_net *net,
+                                                  bcnn_node *node) {
+    bcnn_depthwise_conv_param *param =
+        (bcnn_depthwise_conv_param *)node->param;
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    BCNN_CHECK_AND_LOG(
+        net->log_ctx,
+        src->c * param->size * param->size ==
+            bcnn_tensor_size(&net->tensors[node->src[1]]),
+        BCNN_INVALID_PARAMETER,
+        "Depthwise convolution layer: invalid number of input channels %d\n",
+        src->c);
+    bcnn_tensor_set_shape(
+        dst, src->n, src->c,
+        (src->h + 2 * param->pad - param->size) / param->stride + 1,
+        (src->w + 2 * param->pad - param->size) / param->stride + 1,
+        dst->has_grad);
+    BCNN_CHECK_AND_LOG(net->log_ctx, dst->h > 0 && dst->w > 0,
+                       BCNN_INVALID_PARAMETER,
+                       "Depthwise convolution layer: input %dx%d is too "
+                       "small\n",
+                       src->w, src->h);
+    return BCNN_SUCCESS;
+}
+
 void bcnn_forward_depthwise_conv_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
     bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
@@ -611,8 +641,8 @@ void bcnn_update_depthwise_conv_layer(bcnn_net *net, bcnn_node *node) {
 
 void bcnn_release_param_depthwise_conv_layer(bcnn_node *node) {
     bcnn_depthwise_conv_param *param = (bcnn_depthwise_conv_param *)node->param;
-    bh_align_free(param->adam_m);
-    bh_align_free(param->adam_v);
+    bcnn_align_free(param->adam_m);
+    bcnn_align_free(param->adam_v);
 #ifdef BCNN_USE_CUDA
     if (param->adam_m_gpu) {
         bcnn_cuda_free(param->adam_m_gpu);
@@ -46,6 +46,8 @@ typedef struct bcnn_depthwise_conv_param {
 
 void bcnn_forward_depthwise_conv_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_depthwise_conv_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_depthwise_conv_layer(bcnn_net *net,
+                                                  bcnn_node *node);
 void bcnn_update_depthwise_conv_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_release_param_depthwise_conv_layer(bcnn_node *node);
 
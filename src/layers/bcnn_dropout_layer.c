@@ -25,6 +25,7 @@
 #include <bh/bh_mem.h>
 #include <bh/bh_string.h>
 
+#include "bcnn_allocator.h"
 #include "bcnn_net.h"
 #include "bcnn_tensor.h"
 #include "bcnn_utils.h"
@@ -55,13 +56,15 @@ bcnn_status bcnn_add_dropout_layer(bcnn_net *net, float rate,
     bcnn_dropout_param *param = (bcnn_dropout_param *)node.param;
     param->dropout_rate = rate;
     int sz = bcnn_tensor_size(&net->tensors[node.src[0]]);
-    param->rand = (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+    param->rand = (float *)bcnn_align_calloc(sz * sizeof(float), align_offset_,
+                                             BCNN_ALLOC_ACTIVATIONS);
     param->scale = 1.0f / (1.0f - rate);
 #ifdef BCNN_USE_CUDA
     param->rand_gpu = bcnn_cuda_memcpy_f32(param->rand, sz);
 #endif
     node.forward = bcnn_forward_dropout_layer;
     node.backward = bcnn_backward_dropout_layer;
+    node.infer_shape = bcnn_node_infer_same_shape;
     node.release_param = bcnn_release_param_dropout_layer;
 
     bcnn_net_add_node(net, node);
@@ -135,7 +138,7 @@ void bcnn_backward_dropout_layer(bcnn_net *net, bcnn_node *node) {
 
 void bcnn_release_param_dropout_layer(bcnn_node *node) {
     bcnn_dropout_param *param = (bcnn_dropout_param *)node->param;
-    bh_align_free(param->rand);
+    bcnn_align_free(param->rand);
 #ifdef BCNN_USE_CUDA
     bcnn_cuda_free(param->rand_gpu);
 #endif
@@ -84,6 +84,7 @@ bcnn_status bcnn_add_eltwise_layer(bcnn_net *net, bcnn_activation activation,
     param->stride[1] = bh_max(1, stride[1]);
     node.forward = bcnn_forward_eltwise_layer;
     node.backward = bcnn_backward_eltwise_layer;
+    node.infer_shape = bcnn_infer_shape_eltwise_layer;
     // Setup output tensor
     bcnn_tensor_set_shape(
         &dst_tensor, net->tensors[node.src[0]].n, net->tensors[node.src[0]].c,
@@ -108,6 +109,29 @@ bcnn_status bcnn_add_eltwise_layer(bcnn_net *net, bcnn_activation activation,
     return BCNN_SUCCESS;
 }
 
+bcnn_status bcnn_infer_shape_eltwise_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_eltwise_param *param = (bcnn_eltwise_param *)node->param;
+    bcnn_tensor *src0 = &net->tensors[node->src[0]];
+    bcnn_tensor *src1 = &net->tensors[node->src[1]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    int stride[2] = {src0->w / src1->w, src1->w / src0->w};
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       (stride[0] == src0->h / src1->h) &&
+                           (stride[1] == src1->h / src0->h),
+                       BCNN_INVALID_PARAMETER,
+                       "Eltwise layer: inconsistent spatial size between "
+                       "tensor %s and tensor %s\n",
+                       src0->name, src1->name);
+    param->min_dim[2] = bh_min(src0->w, src1->w);
+    param->min_dim[1] = bh_min(src0->h, src1->h);
+    param->min_dim[0] = bh_min(src0->c, src1->c);
+    param->stride[0] = bh_max(1, stride[0]);
+    param->stride[1] = bh_max(1, stride[1]);
+    bcnn_tensor_set_shape(dst, src0->n, src0->c, src0->h, src0->w,
+                          dst->has_grad);
+    return BCNN_SUCCESS;
+}
+
 void bcnn_forward_eltwise_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *src0_tensor = &net->tensors[node->src[0]];
     bcnn_tensor *src1_tensor = &net->tensors[node->src[1]];
@@ -118,7 +142,12 @@ void bcnn_forward_eltwise_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_copy_f32(sz, src0_tensor->data, dst_tensor->data);
     if (param->stride[0] == 1 && param->stride[1] == 1) {
         int n = param->min_dim[0] * bcnn_tensor_size2d(dst_tensor);
-        bcnn_axpy(n, 1.0f, src1_tensor->data, dst_tensor->data);
+        int src1_sz = bcnn_tensor_size3d(src1_tensor);
+        int dst_sz = bcnn_tensor_size3d(dst_tensor);
+        for (int b = 0; b < dst_tensor->n; ++b) {
+            bcnn_axpy(n, 1.0f, src1_tensor->data + b * src1_sz,
+                      dst_tensor->data + b * dst_sz);
+        }
     } else {
         int x_dim[3] = {src1_tensor->c, src1_tensor->h, src1_tensor->w};
         int y_dim[3] = {dst_tensor->c, dst_tensor->h, dst_tensor->w};
@@ -147,7 +176,12 @@ void bcnn_backward_eltwise_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_axpy(sz, 1.0f, dst_tensor->grad_data, src0_tensor->grad_data);
     if (param->stride[0] == 1 && param->stride[1] == 1) {
         int n = param->min_dim[0] * bcnn_tensor_size2d(dst_tensor);
-        bcnn_axpy(n, 1.0f, dst_tensor->grad_data, src1_tensor->grad_data);
+        int src1_sz = bcnn_tensor_size3d(src1_tensor);
+        int dst_sz = bcnn_tensor_size3d(dst_tensor);
+        for (int b = 0; b < dst_tensor->n; ++b) {
+            bcnn_axpy(n, 1.0f, dst_tensor->grad_data + b * dst_sz,
+                      src1_tensor->grad_data + b * src1_sz);
+        }
     } else {
         int x_dim[3] = {dst_tensor->c, dst_tensor->h, dst_tensor->w};
         int y_dim[3] = {src1_tensor->c, src1_tensor->h, src1_tensor->w};
@@ -171,8 +205,12 @@ void bcnn_forward_eltwise_layer_gpu(bcnn_net *net, bcnn_node *node) {
     bcnn_cuda_copy_f32(sz, src0_tensor->data_gpu, 1, dst_tensor->data_gpu, 1);
     if (param->stride[0] == 1 && param->stride[1] == 1) {
         int n = param->min_dim[0] * bcnn_tensor_size2d(dst_tensor);
-        bcnn_cuda_axpy(n, 1.0f, src1_tensor->data_gpu, 1, dst_tensor->data_gpu,
-                       1);
+        int src1_sz = bcnn_tensor_size3d(src1_tensor);
+        int dst_sz = bcnn_tensor_size3d(dst_tensor);
+        for (int b = 0; b < dst_tensor->n; ++b) {
+            bcnn_cuda_axpy(n, 1.0f, src1_tensor->data_gpu + b * src1_sz, 1,
+                           dst_tensor->data_gpu + b * dst_sz, 1);
+        }
     } else {
         int x_dim[3] = {src1_tensor->c, src1_tensor->h, src1_tensor->w};
         int y_dim[3] = {dst_tensor->c, dst_tensor->h, dst_tensor->w};
@@ -198,8 +236,12 @@ void bcnn_backward_eltwise_layer_gpu(bcnn_net *net, bcnn_node *node) {
                    src0_tensor->grad_data_gpu, 1);
     if (param->stride[0] == 1 && param->stride[1] == 1) {
         int n = param->min_dim[0] * bcnn_tensor_size2d(dst_tensor);
-        bcnn_cuda_axpy(n, 1.0f, dst_tensor->grad_data_gpu, 1,
-                       src1_tensor->grad_data_gpu, 1);
+        int src1_sz = bcnn_tensor_size3d(src1_tensor);
+        int dst_sz = bcnn_tensor_size3d(dst_tensor);
+        for (int b = 0; b < dst_tensor->n; ++b) {
+            bcnn_cuda_axpy(n, 1.0f, dst_tensor->grad_data_gpu + b * dst_sz, 1,
+                           src1_tensor->grad_data_gpu + b * src1_sz, 1);
+        }
     } else {
         int x_dim[3] = {dst_tensor->c, dst_tensor->h, dst_tensor->w};
         int y_dim[3] = {src1_tensor->c, src1_tensor->h, src1_tensor->w};
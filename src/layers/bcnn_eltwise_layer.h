@@ -38,6 +38,7 @@ typedef struct bcnn_eltwise_param {
 
 void bcnn_forward_eltwise_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_eltwise_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_eltwise_layer(bcnn_net *net, bcnn_node *node);
 
 #ifdef __cplusplus
 }
@@ -30,10 +30,12 @@
 #include <bh/bh_string.h>
 
 #include "bcnn_activation_layer.h"
+#include "bcnn_allocator.h"
 #include "bcnn_learner.h"
 #include "bcnn_mat.h"
 #include "bcnn_net.h"
 #include "bcnn_tensor.h"
+#include "bcnn_thread_pool.h"
 #include "bcnn_utils.h"
 
 bcnn_status bcnn_add_fullc_layer(bcnn_net *net, int output_size,
@@ -104,10 +106,12 @@ bcnn_status bcnn_add_fullc_layer(bcnn_net *net, int output_size,
     if (net->learner != NULL) {
         if (net->learner->optimizer == BCNN_OPTIM_ADAM) {
             int weights_size = bcnn_tensor_size(&weights);
-            param->adam_m = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
-            param->adam_v = (float *)bh_align_calloc(
-                weights_size * sizeof(float), align_offset_);
+            param->adam_m = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
+            param->adam_v = (float *)bcnn_align_calloc(
+                weights_size * sizeof(float), align_offset_,
+                BCNN_ALLOC_WEIGHTS);
         }
     }
 #ifdef BCNN_USE_CUDA
@@ -123,6 +127,7 @@ bcnn_status bcnn_add_fullc_layer(bcnn_net *net, int output_size,
 #endif
     node.forward = bcnn_forward_fullc_layer;
     node.backward = bcnn_backward_fullc_layer;
+    node.infer_shape = bcnn_infer_shape_fullc_layer;
     node.update = bcnn_update_fullc_layer;
     node.release_param = bcnn_release_param_fullc_layer;
 
@@ -141,6 +146,47 @@ bcnn_status bcnn_add_fullc_layer(bcnn_net *net, int output_size,
     return BCNN_SUCCESS;
 }
 
+typedef struct {
+    bcnn_tensor *src_tensor;
+    bcnn_tensor *dst_tensor;
+    bcnn_tensor *weights;
+} bcnn_fullc_args;
+
+static void bcnn_fullc_task(void *arg, int begin, int end) {
+    bcnn_fullc_args *a = (bcnn_fullc_args *)arg;
+    bcnn_tensor *src_tensor = a->src_tensor;
+    bcnn_tensor *dst_tensor = a->dst_tensor;
+    int src_size = bcnn_tensor_size3d(src_tensor);
+    int spatial_size = bcnn_tensor_size2d(src_tensor);
+    // pb = p + b * dst_c
+    for (int pb = begin; pb < end; ++pb) {
+        int b = pb / dst_tensor->c;
+        int p = pb % dst_tensor->c;
+        float sum = 0.0f;
+        for (int q = 0; q < src_tensor->c; q++) {
+            float *w = a->weights->data + src_size * p + spatial_size * q;
+            float *x = src_tensor->data + b * src_size + q * spatial_size;
+            sum += bcnn_dot(spatial_size, x, w);
+        }
+        dst_tensor->data[pb] = sum;
+    }
+}
+
+bcnn_status bcnn_infer_shape_fullc_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    bcnn_tensor *weights = &net->tensors[node->src[1]];
+    // The weights are sized for one input shape only
+    BCNN_CHECK_AND_LOG(net->log_ctx,
+                       bcnn_tensor_size3d(src) == bcnn_tensor_size3d(weights),
+                       BCNN_INVALID_PARAMETER,
+                       "Full-connected layer: input size %d does not match "
+                       "the weights size %d\n",
+                       bcnn_tensor_size3d(src), bcnn_tensor_size3d(weights));
+    bcnn_tensor_set_shape(dst, src->n, dst->c, 1, 1, dst->has_grad);
+    return BCNN_SUCCESS;
+}
+
 void bcnn_forward_fullc_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
     bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
@@ -148,24 +194,13 @@ void bcnn_forward_fullc_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *biases = &net->tensors[node->src[2]];
     bcnn_fullc_param *param = (bcnn_fullc_param *)node->param;
     int batch_size = dst_tensor->n;
-    int src_size = bcnn_tensor_size3d(src_tensor);
     int dst_size = bcnn_tensor_size3d(dst_tensor);
     int sz = bcnn_tensor_size(dst_tensor);
-    int spatial_size = bcnn_tensor_size2d(src_tensor);
 
     memset(dst_tensor->data, 0, dst_size * batch_size * sizeof(float));
-    for (int b = 0; b < batch_size; ++b) {
-#pragma omp parallel for num_threads(net->num_threads)
-        for (int p = 0; p < dst_tensor->c; p++) {
-            float sum = 0.0f;
-            for (int q = 0; q < src_tensor->c; q++) {
-                float *w = weights->data + src_size * p + spatial_size * q;
-                float *x = src_tensor->data + b * src_size + q * spatial_size;
-                sum += bcnn_dot(spatial_size, x, w);
-            }
-            dst_tensor->data[b * dst_tensor->c + p] = sum;
-        }
-    }
+    bcnn_fullc_args args = {src_tensor, dst_tensor, weights};
+    bcnn_parallel_for(batch_size * dst_tensor->c, net->num_threads,
+                      bcnn_fullc_task, &args);
     for (int i = 0; i < batch_size; ++i) {
         bcnn_axpy(dst_size, 1, biases->data, dst_tensor->data + i * dst_size);
     }
@@ -349,8 +384,8 @@ void bcnn_update_fullc_layer(bcnn_net *net, bcnn_node *node) {
 
 void bcnn_release_param_fullc_layer(bcnn_node *node) {
     bcnn_fullc_param *param = (bcnn_fullc_param *)node->param;
-    bh_align_free(param->adam_m);
-    bh_align_free(param->adam_v);
+    bcnn_align_free(param->adam_m);
+    bcnn_align_free(param->adam_v);
 #ifdef BCNN_USE_CUDA
     if (param->adam_m_gpu) {
         bcnn_cuda_free(param->adam_m_gpu);
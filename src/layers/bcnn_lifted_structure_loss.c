@@ -3,6 +3,7 @@
 #include <math.h>
 
 #include "bcnn/bcnn.h"
+#include "bcnn_allocator.h"
 #include "bcnn_mat.h"
 #include "bcnn_tensor.h"
 #include "bcnn_utils.h"
@@ -56,7 +57,9 @@ void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node) {
         Step 1: Compute D^2 = x1_transpose + 1x_transpose - 2XX_transpose
     **********************************************************************/
     // Dist square = D^2
-    float *dist_sq = (float *)bh_align_calloc(M_ * sizeof(float), align_offset);
+    float *dist_sq = (float *)bcnn_align_calloc(M_ * sizeof(float),
+                                                align_offset,
+                                                BCNN_ALLOC_WORKSPACE);
     for (int i = 0; i < M_; ++i) {
         dist_sq[i] = bcnn_dot(channels, src_tensor->data + (i * channels),
                               src_tensor->data + (i * channels));
@@ -64,7 +67,8 @@ void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node) {
 
     // dot =-2 XX_transpose
     float *dot_ =
-        (float *)bh_align_calloc(M_ * M_ * sizeof(float), align_offset);
+        (float *)bcnn_align_calloc(M_ * M_ * sizeof(float), align_offset,
+                                   BCNN_ALLOC_WORKSPACE);
 #if BCNN_USE_BLAS
     cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, M_, N_, K_, -2.0,
                 src_tensor->data, K_, src_tensor->data, K_, 0, dot_, N_);
@@ -75,7 +79,8 @@ void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node) {
 
     // one array
     float *one =
-        (float *)bh_align_malloc(batch_size * sizeof(float), align_offset);
+        (float *)bcnn_align_malloc(batch_size * sizeof(float), align_offset,
+                                   BCNN_ALLOC_WORKSPACE);
     for (int i = 0; i < batch_size; ++i) {
         one[i] = 1.0f;
     }
@@ -95,7 +100,8 @@ void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node) {
     ********************************************/
     // array for indicating sample data are same class or not
     int *label_mat =
-        (int *)bh_align_calloc(N_ * N_ * sizeof(int), align_offset);
+        (int *)bcnn_align_calloc(N_ * N_ * sizeof(int), align_offset,
+                                 BCNN_ALLOC_WORKSPACE);
 
     // each label is a One-Hot array
     int length = bcnn_tensor_size3d(label);
@@ -133,9 +139,11 @@ void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node) {
     memset(bout, 0, sz);  // initialize grad_data
 
     float *blob_pos_diff =
-        (float *)bh_align_calloc(channels * sizeof(float), align_offset);
+        (float *)bcnn_align_calloc(channels * sizeof(float), align_offset,
+                                   BCNN_ALLOC_WORKSPACE);
     float *blob_neg_diff =
-        (float *)bh_align_calloc(channels * sizeof(float), align_offset);
+        (float *)bcnn_align_calloc(channels * sizeof(float), align_offset,
+                                   BCNN_ALLOC_WORKSPACE);
 
     // dynamic array according to num_negatives
     float *loss_aug_inference = NULL;
@@ -163,10 +171,12 @@ void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node) {
                     }
                 }
 
-                loss_aug_inference = (float *)bh_align_calloc(
-                    num_negatives * sizeof(float), align_offset);
-                summer_vec = (float *)bh_align_calloc(
-                    num_negatives * sizeof(float), align_offset);
+                loss_aug_inference = (float *)bcnn_align_calloc(
+                    num_negatives * sizeof(float), align_offset,
+                    BCNN_ALLOC_WORKSPACE);
+                summer_vec = (float *)bcnn_align_calloc(
+                    num_negatives * sizeof(float), align_offset,
+                    BCNN_ALLOC_WORKSPACE);
 
                 for (int ss = 0; ss < num_negatives; ++ss) {
                     summer_vec[ss] = 1.0f;
@@ -272,20 +282,20 @@ void bcnn_lifted_struct_loss_forward(bcnn_net *net, bcnn_node *node) {
                         bcnn_axpy(K_, -scaler, blob_neg_diff, bout + k * K_);
                     }
                 }
-                bh_align_free(loss_aug_inference);
-                bh_align_free(summer_vec);
+                bcnn_align_free(loss_aug_inference);
+                bcnn_align_free(summer_vec);
             }
         }
     }
     loss = loss / param->num_constraints;
     dst_tensor->data[0] = loss;
 
-    bh_align_free(dist_sq);
-    bh_align_free(dot_);
-    bh_align_free(one);
-    bh_align_free(label_mat);
-    bh_align_free(blob_pos_diff);
-    bh_align_free(blob_neg_diff);
+    bcnn_align_free(dist_sq);
+    bcnn_align_free(dot_);
+    bcnn_align_free(one);
+    bcnn_align_free(label_mat);
+    bcnn_align_free(blob_pos_diff);
+    bcnn_align_free(blob_neg_diff);
 
 #ifdef BCNN_USE_CUDA
     bcnn_cuda_memcpy_host2dev(src_tensor->data_gpu, src_tensor->data, sz);
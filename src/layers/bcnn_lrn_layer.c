@@ -22,6 +22,7 @@
 
 #include "bcnn_lrn_layer.h"
 
+#include "bcnn_allocator.h"
 #include "bcnn_mat.h"
 #include "bcnn_net.h"
 #include "bcnn_tensor.h"
@@ -81,11 +82,14 @@ bcnn_status bcnn_add_lrn_layer(bcnn_net *net, int local_size, float alpha,
     param->beta = beta;
     int sz = bcnn_tensor_size(&net->tensors[node.src[0]]);
     param->tmp_sum =
-        (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+        (float *)bcnn_align_calloc(sz * sizeof(float), align_offset_,
+                                   BCNN_ALLOC_WORKSPACE);
     param->tmp_squared =
-        (float *)bh_align_calloc(sz * sizeof(float), align_offset_);
+        (float *)bcnn_align_calloc(sz * sizeof(float), align_offset_,
+                                   BCNN_ALLOC_WORKSPACE);
     node.forward = bcnn_forward_lrn_layer;
     node.backward = bcnn_backward_lrn_layer;
+    node.infer_shape = bcnn_node_infer_same_shape;
     node.release_param = bcnn_release_param_lrn_layer;
 
     bcnn_net_add_node(net, node);
@@ -226,8 +230,8 @@ void bcnn_backward_lrn_layer(bcnn_net *net, bcnn_node *node) {
 
 void bcnn_release_param_lrn_layer(bcnn_node *node) {
     bcnn_lrn_param *param = (bcnn_lrn_param *)node->param;
-    bh_align_free(param->tmp_squared);
-    bh_align_free(param->tmp_sum);
+    bcnn_align_free(param->tmp_squared);
+    bcnn_align_free(param->tmp_sum);
 #ifdef BCNN_USE_CUDA
 // Not implemented
 #endif
@@ -27,8 +27,10 @@
 #include <bh/bh_log.h>
 #include <bh/bh_string.h>
 
+#include "bcnn_allocator.h"
 #include "bcnn_net.h"
 #include "bcnn_tensor.h"
+#include "bcnn_thread_pool.h"
 #include "bcnn_utils.h"
 
 #include <bh/bh_timer.h>
@@ -37,6 +39,21 @@
 #include <bh/bh_macros.h>
 #endif
 
+/* Output size along one dimension according to the padding option */
+static int bcnn_maxpool_out_size(int in, int size, int stride,
+                                 bcnn_padding padding) {
+    switch (padding) {
+        case BCNN_PADDING_SAME:
+            return (in + stride - 1) / stride;
+        case BCNN_PADDING_VALID:
+            return (in - size + stride) / stride;
+        case BCNN_PADDING_CAFFE:
+            return (int)(ceil((float)(in - size) / stride)) + 1;
+        default:
+            return 0;
+    }
+}
+
 bcnn_status bcnn_add_maxpool_layer(bcnn_net *net, int size, int stride,
                                    bcnn_padding padding, const char *src_id,
                                    const char *dst_id) {
@@ -59,28 +76,10 @@ bcnn_status bcnn_add_maxpool_layer(bcnn_net *net, int size, int stride,
         bcnn_node_add_input(net, &node, 0);
     }
     // Compute output size according to padding option
-    int out_h =
-        (padding == BCNN_PADDING_SAME)
-            ? (net->tensors[node.src[0]].h + stride - 1) / stride
-            : (padding == BCNN_PADDING_VALID)
-                  ? (net->tensors[node.src[0]].h - size + stride) / stride
-                  : (padding == BCNN_PADDING_CAFFE)
-                        ? ((int)(ceil(
-                               (float)(net->tensors[node.src[0]].h - size) /
-                               stride)) +
-                           1)
-                        : 0;
-    int out_w =
-        (padding == BCNN_PADDING_SAME)
-            ? (net->tensors[node.src[0]].w + stride - 1) / stride
-            : (padding == BCNN_PADDING_VALID)
-                  ? (net->tensors[node.src[0]].w - size + stride) / stride
-                  : (padding == BCNN_PADDING_CAFFE)
-                        ? ((int)(ceil(
-                               (float)(net->tensors[node.src[0]].w - size) /
-                               stride)) +
-                           1)
-                        : 0;
+    int out_h = bcnn_maxpool_out_size(net->tensors[node.src[0]].h, size,
+                                      stride, padding);
+    int out_w = bcnn_maxpool_out_size(net->tensors[node.src[0]].w, size,
+                                      stride, padding);
     bcnn_tensor_set_shape(&dst_tensor,
                           net->tensors[node.src[0]].n,  // batch size
                           net->tensors[node.src[0]].c,  // depth
@@ -102,7 +101,8 @@ bcnn_status bcnn_add_maxpool_layer(bcnn_net *net, int size, int stride,
     param->size = size;
     param->stride = stride;
     param->padding = padding;
-    param->indexes = (int *)calloc(sz, sizeof(int));
+    param->indexes = (int *)bcnn_align_calloc(sz * sizeof(int), align_offset_,
+                                              BCNN_ALLOC_ACTIVATIONS);
 #ifdef BCNN_USE_CUDA
     param->indexes_gpu = bcnn_cuda_malloc_i32(sz);
 #ifdef BCNN_USE_CUDNN
@@ -124,6 +124,7 @@ bcnn_status bcnn_add_maxpool_layer(bcnn_net *net, int size, int stride,
 #endif
     node.forward = bcnn_forward_maxpool_layer;
     node.backward = bcnn_backward_maxpool_layer;
+    node.infer_shape = bcnn_infer_shape_maxpool_layer;
     node.release_param = bcnn_release_param_maxpool_layer;
 
     bcnn_net_add_node(net, node);
@@ -142,51 +143,75 @@ bcnn_status bcnn_add_maxpool_layer(bcnn_net *net, int size, int stride,
     return 0;
 }
 
-void bcnn_forward_maxpool_layer_cpu(bcnn_net *net, bcnn_node *node) {
-    bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
-    bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
-    bcnn_maxpool_param *param = (bcnn_maxpool_param *)node->param;
-    int size = param->size;
-    int stride = param->stride;
-    int *indexes = param->indexes;
-    int batch_size = dst_tensor->n;
-    for (int b = 0; b < batch_size; ++b) {  // batch_size
-        int offset0 = dst_tensor->c * b;
-#pragma omp parallel for num_threads(net->num_threads)
-        for (int k = 0; k < dst_tensor->c; ++k) {  // depth
-            int offset1 = dst_tensor->h * (k + offset0);
-            for (int i = 0; i < dst_tensor->h; ++i) {  // height
-                int offset2 = dst_tensor->w * (offset1 + i);
-                for (int j = 0; j < dst_tensor->w; ++j) {  // width
-                    int dst_index = j + offset2;
-                    float max_f = -FLT_MAX;
-                    int max_i = -1;
-                    for (int n = 0; n < size; ++n) {  // pooling window
-                        for (int m = 0; m < size; ++m) {
-                            int cur_h = i * stride + n;
-                            int cur_w = j * stride + m;
-                            int src_index =
-                                cur_w +
-                                src_tensor->w *
-                                    (cur_h +
-                                     src_tensor->h * (k + b * src_tensor->c));
-                            int valid = (cur_h >= 0 && cur_h < src_tensor->h &&
-                                         cur_w >= 0 && cur_w < src_tensor->w);
-                            float val = (valid != 0)
-                                            ? src_tensor->data[src_index]
-                                            : -FLT_MAX;
-                            if (val > max_f) {
-                                max_f = val;
-                                max_i = src_index;
-                            }
+typedef struct {
+    bcnn_tensor *src_tensor;
+    bcnn_tensor *dst_tensor;
+    bcnn_maxpool_param *param;
+} bcnn_maxpool_args;
+
+static void bcnn_maxpool_task(void *arg, int begin, int end) {
+    bcnn_maxpool_args *a = (bcnn_maxpool_args *)arg;
+    bcnn_tensor *src_tensor = a->src_tensor;
+    bcnn_tensor *dst_tensor = a->dst_tensor;
+    int size = a->param->size;
+    int stride = a->param->stride;
+    int *indexes = a->param->indexes;
+    // kb = k + b * c
+    for (int kb = begin; kb < end; ++kb) {  // batch_size x depth
+        int offset1 = dst_tensor->h * kb;
+        for (int i = 0; i < dst_tensor->h; ++i) {  // height
+            int offset2 = dst_tensor->w * (offset1 + i);
+            for (int j = 0; j < dst_tensor->w; ++j) {  // width
+                int dst_index = j + offset2;
+                float max_f = -FLT_MAX;
+                int max_i = -1;
+                for (int n = 0; n < size; ++n) {  // pooling window
+                    for (int m = 0; m < size; ++m) {
+                        int cur_h = i * stride + n;
+                        int cur_w = j * stride + m;
+                        int src_index =
+                            cur_w + src_tensor->w * (cur_h + src_tensor->h * kb);
+                        int valid = (cur_h >= 0 && cur_h < src_tensor->h &&
+                                     cur_w >= 0 && cur_w < src_tensor->w);
+                        float val = (valid != 0) ? src_tensor->data[src_index]
+                                                 : -FLT_MAX;
+                        if (val > max_f) {
+                            max_f = val;
+                            max_i = src_index;
                         }
                     }
-                    dst_tensor->data[dst_index] = max_f;
-                    indexes[dst_index] = max_i;
                 }
+                dst_tensor->data[dst_index] = max_f;
+                indexes[dst_index] = max_i;
             }
         }
     }
+}
+
+bcnn_status bcnn_infer_shape_maxpool_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_maxpool_param *param = (bcnn_maxpool_param *)node->param;
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    bcnn_tensor_set_shape(
+        dst, src->n, src->c,
+        bcnn_maxpool_out_size(src->h, param->size, param->stride,
+                              param->padding),
+        bcnn_maxpool_out_size(src->w, param->size, param->stride,
+                              param->padding),
+        dst->has_grad);
+    BCNN_CHECK_AND_LOG(net->log_ctx, dst->h > 0 && dst->w > 0,
+                       BCNN_INVALID_PARAMETER,
+                       "Maxpool layer: input %dx%d is too small\n", src->w,
+                       src->h);
+    return BCNN_SUCCESS;
+}
+
+void bcnn_forward_maxpool_layer_cpu(bcnn_net *net, bcnn_node *node) {
+    bcnn_maxpool_args args = {&net->tensors[node->src[0]],
+                              &net->tensors[node->dst[0]],
+                              (bcnn_maxpool_param *)node->param};
+    bcnn_parallel_for(args.dst_tensor->n * args.dst_tensor->c,
+                      net->num_threads, bcnn_maxpool_task, &args);
     return;
 }
 
@@ -283,7 +308,7 @@ void bcnn_backward_maxpool_layer(bcnn_net *net, bcnn_node *node) {
 
 void bcnn_release_param_maxpool_layer(bcnn_node *node) {
     bcnn_maxpool_param *param = (bcnn_maxpool_param *)node->param;
-    bh_free(param->indexes);
+    bcnn_align_free(param->indexes);
 #ifdef BCNN_USE_CUDA
     if (param->indexes_gpu) {
         bcnn_cuda_free(param->indexes_gpu);
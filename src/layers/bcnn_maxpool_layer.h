@@ -48,6 +48,7 @@ typedef struct bcnn_maxpool_param {
 
 void bcnn_forward_maxpool_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_maxpool_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_maxpool_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_release_param_maxpool_layer(bcnn_node *node);
 #ifdef BCNN_USE_CUDA
 void bcnn_forward_maxpool_layer_gpu(bcnn_net *net, bcnn_node *node);
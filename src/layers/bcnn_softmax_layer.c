@@ -69,6 +69,7 @@ bcnn_status bcnn_add_softmax_layer(bcnn_net *net, const char *src_id,
     node.type = BCNN_LAYER_SOFTMAX;
     node.forward = bcnn_forward_softmax_layer;
     node.backward = bcnn_backward_softmax_layer;
+    node.infer_shape = bcnn_node_infer_same_shape;
 
     bcnn_net_add_node(net, node);
 
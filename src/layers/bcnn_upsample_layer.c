@@ -68,6 +68,7 @@ bcnn_status bcnn_add_upsample_layer(bcnn_net *net, int size, const char *src_id,
     param->size = size;
     node.forward = bcnn_forward_upsample_layer;
     node.backward = bcnn_backward_upsample_layer;
+    node.infer_shape = bcnn_infer_shape_upsample_layer;
     bcnn_net_add_node(net, node);
 
     char node_opname[256];
@@ -83,6 +84,15 @@ bcnn_status bcnn_add_upsample_layer(bcnn_net *net, int size, const char *src_id,
     return 0;
 }
 
+bcnn_status bcnn_infer_shape_upsample_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_upsample_param *param = (bcnn_upsample_param *)node->param;
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    bcnn_tensor_set_shape(dst, src->n, src->c, src->h * param->size,
+                          src->w * param->size, dst->has_grad);
+    return BCNN_SUCCESS;
+}
+
 void bcnn_forward_upsample_layer_cpu(bcnn_net *net, bcnn_node *node) {
     bcnn_tensor *src_tensor = &net->tensors[node->src[0]];
     bcnn_tensor *dst_tensor = &net->tensors[node->dst[0]];
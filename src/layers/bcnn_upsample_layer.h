@@ -36,6 +36,7 @@ typedef struct bcnn_upsample_param {
 
 void bcnn_forward_upsample_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_upsample_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_upsample_layer(bcnn_net *net, bcnn_node *node);
 #ifdef BCNN_USE_CUDA
 void bcnn_forward_upsample_layer_gpu(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_upsample_layer_gpu(bcnn_net *net, bcnn_node *node);
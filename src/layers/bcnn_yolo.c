@@ -63,6 +63,7 @@ bcnn_status bcnn_add_yolo_layer(bcnn_net *net, int num_boxes_per_cell,
     }
     node.forward = bcnn_forward_yolo_layer;
     node.backward = bcnn_backward_yolo_layer;
+    node.infer_shape = bcnn_infer_shape_yolo_layer;
     node.release_param = bcnn_release_param_yolo_layer;
 
     // Allocate label tensor
@@ -223,6 +224,16 @@ static bbox float_to_box(float *f, int stride) {
     return b;
 }
 
+bcnn_status bcnn_infer_shape_yolo_layer(bcnn_net *net, bcnn_node *node) {
+    bcnn_yolo_param *param = (bcnn_yolo_param *)node->param;
+    bcnn_tensor *src = &net->tensors[node->src[0]];
+    bcnn_tensor *dst = &net->tensors[node->dst[0]];
+    bcnn_tensor_set_shape(dst, src->n,
+                          param->num * (param->classes + param->coords + 1),
+                          src->h, src->w, dst->has_grad);
+    return BCNN_SUCCESS;
+}
+
 void bcnn_forward_yolo_layer_cpu(bcnn_net *net, bcnn_yolo_param *param,
                                  bcnn_tensor *src_tensor, bcnn_tensor *label,
                                  bcnn_tensor *dst_tensor) {
@@ -22,6 +22,7 @@ typedef struct bcnn_yolo_param {
 
 void bcnn_forward_yolo_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_backward_yolo_layer(bcnn_net *net, bcnn_node *node);
+bcnn_status bcnn_infer_shape_yolo_layer(bcnn_net *net, bcnn_node *node);
 void bcnn_release_param_yolo_layer(bcnn_node *node);
 
 #ifdef __cplusplus